@@ -0,0 +1,30 @@
+// automatically generated, do not modify
+
+package mbtool.daemon.v2;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+public class CancelRequest extends Table {
+  public static CancelRequest getRootAsCancelRequest(ByteBuffer _bb) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (new CancelRequest()).__init(_bb.getInt(_bb.position()) + _bb.position(), _bb); }
+  public CancelRequest __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; return this; }
+
+  public int id() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+
+  public static int createCancelRequest(FlatBufferBuilder builder,
+      int id) {
+    builder.startObject(1);
+    CancelRequest.addId(builder, id);
+    return CancelRequest.endCancelRequest(builder);
+  }
+
+  public static void startCancelRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(0, id, 0); }
+  public static int endCancelRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+};
+
@@ -0,0 +1,30 @@
+// automatically generated, do not modify
+
+package mbtool.daemon.v2;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+public class CancelResponse extends Table {
+  public static CancelResponse getRootAsCancelResponse(ByteBuffer _bb) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (new CancelResponse()).__init(_bb.getInt(_bb.position()) + _bb.position(), _bb); }
+  public CancelResponse __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; return this; }
+
+  public byte success() { int o = __offset(4); return o != 0 ? bb.get(o + bb_pos) : 0; }
+
+  public static int createCancelResponse(FlatBufferBuilder builder,
+      byte success) {
+    builder.startObject(1);
+    CancelResponse.addSuccess(builder, success);
+    return CancelResponse.endCancelResponse(builder);
+  }
+
+  public static void startCancelResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addSuccess(FlatBufferBuilder builder, byte success) { builder.addByte(0, success, 0); }
+  public static int endCancelResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+};
+
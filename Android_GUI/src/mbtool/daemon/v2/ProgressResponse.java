@@ -0,0 +1,39 @@
+// automatically generated, do not modify
+
+package mbtool.daemon.v2;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+public class ProgressResponse extends Table {
+  public static ProgressResponse getRootAsProgressResponse(ByteBuffer _bb) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (new ProgressResponse()).__init(_bb.getInt(_bb.position()) + _bb.position(), _bb); }
+  public ProgressResponse __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; return this; }
+
+  public long bytes() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0; }
+  public long files() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0; }
+  public String currentPath() { int o = __offset(8); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer currentPathAsByteBuffer() { return __vector_as_bytebuffer(8, 1); }
+
+  public static int createProgressResponse(FlatBufferBuilder builder,
+      long bytes,
+      long files,
+      int current_path) {
+    builder.startObject(3);
+    ProgressResponse.addFiles(builder, files);
+    ProgressResponse.addBytes(builder, bytes);
+    ProgressResponse.addCurrentPath(builder, current_path);
+    return ProgressResponse.endProgressResponse(builder);
+  }
+
+  public static void startProgressResponse(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addBytes(FlatBufferBuilder builder, long bytes) { builder.addLong(0, bytes, 0); }
+  public static void addFiles(FlatBufferBuilder builder, long files) { builder.addLong(1, files, 0); }
+  public static void addCurrentPath(FlatBufferBuilder builder, int currentPathOffset) { builder.addOffset(2, currentPathOffset, 0); }
+  public static int endProgressResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+};
+
@@ -34,6 +34,10 @@ public class Request extends Table {
   public ChmodRequest chmodRequest(ChmodRequest obj) { int o = __offset(24); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
   public WipeRomRequest wipeRomRequest() { return wipeRomRequest(new WipeRomRequest()); }
   public WipeRomRequest wipeRomRequest(WipeRomRequest obj) { int o = __offset(28); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
+  public int id() { int o = __offset(30); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public CancelRequest cancelRequest() { return cancelRequest(new CancelRequest()); }
+  public CancelRequest cancelRequest(CancelRequest obj) { int o = __offset(32); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
+  public byte reportProgress() { int o = __offset(34); return o != 0 ? bb.get(o + bb_pos) : 0; }
 
   public static int createRequest(FlatBufferBuilder builder,
       short type,
@@ -47,8 +51,13 @@ public class Request extends Table {
       int open_request,
       int copy_request,
       int chmod_request,
-      int wipe_rom_request) {
-    builder.startObject(13);
+      int wipe_rom_request,
+      int id,
+      int cancel_request,
+      byte report_progress) {
+    builder.startObject(16);
+    Request.addCancelRequest(builder, cancel_request);
+    Request.addId(builder, id);
     Request.addWipeRomRequest(builder, wipe_rom_request);
     Request.addChmodRequest(builder, chmod_request);
     Request.addCopyRequest(builder, copy_request);
@@ -61,10 +70,11 @@ public class Request extends Table {
     Request.addGetRomsListRequest(builder, get_roms_list_request);
     Request.addGetVersionRequest(builder, get_version_request);
     Request.addType(builder, type);
+    Request.addReportProgress(builder, report_progress);
     return Request.endRequest(builder);
   }
 
-  public static void startRequest(FlatBufferBuilder builder) { builder.startObject(13); }
+  public static void startRequest(FlatBufferBuilder builder) { builder.startObject(16); }
   public static void addType(FlatBufferBuilder builder, short type) { builder.addShort(0, type, 0); }
   public static void addGetVersionRequest(FlatBufferBuilder builder, int getVersionRequestOffset) { builder.addOffset(1, getVersionRequestOffset, 0); }
   public static void addGetRomsListRequest(FlatBufferBuilder builder, int getRomsListRequestOffset) { builder.addOffset(2, getRomsListRequestOffset, 0); }
@@ -77,6 +87,9 @@ public class Request extends Table {
   public static void addCopyRequest(FlatBufferBuilder builder, int copyRequestOffset) { builder.addOffset(9, copyRequestOffset, 0); }
   public static void addChmodRequest(FlatBufferBuilder builder, int chmodRequestOffset) { builder.addOffset(10, chmodRequestOffset, 0); }
   public static void addWipeRomRequest(FlatBufferBuilder builder, int wipeRomRequestOffset) { builder.addOffset(12, wipeRomRequestOffset, 0); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(13, id, 0); }
+  public static void addCancelRequest(FlatBufferBuilder builder, int cancelRequestOffset) { builder.addOffset(14, cancelRequestOffset, 0); }
+  public static void addReportProgress(FlatBufferBuilder builder, byte reportProgress) { builder.addByte(15, reportProgress, 0); }
   public static int endRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
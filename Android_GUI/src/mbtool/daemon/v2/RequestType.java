@@ -15,8 +15,9 @@ public class RequestType {
   public static final short CHMOD = 9;
   public static final short LOKI_PATCH = 10;
   public static final short WIPE_ROM = 11;
+  public static final short CANCEL = 12;
 
-  private static final String[] names = { "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", };
+  private static final String[] names = { "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", "CANCEL", };
 
   public static String name(int e) { return names[e]; }
 };
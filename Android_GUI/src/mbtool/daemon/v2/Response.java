@@ -34,6 +34,11 @@ public class Response extends Table {
   public ChmodResponse chmodResponse(ChmodResponse obj) { int o = __offset(24); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
   public WipeRomResponse wipeRomResponse() { return wipeRomResponse(new WipeRomResponse()); }
   public WipeRomResponse wipeRomResponse(WipeRomResponse obj) { int o = __offset(28); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
+  public int id() { int o = __offset(30); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public CancelResponse cancelResponse() { return cancelResponse(new CancelResponse()); }
+  public CancelResponse cancelResponse(CancelResponse obj) { int o = __offset(32); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
+  public ProgressResponse progressResponse() { return progressResponse(new ProgressResponse()); }
+  public ProgressResponse progressResponse(ProgressResponse obj) { int o = __offset(34); return o != 0 ? obj.__init(__indirect(o + bb_pos), bb) : null; }
 
   public static int createResponse(FlatBufferBuilder builder,
       short type,
@@ -47,8 +52,14 @@ public class Response extends Table {
       int open_response,
       int copy_response,
       int chmod_response,
-      int wipe_rom_response) {
-    builder.startObject(13);
+      int wipe_rom_response,
+      int id,
+      int cancel_response,
+      int progress_response) {
+    builder.startObject(16);
+    Response.addProgressResponse(builder, progress_response);
+    Response.addCancelResponse(builder, cancel_response);
+    Response.addId(builder, id);
     Response.addWipeRomResponse(builder, wipe_rom_response);
     Response.addChmodResponse(builder, chmod_response);
     Response.addCopyResponse(builder, copy_response);
@@ -64,7 +75,7 @@ public class Response extends Table {
     return Response.endResponse(builder);
   }
 
-  public static void startResponse(FlatBufferBuilder builder) { builder.startObject(13); }
+  public static void startResponse(FlatBufferBuilder builder) { builder.startObject(16); }
   public static void addType(FlatBufferBuilder builder, short type) { builder.addShort(0, type, 0); }
   public static void addGetVersionResponse(FlatBufferBuilder builder, int getVersionResponseOffset) { builder.addOffset(1, getVersionResponseOffset, 0); }
   public static void addGetRomsListResponse(FlatBufferBuilder builder, int getRomsListResponseOffset) { builder.addOffset(2, getRomsListResponseOffset, 0); }
@@ -77,6 +88,9 @@ public class Response extends Table {
   public static void addCopyResponse(FlatBufferBuilder builder, int copyResponseOffset) { builder.addOffset(9, copyResponseOffset, 0); }
   public static void addChmodResponse(FlatBufferBuilder builder, int chmodResponseOffset) { builder.addOffset(10, chmodResponseOffset, 0); }
   public static void addWipeRomResponse(FlatBufferBuilder builder, int wipeRomResponseOffset) { builder.addOffset(12, wipeRomResponseOffset, 0); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(13, id, 0); }
+  public static void addCancelResponse(FlatBufferBuilder builder, int cancelResponseOffset) { builder.addOffset(14, cancelResponseOffset, 0); }
+  public static void addProgressResponse(FlatBufferBuilder builder, int progressResponseOffset) { builder.addOffset(15, progressResponseOffset, 0); }
   public static int endResponse(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
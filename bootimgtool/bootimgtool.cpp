@@ -474,7 +474,7 @@ bool unpack_main(int argc, char *argv[])
 
     // Load the boot image
     mbp::BootImage bi;
-    if (!bi.load(input_file)) {
+    if (!bi.loadMapped(input_file)) {
         fprintf(stderr, "%s\n", error_to_string(bi.error()).c_str());
         return false;
     }
@@ -536,31 +536,32 @@ bool unpack_main(int argc, char *argv[])
         return false;
     }
 
-    std::vector<unsigned char> kernel_image = bi.kernelImage();
-    std::vector<unsigned char> ramdisk_image = bi.ramdiskImage();
-    std::vector<unsigned char> second_image = bi.secondBootloaderImage();
-    std::vector<unsigned char> dt_image = bi.deviceTreeImage();
+    // These refer directly to the mapped input file
+    mbp::BinaryView kernel_image = bi.kernelImageView();
+    mbp::BinaryView ramdisk_image = bi.ramdiskImageView();
+    mbp::BinaryView second_image = bi.secondBootloaderImageView();
+    mbp::BinaryView dt_image = bi.deviceTreeImageView();
 
     // Write kernel image
-    if (!write_file_data(path_kernel, kernel_image)) {
+    if (!write_file_data(path_kernel, kernel_image.data(), kernel_image.size())) {
         fprintf(stderr, "%s: %s\n", path_kernel.c_str(), strerror(errno));
         return false;
     }
 
     // Write ramdisk image
-    if (!write_file_data(path_ramdisk, ramdisk_image)) {
+    if (!write_file_data(path_ramdisk, ramdisk_image.data(), ramdisk_image.size())) {
         fprintf(stderr, "%s: %s\n", path_ramdisk.c_str(), strerror(errno));
         return false;
     }
 
     // Write second bootloader image
-    if (!write_file_data(path_second, second_image)) {
+    if (!write_file_data(path_second, second_image.data(), second_image.size())) {
         fprintf(stderr, "%s: %s\n", path_second.c_str(), strerror(errno));
         return false;
     }
 
     // Write device tree image
-    if (!write_file_data(path_dt, dt_image)) {
+    if (!write_file_data(path_dt, dt_image.data(), dt_image.size())) {
         fprintf(stderr, "%s: %s\n", path_dt.c_str(), strerror(errno));
         return false;
     }
@@ -19,25 +19,16 @@
 
 #include "autopatchers/patchfilepatcher.h"
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <stdio.h>
-#endif
-
-#ifdef __ANDROID__
-#include <sys/stat.h>
-#endif
-
-#include <regex>
+#include <algorithm>
+#include <mutex>
 #include <unordered_map>
 
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
 
 #include "private/fileutils.h"
 #include "private/logging.h"
+#include "private/unifieddiff.h"
 
 
 namespace mbp
@@ -52,12 +43,20 @@ public:
     PatchInfo::AutoPatcherArgs args;
 
     std::string patchFile;
-    std::vector<std::string> files;
+    std::shared_ptr<const UnifiedDiff> diff;
 
     PatcherError error;
 
-    bool runProcess(std::string program, std::vector<std::string> &progArgs,
-                    std::string *out, int *exitCode);
+    bool patchContents(const UnifiedDiff::FilePatch &fp,
+                       const std::string &in, std::string *out);
+};
+
+struct CachedDiff
+{
+    uint64_t size;
+    // Nanoseconds, so an edit within the same second is still noticed
+    int64_t mtime;
+    std::shared_ptr<const UnifiedDiff> diff;
 };
 /*! \endcond */
 
@@ -66,6 +65,54 @@ const std::string PatchFilePatcher::Id("PatchFile");
 
 static const std::string ArgFile("file");
 
+// Parsed patch files shared by all PatchFilePatcher instances
+static std::mutex diffCacheMutex;
+static std::unordered_map<std::string, CachedDiff> diffCache;
+
+
+/*!
+ * Parse a patch file or return the cached result if it has not changed since
+ * it was last parsed
+ */
+static std::shared_ptr<const UnifiedDiff> loadDiff(const std::string &path)
+{
+    uint64_t size;
+    int64_t mtime;
+    if (!FileUtils::statFile(path, &size, &mtime)) {
+        FLOGW("{}: Failed to stat patch file", path);
+        return std::shared_ptr<const UnifiedDiff>();
+    }
+
+    std::lock_guard<std::mutex> lock(diffCacheMutex);
+
+    auto it = diffCache.find(path);
+    if (it != diffCache.end() && it->second.size == size
+            && it->second.mtime == mtime) {
+        return it->second.diff;
+    }
+
+    std::string contents;
+    auto ret = FileUtils::readToString(path, &contents);
+    if (!ret) {
+        LOGW("Failed to read patch file");
+        return std::shared_ptr<const UnifiedDiff>();
+    }
+
+    // Paths in the patches have a leading a/ and b/ (-p1)
+    std::shared_ptr<UnifiedDiff> diff(new UnifiedDiff());
+    if (!diff->parse(contents, 1)) {
+        FLOGW("{}: Failed to parse patch file", path);
+        return std::shared_ptr<const UnifiedDiff>();
+    }
+
+    CachedDiff &cached = diffCache[path];
+    cached.size = size;
+    cached.mtime = mtime;
+    cached.diff = diff;
+
+    return diff;
+}
+
 
 PatchFilePatcher::PatchFilePatcher(const PatcherConfig * const pc,
                                    const FileInfo * const info,
@@ -83,44 +130,11 @@ PatchFilePatcher::PatchFilePatcher(const PatcherConfig * const pc,
     }
 
     m_impl->patchFile = pc->dataDirectory() + "/patches/" + args.at(ArgFile);
+    m_impl->diff = loadDiff(m_impl->patchFile);
 
-    std::string contents;
-    auto ret = FileUtils::readToString(m_impl->patchFile, &contents);
-    if (!ret) {
-        LOGW("Failed to read patch file");
-        return;
-    }
-
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
-
-    const std::regex reOrigFile("---\\s+(.+?)(?:$|\t)");
-
-    for (auto it = lines.begin(); it != lines.end(); ++it) {
-        std::smatch what;
-
-        if (std::regex_search(*it, what, reOrigFile)) {
-            std::string file = what.str(1);
-            if (boost::starts_with(file, "\"") && boost::ends_with(file, "\"")) {
-                file.erase(file.begin());
-                file.erase(file.end() - 1);
-            }
-
-            // Skip files containing escaped characters
-            if (file.find("\\") != std::string::npos) {
-                FLOGW("Skipping file with escaped characters in filename: {}", file);
-                continue;
-            }
-
-            // Strip leading slash (-p1)
-            auto it = file.find("/");
-            if (it != std::string::npos) {
-                file.erase(file.begin(), file.begin() + it + 1);
-            }
-
-            FLOGD("Found file in patch: {}", file);
-
-            m_impl->files.push_back(file);
+    if (m_impl->diff) {
+        for (auto const &fp : m_impl->diff->files()) {
+            FLOGD("Found file in patch: {}", fp.path);
         }
     }
 }
@@ -141,206 +155,129 @@ std::string PatchFilePatcher::id() const
 
 std::vector<std::string> PatchFilePatcher::newFiles() const
 {
-    return std::vector<std::string>();
+    std::vector<std::string> files;
+    if (m_impl->diff) {
+        for (auto const &fp : m_impl->diff->files()) {
+            if (fp.isNew) {
+                files.push_back(fp.path);
+            }
+        }
+    }
+    return files;
 }
 
 std::vector<std::string> PatchFilePatcher::existingFiles() const
 {
-    return m_impl->files;
+    std::vector<std::string> files;
+    if (m_impl->diff) {
+        for (auto const &fp : m_impl->diff->files()) {
+            // A file with multiple diffs is only listed once since
+            // patchFileInMemory() applies all of them
+            if (!fp.isNew && std::find(files.begin(), files.end(), fp.path)
+                    == files.end()) {
+                files.push_back(fp.path);
+            }
+        }
+    }
+    return files;
 }
 
 bool PatchFilePatcher::patchFiles(const std::string &directory)
 {
-#if defined(__ANDROID__)
-    std::string patch = m_impl->pc->dataDirectory();
-    patch += "/binaries/android/";
-    patch += m_impl->info->device()->architecture();
-    patch += "/patch";
-
-    chmod(patch.c_str(), 0755);
-#elif defined(_WIN32)
-    std::string patch = m_impl->pc->dataDirectory();
-    patch += "/binaries/windows/hctap.exe";
-#else
-    std::string patch = "patch";
-#endif
-
-    std::vector<std::string> args;
-    args.push_back("--no-backup-if-mismatch");
-    args.push_back("-p1");
-    args.push_back("-i");
-    args.push_back(m_impl->patchFile);
-    args.push_back("-d");
-    args.push_back(directory);
-
-    std::string output;
-    int exitCode = -1;
-
-    std::vector<std::string> lines;
-
-    bool error = !m_impl->runProcess(patch, args, &output, &exitCode)
-            || exitCode != 0;
-
-    boost::split(lines, output, boost::is_any_of("\n"));
-    for (auto &line : lines) {
-        FLOGE("patch output: {}", line);
-    }
-
-    if (error) {
+    if (!m_impl->diff) {
         m_impl->error = PatcherError::createPatchingError(
                 ErrorCode::ApplyPatchFileError);
         return false;
-    } else {
-        return true;
-    }
-}
-
-#ifdef _WIN32
-
-bool PatchFilePatcher::Impl::runProcess(std::string program,
-                                        std::vector<std::string> &progArgs,
-                                        std::string *out,
-                                        int *exitCode)
-{
-    std::string args;
-    args += "\"";
-    args += program;
-    args += "\"";
-
-    for (auto &arg : progArgs) {
-        args += " ";
-        args += "\"";
-        args += arg;
-        args += "\"";
     }
 
-    SECURITY_ATTRIBUTES secAttr;
-    HANDLE hStdinRead;
-    HANDLE hStdinWrite;
-    HANDLE hStdoutRead;
-    HANDLE hStdoutWrite;
-    STARTUPINFO si;
-    PROCESS_INFORMATION pi;
-    char command[1024];
+    for (auto const &fp : m_impl->diff->files()) {
+        const std::string path = directory + "/" + fp.path;
 
-    if (args.size() >= 1024) {
-        return false;
-    }
+        std::string contents;
+        if (!fp.isNew && !FileUtils::readToString(path, &contents)) {
+            m_impl->error = PatcherError::createPatchingError(
+                    ErrorCode::ApplyPatchFileError);
+            return false;
+        }
 
-    // Setup secAttr struct
-    ZeroMemory(&secAttr, sizeof(secAttr));
-    secAttr.nLength = sizeof(secAttr);
-    secAttr.bInheritHandle = TRUE;
-    secAttr.lpSecurityDescriptor = NULL;
+        std::string patched;
+        if (!m_impl->patchContents(fp, contents, &patched)) {
+            return false;
+        }
 
-    if (!CreatePipe(&hStdoutRead, &hStdoutWrite, &secAttr, 0)) {
-        return false;
-    }
+        if (fp.isNew) {
+            boost::system::error_code ec;
+            boost::filesystem::create_directories(
+                    boost::filesystem::path(path).parent_path(), ec);
+        }
 
-    if (!SetHandleInformation(hStdoutRead, HANDLE_FLAG_INHERIT, 0)) {
-        return false;
+        auto ret = FileUtils::writeFromString(path, patched);
+        if (!ret) {
+            m_impl->error = ret;
+            return false;
+        }
     }
 
-    if (!CreatePipe(&hStdinRead, &hStdinWrite, &secAttr, 0)) {
-        return false;
-    }
+    return true;
+}
 
-    if (!SetHandleInformation(hStdinWrite, HANDLE_FLAG_INHERIT, 0)) {
-        return false;
-    }
+bool PatchFilePatcher::canPatchInMemory() const
+{
+    // Files created by the patch need to be added from the directory
+    return newFiles().empty();
+}
 
-    ZeroMemory(&si, sizeof(si));
-    si.cb  = sizeof(si);
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdInput = hStdinRead;
-    si.hStdOutput = hStdoutWrite;
-    si.hStdError = hStdoutWrite;
-
-    ZeroMemory(&pi, sizeof(pi));
-
-    strcpy(command, args.c_str());
-
-    if (!CreateProcess(
-            nullptr,
-            command,
-            nullptr,
-            nullptr,
-            TRUE,
-            CREATE_NO_WINDOW | CREATE_NEW_PROCESS_GROUP,
-            nullptr,
-            nullptr,
-            &si,
-            &pi)) {
+bool PatchFilePatcher::patchFileInMemory(const std::string &file,
+                                         std::vector<unsigned char> *contents)
+{
+    if (!m_impl->diff) {
+        m_impl->error = PatcherError::createPatchingError(
+                ErrorCode::ApplyPatchFileError);
         return false;
     }
 
-    if (!CloseHandle(hStdoutWrite)) {
-        return false;
-    }
+    // A patch may contain multiple diffs for the same file
+    for (auto const &fp : m_impl->diff->files()) {
+        if (fp.path != file) {
+            continue;
+        }
 
-    std::string output;
-    char c[1024];
-    DWORD cl;
-    while (ReadFile(hStdoutRead, &c, sizeof(c), &cl, nullptr)) {
-        if (!cl) {
-            break;
+        std::string in(contents->begin(), contents->end());
+        std::string out;
+        if (!m_impl->patchContents(fp, in, &out)) {
+            return false;
         }
 
-        output.insert(output.end(), c, c + cl);
+        contents->assign(out.begin(), out.end());
     }
-    out->swap(output);
-
-    WaitForSingleObject(pi.hProcess, INFINITE);
-
-    GetExitCodeProcess(pi.hProcess, (DWORD *) exitCode);
-
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
 
     return true;
 }
 
-#else
-
-bool PatchFilePatcher::Impl::runProcess(std::string program,
-                                        std::vector<std::string> &progArgs,
-                                        std::string *out,
-                                        int *exitCode)
+bool PatchFilePatcher::Impl::patchContents(const UnifiedDiff::FilePatch &fp,
+                                           const std::string &in,
+                                           std::string *out)
 {
-    // No need to fork and exec when popen can just use shell io redirection
-
-    std::string args;
-    args += "\"";
-    args += program;
-    args += "\"";
-
-    for (auto &arg : progArgs) {
-        args += " ";
-        args += "\"";
-        args += arg;
-        args += "\"";
-    }
-
-    args += " 2>&1";
-
-    FILE *fp = popen(args.c_str(), "r");
-    if (fp == nullptr) {
-        return false;
+    std::vector<UnifiedDiff::HunkResult> results;
+    bool ret = UnifiedDiff::apply(fp, in, out, &results);
+
+    for (auto const &result : results) {
+        if (!result.applied) {
+            FLOGE("{}: Hunk #{} FAILED", fp.path, result.hunk + 1);
+        } else if (result.offset != 0 || result.fuzz != 0) {
+            FLOGD("{}: Hunk #{} succeeded at {} (offset {} lines, fuzz {})",
+                  fp.path, result.hunk + 1, result.line, result.offset,
+                  result.fuzz);
+        }
     }
 
-    std::string output;
-    char buf[1024];
-    while (!feof(fp)) {
-        if (fgets(buf, sizeof(buf), fp) != nullptr) {
-            output += buf;
-        }
+    if (!ret) {
+        FLOGE("{}: Failed to apply {}", fp.path, patchFile);
+        error = PatcherError::createPatchingError(
+                ErrorCode::ApplyPatchFileError);
     }
 
-    out->swap(output);
-    *exitCode = pclose(fp);
-    return true;
+    return ret;
 }
 
-#endif
-
-}
\ No newline at end of file
+}
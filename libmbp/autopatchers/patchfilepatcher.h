@@ -47,11 +47,11 @@ public:
 
     virtual bool patchFiles(const std::string &directory) override;
 
-private:
-    void skipNewlinesAndAdd(const std::string &file,
-                            const std::string &contents,
-                            int begin, int end);
+    virtual bool canPatchInMemory() const override;
+    virtual bool patchFileInMemory(const std::string &file,
+                                   std::vector<unsigned char> *contents) override;
 
+private:
     class Impl;
     std::unique_ptr<Impl> m_impl;
 };
@@ -19,17 +19,8 @@
 
 #include "autopatchers/standardpatcher.h"
 
-#include <regex>
-
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/replace.hpp>
-#include <boost/algorithm/string/split.hpp>
-
-#include <cppformat/format.h>
-
 #include "private/fileutils.h"
+#include "private/updaterscriptrewriter.h"
 
 
 namespace mbp
@@ -41,6 +32,8 @@ class StandardPatcher::Impl
 public:
     const PatcherConfig *pc;
     const FileInfo *info;
+
+    unsigned int rules() const;
 };
 /*! \endcond */
 
@@ -50,12 +43,6 @@ const std::string StandardPatcher::Id
 
 const std::string StandardPatcher::UpdaterScript
         = "META-INF/com/google/android/updater-script";
-static const std::string Mount
-        = "run_program(\"/update-binary-tool\", \"mount\", \"{}\");";
-static const std::string Unmount
-        = "run_program(\"/update-binary-tool\", \"unmount\", \"{}\");";
-static const std::string Format
-        = "run_program(\"/update-binary-tool\", \"format\", \"{}\");";
 
 
 StandardPatcher::StandardPatcher(const PatcherConfig * const pc,
@@ -100,26 +87,46 @@ bool StandardPatcher::patchFiles(const std::string &directory)
     std::string contents;
 
     FileUtils::readToString(directory + "/" + UpdaterScript, &contents);
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    UpdaterScriptRewriter(m_impl->info->device(), m_impl->rules())
+            .rewrite(&contents);
+    FileUtils::writeFromString(directory + "/" + UpdaterScript, contents);
 
-    replaceMountLines(&lines, m_impl->info->device());
-    replaceUnmountLines(&lines, m_impl->info->device());
-    replaceFormatLines(&lines, m_impl->info->device());
-    fixBlockUpdateLines(&lines, m_impl->info->device());
-    fixImageExtractLines(&lines, m_impl->info->device());
+    return true;
+}
 
-    // Remove device check if requested
-    if (!m_impl->info->patchInfo()->deviceCheck()) {
-        removeDeviceChecks(&lines);
+bool StandardPatcher::canPatchInMemory() const
+{
+    return true;
+}
+
+bool StandardPatcher::patchFileInMemory(const std::string &file,
+                                        std::vector<unsigned char> *contents)
+{
+    if (file != UpdaterScript) {
+        return true;
     }
 
-    contents = boost::join(lines, "\n");
-    FileUtils::writeFromString(directory + "/" + UpdaterScript, contents);
+    std::string script;
+    UpdaterScriptRewriter(m_impl->info->device(), m_impl->rules())
+            .rewrite(reinterpret_cast<const char *>(contents->data()),
+                     contents->size(), &script);
+    contents->assign(script.begin(), script.end());
 
     return true;
 }
 
+unsigned int StandardPatcher::Impl::rules() const
+{
+    unsigned int rules = UpdaterScriptRewriter::PartitionRules;
+
+    // Remove device check if requested
+    if (!info->patchInfo()->deviceCheck()) {
+        rules |= UpdaterScriptRewriter::DeviceCheckRule;
+    }
+
+    return rules;
+}
+
 /*!
     \brief Disable assertions for device model/name in updater-script
 
@@ -127,34 +134,10 @@ bool StandardPatcher::patchFiles(const std::string &directory)
  */
 void StandardPatcher::removeDeviceChecks(std::vector<std::string> *lines)
 {
-    std::regex reLine("assert\\s*\\(.*getprop\\s*\\(.*(ro.product.device|ro.build.product)");
-    std::regex reReplace("^(\\s*assert\\s*\\()");
-
-    for (auto &line : *lines) {
-        if (std::regex_search(line, reLine)) {
-            line = std::regex_replace(line, reReplace,
-                                      "$1\"true\" == \"true\" || ");
-        }
-    }
-}
-
-static bool findItemsInString(const std::string &haystack,
-                              const std::vector<std::string> &needles)
-{
-    for (auto const &needle : needles) {
-        if (haystack.find(needle) != std::string::npos) {
-            return true;
-        }
-    }
-
-    return false;
+    UpdaterScriptRewriter(nullptr, UpdaterScriptRewriter::DeviceCheckRule)
+            .rewrite(lines);
 }
 
-#define RE_FUNC(name, args)     "(^|[^a-z])" name "\\s*\\(\\s*" args "[^\\)]*\\)"
-#define RE_ARG(x)               "\"" x "\""
-#define RE_ARG_ANY              "[^\"]*"
-#define RE_ARG_SEP              "\\s*,\\s*"
-
 /*!
     \brief Change partition mounting lines to be multiboot-compatible
 
@@ -164,44 +147,8 @@ static bool findItemsInString(const std::string &haystack,
 void StandardPatcher::replaceMountLines(std::vector<std::string> *lines,
                                         Device *device)
 {
-    auto const systemDevs = device->systemBlockDevs();
-    auto const cacheDevs = device->cacheBlockDevs();
-    auto const dataDevs = device->dataBlockDevs();
-
-    static auto const re1 = std::regex(
-            RE_FUNC("mount", ""));
-    static auto const re2 = std::regex(
-            RE_FUNC("run_program",
-                    RE_ARG(RE_ARG_ANY "busybox")
-                    RE_ARG_SEP
-                    RE_ARG("mount")));
-    static auto const re3 = std::regex(
-            RE_FUNC("run_program",
-                    RE_ARG(RE_ARG_ANY "/mount")));
-
-    for (auto it = lines->begin(); it != lines->end(); ++it) {
-        bool isMountLine = std::regex_search(*it, re1)
-                || std::regex_search(*it, re2)
-                || std::regex_search(*it, re3);
-
-        if (isMountLine) {
-            bool isSystem = it->find("/system") != std::string::npos
-                    || findItemsInString(*it, systemDevs);
-            bool isCache = it->find("/cache") != std::string::npos
-                    || findItemsInString(*it, cacheDevs);
-            bool isData = it->find("/data") != std::string::npos
-                    || it->find("/userdata") != std::string::npos
-                    || findItemsInString(*it, dataDevs);
-
-            if (isSystem) {
-                *it = fmt::format(Mount, "/system");
-            } else if (isCache) {
-                *it = fmt::format(Mount, "/cache");
-            } else if (isData) {
-                *it = fmt::format(Mount, "/data");
-            }
-        }
-    }
+    UpdaterScriptRewriter(device, UpdaterScriptRewriter::MountRule)
+            .rewrite(lines);
 }
 
 /*!
@@ -213,47 +160,8 @@ void StandardPatcher::replaceMountLines(std::vector<std::string> *lines,
 void StandardPatcher::replaceUnmountLines(std::vector<std::string> *lines,
                                           Device *device)
 {
-    auto const systemDevs = device->systemBlockDevs();
-    auto const cacheDevs = device->cacheBlockDevs();
-    auto const dataDevs = device->dataBlockDevs();
-
-    static auto const re1 = std::regex(
-            RE_FUNC("unmount", ""));
-    static auto const re2 = std::regex(
-            RE_FUNC("run_program",
-                    RE_ARG(RE_ARG_ANY "busybox")
-                    RE_ARG_SEP
-                    RE_ARG("umount")));
-
-    for (auto it = lines->begin(); it != lines->end(); ++it) {
-        // Quick hack for CM12
-        if (it->find("ifelse(is_mounted(\"/system\"), unmount(\"/system\"));")
-                != std::string::npos) {
-            it = lines->erase(it);
-            continue;
-        }
-
-        bool isUnmountLine = std::regex_search(*it, re1)
-                || std::regex_search(*it, re2);
-
-        if (isUnmountLine) {
-            bool isSystem = it->find("/system") != std::string::npos
-                    || findItemsInString(*it, systemDevs);
-            bool isCache = it->find("/cache") != std::string::npos
-                    || findItemsInString(*it, cacheDevs);
-            bool isData = it->find("/data") != std::string::npos
-                    || it->find("/userdata") != std::string::npos
-                    || findItemsInString(*it, dataDevs);
-
-            if (isSystem) {
-                *it = fmt::format(Unmount, "/system");
-            } else if (isCache) {
-                *it = fmt::format(Unmount, "/cache");
-            } else if (isData) {
-                *it = fmt::format(Unmount, "/data");
-            }
-        }
-    }
+    UpdaterScriptRewriter(device, UpdaterScriptRewriter::UnmountRule)
+            .rewrite(lines);
 }
 
 /*!
@@ -265,73 +173,22 @@ void StandardPatcher::replaceUnmountLines(std::vector<std::string> *lines,
 void StandardPatcher::replaceFormatLines(std::vector<std::string> *lines,
                                          Device *device)
 {
-    auto const systemDevs = device->systemBlockDevs();
-    auto const cacheDevs = device->cacheBlockDevs();
-    auto const dataDevs = device->dataBlockDevs();
-
-    static auto const re1 = std::regex(RE_FUNC("format", ""));
-    static auto const re2 = std::regex(
-            RE_FUNC("delete_recursive", RE_ARG("/system")));
-    static auto const re3 = std::regex(
-            RE_FUNC("delete_recursive", RE_ARG("/cache")));
-    static auto const re4 = std::regex(
-            RE_FUNC("run_program", RE_ARG(RE_ARG_ANY "/format.sh")));
-
-    for (auto it = lines->begin(); it != lines->end(); ++it) {
-        if (std::regex_search(*it, re1)) {
-            bool isSystem = it->find("/system") != std::string::npos
-                    || findItemsInString(*it, systemDevs);
-            bool isCache = it->find("/cache") != std::string::npos
-                    || findItemsInString(*it, cacheDevs);
-            bool isData = it->find("/data") != std::string::npos
-                    || it->find("/userdata") != std::string::npos
-                    || findItemsInString(*it, dataDevs);
-
-            if (isSystem) {
-                *it = fmt::format(Format, "/system");
-            } else if (isCache) {
-                *it = fmt::format(Format, "/cache");
-            } else if (isData) {
-                *it = fmt::format(Format, "/data");
-            }
-        } else if (std::regex_search(*it, re2)) {
-            *it = fmt::format(Format, "/system");
-        } else if (std::regex_search(*it, re3)) {
-            *it = fmt::format(Format, "/cache");
-        } else if (std::regex_search(*it, re4)) {
-            *it = fmt::format(Format, "/data");
-        }
-    }
+    UpdaterScriptRewriter(device, UpdaterScriptRewriter::FormatRule)
+            .rewrite(lines);
 }
 
 void StandardPatcher::fixBlockUpdateLines(std::vector<std::string> *lines,
                                           Device *device)
 {
-    auto const systemDevs = device->systemBlockDevs();
-
-    for (auto it = lines->begin(); it != lines->end(); ++it) {
-        if (it->find("block_image_update") != std::string::npos) {
-            // References to the system partition should become /mb/system.img
-            for (auto const &dev : systemDevs) {
-                boost::replace_all(*it, dev, "/mb/system.img");
-            }
-        }
-    }
+    UpdaterScriptRewriter(device, UpdaterScriptRewriter::BlockUpdateRule)
+            .rewrite(lines);
 }
 
 void StandardPatcher::fixImageExtractLines(std::vector<std::string> *lines,
                                            Device *device)
 {
-    auto const systemDevs = device->systemBlockDevs();
-
-    for (auto it = lines->begin(); it != lines->end(); ++it) {
-        if (it->find("package_extract_file") != std::string::npos) {
-            // References to the system partition should become /mb/system.img
-            for (auto const &dev : systemDevs) {
-                boost::replace_all(*it, dev, "/mb/system.img");
-            }
-        }
-    }
+    UpdaterScriptRewriter(device, UpdaterScriptRewriter::ImageExtractRule)
+            .rewrite(lines);
 }
 
 }
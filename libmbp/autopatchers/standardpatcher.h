@@ -50,6 +50,10 @@ public:
 
     virtual bool patchFiles(const std::string &directory) override;
 
+    virtual bool canPatchInMemory() const override;
+    virtual bool patchFileInMemory(const std::string &file,
+                                   std::vector<unsigned char> *contents) override;
+
     // These are public so other patchers can use them
     static void removeDeviceChecks(std::vector<std::string> *lines);
 
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "batchpatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "fileinfo.h"
+#include "patcherinterface.h"
+#include "patchers/multibootpatcher.h"
+#include "private/logging.h"
+
+
+namespace mbp
+{
+
+/*! \cond INTERNAL */
+class BatchPatcher::Impl
+{
+public:
+    PatcherConfig *pc;
+
+    unsigned int maxJobs = 0;
+    unsigned int maxJobsPerDisk = 2;
+    // Threads that each job's patcher may use, so that the jobs together
+    // don't use more threads (and buffers) than there are CPUs
+    unsigned int threadsPerJob = 0;
+
+    const std::vector<Job> *jobs;
+    std::vector<Result> results;
+    // Disk containing each job's file
+    std::vector<std::string> disks;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<bool> started;
+    std::size_t nStarted;
+    std::unordered_map<std::string, unsigned int> runningPerDisk;
+    std::unordered_set<Patcher *> running;
+    // Jobs whose callbacks have not been called yet
+    std::deque<std::size_t> finished;
+    // Set under the mutex so that a job is either not started or is in
+    // running when cancelPatching() looks, but read without it
+    std::atomic<bool> cancelled{false};
+
+    // Passed to a running patcher's callbacks
+    struct JobContext
+    {
+        Impl *impl;
+        Patcher *patcher;
+    };
+
+    bool nextJob(std::size_t *index);
+    void worker();
+    Result runJob(const Job &job);
+
+    static void onUpdate(uint64_t value, uint64_t maxValue, void *userData);
+};
+/*! \endcond */
+
+
+/*!
+ * \class BatchPatcher
+ * \brief Patches many files concurrently
+ *
+ * Each job is patched by its own Patcher created from the shared
+ * PatcherConfig, so the devices and the loaded PatchInfos are only loaded
+ * once. Jobs run on a bounded pool of threads. Since patching a large zip is
+ * mostly disk bound, the number of jobs that read from the same disk at the
+ * same time is limited separately.
+ */
+
+BatchPatcher::BatchPatcher(PatcherConfig * const pc) : m_impl(new Impl())
+{
+    m_impl->pc = pc;
+}
+
+BatchPatcher::~BatchPatcher()
+{
+}
+
+/*!
+ * \brief Maximum number of jobs to run at the same time
+ *
+ * \return Number of jobs (0 means the number of CPUs)
+ */
+unsigned int BatchPatcher::maxJobs() const
+{
+    return m_impl->maxJobs;
+}
+
+/*!
+ * \brief Set the maximum number of jobs to run at the same time
+ *
+ * \param jobs Number of jobs (0 means the number of CPUs)
+ */
+void BatchPatcher::setMaxJobs(unsigned int jobs)
+{
+    m_impl->maxJobs = jobs;
+}
+
+/*!
+ * \brief Maximum number of jobs whose files are on the same disk to run at the
+ *        same time
+ *
+ * \return Number of jobs (0 means unlimited)
+ */
+unsigned int BatchPatcher::maxJobsPerDisk() const
+{
+    return m_impl->maxJobsPerDisk;
+}
+
+/*!
+ * \brief Set the maximum number of jobs whose files are on the same disk to
+ *        run at the same time
+ *
+ * The default is 2, which keeps a disk busy while the other job is CPU bound
+ * (eg. while patching a boot image).
+ *
+ * \param jobs Number of jobs (0 means unlimited)
+ */
+void BatchPatcher::setMaxJobsPerDisk(unsigned int jobs)
+{
+    m_impl->maxJobsPerDisk = jobs;
+}
+
+static std::string diskForFile(const std::string &path)
+{
+#ifdef _WIN32
+    return boost::filesystem::absolute(path).root_name().string();
+#else
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return std::string();
+    }
+    return std::to_string(sb.st_dev);
+#endif
+}
+
+/*!
+ * \brief Patch a list of files
+ *
+ * This blocks until all of the jobs have finished. \a finishedCb is called
+ * from the calling thread as each job finishes, in the order they finish.
+ *
+ * \param jobs Jobs to run
+ * \param finishedCb Called with the index and result of each finished job
+ *                   (can be nullptr)
+ * \param userData Pointer to pass to the callback
+ *
+ * \return Result of every job, in the same order as \a jobs
+ */
+std::vector<BatchPatcher::Result> BatchPatcher::patchFiles(
+        const std::vector<Job> &jobs, JobFinishedCallback finishedCb,
+        void *userData)
+{
+    m_impl->jobs = &jobs;
+    m_impl->results.assign(jobs.size(), Result());
+    m_impl->started.assign(jobs.size(), false);
+    m_impl->nStarted = 0;
+    m_impl->runningPerDisk.clear();
+    m_impl->finished.clear();
+    m_impl->cancelled.store(false);
+
+    m_impl->disks.clear();
+    for (const Job &job : jobs) {
+        m_impl->disks.push_back(diskForFile(job.filename));
+    }
+
+    unsigned int nCpus = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned int nThreads = m_impl->maxJobs;
+    if (nThreads == 0) {
+        nThreads = nCpus;
+    }
+    nThreads = std::min<std::size_t>(nThreads, jobs.size());
+    m_impl->threadsPerJob = std::max(nCpus / std::max(nThreads, 1u), 1u);
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < nThreads; ++i) {
+        try {
+            threads.emplace_back(&Impl::worker, m_impl.get());
+        } catch (const std::system_error &e) {
+            FLOGW("Failed to start batch patcher thread: {}", e.what());
+            break;
+        }
+    }
+
+    if (threads.empty() && !jobs.empty()) {
+        // Run everything on this thread
+        m_impl->worker();
+    }
+
+    std::size_t nFinished = 0;
+
+    while (nFinished < jobs.size()) {
+        std::size_t index;
+
+        {
+            std::unique_lock<std::mutex> lock(m_impl->mutex);
+            while (m_impl->finished.empty()) {
+                m_impl->cv.wait(lock);
+            }
+            index = m_impl->finished.front();
+            m_impl->finished.pop_front();
+        }
+
+        ++nFinished;
+
+        if (finishedCb) {
+            finishedCb(index, m_impl->results[index], userData);
+        }
+    }
+
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    m_impl->jobs = nullptr;
+
+    std::vector<Result> results;
+    results.swap(m_impl->results);
+    return results;
+}
+
+/*!
+ * \brief Cancel all jobs
+ *
+ * Running jobs are cancelled and jobs that have not started yet fail with
+ * ErrorCode::PatchingCancelled.
+ */
+void BatchPatcher::cancelPatching()
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->cancelled.store(true);
+    for (Patcher *p : m_impl->running) {
+        p->cancelPatching();
+    }
+    m_impl->cv.notify_all();
+}
+
+/*!
+ * Pick the first job that has not started and whose disk is not busy. Must be
+ * called with the mutex locked. Returns false if there is no such job.
+ */
+bool BatchPatcher::Impl::nextJob(std::size_t *index)
+{
+    for (std::size_t i = 0; i < started.size(); ++i) {
+        if (started[i]) {
+            continue;
+        }
+
+        if (cancelled.load() || maxJobsPerDisk == 0
+                || runningPerDisk[disks[i]] < maxJobsPerDisk) {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void BatchPatcher::Impl::worker()
+{
+    while (true) {
+        std::size_t index;
+        bool cancel;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (nStarted < started.size() && !nextJob(&index)) {
+                cv.wait(lock);
+            }
+            if (nStarted == started.size()) {
+                return;
+            }
+
+            started[index] = true;
+            ++nStarted;
+            ++runningPerDisk[disks[index]];
+            cancel = cancelled.load();
+        }
+
+        Result result;
+        if (cancel) {
+            result.error = PatcherError::createCancelledError(
+                    ErrorCode::PatchingCancelled);
+        } else {
+            result = runJob((*jobs)[index]);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        results[index] = std::move(result);
+        --runningPerDisk[disks[index]];
+        finished.push_back(index);
+        cv.notify_all();
+    }
+}
+
+BatchPatcher::Result BatchPatcher::Impl::runJob(const Job &job)
+{
+    Result result;
+
+    FileInfo info;
+    info.setFilename(job.filename);
+    info.setDevice(job.device);
+    info.setRomId(job.romId);
+
+    PatchInfo *patchInfo = job.patchInfo;
+    if (!patchInfo) {
+        patchInfo = pc->findMatchingPatchInfo(job.device, job.filename);
+    }
+    if (!patchInfo) {
+        FLOGE("{}: No matching PatchInfo", job.filename);
+        result.error = PatcherError::createGenericError(
+                ErrorCode::UnknownError);
+        return result;
+    }
+    info.setPatchInfo(patchInfo);
+
+    const std::string &id = job.patcherId.empty()
+            ? MultiBootPatcher::Id : job.patcherId;
+
+    Patcher *patcher = pc->createPatcher(id);
+    if (!patcher) {
+        result.error = PatcherError::createPatcherCreationError(
+                ErrorCode::PatcherCreateError, id);
+        return result;
+    }
+
+    patcher->setFileInfo(&info);
+    patcher->setMaxThreads(threadsPerJob);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancelled.load()) {
+            patcher->setFileInfo(nullptr);
+            pc->destroyPatcher(patcher);
+            result.error = PatcherError::createCancelledError(
+                    ErrorCode::PatchingCancelled);
+            return result;
+        }
+        running.insert(patcher);
+    }
+
+    // patchFile() discards cancels made before it starts, so the callbacks
+    // forward any cancel that landed in between. The file count is reported
+    // as soon as the first pass starts, so this doesn't wait for the next
+    // (rate limited) progress update.
+    JobContext ctx{this, patcher};
+    result.success = patcher->patchFile(&onUpdate, &onUpdate, nullptr, &ctx);
+    if (result.success) {
+        result.newFilePath = patcher->newFilePath();
+    } else {
+        result.error = patcher->error();
+    }
+
+    patcher->setFileInfo(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running.erase(patcher);
+    }
+
+    pc->destroyPatcher(patcher);
+
+    return result;
+}
+
+// Progress and file count callback of a running patcher
+void BatchPatcher::Impl::onUpdate(uint64_t value, uint64_t maxValue,
+                                  void *userData)
+{
+    (void) value;
+    (void) maxValue;
+
+    JobContext *ctx = static_cast<JobContext *>(userData);
+
+    if (ctx->impl->cancelled.load()) {
+        ctx->patcher->cancelPatching();
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libmbp_global.h"
+
+#include "device.h"
+#include "patcherconfig.h"
+#include "patchererror.h"
+#include "patchinfo.h"
+
+
+namespace mbp
+{
+
+class MBP_EXPORT BatchPatcher
+{
+public:
+    struct Job
+    {
+        // Path to the file to patch
+        std::string filename;
+        Device *device = nullptr;
+        // If nullptr, PatcherConfig::findMatchingPatchInfo() is used
+        PatchInfo *patchInfo = nullptr;
+        std::string romId;
+        // If empty, MultiBootPatcher is used
+        std::string patcherId;
+    };
+
+    struct Result
+    {
+        bool success = false;
+        std::string newFilePath;
+        PatcherError error;
+    };
+
+    typedef void (*JobFinishedCallback) (std::size_t, const Result &, void *);
+
+    explicit BatchPatcher(PatcherConfig * const pc);
+    ~BatchPatcher();
+
+    unsigned int maxJobs() const;
+    void setMaxJobs(unsigned int jobs);
+
+    unsigned int maxJobsPerDisk() const;
+    void setMaxJobsPerDisk(unsigned int jobs);
+
+    std::vector<Result> patchFiles(const std::vector<Job> &jobs,
+                                   JobFinishedCallback finishedCb,
+                                   void *userData);
+
+    void cancelPatching();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+}
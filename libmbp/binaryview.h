@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "libmbp_global.h"
+
+
+namespace mbp
+{
+
+/*!
+ * \class BinaryView
+ * \brief Non-owning, read-only view of a contiguous block of binary data
+ *
+ * A BinaryView does not keep the underlying data alive. It is only valid for
+ * as long as the object that returned it is alive and the viewed data has not
+ * been replaced (eg. by calling one of BootImage's `set*Image()` functions).
+ */
+class MBP_EXPORT BinaryView
+{
+public:
+    typedef unsigned char value_type;
+    typedef const unsigned char * iterator;
+    typedef const unsigned char * const_iterator;
+
+    BinaryView() : m_data(nullptr), m_size(0) {}
+    BinaryView(const unsigned char *data, std::size_t size)
+        : m_data(data), m_size(size) {}
+
+    const unsigned char * data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const unsigned char * begin() const { return m_data; }
+    const unsigned char * end() const { return m_data + m_size; }
+
+    std::vector<unsigned char> toVector() const
+    {
+        return std::vector<unsigned char>(begin(), end());
+    }
+
+private:
+    const unsigned char *m_data;
+    std::size_t m_size;
+};
+
+}
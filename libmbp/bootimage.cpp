@@ -19,9 +19,20 @@
 
 #include "bootimage.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <fstream>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 #include <cppformat/format.h>
 
 #include "bootimage/header.h"
@@ -30,6 +41,8 @@
 #include "external/sha.h"
 #include "private/fileutils.h"
 #include "private/logging.h"
+#include "private/mappedfile.h"
+#include "private/patternscanner.h"
 
 
 namespace mbp
@@ -51,6 +64,88 @@ const uint32_t BootImage::DefaultTagsOffset = 0x00000100u;
 
 
 /*! \cond INTERNAL */
+class ImageComponent
+{
+public:
+    ImageComponent() : m_data(nullptr), m_size(0) {}
+
+    ImageComponent(const ImageComponent &) = delete;
+    ImageComponent & operator=(const ImageComponent &) = delete;
+
+    // Take ownership of the data
+    void assign(std::vector<unsigned char> data)
+    {
+        m_owned = std::move(data);
+        m_data = m_owned.data();
+        m_size = m_owned.size();
+    }
+
+    // Refer to data owned by someone else (eg. a memory mapping) without
+    // copying it
+    void borrow(const unsigned char *data, std::size_t size)
+    {
+        m_owned.clear();
+        m_owned.shrink_to_fit();
+        m_data = data;
+        m_size = size;
+    }
+
+    void clear()
+    {
+        borrow(nullptr, 0);
+    }
+
+    BinaryView view() const
+    {
+        return BinaryView(m_data, m_size);
+    }
+
+    const unsigned char * data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const unsigned char * begin() const { return m_data; }
+    const unsigned char * end() const { return m_data + m_size; }
+
+    bool operator==(const ImageComponent &other) const
+    {
+        return m_size == other.m_size
+                && (m_size == 0
+                        || std::memcmp(m_data, other.m_data, m_size) == 0);
+    }
+
+private:
+    std::vector<unsigned char> m_owned;
+    const unsigned char *m_data;
+    std::size_t m_size;
+};
+
+// Piece of the output boot image
+struct OutputSegment
+{
+    const unsigned char *data;
+    std::size_t size;
+};
+
+// Layout of the output boot image. The segments point either to the images
+// in the BootImage or to the buffers below, which must not be modified after
+// the segments are added.
+struct OutputLayout
+{
+    // Header padded to a page (with the Loki header if Loki is applied)
+    std::vector<unsigned char> headerPage;
+    // Original aboot code with the Loki shellcode
+    std::vector<unsigned char> lokiCode;
+    // Source of zeros for padding
+    std::vector<unsigned char> zeros;
+
+    std::vector<OutputSegment> segments;
+    uint64_t size = 0;
+
+    void add(const unsigned char *data, std::size_t size);
+    void addPadding(std::size_t size);
+};
+
 class BootImage::Impl
 {
 public:
@@ -60,38 +155,66 @@ public:
     BootImageHeader header;
 
     // Various images stored in the boot image
-    std::vector<unsigned char> kernelImage;
-    std::vector<unsigned char> ramdiskImage;
-    std::vector<unsigned char> secondBootloaderImage;
-    std::vector<unsigned char> deviceTreeImage;
+    ImageComponent kernelImage;
+    ImageComponent ramdiskImage;
+    ImageComponent secondBootloaderImage;
+    ImageComponent deviceTreeImage;
 
     // Used for loki only
     std::vector<unsigned char> abootImage;
 
+    // If the boot image was loaded from a file, the components that have not
+    // been replaced point into one of these
+    std::vector<unsigned char> fileData;
+    MappedFile mapping;
+    // Whether components should point into the loaded data instead of being
+    // copied
+    bool borrowData = false;
+
     bool wasLoki = false;
     bool wasBump = false;
     bool applyLoki = false;
     bool applyBump = false;
 
+    // SHA1 states after hashing each section of the boot image. Only the
+    // sections after the first modified one need to be rehashed when the ID
+    // is recomputed.
+    enum HashSection {
+        HashKernel,
+        HashRamdisk,
+        HashSecondBootloader,
+        HashDeviceTree,
+        HashSectionCount
+    };
+    SHA_CTX hashStates[HashSectionCount];
+    int validHashStates = 0;
+
     PatcherError error;
 
-    bool loadAndroidHeader(const std::vector<unsigned char> &data,
+    void resetImages();
+    void setComponent(ImageComponent *component,
+                      const unsigned char *data, std::size_t size);
+
+    bool loadImage(const unsigned char *data, std::size_t size);
+    bool loadAndroidHeader(const unsigned char *data, std::size_t size,
                            const uint32_t headerIndex);
-    bool loadLokiHeader(const std::vector<unsigned char> &data,
+    bool loadLokiHeader(const unsigned char *data, std::size_t size,
                         const uint32_t headerIndex);
-    bool loadLokiNewImage(const std::vector<unsigned char> &data,
+    bool loadLokiNewImage(const unsigned char *data, std::size_t size,
                           const LokiHeader *loki);
-    bool loadLokiOldImage(const std::vector<unsigned char> &data,
+    bool loadLokiOldImage(const unsigned char *data, std::size_t size,
                           const LokiHeader *loki);
-    uint32_t lokiOldFindGzipOffset(const std::vector<unsigned char> &data,
+    uint32_t lokiOldFindGzipOffset(const unsigned char *data, std::size_t size,
                                    const uint32_t startOffset) const;
-    uint32_t lokiOldFindRamdiskSize(const std::vector<unsigned char> &data,
+    uint32_t lokiOldFindRamdiskSize(const unsigned char *data, std::size_t size,
                                     const uint32_t ramdiskOffset) const;
-    uint32_t lokiFindRamdiskAddress(const std::vector<unsigned char> &data,
+    uint32_t lokiFindRamdiskAddress(const unsigned char *data, std::size_t size,
                                     const LokiHeader *loki) const;
     uint32_t skipPadding(const uint32_t itemSize,
                          const uint32_t pageSize) const;
+    void invalidateSHA1Hash(HashSection section);
     void updateSHA1Hash();
+    bool prepareOutput(OutputLayout *layout);
 
     void dumpHeader() const;
 
@@ -190,25 +313,136 @@ PatcherError BootImage::error() const
  * \return Whether the boot image was successfully read and parsed.
  */
 bool BootImage::load(const std::vector<unsigned char> &data)
+{
+    m_impl->resetImages();
+    m_impl->borrowData = false;
+
+    return m_impl->loadImage(data.data(), data.size());
+}
+
+/*!
+ * \brief Load a boot image file
+ *
+ * This function reads a boot image file into memory and parses it the same
+ * way as BootImage::load(const std::vector<unsigned char> &). The components
+ * are not copied out of the file contents, so the boot image is only stored in
+ * memory once.
+ *
+ * \warning If the boot image cannot be loaded, do not use the same BootImage
+ *          object to load another boot image as it may contain partially
+ *          loaded data.
+ *
+ * \sa BootImage::load(const std::vector<unsigned char> &)
+ *
+ * \return Whether the boot image was successfully read and parsed.
+ */
+bool BootImage::load(const std::string &filename)
+{
+    m_impl->resetImages();
+    m_impl->borrowData = true;
+
+    // The components refer to the file contents instead of being copied again
+    auto ret = FileUtils::readToMemory(filename, &m_impl->fileData);
+    if (!ret) {
+        m_impl->error = ret;
+        return false;
+    }
+
+    if (!m_impl->loadImage(m_impl->fileData.data(), m_impl->fileData.size())) {
+        m_impl->resetImages();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load a boot image file without copying its contents
+ *
+ * This function maps the boot image file (or block device) into memory
+ * read-only. The kernel, ramdisk, second bootloader, and device tree images
+ * are not copied. Instead, they refer directly to the mapping, which is kept
+ * until another boot image is loaded or the BootImage is destroyed. A
+ * component is only copied if it is replaced with one of the `set*Image()`
+ * functions.
+ *
+ * This is useful for inspecting a large number of boot images since each
+ * image is only read from disk once and never exists twice in memory.
+ *
+ * \warning The file must not be modified or truncated while the BootImage
+ *          refers to it. In particular, do not use BootImage::createFile() to
+ *          overwrite the file that was loaded.
+ *
+ * \warning If the boot image cannot be loaded, do not use the same BootImage
+ *          object to load another boot image as it may contain partially
+ *          loaded data.
+ *
+ * \sa BootImage::load(const std::string &)
+ *
+ * \return Whether the boot image was successfully mapped and parsed.
+ */
+bool BootImage::loadMapped(const std::string &filename)
+{
+    m_impl->resetImages();
+    m_impl->borrowData = true;
+
+    auto ret = m_impl->mapping.open(filename);
+    if (!ret) {
+        m_impl->error = ret;
+        return false;
+    }
+
+    if (!m_impl->loadImage(m_impl->mapping.data(), m_impl->mapping.size())) {
+        // Don't leave views into a mapping that may be reused
+        m_impl->resetImages();
+        return false;
+    }
+
+    return true;
+}
+
+void BootImage::Impl::resetImages()
+{
+    // Components may point into the old mapping, so clear them first
+    kernelImage.clear();
+    ramdiskImage.clear();
+    secondBootloaderImage.clear();
+    deviceTreeImage.clear();
+    fileData.clear();
+    fileData.shrink_to_fit();
+    mapping.close();
+    validHashStates = 0;
+}
+
+void BootImage::Impl::setComponent(ImageComponent *component,
+                                   const unsigned char *data, std::size_t size)
+{
+    if (borrowData) {
+        component->borrow(data, size);
+    } else {
+        component->assign(std::vector<unsigned char>(data, data + size));
+    }
+}
+
+bool BootImage::Impl::loadImage(const unsigned char *data, std::size_t size)
 {
     // Check that the size of the boot image is okay
-    if (data.size() < 512 + sizeof(BootImageHeader)) {
+    if (size < 512 + sizeof(BootImageHeader)) {
         LOGE("The boot image is smaller than the boot image header!");
-        m_impl->error = PatcherError::createBootImageError(
+        error = PatcherError::createBootImageError(
                 ErrorCode::BootImageParseError);
         return false;
     }
 
     // Find the Loki magic string
-    m_impl->wasLoki = std::memcmp(&data[0x400], LOKI_MAGIC,
-                                  LOKI_MAGIC_SIZE) == 0;
+    wasLoki = std::memcmp(&data[0x400], LOKI_MAGIC, LOKI_MAGIC_SIZE) == 0;
 
     // Find the Android magic string
     bool isAndroid = false;
     uint32_t headerIndex;
 
     uint32_t searchRange;
-    if (m_impl->wasLoki) {
+    if (wasLoki) {
         searchRange = 32;
     } else {
         searchRange = 512;
@@ -224,56 +458,31 @@ bool BootImage::load(const std::vector<unsigned char> &data)
 
     if (!isAndroid) {
         LOGE("The boot image does not contain an boot image header");
-        m_impl->error = PatcherError::createBootImageError(
+        error = PatcherError::createBootImageError(
                 ErrorCode::BootImageParseError);
         return false;
     }
 
     bool ret;
 
-    if (m_impl->wasLoki) {
-        ret = m_impl->loadLokiHeader(data, headerIndex);
+    if (wasLoki) {
+        ret = loadLokiHeader(data, size, headerIndex);
     } else {
-        ret = m_impl->loadAndroidHeader(data, headerIndex);
+        ret = loadAndroidHeader(data, size, headerIndex);
     }
 
-    FLOGD("Image is Loki-patched: {:s}", m_impl->wasLoki ? "true" : "false");
-    FLOGD("Image is Bump-patched: {:s}", m_impl->wasBump ? "true" : "false");
+    FLOGD("Image is Loki-patched: {:s}", wasLoki ? "true" : "false");
+    FLOGD("Image is Bump-patched: {:s}", wasBump ? "true" : "false");
 
     return ret;
 }
 
-/*!
- * \brief Load a boot image file
- *
- * This function reads a boot image file and then calls
- * BootImage::load(const std::vector<unsigned char> &)
- *
- * \warning If the boot image cannot be loaded, do not use the same BootImage
- *          object to load another boot image as it may contain partially
- *          loaded data.
- *
- * \sa BootImage::load(const std::vector<unsigned char> &)
- *
- * \return Whether the boot image was successfully read and parsed.
- */
-bool BootImage::load(const std::string &filename)
-{
-    std::vector<unsigned char> data;
-    auto ret = FileUtils::readToMemory(filename, &data);
-    if (!ret) {
-        m_impl->error = ret;
-        return false;
-    }
-
-    return load(data);
-}
-
-bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
+bool BootImage::Impl::loadAndroidHeader(const unsigned char *data,
+                                        std::size_t size,
                                         const uint32_t headerIndex)
 {
     // Make sure the file is large enough to contain the header
-    if (data.size() < headerIndex + sizeof(BootImageHeader)) {
+    if (size < headerIndex + sizeof(BootImageHeader)) {
         LOGE("The boot image is smaller than the boot image header!");
         error = PatcherError::createBootImageError(
                 ErrorCode::BootImageParseError);
@@ -309,38 +518,34 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
     // Don't try to read the various images inside the boot image if it's
     // Loki'd since some offsets and sizes need to be calculated
     if (!wasLoki) {
-        uint32_t pos = sizeof(BootImageHeader);
+        uint64_t pos = sizeof(BootImageHeader);
         pos += skipPadding(sizeof(BootImageHeader), android->page_size);
 
-        if (pos + android->kernel_size > data.size()) {
+        if (pos + android->kernel_size > size) {
             LOGE("Kernel image exceeds boot image size");
             error = PatcherError::createBootImageError(
                     ErrorCode::BootImageParseError);
             return false;
         }
 
-        kernelImage.assign(
-                data.begin() + pos,
-                data.begin() + pos + android->kernel_size);
+        setComponent(&kernelImage, data + pos, android->kernel_size);
 
         pos += android->kernel_size;
         pos += skipPadding(android->kernel_size, android->page_size);
 
-        if (pos + android->ramdisk_size > data.size()) {
+        if (pos + android->ramdisk_size > size) {
             LOGE("Ramdisk image exceeds boot image size");
             error = PatcherError::createBootImageError(
                     ErrorCode::BootImageParseError);
             return false;
         }
 
-        ramdiskImage.assign(
-                data.begin() + pos,
-                data.begin() + pos + android->ramdisk_size);
+        setComponent(&ramdiskImage, data + pos, android->ramdisk_size);
 
         pos += android->ramdisk_size;
         pos += skipPadding(android->ramdisk_size, android->page_size);
 
-        if (pos + android->second_size > data.size()) {
+        if (pos + android->second_size > size) {
             LOGE("Second bootloader image exceeds boot image size");
             error = PatcherError::createBootImageError(
                     ErrorCode::BootImageParseError);
@@ -349,9 +554,8 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
 
         // The second bootloader may not exist
         if (android->second_size > 0) {
-            secondBootloaderImage.assign(
-                    data.begin() + pos,
-                    data.begin() + pos + android->second_size);
+            setComponent(&secondBootloaderImage,
+                         data + pos, android->second_size);
         } else {
             secondBootloaderImage.clear();
         }
@@ -359,7 +563,7 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
         pos += android->second_size;
         pos += skipPadding(android->second_size, android->page_size);
 
-        if (pos + android->dt_size > data.size()) {
+        if (pos + android->dt_size > size) {
             LOGE("Device tree image exceeds boot image size");
             error = PatcherError::createBootImageError(
                     ErrorCode::BootImageParseError);
@@ -368,9 +572,7 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
 
         // The device tree image may not exist as well
         if (android->dt_size > 0) {
-            deviceTreeImage.assign(
-                    data.begin() + pos,
-                    data.begin() + pos + android->dt_size);
+            setComponent(&deviceTreeImage, data + pos, android->dt_size);
         } else {
             deviceTreeImage.clear();
         }
@@ -378,9 +580,8 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
         pos += android->dt_size;
         pos += skipPadding(android->dt_size, android->page_size);
 
-        if (pos + BUMP_MAGIC_SIZE <= data.size()
-                && memcmp(data.data() + pos, BUMP_MAGIC,
-                          BUMP_MAGIC_SIZE) == 0) {
+        if (pos + BUMP_MAGIC_SIZE <= size
+                && memcmp(data + pos, BUMP_MAGIC, BUMP_MAGIC_SIZE) == 0) {
             wasBump = true;
         }
     }
@@ -388,18 +589,19 @@ bool BootImage::Impl::loadAndroidHeader(const std::vector<unsigned char> &data,
     return true;
 }
 
-bool BootImage::Impl::loadLokiHeader(const std::vector<unsigned char> &data,
+bool BootImage::Impl::loadLokiHeader(const unsigned char *data,
+                                     std::size_t size,
                                      const uint32_t headerIndex)
 {
     // Make sure the file is large enough to contain the Loki header
-    if (data.size() < 0x400 + sizeof(LokiHeader)) {
+    if (size < 0x400 + sizeof(LokiHeader)) {
         LOGE("The boot image is smaller than the loki header!");
         error = PatcherError::createBootImageError(
                 ErrorCode::BootImageParseError);
         return false;
     }
 
-    if (!loadAndroidHeader(data, headerIndex)) {
+    if (!loadAndroidHeader(data, size, headerIndex)) {
         // Error code already set
         return false;
     }
@@ -417,13 +619,14 @@ bool BootImage::Impl::loadLokiHeader(const std::vector<unsigned char> &data,
     if (loki->orig_kernel_size != 0
             && loki->orig_ramdisk_size != 0
             && loki->ramdisk_addr != 0) {
-        return loadLokiNewImage(data, loki);
+        return loadLokiNewImage(data, size, loki);
     } else {
-        return loadLokiOldImage(data, loki);
+        return loadLokiOldImage(data, size, loki);
     }
 }
 
-bool BootImage::Impl::loadLokiNewImage(const std::vector<unsigned char> &data,
+bool BootImage::Impl::loadLokiNewImage(const unsigned char *data,
+                                       std::size_t size,
                                        const LokiHeader *loki)
 {
     LOGD("This is a new loki image");
@@ -439,7 +642,7 @@ bool BootImage::Impl::loadLokiNewImage(const std::vector<unsigned char> &data,
     }
 
     // Find original ramdisk address
-    uint32_t ramdiskAddr = lokiFindRamdiskAddress(data, loki);
+    uint32_t ramdiskAddr = lokiFindRamdiskAddress(data, size, loki);
     if (ramdiskAddr == 0) {
         LOGE("Could not find ramdisk address in new loki boot image");
         error = PatcherError::createBootImageError(
@@ -452,27 +655,50 @@ bool BootImage::Impl::loadLokiNewImage(const std::vector<unsigned char> &data,
     header.kernel_size = loki->orig_kernel_size;
     header.ramdisk_addr = ramdiskAddr;
 
-    uint32_t pageKernelSize = (loki->orig_kernel_size + pageMask) & ~pageMask;
-    uint32_t pageRamdiskSize = (loki->orig_ramdisk_size + pageMask) & ~pageMask;
+    uint64_t pageKernelSize =
+            (uint64_t(loki->orig_kernel_size) + pageMask) & ~uint64_t(pageMask);
+    uint64_t pageRamdiskSize =
+            (uint64_t(loki->orig_ramdisk_size) + pageMask) & ~uint64_t(pageMask);
+
+    // The components are not copied, so the offsets and sizes from the loki
+    // header must be checked before they are used
+    uint64_t kernelOffset = header.page_size;
+    uint64_t ramdiskOffset = kernelOffset + pageKernelSize;
+    uint64_t dtOffset = ramdiskOffset + pageRamdiskSize + fakeSize;
+
+    if (kernelOffset + loki->orig_kernel_size > size) {
+        LOGE("Kernel image exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
+
+    if (ramdiskOffset + loki->orig_ramdisk_size > size) {
+        LOGE("Ramdisk image exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
+
+    if (header.dt_size != 0 && dtOffset + header.dt_size > size) {
+        LOGE("Device tree image exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
 
     // Kernel image
-    kernelImage.assign(
-            data.begin() + header.page_size,
-            data.begin() + header.page_size + loki->orig_kernel_size);
+    setComponent(&kernelImage, data + kernelOffset, loki->orig_kernel_size);
 
     // Ramdisk image
-    ramdiskImage.assign(
-            data.begin() + header.page_size + pageKernelSize,
-            data.begin() + header.page_size + pageKernelSize + loki->orig_ramdisk_size);
+    setComponent(&ramdiskImage, data + ramdiskOffset, loki->orig_ramdisk_size);
 
     // No second bootloader image
     secondBootloaderImage.clear();
 
     // Possible device tree image
     if (header.dt_size != 0) {
-        auto startPtr = data.begin() + header.page_size
-                + pageKernelSize + pageRamdiskSize + fakeSize;
-        deviceTreeImage.assign(startPtr, startPtr + header.dt_size);
+        setComponent(&deviceTreeImage, data + dtOffset, header.dt_size);
     } else {
         deviceTreeImage.clear();
     }
@@ -480,7 +706,8 @@ bool BootImage::Impl::loadLokiNewImage(const std::vector<unsigned char> &data,
     return true;
 }
 
-bool BootImage::Impl::loadLokiOldImage(const std::vector<unsigned char> &data,
+bool BootImage::Impl::loadLokiOldImage(const unsigned char *data,
+                                       std::size_t size,
                                        const LokiHeader *loki)
 {
     LOGD("This is an old loki image");
@@ -497,15 +724,29 @@ bool BootImage::Impl::loadLokiOldImage(const std::vector<unsigned char> &data,
     // kernel size is not stored in the loki header properly (or in the shellcode).
     // The size is stored in the kernel image's header though, so we'll use that.
     // http://www.simtec.co.uk/products/SWLINUX/files/booting_article.html#d0e309
+    if (uint64_t(header.page_size) + 0x2c + sizeof(int32_t) > size) {
+        LOGE("Kernel image header exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
+
     kernelSize = *(reinterpret_cast<const int32_t *>(
             &data[header.page_size + 0x2c]));
     FLOGD("Kernel size: {:d}", kernelSize);
 
+    if (uint64_t(header.page_size) + kernelSize > size) {
+        LOGE("Kernel image exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
+
 
     // The ramdisk always comes after the kernel in boot images, so start the
     // search there
     uint32_t gzipOffset = lokiOldFindGzipOffset(
-            data, header.page_size + kernelSize);
+            data, size, header.page_size + kernelSize);
     if (gzipOffset == 0) {
         LOGE("Could not find gzip offset in old loki boot image");
         error = PatcherError::createBootImageError(
@@ -513,9 +754,16 @@ bool BootImage::Impl::loadLokiOldImage(const std::vector<unsigned char> &data,
         return false;
     }
 
-    ramdiskSize = lokiOldFindRamdiskSize(data, gzipOffset);
+    ramdiskSize = lokiOldFindRamdiskSize(data, size, gzipOffset);
+
+    if (uint64_t(gzipOffset) + ramdiskSize > size) {
+        LOGE("Ramdisk image exceeds boot image size");
+        error = PatcherError::createBootImageError(
+                ErrorCode::BootImageParseError);
+        return false;
+    }
 
-    ramdiskAddr = lokiFindRamdiskAddress(data, loki);
+    ramdiskAddr = lokiFindRamdiskAddress(data, size, loki);
     if (ramdiskAddr == 0) {
         LOGE("Could not find ramdisk address in old loki boot image");
         error = PatcherError::createBootImageError(
@@ -528,14 +776,10 @@ bool BootImage::Impl::loadLokiOldImage(const std::vector<unsigned char> &data,
     header.ramdisk_addr = ramdiskAddr;
 
     // Kernel image
-    kernelImage.assign(
-            data.begin() + header.page_size,
-            data.begin() + header.page_size + kernelSize);
+    setComponent(&kernelImage, data + header.page_size, kernelSize);
 
     // Ramdisk image
-    ramdiskImage.assign(
-            data.begin() + gzipOffset,
-            data.begin() + gzipOffset + ramdiskSize);
+    setComponent(&ramdiskImage, data + gzipOffset, ramdiskSize);
 
     // No second bootloader image
     secondBootloaderImage.clear();
@@ -546,7 +790,8 @@ bool BootImage::Impl::loadLokiOldImage(const std::vector<unsigned char> &data,
     return true;
 }
 
-uint32_t BootImage::Impl::lokiOldFindGzipOffset(const std::vector<unsigned char> &data,
+uint32_t BootImage::Impl::lokiOldFindGzipOffset(const unsigned char *data,
+                                                std::size_t size,
                                                 const uint32_t startOffset) const
 {
     // gzip header:
@@ -562,22 +807,20 @@ uint32_t BootImage::Impl::lokiOldFindGzipOffset(const std::vector<unsigned char>
     std::vector<uint32_t> offsetsFlag8; // Has original file name
     std::vector<uint32_t> offsetsFlag0; // No flags
 
-    uint32_t curOffset = startOffset - 1;
-
-    while (true) {
-        // Try to find gzip header
-        auto it = std::search(data.begin() + curOffset + 1, data.end(),
-                              gzipDeflate, gzipDeflate + 3);
+    if (startOffset >= size) {
+        return 0;
+    }
 
-        if (it == data.end()) {
-            break;
-        }
+    PatternScanner scanner;
+    scanner.addPattern(gzipDeflate, sizeof(gzipDeflate));
 
-        curOffset = it - data.begin();
+    scanner.scan(data + startOffset, size - startOffset,
+                 [&](std::size_t, std::size_t offset) {
+        uint32_t curOffset = startOffset + offset;
 
         // We're checking 1 more byte so make sure it's within bounds
-        if (curOffset + 1 >= data.size()) {
-            break;
+        if (curOffset + 3 >= size) {
+            return false;
         }
 
         if (data[curOffset + 3] == '\x08') {
@@ -589,9 +832,10 @@ uint32_t BootImage::Impl::lokiOldFindGzipOffset(const std::vector<unsigned char>
         } else {
             FLOGW("Unexpected flag {:#02x} found in gzip header at {:#x}",
                   static_cast<int32_t>(data[curOffset + 3]), curOffset);
-            continue;
         }
-    }
+
+        return true;
+    });
 
     FLOGD("Found {:d} total gzip headers",
           offsetsFlag8.size() + offsetsFlag0.size());
@@ -618,7 +862,8 @@ uint32_t BootImage::Impl::lokiOldFindGzipOffset(const std::vector<unsigned char>
     return gzipOffset;
 }
 
-uint32_t BootImage::Impl::lokiOldFindRamdiskSize(const std::vector<unsigned char> &data,
+uint32_t BootImage::Impl::lokiOldFindRamdiskSize(const unsigned char *data,
+                                                 std::size_t size,
                                                  const uint32_t ramdiskOffset) const
 {
     uint32_t ramdiskSize;
@@ -628,13 +873,13 @@ uint32_t BootImage::Impl::lokiOldFindRamdiskSize(const std::vector<unsigned char
 
     // The ramdisk is supposed to be from the gzip header to EOF, but loki needs
     // to store a copy of aboot, so it is put in the last 0x200 bytes of the file.
-    ramdiskSize = data.size() - ramdiskOffset - 0x200;
+    ramdiskSize = size - ramdiskOffset - 0x200;
     // For LG kernels:
-    // ramdiskSize = data.size() - ramdiskOffset - d->header->page_size;
+    // ramdiskSize = size - ramdiskOffset - d->header->page_size;
 
     // The gzip file is zero padded, so we'll search backwards until we find a
     // non-zero byte
-    std::size_t begin = data.size() - 0x200;
+    std::size_t begin = size - 0x200;
     std::size_t location;
     bool found = false;
 
@@ -660,7 +905,8 @@ uint32_t BootImage::Impl::lokiOldFindRamdiskSize(const std::vector<unsigned char
     return ramdiskSize;
 }
 
-uint32_t BootImage::Impl::lokiFindRamdiskAddress(const std::vector<unsigned char> &data,
+uint32_t BootImage::Impl::lokiFindRamdiskAddress(const unsigned char *data,
+                                                 std::size_t size,
                                                  const LokiHeader *loki) const
 {
     // If the boot image was patched with a newer version of loki, find the ramdisk
@@ -668,15 +914,19 @@ uint32_t BootImage::Impl::lokiFindRamdiskAddress(const std::vector<unsigned char
     uint32_t ramdiskAddr = 0;
 
     if (loki->ramdisk_addr != 0) {
-        auto size = data.size();
-
-        for (uint32_t i = 0; i < size - (LOKI_SHELLCODE_SIZE - 9); ++i) {
-            if (std::memcmp(&data[i], LOKI_SHELLCODE, LOKI_SHELLCODE_SIZE - 9) == 0) {
-                ramdiskAddr = *(reinterpret_cast<const uint32_t *>(
-                        &data[i] + LOKI_SHELLCODE_SIZE - 5));
-                break;
+        // The ramdisk address is stored in the last part of the shellcode.
+        // Everything before it is fixed.
+        PatternScanner scanner;
+        scanner.addPattern(LOKI_SHELLCODE, LOKI_SHELLCODE_SIZE - 9);
+
+        scanner.scan(data, size, [&](std::size_t, std::size_t offset) {
+            if (size - offset < LOKI_SHELLCODE_SIZE - 1) {
+                return false;
             }
-        }
+            std::memcpy(&ramdiskAddr, data + offset + LOKI_SHELLCODE_SIZE - 5,
+                        sizeof(ramdiskAddr));
+            return false;
+        });
 
         if (ramdiskAddr == 0) {
             LOGW("Couldn't determine ramdisk offset");
@@ -693,22 +943,194 @@ uint32_t BootImage::Impl::lokiFindRamdiskAddress(const std::vector<unsigned char
     return ramdiskAddr;
 }
 
+void OutputLayout::add(const unsigned char *data, std::size_t size)
+{
+    if (size > 0) {
+        segments.push_back({ data, size });
+        this->size += size;
+    }
+}
+
+void OutputLayout::addPadding(std::size_t size)
+{
+    // The padding is always less than a page
+    assert(size <= zeros.size());
+    add(zeros.data(), size);
+}
+
+static bool writeSegments(int fd, std::vector<OutputSegment> *segments)
+{
+#ifdef _WIN32
+    for (auto const &segment : *segments) {
+        const unsigned char *ptr = segment.data;
+        std::size_t remaining = segment.size;
+
+        while (remaining > 0) {
+            int n = _write(fd, ptr, remaining);
+            if (n <= 0) {
+                return false;
+            }
+            ptr += n;
+            remaining -= n;
+        }
+    }
+
+    return true;
+#else
+    std::vector<struct iovec> iov;
+    iov.reserve(segments->size());
+
+    for (auto const &segment : *segments) {
+        struct iovec v;
+        v.iov_base = const_cast<unsigned char *>(segment.data);
+        v.iov_len = segment.size;
+        iov.push_back(v);
+    }
+
+    std::size_t index = 0;
+
+    while (index < iov.size()) {
+        int count = std::min<std::size_t>(iov.size() - index, IOV_MAX);
+
+        ssize_t n = writev(fd, &iov[index], count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Skip over what was written and retry the rest on a short write
+        std::size_t written = n;
+        while (index < iov.size() && written >= iov[index].iov_len) {
+            written -= iov[index].iov_len;
+            ++index;
+        }
+        if (written > 0) {
+            iov[index].iov_base =
+                    static_cast<unsigned char *>(iov[index].iov_base) + written;
+            iov[index].iov_len -= written;
+        }
+    }
+
+    return true;
+#endif
+}
+
 /*!
  * \brief Constructs the boot image binary data
  *
  * This function builds the bootable boot image binary data that the BootImage
  * represents. This is equivalent to AOSP's \a mkbootimg tool.
  *
+ * \note If the boot image is going to be written to a file or a partition, use
+ *       BootImage::writeTo() or BootImage::createFile() instead. They do not
+ *       need to hold a serialized copy of the whole boot image in memory.
+ *
  * \return Boot image binary data
  */
 std::vector<unsigned char> BootImage::create() const
 {
+    OutputLayout layout;
+    if (!m_impl->prepareOutput(&layout)) {
+        return std::vector<unsigned char>();
+    }
+
     std::vector<unsigned char> data;
+    data.reserve(layout.size);
+
+    for (auto const &segment : layout.segments) {
+        data.insert(data.end(), segment.data, segment.data + segment.size);
+    }
+
+    return data;
+}
+
+/*!
+ * \brief Constructs boot image and writes it to a file
+ *
+ * This is equivalent to writing the data returned by BootImage::create() to the
+ * specified file, except that the boot image is written piece by piece
+ * directly from the individual images.
+ *
+ * \return Whether the file was successfully written
+ *
+ * \sa BootImage::create()
+ */
+bool BootImage::createFile(const std::string &path)
+{
+    // Don't truncate the file if the boot image cannot be built
+    OutputLayout layout;
+    if (!m_impl->prepareOutput(&layout)) {
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (file.fail()) {
+        m_impl->error = PatcherError::createIOError(
+                ErrorCode::FileOpenError, path);
+        return false;
+    }
+
+    for (auto const &segment : layout.segments) {
+        file.write(reinterpret_cast<const char *>(segment.data), segment.size);
+        if (file.bad()) {
+            m_impl->error = PatcherError::createIOError(
+                    ErrorCode::FileWriteError, path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Constructs boot image and writes it to a file descriptor
+ *
+ * The boot image is written starting at the current file offset of \a fd. The
+ * header, images, and padding are written directly from memory (with
+ * `writev()` where available), so a serialized copy of the boot image is never
+ * created. This makes it possible to write the boot image straight to a block
+ * device.
+ *
+ * \note The file descriptor is not closed or synced.
+ *
+ * \param fd File descriptor opened for writing
+ *
+ * \return Whether the boot image was successfully written
+ *
+ * \sa BootImage::create()
+ */
+bool BootImage::writeTo(int fd) const
+{
+    OutputLayout layout;
+    if (!m_impl->prepareOutput(&layout)) {
+        return false;
+    }
 
+    if (!writeSegments(fd, &layout.segments)) {
+        FLOGE("Failed to write boot image: {}", strerror(errno));
+        m_impl->error = PatcherError::createIOError(
+                ErrorCode::FileWriteError, std::string());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compute the layout of the output boot image
+ *
+ * Nothing is copied except for the header page and, if Loki is being applied,
+ * the small block of aboot code following the ramdisk. All other segments point
+ * directly to the images stored in the BootImage.
+ */
+bool BootImage::Impl::prepareOutput(OutputLayout *layout)
+{
     // Update SHA1
-    m_impl->updateSHA1Hash();
+    updateSHA1Hash();
 
-    switch (m_impl->header.page_size) {
+    switch (header.page_size) {
     case 2048:
     case 4096:
     case 8192:
@@ -718,110 +1140,76 @@ std::vector<unsigned char> BootImage::create() const
     case 131072:
         break;
     default:
-        FLOGE("Invalid page size: {:d}", m_impl->header.page_size);
-        m_impl->error = PatcherError::createBootImageError(
+        FLOGE("Invalid page size: {:d}", header.page_size);
+        error = PatcherError::createBootImageError(
                 ErrorCode::BootImageParseError);
-        return std::vector<unsigned char>();
+        return false;
     }
 
-    // Header
-    unsigned char *headerBegin =
-            reinterpret_cast<unsigned char *>(&m_impl->header);
-    data.insert(data.end(), headerBegin, headerBegin + sizeof(BootImageHeader));
-
-    // Padding
-    uint32_t paddingSize = m_impl->skipPadding(
-            sizeof(BootImageHeader), m_impl->header.page_size);
-    data.insert(data.end(), paddingSize, 0);
+    const uint32_t pageSize = header.page_size;
 
-    // Kernel image
-    data.insert(data.end(), m_impl->kernelImage.begin(),
-                m_impl->kernelImage.end());
+    BootImageHeader hdr = header;
+    LokiHeader lokiHdr;
 
-    // More padding
-    paddingSize = m_impl->skipPadding(
-            m_impl->kernelImage.size(), m_impl->header.page_size);
-    data.insert(data.end(), paddingSize, 0);
+    if (applyLoki) {
+        if (!LokiPatcher::patchHeader(&hdr, &lokiHdr, abootImage,
+                                      &layout->lokiCode)) {
+            error = PatcherError::createBootImageError(
+                    ErrorCode::BootImageApplyLokiError);
+            return false;
+        }
+    }
 
-    // Ramdisk image
-    data.insert(data.end(), m_impl->ramdiskImage.begin(),
-                m_impl->ramdiskImage.end());
+    // Header and its padding
+    layout->headerPage.assign(pageSize, 0);
+    std::memcpy(layout->headerPage.data(), &hdr, sizeof(BootImageHeader));
+    if (applyLoki) {
+        std::memcpy(layout->headerPage.data() + 0x400, &lokiHdr,
+                    sizeof(LokiHeader));
+    }
 
-    // Even more padding
-    paddingSize = m_impl->skipPadding(
-            m_impl->ramdiskImage.size(), m_impl->header.page_size);
-    data.insert(data.end(), paddingSize, 0);
+    layout->zeros.assign(pageSize, 0);
 
-    // Second bootloader image
-    if (!m_impl->secondBootloaderImage.empty()) {
-        data.insert(data.end(), m_impl->secondBootloaderImage.begin(),
-                    m_impl->secondBootloaderImage.end());
+    layout->add(layout->headerPage.data(), layout->headerPage.size());
 
-        // Enough padding already!
-        paddingSize = m_impl->skipPadding(
-                m_impl->secondBootloaderImage.size(), m_impl->header.page_size);
-        data.insert(data.end(), paddingSize, 0);
-    }
+    // Kernel image
+    layout->add(kernelImage.data(), kernelImage.size());
+    layout->addPadding(skipPadding(kernelImage.size(), pageSize));
 
-    // Device tree image
-    if (!m_impl->deviceTreeImage.empty()) {
-        data.insert(data.end(), m_impl->deviceTreeImage.begin(),
-                    m_impl->deviceTreeImage.end());
+    // Ramdisk image
+    layout->add(ramdiskImage.data(), ramdiskImage.size());
+    layout->addPadding(skipPadding(ramdiskImage.size(), pageSize));
 
-        // Last bit of padding (I hope)
-        paddingSize = m_impl->skipPadding(
-                m_impl->deviceTreeImage.size(), m_impl->header.page_size);
-        data.insert(data.end(), paddingSize, 0);
-    }
+    if (applyLoki) {
+        // Loki'd images have the original aboot code and shellcode after the
+        // ramdisk, followed by the unpadded device tree. The Bump magic would
+        // be discarded by Loki, so it's never written.
+        layout->add(layout->lokiCode.data(), layout->lokiCode.size());
 
-    if (m_impl->applyBump) {
-        if (!BumpPatcher::patchImage(&data)) {
-            m_impl->error = PatcherError::createBootImageError(
-                    ErrorCode::BootImageApplyBumpError);
-            return std::vector<unsigned char>();
+        if (!deviceTreeImage.empty()) {
+            layout->add(deviceTreeImage.data(), deviceTreeImage.size());
         }
-    }
 
-    if (m_impl->applyLoki) {
-        if (!LokiPatcher::patchImage(&data, m_impl->abootImage)) {
-            m_impl->error = PatcherError::createBootImageError(
-                    ErrorCode::BootImageApplyLokiError);
-            return std::vector<unsigned char>();
-        }
+        return true;
     }
 
-    return data;
-}
-
-/*!
- * \brief Constructs boot image and writes it to a file
- *
- * This is a convenience function that calls BootImage::create() and writes the
- * data to the specified file.
- *
- * \return Whether the file was successfully written
- *
- * \sa BootImage::create()
- */
-bool BootImage::createFile(const std::string &path)
-{
-    std::ofstream file(path, std::ios::binary);
-    if (file.fail()) {
-        m_impl->error = PatcherError::createIOError(
-                ErrorCode::FileOpenError, path);
-        return false;
+    // Second bootloader image
+    if (!secondBootloaderImage.empty()) {
+        layout->add(secondBootloaderImage.data(),
+                    secondBootloaderImage.size());
+        layout->addPadding(skipPadding(secondBootloaderImage.size(), pageSize));
     }
 
-    std::vector<unsigned char> data = create();
-    if (data.empty()) {
-        return false;
+    // Device tree image
+    if (!deviceTreeImage.empty()) {
+        layout->add(deviceTreeImage.data(), deviceTreeImage.size());
+        layout->addPadding(skipPadding(deviceTreeImage.size(), pageSize));
     }
 
-    file.write(reinterpret_cast<const char *>(data.data()), data.size());
-    if (file.bad()) {
-        m_impl->error = PatcherError::createIOError(
-                ErrorCode::FileWriteError, path);
-        return false;
+    // The image is properly padded, so the Bump magic can be appended directly
+    if (applyBump) {
+        layout->add(reinterpret_cast<const unsigned char *>(BUMP_MAGIC),
+                    BUMP_MAGIC_SIZE);
     }
 
     return true;
@@ -872,34 +1260,64 @@ static std::string toHex(const unsigned char *data, uint32_t size) {
     return hex;
 }
 
+void BootImage::Impl::invalidateSHA1Hash(HashSection section)
+{
+    if (validHashStates > section) {
+        validHashStates = section;
+    }
+}
+
 void BootImage::Impl::updateSHA1Hash()
 {
     SHA_CTX ctx;
-    SHA_init(&ctx);
 
-    SHA_update(&ctx, kernelImage.data(), kernelImage.size());
-    SHA_update(&ctx, reinterpret_cast<char *>(&header.kernel_size),
-               sizeof(header.kernel_size));
-
-    SHA_update(&ctx, ramdiskImage.data(), ramdiskImage.size());
-    SHA_update(&ctx, reinterpret_cast<char *>(&header.ramdisk_size),
-               sizeof(header.ramdisk_size));
-    if (!secondBootloaderImage.empty()) {
-        SHA_update(&ctx, secondBootloaderImage.data(),
-                   secondBootloaderImage.size());
+    if (validHashStates > 0) {
+        ctx = hashStates[validHashStates - 1];
+    } else {
+        SHA_init(&ctx);
     }
 
-    // Bug in AOSP? AOSP's mkbootimg adds the second bootloader size to the SHA1
-    // hash even if it's 0
-    SHA_update(&ctx, reinterpret_cast<char *>(&header.second_size),
-               sizeof(header.second_size));
+    for (int i = validHashStates; i < HashSectionCount; ++i) {
+        switch (i) {
+        case HashKernel:
+            SHA_update(&ctx, kernelImage.data(), kernelImage.size());
+            SHA_update(&ctx, reinterpret_cast<char *>(&header.kernel_size),
+                       sizeof(header.kernel_size));
+            break;
 
-    if (!deviceTreeImage.empty()) {
-        SHA_update(&ctx, deviceTreeImage.data(), deviceTreeImage.size());
-        SHA_update(&ctx, reinterpret_cast<char *>(&header.dt_size),
-                   sizeof(header.dt_size));
+        case HashRamdisk:
+            SHA_update(&ctx, ramdiskImage.data(), ramdiskImage.size());
+            SHA_update(&ctx, reinterpret_cast<char *>(&header.ramdisk_size),
+                       sizeof(header.ramdisk_size));
+            break;
+
+        case HashSecondBootloader:
+            if (!secondBootloaderImage.empty()) {
+                SHA_update(&ctx, secondBootloaderImage.data(),
+                           secondBootloaderImage.size());
+            }
+
+            // Bug in AOSP? AOSP's mkbootimg adds the second bootloader size to
+            // the SHA1 hash even if it's 0
+            SHA_update(&ctx, reinterpret_cast<char *>(&header.second_size),
+                       sizeof(header.second_size));
+            break;
+
+        case HashDeviceTree:
+            if (!deviceTreeImage.empty()) {
+                SHA_update(&ctx, deviceTreeImage.data(),
+                           deviceTreeImage.size());
+                SHA_update(&ctx, reinterpret_cast<char *>(&header.dt_size),
+                           sizeof(header.dt_size));
+            }
+            break;
+        }
+
+        hashStates[i] = ctx;
     }
 
+    validHashStates = HashSectionCount;
+
     std::memset(header.id, 0, sizeof(header.id));
     memcpy(header.id, SHA_final(&ctx), SHA_DIGEST_SIZE);
 
@@ -1199,7 +1617,21 @@ void BootImage::setAddresses(uint32_t base, uint32_t kernelOffset,
  */
 std::vector<unsigned char> BootImage::kernelImage() const
 {
-    return m_impl->kernelImage;
+    return std::vector<unsigned char>(m_impl->kernelImage.begin(),
+                                      m_impl->kernelImage.end());
+}
+
+/*!
+ * \brief Kernel image without copying
+ *
+ * \note The returned view is invalidated when the kernel image is replaced,
+ *       another boot image is loaded, or the BootImage is destroyed.
+ *
+ * \return View of the kernel image binary data
+ */
+BinaryView BootImage::kernelImageView() const
+{
+    return m_impl->kernelImage.view();
 }
 
 /*!
@@ -1211,7 +1643,8 @@ std::vector<unsigned char> BootImage::kernelImage() const
 void BootImage::setKernelImage(std::vector<unsigned char> data)
 {
     m_impl->header.kernel_size = data.size();
-    m_impl->kernelImage = std::move(data);
+    m_impl->kernelImage.assign(std::move(data));
+    m_impl->invalidateSHA1Hash(Impl::HashKernel);
 }
 
 /*!
@@ -1221,7 +1654,21 @@ void BootImage::setKernelImage(std::vector<unsigned char> data)
  */
 std::vector<unsigned char> BootImage::ramdiskImage() const
 {
-    return m_impl->ramdiskImage;
+    return std::vector<unsigned char>(m_impl->ramdiskImage.begin(),
+                                      m_impl->ramdiskImage.end());
+}
+
+/*!
+ * \brief Ramdisk image without copying
+ *
+ * \note The returned view is invalidated when the ramdisk image is replaced,
+ *       another boot image is loaded, or the BootImage is destroyed.
+ *
+ * \return View of the ramdisk image binary data
+ */
+BinaryView BootImage::ramdiskImageView() const
+{
+    return m_impl->ramdiskImage.view();
 }
 
 /*!
@@ -1233,7 +1680,8 @@ std::vector<unsigned char> BootImage::ramdiskImage() const
 void BootImage::setRamdiskImage(std::vector<unsigned char> data)
 {
     m_impl->header.ramdisk_size = data.size();
-    m_impl->ramdiskImage = std::move(data);
+    m_impl->ramdiskImage.assign(std::move(data));
+    m_impl->invalidateSHA1Hash(Impl::HashRamdisk);
 }
 
 /*!
@@ -1243,7 +1691,21 @@ void BootImage::setRamdiskImage(std::vector<unsigned char> data)
  */
 std::vector<unsigned char> BootImage::secondBootloaderImage() const
 {
-    return m_impl->secondBootloaderImage;
+    return std::vector<unsigned char>(m_impl->secondBootloaderImage.begin(),
+                                      m_impl->secondBootloaderImage.end());
+}
+
+/*!
+ * \brief Second bootloader image without copying
+ *
+ * \note The returned view is invalidated when the second bootloader image is replaced,
+ *       another boot image is loaded, or the BootImage is destroyed.
+ *
+ * \return View of the second bootloader image binary data
+ */
+BinaryView BootImage::secondBootloaderImageView() const
+{
+    return m_impl->secondBootloaderImage.view();
 }
 
 /*!
@@ -1255,7 +1717,8 @@ std::vector<unsigned char> BootImage::secondBootloaderImage() const
 void BootImage::setSecondBootloaderImage(std::vector<unsigned char> data)
 {
     m_impl->header.second_size = data.size();
-    m_impl->secondBootloaderImage = std::move(data);
+    m_impl->secondBootloaderImage.assign(std::move(data));
+    m_impl->invalidateSHA1Hash(Impl::HashSecondBootloader);
 }
 
 /*!
@@ -1265,7 +1728,21 @@ void BootImage::setSecondBootloaderImage(std::vector<unsigned char> data)
  */
 std::vector<unsigned char> BootImage::deviceTreeImage() const
 {
-    return m_impl->deviceTreeImage;
+    return std::vector<unsigned char>(m_impl->deviceTreeImage.begin(),
+                                      m_impl->deviceTreeImage.end());
+}
+
+/*!
+ * \brief Device tree image without copying
+ *
+ * \note The returned view is invalidated when the device tree image is replaced,
+ *       another boot image is loaded, or the BootImage is destroyed.
+ *
+ * \return View of the device tree image binary data
+ */
+BinaryView BootImage::deviceTreeImageView() const
+{
+    return m_impl->deviceTreeImage.view();
 }
 
 /*!
@@ -1277,7 +1754,8 @@ std::vector<unsigned char> BootImage::deviceTreeImage() const
 void BootImage::setDeviceTreeImage(std::vector<unsigned char> data)
 {
     m_impl->header.dt_size = data.size();
-    m_impl->deviceTreeImage = std::move(data);
+    m_impl->deviceTreeImage.assign(std::move(data));
+    m_impl->invalidateSHA1Hash(Impl::HashDeviceTree);
 }
 
 std::vector<unsigned char> BootImage::abootImage() const
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "libmbp_global.h"
+#include "binaryview.h"
 #include "patchererror.h"
 
 
@@ -53,8 +54,10 @@ public:
 
     bool load(const std::vector<unsigned char> &data);
     bool load(const std::string &filename);
+    bool loadMapped(const std::string &filename);
     std::vector<unsigned char> create() const;
     bool createFile(const std::string &path);
+    bool writeTo(int fd) const;
 
     bool wasLoki() const;
     bool wasBump() const;
@@ -99,15 +102,19 @@ public:
     // For setting the various images
 
     std::vector<unsigned char> kernelImage() const;
+    BinaryView kernelImageView() const;
     void setKernelImage(std::vector<unsigned char> data);
 
     std::vector<unsigned char> ramdiskImage() const;
+    BinaryView ramdiskImageView() const;
     void setRamdiskImage(std::vector<unsigned char> data);
 
     std::vector<unsigned char> secondBootloaderImage() const;
+    BinaryView secondBootloaderImageView() const;
     void setSecondBootloaderImage(std::vector<unsigned char> data);
 
     std::vector<unsigned char> deviceTreeImage() const;
+    BinaryView deviceTreeImageView() const;
     void setDeviceTreeImage(std::vector<unsigned char> data);
 
     // For Loki only
@@ -39,6 +39,7 @@
 
 #include "bootimage/header.h"
 #include "private/logging.h"
+#include "private/patternscanner.h"
 
 struct LokiTarget {
     const char *vendor;
@@ -131,41 +132,79 @@ static bool patchShellcode(uint32_t header, uint32_t ramdisk,
     return foundHeader && foundRamdisk;
 }
 
-bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
-                             std::vector<unsigned char> aboot)
+/*!
+ * \brief Patch the boot image header for Loki
+ *
+ * This fills in \a lokiHdr, changes the sizes and addresses in \a hdr so that
+ * aboot jumps to the shellcode, and produces the block of original aboot code
+ * (with the shellcode written into it) that must immediately follow the
+ * page-aligned ramdisk in the output image. The kernel and ramdisk data
+ * themselves are not touched, so the output image can be written out
+ * incrementally.
+ *
+ * The layout of the Loki'd image is:
+ *
+ * - Header page (\a hdr followed by \a lokiHdr at offset 0x400)
+ * - Kernel, padded to a page boundary
+ * - Ramdisk, padded to a page boundary
+ * - \a fakeCode
+ * - Device tree (not padded)
+ *
+ * \param hdr Boot image header with the original values
+ * \param lokiHdr Output Loki header
+ * \param aboot aboot partition image
+ * \param fakeCode Output code that follows the ramdisk
+ *
+ * \return Whether the header was successfully patched
+ */
+bool LokiPatcher::patchHeader(BootImageHeader *hdr, LokiHeader *lokiHdr,
+                              std::vector<unsigned char> aboot,
+                              std::vector<unsigned char> *fakeCode)
 {
+    if (aboot.size() < 16) {
+        LOGE("[Loki] aboot image is too small");
+        return false;
+    }
+
     // Prevent reading out of bounds
-    data->resize((data->size() + 0x2000 + 0xfff) & ~0xfff);
     aboot.resize((aboot.size() + 0xfff) & ~0xfff);
 
     uint32_t target = 0;
     uint32_t abootBase = *reinterpret_cast<uint32_t *>(aboot.data() + 12) - 0x28;
 
-    // Find the signature checking function via pattern matching
-    for (const unsigned char *ptr = aboot.data();
-            ptr < aboot.data() + aboot.size() - 0x1000; ++ptr) {
-        if (!memcmp(ptr, PATTERN1, 8) ||
-                !memcmp(ptr, PATTERN2, 8) ||
-                !memcmp(ptr, PATTERN3, 8) ||
-                !memcmp(ptr, PATTERN4, 8) ||
-                !memcmp(ptr, PATTERN5, 8)) {
-            target = static_cast<uint32_t>(ptr - aboot.data() + abootBase);
-            break;
+    // Find the signature checking function via pattern matching. Some LG
+    // models have both LG patterns, which throws off the fingerprinting, so
+    // the second LG pattern is only used if none of the others are found.
+    mbp::PatternScanner scanner;
+    scanner.addPattern(PATTERN1, 8);
+    scanner.addPattern(PATTERN2, 8);
+    scanner.addPattern(PATTERN3, 8);
+    scanner.addPattern(PATTERN4, 8);
+    scanner.addPattern(PATTERN5, 8);
+    const std::size_t lgPattern2 = scanner.addPattern(PATTERN6, 8);
+
+    bool foundLgPattern2 = false;
+    std::size_t lgPattern2Offset = 0;
+    bool foundOther = false;
+    std::size_t otherOffset = 0;
+
+    scanner.scan(aboot.data(), aboot.size() - 0x1000 + 7,
+                 [&](std::size_t id, std::size_t offset) {
+        if (id != lgPattern2) {
+            foundOther = true;
+            otherOffset = offset;
+            return false;
+        } else if (!foundLgPattern2) {
+            foundLgPattern2 = true;
+            lgPattern2Offset = offset;
         }
-    }
-
-    // Do a second pass for the second LG pattern. This is necessary because
-    // apparently some LG models have both LG patterns, which throws off the
-    // fingerprinting.
+        return true;
+    });
 
-    if (!target) {
-        for (const unsigned char *ptr = aboot.data();
-                ptr < aboot.data() + aboot.size() - 0x1000; ++ptr) {
-            if (memcmp(ptr, PATTERN6, 8) == 0) {
-                target = static_cast<uint32_t>(ptr - aboot.data() + abootBase);
-                break;
-            }
-        }
+    if (foundOther) {
+        target = static_cast<uint32_t>(otherOffset + abootBase);
+    } else if (foundLgPattern2) {
+        target = static_cast<uint32_t>(lgPattern2Offset + abootBase);
     }
 
     if (!target) {
@@ -190,10 +229,8 @@ bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
     FLOGD("[Loki] Detected target {} {} build {}",
           tgt->vendor, tgt->device, tgt->build);
 
-    BootImageHeader *hdr = reinterpret_cast<BootImageHeader *>(data->data());
-    LokiHeader *lokiHdr = reinterpret_cast<LokiHeader *>(data->data() + 0x400);
-
     // Set the Loki header
+    memset(lokiHdr, 0, sizeof(LokiHeader));
     memcpy(lokiHdr->magic, LOKI_MAGIC, LOKI_MAGIC_SIZE);
     lokiHdr->recovery = 0;
     strncpy(lokiHdr->build, tgt->build, sizeof(lokiHdr->build) - 1);
@@ -224,11 +261,11 @@ bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
             hdr->ramdisk_size;
 
     // Guarantee 16-byte alignment
-    int offset = tgt->check_sigs & 0xf;
+    uint32_t offset = tgt->check_sigs & 0xf;
 
     hdr->ramdisk_addr = tgt->check_sigs - offset;
 
-    int fakeSize;
+    uint32_t fakeSize;
 
     if (tgt->lg) {
         fakeSize = pageSize;
@@ -238,6 +275,42 @@ bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
         hdr->ramdisk_size = 0;
     }
 
+    // Copy fake size bytes of original code
+    uint32_t codeOffset = tgt->check_sigs - abootBase - offset;
+    if (codeOffset + fakeSize > aboot.size()) {
+        LOGE("[Loki] Original code exceeds aboot image size");
+        return false;
+    }
+
+    fakeCode->assign(aboot.data() + codeOffset,
+                     aboot.data() + codeOffset + fakeSize);
+
+    // Write the patch
+    memcpy(fakeCode->data() + offset, patch, sizeof(patch));
+
+    return true;
+}
+
+bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
+                             std::vector<unsigned char> aboot)
+{
+    // Prevent reading out of bounds
+    data->resize((data->size() + 0x2000 + 0xfff) & ~0xfff);
+
+    BootImageHeader *hdr = reinterpret_cast<BootImageHeader *>(data->data());
+    LokiHeader *lokiHdr = reinterpret_cast<LokiHeader *>(data->data() + 0x400);
+
+    uint32_t pageSize = hdr->page_size;
+    uint32_t pageMask = hdr->page_size - 1;
+
+    uint32_t pageKernelSize = (hdr->kernel_size + pageMask) & ~pageMask;
+    uint32_t pageRamdiskSize = (hdr->ramdisk_size + pageMask) & ~pageMask;
+
+    std::vector<unsigned char> fakeCode;
+    if (!patchHeader(hdr, lokiHdr, std::move(aboot), &fakeCode)) {
+        return false;
+    }
+
     std::vector<unsigned char> newImage;
 
     // Write the image header
@@ -245,27 +318,18 @@ bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
                     data->data(),
                     data->data() + pageSize);
 
-    uint32_t pageKernelSize = (origKernelSize + pageMask) & ~pageMask;
-
     // Write the kernel
     newImage.insert(newImage.end(),
                     data->data() + pageSize,
                     data->data() + pageSize + pageKernelSize);
 
-    uint32_t pageRamdiskSize = (origRamdiskSize + pageMask) & ~pageMask;
-
     // Write the ramdisk
     newImage.insert(newImage.end(),
                     data->data() + pageSize + pageKernelSize,
                     data->data() + pageSize + pageKernelSize + pageRamdiskSize);
 
-    // Write fake size bytes of original code to the output
-    newImage.insert(newImage.end(),
-                    aboot.data() + tgt->check_sigs - abootBase - offset,
-                    aboot.data() + tgt->check_sigs - abootBase - offset + fakeSize);
-
-    // Save this position for later
-    uint32_t pos = newImage.size();
+    // Write fake size bytes of original code (with the patch) to the output
+    newImage.insert(newImage.end(), fakeCode.begin(), fakeCode.end());
 
     if (hdr->dt_size) {
         LOGD("[Loki] Writing device tree");
@@ -275,9 +339,6 @@ bool LokiPatcher::patchImage(std::vector<unsigned char> *data,
                         data->data() + pageSize + pageKernelSize + pageRamdiskSize + hdr->dt_size);
     }
 
-    // Write the patch
-    memcpy(newImage.data() + pos - (fakeSize - offset), patch, sizeof(patch));
-
     LOGD("[Loki] Patching completed");
 
     data->swap(newImage);
@@ -38,6 +38,8 @@
 #include <vector>
 #include <cstdint>
 
+#include "bootimage/header.h"
+
 
 #define LOKI_MAGIC              "LOKI"
 #define LOKI_MAGIC_SIZE         4
@@ -92,4 +94,7 @@ class LokiPatcher
 public:
     static bool patchImage(std::vector<unsigned char> *data,
                            std::vector<unsigned char> aboot);
+    static bool patchHeader(BootImageHeader *hdr, LokiHeader *lokiHdr,
+                            std::vector<unsigned char> aboot,
+                            std::vector<unsigned char> *fakeCode);
 };
\ No newline at end of file
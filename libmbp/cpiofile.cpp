@@ -19,15 +19,21 @@
 
 #include "cpiofile.h"
 
+#include <cstdint>
 #include <cstring>
 
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "private/blockcompressor.h"
 #include "private/fileutils.h"
 #include "private/logging.h"
 
@@ -35,7 +41,88 @@
 namespace mbp
 {
 
-typedef std::pair<archive_entry *, std::vector<unsigned char>> FilePair;
+/*! \cond INTERNAL */
+/*
+ * Contents of a file in the archive. The data may be a slice of a buffer that
+ * is shared with other entries or an entire buffer owned by this entry. Shared
+ * data is only copied when a mutable buffer is requested.
+ */
+class CpioData
+{
+public:
+    CpioData() : m_offset(0), m_size(0), m_whole(false)
+    {
+    }
+
+    explicit CpioData(std::vector<unsigned char> data)
+        : m_buf(std::make_shared<std::vector<unsigned char>>(std::move(data))),
+        m_offset(0), m_size(0), m_whole(true)
+    {
+    }
+
+    CpioData(std::shared_ptr<std::vector<unsigned char>> buf,
+             std::size_t offset, std::size_t size)
+        : m_buf(std::move(buf)), m_offset(offset), m_size(size),
+        m_whole(false)
+    {
+    }
+
+    const unsigned char * data() const
+    {
+        if (!m_buf) {
+            return nullptr;
+        }
+        return m_buf->data() + m_offset;
+    }
+
+    std::size_t size() const
+    {
+        if (!m_buf) {
+            return 0;
+        }
+        return m_whole ? m_buf->size() : m_size;
+    }
+
+    std::vector<unsigned char> * mutableBuffer()
+    {
+        if (!m_buf || !m_whole || m_buf.use_count() > 1) {
+            m_buf = std::make_shared<std::vector<unsigned char>>(
+                    data(), data() + size());
+            m_offset = 0;
+            m_size = 0;
+            m_whole = true;
+        }
+        return m_buf.get();
+    }
+
+private:
+    std::shared_ptr<std::vector<unsigned char>> m_buf;
+    std::size_t m_offset;
+    std::size_t m_size;
+    bool m_whole;
+};
+/*! \endcond */
+
+/*! \cond INTERNAL */
+struct CpioEntry
+{
+    std::string name;
+    uint32_t ino = 0;
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t nlink = 1;
+    uint32_t mtime = 0;
+    uint32_t devMajor = 0;
+    uint32_t devMinor = 0;
+    uint32_t rdevMajor = 0;
+    uint32_t rdevMinor = 0;
+    // For symlinks, this is the link target
+    CpioData data;
+    // Removed entries are kept until the list is compacted
+    bool removed = false;
+};
+/*! \endcond */
 
 enum Compression {
     NONE,
@@ -47,85 +134,320 @@ enum Compression {
 class CpioFile::Impl
 {
 public:
-    ~Impl();
+    std::vector<CpioEntry> files;
+    std::size_t removedCount = 0;
+    bool needsSort = false;
+
+    // Maps paths to their (first) position in files. Built on demand.
+    std::unordered_map<std::string, std::size_t> index;
+    bool indexValid = false;
+    bool hasDuplicates = false;
 
-    std::vector<FilePair> files;
+    Compression compression = NONE;
 
-    Compression compression;
+    // Compression policy
+    int compressionLevel = -1;
+    unsigned int compressionThreads = 1;
+    // Set once a level or thread count is chosen. Until then, libarchive
+    // compresses the archive like it always has.
+    bool blockCompression = false;
+    std::size_t compressedSizeLimit = 0;
 
     PatcherError error;
+
+    CpioEntry * find(const std::string &name);
+    void add(CpioEntry entry);
+    void erase(CpioEntry *entry);
+    void compact();
+
+    void reattachHardLinks();
+    bool parseNewc(std::shared_ptr<std::vector<unsigned char>> buffer);
+    bool loadArchive(const unsigned char *data, std::size_t size);
+    void writeNewc(std::vector<unsigned char> *out,
+                   std::size_t blockSize) const;
+    bool compressNewc(const std::vector<unsigned char> &newc, int level,
+                      std::vector<unsigned char> *out);
+
+private:
+    void buildIndex();
 };
 /*! \endcond */
 
 
-CpioFile::Impl::~Impl()
+// newc header: 6 byte magic followed by 13 8-digit hex fields
+static const std::size_t NewcHeaderSize = 110;
+static const char NewcMagic[] = "070701";
+static const char NewcCrcMagic[] = "070702";
+static const char NewcTrailer[] = "TRAILER!!!";
+
+static inline std::size_t align4(std::size_t n)
 {
-    for (auto &p : files) {
-        archive_entry_free(p.first);
+    return (n + 3) & ~static_cast<std::size_t>(3);
+}
+
+static inline bool parseHex(const unsigned char *in, uint32_t *valueOut)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        unsigned char c = in[i];
+        uint32_t digit;
+
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+
+        value = (value << 4) | digit;
     }
+
+    *valueOut = value;
+    return true;
 }
 
+static inline unsigned char * writeHex(unsigned char *out, uint32_t value)
+{
+    static const char digits[] = "0123456789abcdef";
 
-/*!
- * \class CpioFile
- * \brief Very simple class to manipulate cpio archives
- *
- * This is a very simple class that allows a cpio archive to be manipulated. It
- * is meant for use with ramdisk cpio archives. The only supported operations
- * are:
- *
- * - Adding regular files
- * - Adding symlinks
- * - Checking existence of files
- * - Removing files
- */
+    for (int i = 7; i >= 0; --i) {
+        out[i] = digits[value & 0xf];
+        value >>= 4;
+    }
 
+    return out + 8;
+}
 
-CpioFile::CpioFile() : m_impl(new Impl())
+static bool isNewc(const unsigned char *data, std::size_t size)
 {
+    return size >= NewcHeaderSize
+            && (std::memcmp(data, NewcMagic, 6) == 0
+            || std::memcmp(data, NewcCrcMagic, 6) == 0);
 }
 
-CpioFile::~CpioFile()
+// Regular files and symlinks (whose target is the body) are the only entries
+// that have data in the archive
+static bool hasBody(const CpioEntry &entry)
 {
+    uint32_t type = entry.mode & AE_IFMT;
+    return type == AE_IFREG || type == AE_IFLNK;
+}
+
+static bool isHardLink(const CpioEntry &entry)
+{
+    return (entry.mode & AE_IFMT) == AE_IFREG && entry.nlink > 1;
+}
+
+typedef std::tuple<uint32_t, uint32_t, uint32_t> InodeKey;
+
+static InodeKey inodeKey(const CpioEntry &entry)
+{
+    return InodeKey(entry.devMajor, entry.devMinor, entry.ino);
+}
+
+
+void CpioFile::Impl::buildIndex()
+{
+    index.clear();
+    index.reserve(files.size());
+    hasDuplicates = false;
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!files[i].removed) {
+            auto ret = index.emplace(files[i].name, i);
+            if (!ret.second) {
+                hasDuplicates = true;
+            }
+        }
+    }
+
+    indexValid = true;
+}
+
+CpioEntry * CpioFile::Impl::find(const std::string &name)
+{
+    if (!indexValid) {
+        buildIndex();
+    }
+
+    auto it = index.find(name);
+    if (it == index.end()) {
+        return nullptr;
+    }
+
+    return &files[it->second];
+}
+
+void CpioFile::Impl::add(CpioEntry entry)
+{
+    files.push_back(std::move(entry));
+    if (indexValid) {
+        index.emplace(files.back().name, files.size() - 1);
+    }
+
+    // Sorting is deferred until the archive is written or listed
+    needsSort = true;
+}
+
+void CpioFile::Impl::erase(CpioEntry *entry)
+{
+    if (indexValid) {
+        index.erase(entry->name);
+        if (hasDuplicates) {
+            // Another entry with the same name may need to take its place
+            indexValid = false;
+        }
+    }
+
+    entry->removed = true;
+    entry->data = CpioData();
+    ++removedCount;
+}
+
+static bool sortByName(const CpioEntry &e1, const CpioEntry &e2)
+{
+    return e1.name < e2.name;
+}
+
+void CpioFile::Impl::compact()
+{
+    if (removedCount > 0) {
+        files.erase(std::remove_if(files.begin(), files.end(),
+                                   [](const CpioEntry &e) {
+                                       return e.removed;
+                                   }), files.end());
+        removedCount = 0;
+        indexValid = false;
+    }
+
+    if (needsSort) {
+        std::stable_sort(files.begin(), files.end(), sortByName);
+        needsSort = false;
+        indexValid = false;
+    }
 }
 
 /*!
- * \brief Get error information
- *
- * \note The returned PatcherError contains valid information only if an
- *       operation has failed.
- *
- * \return PatcherError containing information about the error
+ * In newc archives, only one of the entries for a hard-linked file (usually
+ * the last) carries the contents. Share those contents with the other links so
+ * that every name reads back the same data, as with libarchive's hard link
+ * handling. writeNewc() stores the data only once again.
  */
-PatcherError CpioFile::error() const
+void CpioFile::Impl::reattachHardLinks()
 {
-    return m_impl->error;
+    std::map<InodeKey, const CpioData *> bodies;
+
+    for (const CpioEntry &entry : files) {
+        if (isHardLink(entry) && entry.data.size() > 0) {
+            bodies[inodeKey(entry)] = &entry.data;
+        }
+    }
+
+    if (bodies.empty()) {
+        return;
+    }
+
+    for (CpioEntry &entry : files) {
+        if (isHardLink(entry) && entry.data.size() == 0) {
+            auto it = bodies.find(inodeKey(entry));
+            if (it != bodies.end()) {
+                entry.data = *it->second;
+            }
+        }
+    }
 }
 
 /*!
- * \brief Load a cpio archive from binary data
- *
- * This function loads a cpio archive from a vector containing the binary data.
- * Each file's metadata and contents will be copied and stored.
- *
- * \warning If the cpio archive cannot be loaded, this CpioFile object may be
- *          left in an inconsistent state. Create a new CpioFile to load another
- *          cpio archive.
- *
- * \return Whether the cpio archive was successfully read
+ * Parse an uncompressed newc archive. The entries refer to slices of
+ * \a buffer, so no data is copied.
  */
-bool CpioFile::load(const std::vector<unsigned char> &data)
+bool CpioFile::Impl::parseNewc(std::shared_ptr<std::vector<unsigned char>> buffer)
 {
-    if (data.size() >= 2 && std::memcmp(data.data(), "\x1f\x8b", 2) == 0) {
-        m_impl->compression = GZIP;
-    } else if (data.size() >= 4
-            && std::memcmp(data.data(), "\x02\x21\x4c\x18", 4) == 0) {
-        // Magic number is 0x184C2102 (little endian)
-        m_impl->compression = LZ4;
-    } else {
-        m_impl->compression = NONE;
+    const unsigned char *data = buffer->data();
+    const std::size_t size = buffer->size();
+    std::size_t pos = 0;
+
+    while (true) {
+        if (size - pos < NewcHeaderSize || !isNewc(data + pos, size - pos)) {
+            LOGW("cpio: Invalid or truncated newc header");
+            error = PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, std::string());
+            return false;
+        }
+
+        uint32_t fields[13];
+        for (int i = 0; i < 13; ++i) {
+            if (!parseHex(data + pos + 6 + i * 8, &fields[i])) {
+                LOGW("cpio: Invalid hex field in newc header");
+                error = PatcherError::createArchiveError(
+                        ErrorCode::ArchiveReadHeaderError, std::string());
+                return false;
+            }
+        }
+
+        uint32_t fileSize = fields[6];
+        uint32_t nameSize = fields[11];
+
+        std::size_t nameOffset = pos + NewcHeaderSize;
+        if (nameSize == 0 || nameSize > size - nameOffset) {
+            LOGW("cpio: Truncated file name in newc header");
+            error = PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, std::string());
+            return false;
+        }
+
+        const char *namePtr = reinterpret_cast<const char *>(data + nameOffset);
+        std::string name(namePtr, std::find(namePtr, namePtr + nameSize - 1,
+                                            '\0'));
+
+        std::size_t dataOffset = align4(nameOffset + nameSize);
+        if (dataOffset > size || fileSize > size - dataOffset) {
+            error = PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadDataError, name);
+            return false;
+        }
+
+        if (name == NewcTrailer) {
+            break;
+        }
+
+        CpioEntry entry;
+        entry.name = std::move(name);
+        entry.ino = fields[0];
+        entry.mode = fields[1];
+        entry.uid = fields[2];
+        entry.gid = fields[3];
+        entry.nlink = fields[4];
+        entry.mtime = fields[5];
+        entry.devMajor = fields[7];
+        entry.devMinor = fields[8];
+        entry.rdevMajor = fields[9];
+        entry.rdevMinor = fields[10];
+        entry.data = CpioData(buffer, dataOffset, fileSize);
+        files.push_back(std::move(entry));
+
+        pos = align4(dataOffset + fileSize);
+        if (pos > size) {
+            pos = size;
+        }
     }
 
+    reattachHardLinks();
+
+    indexValid = false;
+    return true;
+}
+
+/*!
+ * Load an archive with libarchive. This is only used for cpio variants other
+ * than newc.
+ */
+bool CpioFile::Impl::loadArchive(const unsigned char *data, std::size_t size)
+{
     archive *a;
     archive_entry *entry;
 
@@ -138,20 +460,23 @@ bool CpioFile::load(const std::vector<unsigned char> &data)
     archive_read_support_format_cpio(a);
 
     int ret = archive_read_open_memory(a,
-            const_cast<unsigned char *>(data.data()), data.size());
+            const_cast<unsigned char *>(data), size);
     if (ret != ARCHIVE_OK) {
         FLOGW("libarchive: {}", archive_error_string(a));
         archive_read_free(a);
 
-        m_impl->error = PatcherError::createArchiveError(
+        error = PatcherError::createArchiveError(
                 ErrorCode::ArchiveReadOpenError, "<memory>");
         return false;
     }
 
+    // The contents of every file are stored in one buffer and the entries
+    // refer to slices of it
+    auto buffer = std::make_shared<std::vector<unsigned char>>();
+
     while ((ret = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
         // Read the data for the entry
-        std::vector<unsigned char> entryData;
-        entryData.reserve(archive_entry_size(entry));
+        std::size_t entryOffset = buffer->size();
 
         int r;
         __LA_INT64_T offset;
@@ -160,15 +485,15 @@ bool CpioFile::load(const std::vector<unsigned char> &data)
 
         while ((r = archive_read_data_block(a, &buff,
                 &bytes_read, &offset)) == ARCHIVE_OK) {
-            entryData.insert(entryData.end(),
-                             reinterpret_cast<const char *>(buff),
-                             reinterpret_cast<const char *>(buff) + bytes_read);
+            buffer->insert(buffer->end(),
+                           reinterpret_cast<const char *>(buff),
+                           reinterpret_cast<const char *>(buff) + bytes_read);
         }
 
         if (r < ARCHIVE_WARN) {
             FLOGW("libarchive: {}", archive_error_string(a));
 
-            m_impl->error = PatcherError::createArchiveError(
+            error = PatcherError::createArchiveError(
                     ErrorCode::ArchiveReadDataError,
                     archive_entry_pathname(entry));
 
@@ -176,16 +501,38 @@ bool CpioFile::load(const std::vector<unsigned char> &data)
             return false;
         }
 
-        // Save the header and data
-        archive_entry *cloned = archive_entry_clone(entry);
-        m_impl->files.push_back(std::make_pair(cloned, std::move(entryData)));
+        // libarchive does not return the symlink target as data
+        const char *target = archive_entry_symlink(entry);
+        if (target) {
+            buffer->insert(buffer->end(), target, target + std::strlen(target));
+        }
+
+        CpioEntry cpioEntry;
+        cpioEntry.name = archive_entry_pathname(entry);
+        cpioEntry.ino = archive_entry_ino64(entry);
+        cpioEntry.mode = archive_entry_mode(entry);
+        cpioEntry.uid = archive_entry_uid(entry);
+        cpioEntry.gid = archive_entry_gid(entry);
+        cpioEntry.nlink = archive_entry_nlink(entry);
+        cpioEntry.mtime = archive_entry_mtime(entry);
+        cpioEntry.devMajor = archive_entry_devmajor(entry);
+        cpioEntry.devMinor = archive_entry_devminor(entry);
+        cpioEntry.rdevMajor = archive_entry_rdevmajor(entry);
+        cpioEntry.rdevMinor = archive_entry_rdevminor(entry);
+        cpioEntry.data = CpioData(buffer, entryOffset,
+                                  buffer->size() - entryOffset);
+        files.push_back(std::move(cpioEntry));
     }
 
+    reattachHardLinks();
+
+    indexValid = false;
+
     if (ret < ARCHIVE_WARN) {
         FLOGW("libarchive: {}", archive_error_string(a));
         archive_read_free(a);
 
-        m_impl->error = PatcherError::createArchiveError(
+        error = PatcherError::createArchiveError(
                 ErrorCode::ArchiveReadHeaderError, std::string());
         return false;
     }
@@ -194,7 +541,7 @@ bool CpioFile::load(const std::vector<unsigned char> &data)
     if (ret != ARCHIVE_OK) {
         FLOGW("libarchive: {}", archive_error_string(a));
 
-        m_impl->error = PatcherError::createArchiveError(
+        error = PatcherError::createArchiveError(
                 ErrorCode::ArchiveFreeError, std::string());
         return false;
     }
@@ -202,6 +549,256 @@ bool CpioFile::load(const std::vector<unsigned char> &data)
     return true;
 }
 
+static unsigned char * writeNewcHeader(unsigned char *out,
+                                       const CpioEntry &entry,
+                                       uint32_t fileSize,
+                                       const std::string &name)
+{
+    uint32_t type = entry.mode & AE_IFMT;
+    bool isDevice = type == AE_IFCHR || type == AE_IFBLK;
+    uint32_t nameSize = name.size() + 1;
+
+    std::memcpy(out, NewcMagic, 6);
+    out += 6;
+    out = writeHex(out, entry.ino);
+    out = writeHex(out, entry.mode);
+    out = writeHex(out, entry.uid);
+    out = writeHex(out, entry.gid);
+    out = writeHex(out, entry.nlink);
+    out = writeHex(out, entry.mtime);
+    out = writeHex(out, fileSize);
+    out = writeHex(out, entry.devMajor);
+    out = writeHex(out, entry.devMinor);
+    out = writeHex(out, isDevice ? entry.rdevMajor : 0);
+    out = writeHex(out, isDevice ? entry.rdevMinor : 0);
+    out = writeHex(out, nameSize);
+    out = writeHex(out, 0); // check
+
+    // Name is null terminated. The output buffer is zero-filled, so the null
+    // terminator and padding don't need to be written.
+    std::memcpy(out, name.data(), name.size());
+    return out + align4(NewcHeaderSize + nameSize) - NewcHeaderSize;
+}
+
+/*!
+ * Serialize the entries as an uncompressed newc archive, zero-padded to a
+ * multiple of \a blockSize. The output size is computed up front so that the
+ * buffer is only allocated once.
+ */
+void CpioFile::Impl::writeNewc(std::vector<unsigned char> *out,
+                               std::size_t blockSize) const
+{
+    static const std::string trailer(NewcTrailer);
+
+    // Like GNU cpio, the contents of a hard-linked file are only stored in the
+    // last entry for the inode. Links whose contents were changed separately
+    // keep their own copy.
+    std::map<InodeKey, std::size_t> lastLinks;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (isHardLink(files[i])) {
+            lastLinks[inodeKey(files[i])] = i;
+        }
+    }
+
+    std::vector<std::size_t> dataSizes(files.size());
+    std::size_t total = align4(NewcHeaderSize + trailer.size() + 1);
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        const CpioEntry &entry = files[i];
+        std::size_t dataSize = hasBody(entry) ? entry.data.size() : 0;
+
+        if (dataSize > 0 && isHardLink(entry)) {
+            const CpioData &last = files[lastLinks[inodeKey(entry)]].data;
+            if (&last != &entry.data && last.size() == dataSize
+                    && (last.data() == entry.data.data()
+                            || std::memcmp(last.data(), entry.data.data(),
+                                           dataSize) == 0)) {
+                dataSize = 0;
+            }
+        }
+
+        dataSizes[i] = dataSize;
+        total += align4(NewcHeaderSize + entry.name.size() + 1);
+        total += align4(dataSize);
+    }
+    total = (total + blockSize - 1) / blockSize * blockSize;
+
+    out->assign(total, 0);
+    unsigned char *ptr = out->data();
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        const CpioEntry &entry = files[i];
+        std::size_t dataSize = dataSizes[i];
+
+        ptr = writeNewcHeader(ptr, entry, dataSize, entry.name);
+        if (dataSize > 0) {
+            std::memcpy(ptr, entry.data.data(), dataSize);
+        }
+        ptr += align4(dataSize);
+    }
+
+    CpioEntry trailerEntry;
+    trailerEntry.nlink = 1;
+    writeNewcHeader(ptr, trailerEntry, 0, trailer);
+}
+
+/*!
+ * Decompress a gzip or LZ4 stream. libarchive's raw format is used so that
+ * only the compression filters are involved.
+ */
+static bool decompress(const unsigned char *data, std::size_t size,
+                       std::vector<unsigned char> *out, PatcherError *error)
+{
+    archive *a = archive_read_new();
+    archive_entry *entry;
+
+    archive_read_support_filter_gzip(a);
+    archive_read_support_filter_lz4(a);
+    archive_read_support_format_raw(a);
+
+    int ret = archive_read_open_memory(a,
+            const_cast<unsigned char *>(data), size);
+    if (ret != ARCHIVE_OK) {
+        FLOGW("libarchive: {}", archive_error_string(a));
+        archive_read_free(a);
+
+        *error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadOpenError, "<memory>");
+        return false;
+    }
+
+    if (archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        FLOGW("libarchive: {}", archive_error_string(a));
+        archive_read_free(a);
+
+        *error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadHeaderError, std::string());
+        return false;
+    }
+
+    int r;
+    __LA_INT64_T offset;
+    const void *buff;
+    size_t bytes_read;
+
+    while ((r = archive_read_data_block(a, &buff,
+            &bytes_read, &offset)) == ARCHIVE_OK) {
+        out->insert(out->end(),
+                    reinterpret_cast<const char *>(buff),
+                    reinterpret_cast<const char *>(buff) + bytes_read);
+    }
+
+    if (r < ARCHIVE_WARN) {
+        FLOGW("libarchive: {}", archive_error_string(a));
+        archive_read_free(a);
+
+        *error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadDataError, "<memory>");
+        return false;
+    }
+
+    archive_read_free(a);
+
+    return true;
+}
+
+
+/*!
+ * \class CpioFile
+ * \brief Very simple class to manipulate cpio archives
+ *
+ * This is a very simple class that allows a cpio archive to be manipulated. It
+ * is meant for use with ramdisk cpio archives. The only supported operations
+ * are:
+ *
+ * - Adding regular files
+ * - Adding symlinks
+ * - Checking existence of files
+ * - Removing files
+ */
+
+
+CpioFile::CpioFile() : m_impl(new Impl())
+{
+}
+
+CpioFile::~CpioFile()
+{
+}
+
+/*!
+ * \brief Get error information
+ *
+ * \note The returned PatcherError contains valid information only if an
+ *       operation has failed.
+ *
+ * \return PatcherError containing information about the error
+ */
+PatcherError CpioFile::error() const
+{
+    return m_impl->error;
+}
+
+/*!
+ * \brief Load a cpio archive from binary data
+ *
+ * This function loads a cpio archive from a vector containing the binary data.
+ * The archive is decompressed once and the contents of all files are kept in
+ * a single shared buffer. Files are only copied out of it when they are
+ * modified.
+ *
+ * \warning If the cpio archive cannot be loaded, this CpioFile object may be
+ *          left in an inconsistent state. Create a new CpioFile to load another
+ *          cpio archive.
+ *
+ * \return Whether the cpio archive was successfully read
+ */
+bool CpioFile::load(const std::vector<unsigned char> &data)
+{
+    return load(data.data(), data.size());
+}
+
+/*!
+ * \brief Load a cpio archive from a block of binary data
+ *
+ * This is the same as CpioFile::load(const std::vector<unsigned char> &), but
+ * allows the archive to be loaded from memory that is not owned by a vector
+ * (eg. BootImage::ramdiskImageView()). The data only needs to remain valid
+ * for the duration of the call.
+ *
+ * \return Whether the cpio archive was successfully read
+ */
+bool CpioFile::load(const unsigned char *data, std::size_t size)
+{
+    if (size >= 2 && std::memcmp(data, "\x1f\x8b", 2) == 0) {
+        m_impl->compression = GZIP;
+    } else if (size >= 4
+            && std::memcmp(data, "\x02\x21\x4c\x18", 4) == 0) {
+        // Magic number is 0x184C2102 (little endian)
+        m_impl->compression = LZ4;
+    } else {
+        m_impl->compression = NONE;
+    }
+
+    // Decompress first so that the archive can be parsed from one contiguous
+    // buffer. The entries refer to slices of that buffer and an entry only
+    // gets its own copy of the data if it is modified.
+    auto buffer = std::make_shared<std::vector<unsigned char>>();
+
+    if (m_impl->compression == NONE) {
+        buffer->assign(data, data + size);
+    } else if (!decompress(data, size, buffer.get(), &m_impl->error)) {
+        return false;
+    }
+
+    if (isNewc(buffer->data(), buffer->size())) {
+        return m_impl->parseNewc(std::move(buffer));
+    }
+
+    // Let libarchive deal with other cpio formats
+    return m_impl->loadArchive(data, size);
+}
+
 static int archiveOpenCallback(archive *a, void *clientData)
 {
     (void) a;
@@ -226,42 +823,27 @@ static int archiveCloseCallback(archive *a, void *clientData)
     return ARCHIVE_OK;
 }
 
-static bool sortByName(const FilePair &p1, const FilePair &p2)
-{
-    const char *cname1 = archive_entry_pathname(p1.first);
-    const char *cname2 = archive_entry_pathname(p2.first);
-
-    return std::strcmp(cname1, cname2) < 0;
-}
-
 /*!
- * \brief Constructs the cpio archive
- *
- * This function builds the `.cpio` file, compressing it in either gzip or LZ4.
- * The archive uses the `newc` format and files are written in lexographical
- * order.
- *
- * \return Cpio archive binary data
+ * Compress \a data with libarchive's gzip or LZ4 filter. libarchive's raw
+ * format is used so that only the compression filters are involved.
  */
-bool CpioFile::createData(std::vector<unsigned char> *dataOut)
+static bool compress(const std::vector<unsigned char> &data,
+                     Compression compression,
+                     std::vector<unsigned char> *out, PatcherError *error)
 {
-    std::vector<unsigned char> data;
     archive *a = archive_write_new();
 
-    archive_write_set_format_cpio_newc(a);
+    archive_write_set_format_raw(a);
 
-    // Use same compression as before
-    if (m_impl->compression == GZIP) {
+    if (compression == GZIP) {
         archive_write_add_filter_gzip(a);
-    } else if (m_impl->compression == LZ4) {
+    } else if (compression == LZ4) {
         archive_write_add_filter_lz4(a);
-    } else {
-        archive_write_add_filter_none(a);
     }
 
     archive_write_set_bytes_per_block(a, 512);
 
-    int ret = archive_write_open(a, reinterpret_cast<void *>(&data),
+    int ret = archive_write_open(a, reinterpret_cast<void *>(out),
                                  &archiveOpenCallback,
                                  &archiveWriteCallback,
                                  &archiveCloseCallback);
@@ -270,36 +852,36 @@ bool CpioFile::createData(std::vector<unsigned char> *dataOut)
         archive_write_fail(a);
         archive_write_free(a);
 
-        m_impl->error = PatcherError::createArchiveError(
+        *error = PatcherError::createArchiveError(
                 ErrorCode::ArchiveWriteOpenError, "<memory>");
         return false;
     }
+    archive_entry *entry = archive_entry_new();
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_size(entry, data.size());
 
-    for (auto const &p : m_impl->files) {
-        if (archive_write_header(a, p.first) != ARCHIVE_OK) {
-            FLOGW("libarchive: {} : {}",
-                  archive_error_string(a),
-                  archive_entry_pathname(p.first));
+    ret = archive_write_header(a, entry);
+    archive_entry_free(entry);
 
-            archive_write_fail(a);
-            archive_write_free(a);
+    if (ret != ARCHIVE_OK) {
+        FLOGW("libarchive: {}", archive_error_string(a));
+        archive_write_fail(a);
+        archive_write_free(a);
 
-            m_impl->error = PatcherError::createArchiveError(
-                    ErrorCode::ArchiveWriteHeaderError,
-                    archive_entry_pathname(p.first));
-            return false;
-        }
+        *error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveWriteHeaderError, std::string());
+        return false;
+    }
 
-        if (archive_write_data(a, p.second.data(), p.second.size())
-                != int(p.second.size())) {
-            archive_write_fail(a);
-            archive_write_free(a);
+    if (archive_write_data(a, data.data(), data.size())
+            != static_cast<__LA_SSIZE_T>(data.size())) {
+        FLOGW("libarchive: {}", archive_error_string(a));
+        archive_write_fail(a);
+        archive_write_free(a);
 
-            m_impl->error = PatcherError::createArchiveError(
-                    ErrorCode::ArchiveWriteDataError,
-                    archive_entry_pathname(p.first));
-            return false;
-        }
+        *error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveWriteDataError, std::string());
+        return false;
     }
 
     ret = archive_write_close(a);
@@ -309,18 +891,207 @@ bool CpioFile::createData(std::vector<unsigned char> *dataOut)
         archive_write_fail(a);
         archive_write_free(a);
 
-        m_impl->error = PatcherError::createArchiveError(
+        *error = PatcherError::createArchiveError(
                 ErrorCode::ArchiveCloseError, std::string());
         return false;
     }
 
     archive_write_free(a);
 
+    return true;
+}
+
+// Levels to fall back to when the output exceeds the size limit
+static const int GzipLevels[] = { 6, 9 };
+static const int Lz4Levels[] = { 1, 9, 16 };
+
+/*!
+ * Compress the newc archive at \a level using the configured policy. If no
+ * level or thread count was ever set, libarchive is used.
+ */
+bool CpioFile::Impl::compressNewc(const std::vector<unsigned char> &newc,
+                                  int level, std::vector<unsigned char> *out)
+{
+    if (level < 0 && !blockCompression) {
+        return compress(newc, compression, out, &error);
+    }
+
+    unsigned int threads = compressionThreads == 0
+            ? defaultThreadCount() : compressionThreads;
+
+    bool ret;
+    if (compression == GZIP) {
+        ret = gzipCompressBlocks(newc.data(), newc.size(), level, threads, out);
+    } else {
+        ret = lz4CompressBlocks(newc.data(), newc.size(), level, threads, out);
+    }
+
+    if (!ret) {
+        FLOGE("Failed to compress ramdisk at level {}", level);
+        error = PatcherError::createArchiveError(
+                ErrorCode::ArchiveWriteDataError, "<memory>");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Constructs the cpio archive
+ *
+ * This function builds the `.cpio` file, compressing it in either gzip or LZ4.
+ * The archive uses the `newc` format and files are written in lexographical
+ * order.
+ *
+ * The archive is compressed according to the compression policy (see
+ * setCompressionLevel(), setCompressionThreads() and
+ * setCompressedSizeLimit()). If a size limit is set and the output does not
+ * fit, higher compression levels are tried and the smallest output is kept.
+ *
+ * \return Cpio archive binary data
+ */
+bool CpioFile::createData(std::vector<unsigned char> *dataOut)
+{
+    m_impl->compact();
+
+    std::vector<unsigned char> data;
+
+    if (m_impl->compression == NONE) {
+        // Pad to the same block size as the compressed output
+        m_impl->writeNewc(&data, 512);
+    } else {
+        std::vector<unsigned char> newc;
+        m_impl->writeNewc(&newc, 1);
+
+        if (!m_impl->compressNewc(newc, m_impl->compressionLevel, &data)) {
+            return false;
+        }
+
+        std::size_t limit = m_impl->compressedSizeLimit;
+
+        if (limit > 0 && data.size() > limit) {
+            const int *begin = GzipLevels;
+            const int *end = GzipLevels + sizeof(GzipLevels) / sizeof(int);
+            if (m_impl->compression == LZ4) {
+                begin = Lz4Levels;
+                end = Lz4Levels + sizeof(Lz4Levels) / sizeof(int);
+            }
+
+            // Only try levels that are stronger than the one already used
+            int current = m_impl->compressionLevel < 0
+                    ? *begin : m_impl->compressionLevel;
+
+            for (const int *level = begin; level != end; ++level) {
+                if (*level <= current) {
+                    continue;
+                }
+
+                std::vector<unsigned char> attempt;
+                if (!m_impl->compressNewc(newc, *level, &attempt)) {
+                    return false;
+                }
+
+                FLOGD("Ramdisk is {} bytes at compression level {}",
+                      attempt.size(), *level);
+
+                if (attempt.size() < data.size()) {
+                    data.swap(attempt);
+                }
+            }
+
+            if (data.size() > limit) {
+                FLOGE("Smallest compressed ramdisk ({} bytes) exceeds the "
+                      "limit of {} bytes", data.size(), limit);
+                m_impl->error = PatcherError::createArchiveError(
+                        ErrorCode::ArchiveWriteDataError, "<memory>");
+                return false;
+            }
+        }
+    }
+
     dataOut->swap(data);
 
     return true;
 }
 
+/*!
+ * \brief Get the compression level
+ *
+ * \return Compression level or -1 if the default level is used
+ */
+int CpioFile::compressionLevel() const
+{
+    return m_impl->compressionLevel;
+}
+
+/*!
+ * \brief Set the compression level
+ *
+ * For gzip, this is the zlib level (0-9). For LZ4, levels below 3 use the fast
+ * compressor and higher levels use LZ4HC.
+ *
+ * \param level Compression level or -1 to use the default level
+ */
+void CpioFile::setCompressionLevel(int level)
+{
+    m_impl->compressionLevel = level;
+    m_impl->blockCompression = true;
+}
+
+/*!
+ * \brief Get the number of compression threads
+ *
+ * \return Number of threads or 0 if one thread per CPU is used
+ */
+unsigned int CpioFile::compressionThreads() const
+{
+    return m_impl->compressionThreads;
+}
+
+/*!
+ * \brief Set the number of compression threads
+ *
+ * Once this or setCompressionLevel() has been called, gzip archives are
+ * compressed as independent blocks that form a single gzip stream and LZ4
+ * archives are written in the legacy format, with the blocks compressed in
+ * parallel. The output then does not depend on the number of threads, but it
+ * differs from the output of the default libarchive compressor used when
+ * neither function has been called.
+ *
+ * \param threads Number of threads (1 by default) or 0 to use one thread per
+ *                CPU
+ */
+void CpioFile::setCompressionThreads(unsigned int threads)
+{
+    m_impl->compressionThreads = threads;
+    m_impl->blockCompression = true;
+}
+
+/*!
+ * \brief Get the maximum size of the compressed archive
+ *
+ * \return Size limit in bytes or 0 if there is no limit
+ */
+std::size_t CpioFile::compressedSizeLimit() const
+{
+    return m_impl->compressedSizeLimit;
+}
+
+/*!
+ * \brief Set the maximum size of the compressed archive
+ *
+ * If the archive compressed with the configured level is larger than \a limit,
+ * createData() will retry with higher compression levels and use the smallest
+ * output. createData() fails if even the smallest output does not fit. This is
+ * useful for keeping the boot image within the size of the boot partition.
+ *
+ * \param limit Size limit in bytes or 0 for no limit
+ */
+void CpioFile::setCompressedSizeLimit(std::size_t limit)
+{
+    m_impl->compressedSizeLimit = limit;
+}
+
 /*!
  * \brief Check if a file exists in the cpio archive
  *
@@ -332,13 +1103,7 @@ bool CpioFile::createData(std::vector<unsigned char> *dataOut)
  */
 bool CpioFile::exists(const std::string &name) const
 {
-    for (auto const &p : m_impl->files) {
-        if (name == archive_entry_pathname(p.first)) {
-            return true;
-        }
-    }
-
-    return false;
+    return m_impl->find(name) != nullptr;
 }
 
 /*!
@@ -354,16 +1119,13 @@ bool CpioFile::exists(const std::string &name) const
  */
 bool CpioFile::remove(const std::string &name)
 {
-    for (auto it = m_impl->files.begin(); it != m_impl->files.end(); ++it) {
-        archive_entry *entry = (*it).first;
-        if (name == archive_entry_pathname(entry)) {
-            archive_entry_free(entry);
-            m_impl->files.erase(it);
-            return true;
-        }
+    CpioEntry *entry = m_impl->find(name);
+    if (!entry) {
+        return false;
     }
 
-    return false;
+    m_impl->erase(entry);
+    return true;
 }
 
 /*!
@@ -375,8 +1137,11 @@ std::vector<std::string> CpioFile::filenames() const
 {
     std::vector<std::string> list;
 
-    for (auto const &p : m_impl->files) {
-        list.push_back(archive_entry_pathname(p.first));
+    m_impl->compact();
+    list.reserve(m_impl->files.size());
+
+    for (auto const &entry : m_impl->files) {
+        list.push_back(entry.name);
     }
 
     return list;
@@ -390,11 +1155,11 @@ std::vector<std::string> CpioFile::filenames() const
 bool CpioFile::contents(const std::string &name,
                         std::vector<unsigned char> *dataOut) const
 {
-    for (auto const &p : m_impl->files) {
-        if (name == archive_entry_pathname(p.first)) {
-            *dataOut = p.second;
-            return true;
-        }
+    const CpioEntry *entry = m_impl->find(name);
+    if (entry) {
+        dataOut->assign(entry->data.data(),
+                        entry->data.data() + entry->data.size());
+        return true;
     }
 
     m_impl->error = PatcherError::createCpioError(
@@ -402,6 +1167,59 @@ bool CpioFile::contents(const std::string &name,
     return false;
 }
 
+/*!
+ * \brief Get contents of a file in the archive without copying
+ *
+ * \note The returned view is invalidated when the file is modified or removed
+ *       or when the CpioFile is destroyed.
+ *
+ * \param name File in the archive
+ * \param viewOut Output view of the file's contents
+ *
+ * \return Whether the file exists
+ */
+bool CpioFile::contentsView(const std::string &name, BinaryView *viewOut) const
+{
+    const CpioEntry *entry = m_impl->find(name);
+    if (entry) {
+        *viewOut = BinaryView(entry->data.data(), entry->data.size());
+        return true;
+    }
+
+    m_impl->error = PatcherError::createCpioError(
+            ErrorCode::CpioFileNotExistError, name);
+    return false;
+}
+
+/*!
+ * \brief Get a modifiable buffer containing the contents of a file
+ *
+ * The buffer can be modified (including resized) in place. If the contents are
+ * shared with another entry or with the loaded archive, they are copied the
+ * first time this function is called. The file size in the archive is updated
+ * when the archive is written.
+ *
+ * \note The returned pointer is invalidated when the file is removed or its
+ *       contents are replaced with setContents() or when the CpioFile is
+ *       destroyed.
+ *
+ * \param name File in the archive
+ *
+ * \return Buffer with the file's contents or nullptr if the file does not
+ *         exist
+ */
+std::vector<unsigned char> * CpioFile::contentsBuffer(const std::string &name)
+{
+    CpioEntry *entry = m_impl->find(name);
+    if (entry) {
+        return entry->data.mutableBuffer();
+    }
+
+    m_impl->error = PatcherError::createCpioError(
+            ErrorCode::CpioFileNotExistError, name);
+    return nullptr;
+}
+
 /*!
  * \brief Set contents of a file in the archive
  *
@@ -413,12 +1231,10 @@ bool CpioFile::contents(const std::string &name,
 bool CpioFile::setContents(const std::string &name,
                            std::vector<unsigned char> data)
 {
-    for (auto &p : m_impl->files) {
-        if (name == archive_entry_pathname(p.first)) {
-            archive_entry_set_size(p.first, data.size());
-            p.second = std::move(data);
-            return true;
-        }
+    CpioEntry *entry = m_impl->find(name);
+    if (entry) {
+        entry->data = CpioData(std::move(data));
+        return true;
     }
 
     m_impl->error = PatcherError::createCpioError(
@@ -444,27 +1260,13 @@ bool CpioFile::addSymlink(const std::string &source, const std::string &target)
         return false;
     }
 
-    archive_entry *entry = archive_entry_new();
-
-    archive_entry_set_uid(entry, 0);
-    archive_entry_set_gid(entry, 0);
-    archive_entry_set_nlink(entry, 1);
-    archive_entry_set_mtime(entry, 0, 0);
-    archive_entry_set_devmajor(entry, 0);
-    archive_entry_set_devminor(entry, 0);
-    archive_entry_set_rdevmajor(entry, 0);
-    archive_entry_set_rdevminor(entry, 0);
-
-    archive_entry_set_pathname(entry, target.c_str());
-    archive_entry_set_size(entry, 0);
-    archive_entry_set_symlink(entry, source.c_str());
-
-    archive_entry_set_filetype(entry, AE_IFLNK);
-    archive_entry_set_perm(entry, 0777);
-
-    m_impl->files.push_back(std::make_pair(entry, std::vector<unsigned char>()));
+    CpioEntry entry;
+    entry.name = target;
+    entry.mode = AE_IFLNK | 0777;
+    entry.data = CpioData(std::vector<unsigned char>(source.begin(),
+                                                     source.end()));
 
-    std::sort(m_impl->files.begin(), m_impl->files.end(), sortByName);
+    m_impl->add(std::move(entry));
 
     return true;
 }
@@ -519,26 +1321,12 @@ bool CpioFile::addFile(std::vector<unsigned char> contents,
         return false;
     }
 
-    archive_entry *entry = archive_entry_new();
-
-    archive_entry_set_uid(entry, 0);
-    archive_entry_set_gid(entry, 0);
-    archive_entry_set_nlink(entry, 1);
-    archive_entry_set_mtime(entry, 0, 0);
-    archive_entry_set_devmajor(entry, 0);
-    archive_entry_set_devminor(entry, 0);
-    archive_entry_set_rdevmajor(entry, 0);
-    archive_entry_set_rdevminor(entry, 0);
-
-    archive_entry_set_pathname(entry, name.c_str());
-    archive_entry_set_size(entry, contents.size());
-
-    archive_entry_set_filetype(entry, AE_IFREG);
-    archive_entry_set_perm(entry, perms);
-
-    m_impl->files.push_back(std::make_pair(entry, std::move(contents)));
+    CpioEntry entry;
+    entry.name = name;
+    entry.mode = AE_IFREG | (perms & 07777);
+    entry.data = CpioData(std::move(contents));
 
-    std::sort(m_impl->files.begin(), m_impl->files.end(), sortByName);
+    m_impl->add(std::move(entry));
 
     return true;
 }
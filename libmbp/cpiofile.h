@@ -22,6 +22,7 @@
 #include <memory>
 #include <vector>
 
+#include "binaryview.h"
 #include "libmbp_global.h"
 #include "patchererror.h"
 
@@ -38,8 +39,18 @@ public:
     PatcherError error() const;
 
     bool load(const std::vector<unsigned char> &data);
+    bool load(const unsigned char *data, std::size_t size);
     bool createData(std::vector<unsigned char> *dataOut);
 
+    // Compression policy
+
+    int compressionLevel() const;
+    void setCompressionLevel(int level);
+    unsigned int compressionThreads() const;
+    void setCompressionThreads(unsigned int threads);
+    std::size_t compressedSizeLimit() const;
+    void setCompressedSizeLimit(std::size_t limit);
+
     bool exists(const std::string &name) const;
     bool remove(const std::string &name);
 
@@ -49,6 +60,8 @@ public:
 
     bool contents(const std::string &name,
                   std::vector<unsigned char> *dataOut) const;
+    bool contentsView(const std::string &name, BinaryView *viewOut) const;
+    std::vector<unsigned char> * contentsBuffer(const std::string &name);
     bool setContents(const std::string &name,
                      std::vector<unsigned char> data);
 
@@ -126,6 +126,23 @@ bool mbp_bootimage_load_file(CBootImage *bootImage,
     return bi->load(filename);
 }
 
+/*!
+ * \brief Load boot image from a file without copying its contents
+ *
+ * \param bootImage CBootImage object
+ * \param filename Path to boot image file
+ *
+ * \return true on success or false on failure and error set appropriately
+ *
+ * \sa BootImage::loadMapped(const std::string &)
+ */
+bool mbp_bootimage_load_file_mapped(CBootImage *bootImage,
+                                    const char *filename)
+{
+    CAST(bootImage);
+    return bi->loadMapped(filename);
+}
+
 /*!
  * \brief Constructs the boot image binary data
  *
@@ -162,6 +179,22 @@ bool mbp_bootimage_create_file(CBootImage *bootImage,
     return bi->createFile(filename);
 }
 
+/*!
+ * \brief Constructs boot image and writes it to a file descriptor
+ *
+ * \param bootImage CBootImage object
+ * \param fd File descriptor opened for writing
+ *
+ * \return true on success or false on failure and error set appropriately
+ *
+ * \sa BootImage::writeTo()
+ */
+bool mbp_bootimage_write_to(const CBootImage *bootImage, int fd)
+{
+    CCAST(bootImage);
+    return bi->writeTo(fd);
+}
+
 bool mbp_bootimage_was_loki(CBootImage *bootImage)
 {
     CCAST(bootImage);
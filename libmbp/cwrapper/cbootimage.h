@@ -38,11 +38,14 @@ bool mbp_bootimage_load_data(CBootImage *bootImage,
                              const void *data, size_t size);
 bool mbp_bootimage_load_file(CBootImage *bootImage,
                              const char *filename);
+bool mbp_bootimage_load_file_mapped(CBootImage *bootImage,
+                                    const char *filename);
 
 void mbp_bootimage_create_data(const CBootImage *bootImage,
                                void **data, size_t *size);
 bool mbp_bootimage_create_file(CBootImage *bootImage,
                                const char *filename);
+bool mbp_bootimage_write_to(const CBootImage *bootImage, int fd);
 
 bool mbp_bootimage_was_loki(CBootImage *bootImage);
 bool mbp_bootimage_was_bump(CBootImage *bootImage);
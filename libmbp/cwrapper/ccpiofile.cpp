@@ -136,6 +136,94 @@ bool mbp_cpiofile_create_data(CCpioFile *cpio,
     return true;
 }
 
+/*!
+ * \brief Get the compression level
+ *
+ * \param cpio CCpioFile object
+ *
+ * \return Compression level or -1 if the default level is used
+ *
+ * \sa CpioFile::compressionLevel()
+ */
+int mbp_cpiofile_compression_level(const CCpioFile *cpio)
+{
+    CCAST(cpio);
+    return cf->compressionLevel();
+}
+
+/*!
+ * \brief Set the compression level
+ *
+ * \param cpio CCpioFile object
+ * \param level Compression level or -1 to use the default level
+ *
+ * \sa CpioFile::setCompressionLevel()
+ */
+void mbp_cpiofile_set_compression_level(CCpioFile *cpio, int level)
+{
+    CAST(cpio);
+    cf->setCompressionLevel(level);
+}
+
+/*!
+ * \brief Get the number of compression threads
+ *
+ * \param cpio CCpioFile object
+ *
+ * \return Number of threads or 0 if one thread per CPU is used
+ *
+ * \sa CpioFile::compressionThreads()
+ */
+unsigned int mbp_cpiofile_compression_threads(const CCpioFile *cpio)
+{
+    CCAST(cpio);
+    return cf->compressionThreads();
+}
+
+/*!
+ * \brief Set the number of compression threads
+ *
+ * \param cpio CCpioFile object
+ * \param threads Number of threads or 0 to use one thread per CPU
+ *
+ * \sa CpioFile::setCompressionThreads()
+ */
+void mbp_cpiofile_set_compression_threads(CCpioFile *cpio,
+                                          unsigned int threads)
+{
+    CAST(cpio);
+    cf->setCompressionThreads(threads);
+}
+
+/*!
+ * \brief Get the maximum size of the compressed archive
+ *
+ * \param cpio CCpioFile object
+ *
+ * \return Size limit in bytes or 0 if there is no limit
+ *
+ * \sa CpioFile::compressedSizeLimit()
+ */
+size_t mbp_cpiofile_compressed_size_limit(const CCpioFile *cpio)
+{
+    CCAST(cpio);
+    return cf->compressedSizeLimit();
+}
+
+/*!
+ * \brief Set the maximum size of the compressed archive
+ *
+ * \param cpio CCpioFile object
+ * \param limit Size limit in bytes or 0 for no limit
+ *
+ * \sa CpioFile::setCompressedSizeLimit()
+ */
+void mbp_cpiofile_set_compressed_size_limit(CCpioFile *cpio, size_t limit)
+{
+    CAST(cpio);
+    cf->setCompressedSizeLimit(limit);
+}
+
 /*!
  * \brief Check if a file exists in the cpio archive
  *
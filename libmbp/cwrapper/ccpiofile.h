@@ -39,6 +39,14 @@ bool mbp_cpiofile_load_data(CCpioFile *cpio,
 bool mbp_cpiofile_create_data(CCpioFile *cpio,
                               void **data, size_t *size);
 
+int mbp_cpiofile_compression_level(const CCpioFile *cpio);
+void mbp_cpiofile_set_compression_level(CCpioFile *cpio, int level);
+unsigned int mbp_cpiofile_compression_threads(const CCpioFile *cpio);
+void mbp_cpiofile_set_compression_threads(CCpioFile *cpio,
+                                          unsigned int threads);
+size_t mbp_cpiofile_compressed_size_limit(const CCpioFile *cpio);
+void mbp_cpiofile_set_compressed_size_limit(CCpioFile *cpio, size_t limit);
+
 bool mbp_cpiofile_exists(const CCpioFile *cpio,
                          const char *filename);
 bool mbp_cpiofile_remove(CCpioFile *cpio,
@@ -200,6 +200,37 @@ CDevice ** mbp_config_devices(const CPatcherConfig *pc)
 
 #ifndef LIBMBP_MINI
 
+/*!
+ * \brief Get the path of the patchinfo cache
+ *
+ * \note The returned string is dynamically allocated. It should be free()'d
+ *       when it is no longer needed.
+ *
+ * \param pc CPatcherConfig object
+ * \return Path to cache file (empty if caching is disabled)
+ *
+ * \sa PatcherConfig::patchInfoCachePath()
+ */
+char * mbp_config_patchinfo_cache_path(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return string_to_cstring(config->patchInfoCachePath());
+}
+
+/*!
+ * \brief Set the path of the patchinfo cache
+ *
+ * \param pc CPatcherConfig object
+ * \param path Path to cache file (empty to disable caching)
+ *
+ * \sa PatcherConfig::setPatchInfoCachePath()
+ */
+void mbp_config_set_patchinfo_cache_path(CPatcherConfig *pc, char *path)
+{
+    CAST(pc);
+    config->setPatchInfoCachePath(path);
+}
+
 /*!
  * \brief Get list of PatchInfos
  *
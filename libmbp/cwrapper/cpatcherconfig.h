@@ -41,6 +41,9 @@ void mbp_config_set_temp_directory(CPatcherConfig *pc, char *path);
 char * mbp_config_version(const CPatcherConfig *pc);
 CDevice ** mbp_config_devices(const CPatcherConfig *pc);
 #ifndef LIBMBP_MINI
+char * mbp_config_patchinfo_cache_path(const CPatcherConfig *pc);
+void mbp_config_set_patchinfo_cache_path(CPatcherConfig *pc, char *path);
+
 CPatchInfo ** mbp_config_patchinfos(const CPatcherConfig *pc);
 CPatchInfo ** mbp_config_patchinfos_for_device(const CPatcherConfig *pc,
                                                const CDevice *device);
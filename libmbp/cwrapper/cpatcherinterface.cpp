@@ -303,6 +303,51 @@ bool mbp_autopatcher_patch_files(CAutoPatcher *patcher, const char *directory)
     return ap->patchFiles(directory);
 }
 
+/*!
+ * \brief Whether the files can be patched in memory
+ *
+ * \param patcher CAutoPatcher object
+ * \return true if mbp_autopatcher_patch_file_in_memory() is supported
+ *
+ * \sa AutoPatcher::canPatchInMemory()
+ */
+bool mbp_autopatcher_can_patch_in_memory(const CAutoPatcher *patcher)
+{
+    CCASTAP(patcher);
+    return ap->canPatchInMemory();
+}
+
+/*!
+ * \brief Patch a file in memory
+ *
+ * \note The output data is dynamically allocated. It should be `free()`'d
+ *       when it is no longer needed.
+ *
+ * \param patcher CAutoPatcher object
+ * \param file Path of the file in the zip file
+ * \param data Contents of the file
+ * \param size Size of contents
+ * \param dataOut Output data
+ * \param sizeOut Size of output data
+ * \return true on success, otherwise false (and error set appropriately)
+ *
+ * \sa AutoPatcher::patchFileInMemory()
+ */
+bool mbp_autopatcher_patch_file_in_memory(CAutoPatcher *patcher,
+                                          const char *file,
+                                          const void *data, size_t size,
+                                          void **dataOut, size_t *sizeOut)
+{
+    CASTAP(patcher);
+    std::vector<unsigned char> contents = data_to_vector(data, size);
+    if (!ap->patchFileInMemory(file, &contents)) {
+        return false;
+    }
+
+    vector_to_data(contents, dataOut, sizeOut);
+    return true;
+}
+
 /*!
  * \brief Get the error information
  *
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cwrapper/ctypes.h"
@@ -51,6 +52,11 @@ char * mbp_autopatcher_id(const CAutoPatcher *patcher);
 char ** mbp_autopatcher_new_files(const CAutoPatcher *patcher);
 char ** mbp_autopatcher_existing_files(const CAutoPatcher *patcher);
 bool mbp_autopatcher_patch_files(CAutoPatcher *patcher, const char *directory);
+bool mbp_autopatcher_can_patch_in_memory(const CAutoPatcher *patcher);
+bool mbp_autopatcher_patch_file_in_memory(CAutoPatcher *patcher,
+                                          const char *file,
+                                          const void *data, size_t size,
+                                          void **dataOut, size_t *sizeOut);
 
 
 CPatcherError * mbp_ramdiskpatcher_error(const CRamdiskPatcher *patcher);
@@ -25,64 +25,200 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// Whole blocks are hashed directly from the input buffer. On x86 CPUs with the
+// SHA extensions, the block function is selected at runtime.
 
 #include "sha.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA_HAVE_X86_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_Transform(SHA_CTX* ctx) {
+typedef void (*SHA1_BlockFunc)(uint32_t state[5], const uint8_t* data,
+                               size_t blocks);
+
+static void SHA1_Transform(uint32_t state[5], const uint8_t* data,
+                           size_t blocks) {
     uint32_t W[80];
     uint32_t A, B, C, D, E;
-    uint8_t* p = ctx->buf;
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
+    for (; blocks > 0; --blocks, data += 64) {
+        const uint8_t* p = data;
+
+        for(t = 0; t < 16; ++t) {
+            uint32_t tmp =  (uint32_t) *p++ << 24;
+            tmp |= *p++ << 16;
+            tmp |= *p++ << 8;
+            tmp |= *p++;
+            W[t] = tmp;
+        }
+
+        for(; t < 80; t++) {
+            W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+        }
+
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+
+        for(t = 0; t < 80; t++) {
+            uint32_t tmp = rol(5,A) + E + W[t];
+
+            if (t < 20)
+                tmp += (D^(B&(C^D))) + 0x5A827999;
+            else if ( t < 40)
+                tmp += (B^C^D) + 0x6ED9EBA1;
+            else if ( t < 60)
+                tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
+            else
+                tmp += (B^C^D) + 0xCA62C1D6;
+
+            E = D;
+            D = C;
+            C = rol(30,B);
+            B = A;
+            A = tmp;
+        }
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+    }
+}
+
+#ifdef SHA_HAVE_X86_SHANI
+
+// Four rounds for rounds 12-79. Computing the message schedule for rounds past
+// 79 is harmless, so the last few groups don't need to be special-cased.
+#define SHANI_ROUNDS4(E_IN, E_OUT, M0, M1, M2, M3, F) \
+    E_IN = _mm_sha1nexte_epu32(E_IN, M0); \
+    E_OUT = ABCD; \
+    M1 = _mm_sha1msg2_epu32(M1, M0); \
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E_IN, F); \
+    M3 = _mm_sha1msg1_epu32(M3, M0); \
+    M2 = _mm_xor_si128(M2, M0);
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void SHA1_Transform_SHANI(uint32_t state[5], const uint8_t* data,
+                                 size_t blocks) {
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+
+    ABCD = _mm_loadu_si128((const __m128i*) state);
+    E0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        // Rounds 0-3
+        MSG0 = _mm_loadu_si128((const __m128i*) (data + 0));
+        MSG0 = _mm_shuffle_epi8(MSG0, MASK);
+        E0 = _mm_add_epi32(E0, MSG0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        // Rounds 4-7
+        MSG1 = _mm_loadu_si128((const __m128i*) (data + 16));
+        MSG1 = _mm_shuffle_epi8(MSG1, MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+        // Rounds 8-11
+        MSG2 = _mm_loadu_si128((const __m128i*) (data + 32));
+        MSG2 = _mm_shuffle_epi8(MSG2, MASK);
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        MSG3 = _mm_loadu_si128((const __m128i*) (data + 48));
+        MSG3 = _mm_shuffle_epi8(MSG3, MASK);
+
+        SHANI_ROUNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 0) // 12-15
+        SHANI_ROUNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 0) // 16-19
+        SHANI_ROUNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 1) // 20-23
+        SHANI_ROUNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 1) // 24-27
+        SHANI_ROUNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 1) // 28-31
+        SHANI_ROUNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 1) // 32-35
+        SHANI_ROUNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 1) // 36-39
+        SHANI_ROUNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 2) // 40-43
+        SHANI_ROUNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 2) // 44-47
+        SHANI_ROUNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 2) // 48-51
+        SHANI_ROUNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 2) // 52-55
+        SHANI_ROUNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 2) // 56-59
+        SHANI_ROUNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 3) // 60-63
+        SHANI_ROUNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 3) // 64-67
+        SHANI_ROUNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 3) // 68-71
+        SHANI_ROUNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 3) // 72-75
+        SHANI_ROUNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 3) // 76-79
+
+        // Combine state
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
     }
 
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i*) state, ABCD);
+    state[4] = (uint32_t) _mm_extract_epi32(E0, 3);
+}
+
+static int SHA1_CpuHasSHANI(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
     }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
+    // SSSE3 and SSE4.1
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & (1u << 9)) || !(ecx & (1u << 19))) {
+        return 0;
     }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+    // SHA
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1u << 29)) != 0;
+}
+
+#endif
+
+static SHA1_BlockFunc SHA1_GetBlockFunc(void) {
+    // Benign race: every thread computes the same value
+    static SHA1_BlockFunc func = NULL;
+
+    if (!func) {
+#ifdef SHA_HAVE_X86_SHANI
+        if (SHA1_CpuHasSHANI()) {
+            func = SHA1_Transform_SHANI;
+        } else
+#endif
+        {
+            func = SHA1_Transform;
+        }
+    }
+
+    return func;
 }
 
 static const HASH_VTAB SHA_VTAB = {
@@ -107,16 +243,42 @@ void SHA_init(SHA_CTX* ctx) {
 void SHA_update(SHA_CTX* ctx, const void* data, int len) {
     int i = (int) (ctx->count & 63);
     const uint8_t* p = (const uint8_t*)data;
+    SHA1_BlockFunc transform;
+
+    if (len <= 0) {
+        return;
+    }
 
     ctx->count += len;
+    transform = SHA1_GetBlockFunc();
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA1_Transform(ctx);
-            i = 0;
+    // Complete the partially filled block
+    if (i > 0) {
+        int n = 64 - i;
+        if (n > len) {
+            n = len;
         }
+        memcpy(ctx->buf + i, p, n);
+        i += n;
+        p += n;
+        len -= n;
+
+        if (i < 64) {
+            return;
+        }
+        transform(ctx->state, ctx->buf, 1);
     }
+
+    // Hash whole blocks straight from the input
+    if (len >= 64) {
+        size_t blocks = (size_t) len / 64;
+        transform(ctx->state, p, blocks);
+        p += blocks * 64;
+        len -= (int) (blocks * 64);
+    }
+
+    // Save the remainder for later
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -19,7 +19,9 @@
 
 #include "patcherconfig.h"
 
+#include <mutex>
 #include <regex>
+#include <unordered_map>
 
 #include <boost/algorithm/string/erase.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -36,6 +38,10 @@
 #include "patchinfo.h"
 #endif
 #include "private/logging.h"
+#ifndef LIBMBP_MINI
+#include "private/fileutils.h"
+#include "private/patchinfocache.h"
+#endif
 
 // Patchers
 #ifndef LIBMBP_MINI
@@ -66,9 +72,16 @@ namespace mbp
 class PatcherConfig::Impl
 {
 public:
+    // Protects everything below except for the devices and version, which
+    // never change after construction
+    mutable std::mutex mutex;
+
     // Directories
     std::string dataDir;
     std::string tempDir;
+#ifndef LIBMBP_MINI
+    std::string patchInfoCachePath;
+#endif
 
     std::string version;
     std::vector<Device *> devices;
@@ -77,6 +90,24 @@ public:
 #ifndef LIBMBP_MINI
     // PatchInfos
     std::vector<PatchInfo *> patchInfos;
+
+    struct PatchInfoMatcher
+    {
+        PatchInfo *info;
+        std::vector<std::regex> regexes;
+        std::vector<std::regex> excludeRegexes;
+    };
+
+    struct PatchInfoMatchers
+    {
+        std::vector<PatchInfoMatcher> matchers;
+        // Indexes of the matchers that apply to each device
+        std::unordered_map<const Device *, std::vector<std::size_t>> byDevice;
+    };
+
+    // Compiled regexes for findMatchingPatchInfo(). This is replaced, never
+    // modified, so that lookups can run without holding the mutex.
+    std::shared_ptr<const PatchInfoMatchers> matchers;
 #endif
 
     bool loadedConfig;
@@ -94,6 +125,10 @@ public:
     void loadDefaultDevices();
 
 #ifndef LIBMBP_MINI
+    bool isPatchInfoForDevice(const PatchInfo *info,
+                              const Device *device) const;
+    void compileMatchers();
+
     // XML parsing functions for the patchinfo files
     bool loadPatchInfoXml(const std::string &path, const std::string &pathId);
     void parsePatchInfoTagPatchinfo(pugi::xml_node node, PatchInfo * const info);
@@ -134,6 +169,9 @@ const char *XmlTextFalse = "false";
  *
  * This is the main interface of the patcher.
  * Blah blah documenting later ;)
+ *
+ * All methods are thread safe, so one PatcherConfig can be shared by patchers
+ * running at the same time (eg. with BatchPatcher).
  */
 
 PatcherConfig::PatcherConfig() : m_impl(new Impl())
@@ -161,20 +199,22 @@ PatcherConfig::~PatcherConfig()
     }
     m_impl->patchInfos.clear();
 
-    for (Patcher *patcher : m_impl->allocPatchers) {
+    // destroy*Patcher() removes the patcher from the list, so iterate over
+    // copies
+    auto patchers = m_impl->allocPatchers;
+    for (Patcher *patcher : patchers) {
         destroyPatcher(patcher);
     }
-    m_impl->allocPatchers.clear();
 
-    for (AutoPatcher *patcher : m_impl->allocAutoPatchers) {
+    auto autoPatchers = m_impl->allocAutoPatchers;
+    for (AutoPatcher *patcher : autoPatchers) {
         destroyAutoPatcher(patcher);
     }
-    m_impl->allocAutoPatchers.clear();
 
-    for (RamdiskPatcher *patcher : m_impl->allocRamdiskPatchers) {
+    auto ramdiskPatchers = m_impl->allocRamdiskPatchers;
+    for (RamdiskPatcher *patcher : ramdiskPatchers) {
         destroyRamdiskPatcher(patcher);
     }
-    m_impl->allocRamdiskPatchers.clear();
 #endif
 }
 
@@ -188,6 +228,7 @@ PatcherConfig::~PatcherConfig()
  */
 PatcherError PatcherConfig::error() const
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     return m_impl->error;
 }
 
@@ -198,6 +239,7 @@ PatcherError PatcherConfig::error() const
  */
 std::string PatcherConfig::dataDirectory() const
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     return m_impl->dataDir;
 }
 
@@ -210,6 +252,7 @@ std::string PatcherConfig::dataDirectory() const
  */
 std::string PatcherConfig::tempDirectory() const
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     if (m_impl->tempDir.empty()) {
         return boost::filesystem::temp_directory_path().string();
     } else {
@@ -224,6 +267,7 @@ std::string PatcherConfig::tempDirectory() const
  */
 void PatcherConfig::setDataDirectory(std::string path)
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     m_impl->dataDir = std::move(path);
 }
 
@@ -237,9 +281,40 @@ void PatcherConfig::setDataDirectory(std::string path)
  */
 void PatcherConfig::setTempDirectory(std::string path)
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     m_impl->tempDir = std::move(path);
 }
 
+#ifndef LIBMBP_MINI
+
+/*!
+ * \brief Get the path of the patchinfo cache
+ *
+ * \return Path to the cache file or an empty string if caching is disabled
+ */
+std::string PatcherConfig::patchInfoCachePath() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->patchInfoCachePath;
+}
+
+/*!
+ * \brief Set the path of the patchinfo cache
+ *
+ * If set, loadPatchInfos() stores the parsed PatchInfos in this file and reuses
+ * them on the next load as long as none of the XML files have been added,
+ * removed, or modified. The cache is disabled by default.
+ *
+ * \param path Path to cache file (empty to disable caching)
+ */
+void PatcherConfig::setPatchInfoCachePath(std::string path)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->patchInfoCachePath = std::move(path);
+}
+
+#endif
+
 /*!
  * \brief Get version number of the patcher
  *
@@ -269,6 +344,7 @@ std::vector<Device *> PatcherConfig::devices() const
  */
 std::vector<PatchInfo *> PatcherConfig::patchInfos() const
 {
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
     return m_impl->patchInfos;
 }
 
@@ -283,17 +359,11 @@ std::vector<PatchInfo *> PatcherConfig::patchInfos(const Device * const device)
 {
     std::vector<PatchInfo *> l;
 
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+
     for (PatchInfo *info : m_impl->patchInfos) {
-        if (boost::starts_with(info->id(), device->id())) {
+        if (m_impl->isPatchInfoForDevice(info, device)) {
             l.push_back(info);
-            continue;
-        }
-
-        for (auto const &include : m_impl->patchinfoIncludeDirs) {
-            if (boost::starts_with(info->id(), include)) {
-                l.push_back(info);
-                break;
-            }
         }
     }
 
@@ -321,15 +391,43 @@ PatchInfo * PatcherConfig::findMatchingPatchInfo(Device *device,
 
     std::string noPath = boost::filesystem::path(filename).filename().string();
 
-    for (PatchInfo *info : patchInfos(device)) {
-        for (auto const &regex : info->regexes()) {
-            if (std::regex_search(noPath, std::regex(regex))) {
+    std::shared_ptr<const Impl::PatchInfoMatchers> matchers;
+    std::vector<std::size_t> unknownDevice;
+    const std::vector<std::size_t> *candidates;
+
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        matchers = m_impl->matchers;
+        if (!matchers) {
+            return nullptr;
+        }
+
+        auto it = matchers->byDevice.find(device);
+        if (it != matchers->byDevice.end()) {
+            candidates = &it->second;
+        } else {
+            // Not one of our devices
+            for (std::size_t i = 0; i < matchers->matchers.size(); ++i) {
+                if (m_impl->isPatchInfoForDevice(
+                        matchers->matchers[i].info, device)) {
+                    unknownDevice.push_back(i);
+                }
+            }
+            candidates = &unknownDevice;
+        }
+    }
+
+    for (std::size_t i : *candidates) {
+        const Impl::PatchInfoMatcher &matcher = matchers->matchers[i];
+
+        for (auto const &regex : matcher.regexes) {
+            if (std::regex_search(noPath, regex)) {
                 bool skipCurInfo = false;
 
                 // If the regex matches, make sure the filename isn't matched
                 // by one of the exclusion regexes
-                for (auto const &excludeRegex : info->excludeRegexes()) {
-                    if (std::regex_search(noPath, std::regex(excludeRegex))) {
+                for (auto const &excludeRegex : matcher.excludeRegexes) {
+                    if (std::regex_search(noPath, excludeRegex)) {
                         skipCurInfo = true;
                         break;
                     }
@@ -339,7 +437,7 @@ PatchInfo * PatcherConfig::findMatchingPatchInfo(Device *device,
                     break;
                 }
 
-                return info;
+                return matcher.info;
             }
         }
     }
@@ -347,6 +445,61 @@ PatchInfo * PatcherConfig::findMatchingPatchInfo(Device *device,
     return nullptr;
 }
 
+bool PatcherConfig::Impl::isPatchInfoForDevice(const PatchInfo *info,
+                                               const Device *device) const
+{
+    if (boost::starts_with(info->id(), device->id())) {
+        return true;
+    }
+
+    for (auto const &include : patchinfoIncludeDirs) {
+        if (boost::starts_with(info->id(), include)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * Compile the regexes of all PatchInfos and work out which PatchInfos apply to
+ * each device, so that findMatchingPatchInfo() doesn't have to. Must be called
+ * with the mutex locked. Throws std::regex_error if a regex is invalid.
+ */
+void PatcherConfig::Impl::compileMatchers()
+{
+    const auto flags = std::regex::ECMAScript | std::regex::optimize;
+
+    std::shared_ptr<PatchInfoMatchers> m = std::make_shared<PatchInfoMatchers>();
+    m->matchers.reserve(patchInfos.size());
+
+    for (PatchInfo *info : patchInfos) {
+        PatchInfoMatcher matcher;
+        matcher.info = info;
+
+        for (auto const &regex : info->regexes()) {
+            matcher.regexes.emplace_back(regex, flags);
+        }
+        for (auto const &regex : info->excludeRegexes()) {
+            matcher.excludeRegexes.emplace_back(regex, flags);
+        }
+
+        m->matchers.push_back(std::move(matcher));
+    }
+
+    for (const Device *device : devices) {
+        std::vector<std::size_t> &indexes = m->byDevice[device];
+
+        for (std::size_t i = 0; i < patchInfos.size(); ++i) {
+            if (isPatchInfoForDevice(patchInfos[i], device)) {
+                indexes.push_back(i);
+            }
+        }
+    }
+
+    matchers = std::move(m);
+}
+
 #endif
 
 void PatcherConfig::Impl::loadDefaultDevices()
@@ -650,6 +803,7 @@ Patcher * PatcherConfig::createPatcher(const std::string &id)
     }
 
     if (p != nullptr) {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
         m_impl->allocPatchers.push_back(p);
     }
 
@@ -678,6 +832,7 @@ AutoPatcher * PatcherConfig::createAutoPatcher(const std::string &id,
     }
 
     if (ap != nullptr) {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
         m_impl->allocAutoPatchers.push_back(ap);
     }
 
@@ -728,6 +883,7 @@ RamdiskPatcher * PatcherConfig::createRamdiskPatcher(const std::string &id,
     }
 
     if (rp != nullptr) {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
         m_impl->allocRamdiskPatchers.push_back(rp);
     }
 
@@ -741,13 +897,18 @@ RamdiskPatcher * PatcherConfig::createRamdiskPatcher(const std::string &id,
  */
 void PatcherConfig::destroyPatcher(Patcher *patcher)
 {
-    auto it = std::find(m_impl->allocPatchers.begin(),
-                        m_impl->allocPatchers.end(),
-                        patcher);
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        auto it = std::find(m_impl->allocPatchers.begin(),
+                            m_impl->allocPatchers.end(),
+                            patcher);
 
-    assert(it != m_impl->allocPatchers.end());
+        assert(it != m_impl->allocPatchers.end());
+
+        m_impl->allocPatchers.erase(it);
+    }
 
-    m_impl->allocPatchers.erase(it);
     delete patcher;
 }
 
@@ -758,13 +919,18 @@ void PatcherConfig::destroyPatcher(Patcher *patcher)
  */
 void PatcherConfig::destroyAutoPatcher(AutoPatcher *patcher)
 {
-    auto it = std::find(m_impl->allocAutoPatchers.begin(),
-                        m_impl->allocAutoPatchers.end(),
-                        patcher);
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        auto it = std::find(m_impl->allocAutoPatchers.begin(),
+                            m_impl->allocAutoPatchers.end(),
+                            patcher);
 
-    assert(it != m_impl->allocAutoPatchers.end());
+        assert(it != m_impl->allocAutoPatchers.end());
+
+        m_impl->allocAutoPatchers.erase(it);
+    }
 
-    m_impl->allocAutoPatchers.erase(it);
     delete patcher;
 }
 
@@ -775,13 +941,18 @@ void PatcherConfig::destroyAutoPatcher(AutoPatcher *patcher)
  */
 void PatcherConfig::destroyRamdiskPatcher(RamdiskPatcher *patcher)
 {
-    auto it = std::find(m_impl->allocRamdiskPatchers.begin(),
-                        m_impl->allocRamdiskPatchers.end(),
-                        patcher);
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        auto it = std::find(m_impl->allocRamdiskPatchers.begin(),
+                            m_impl->allocRamdiskPatchers.end(),
+                            patcher);
 
-    assert(it != m_impl->allocRamdiskPatchers.end());
+        assert(it != m_impl->allocRamdiskPatchers.end());
+
+        m_impl->allocRamdiskPatchers.erase(it);
+    }
 
-    m_impl->allocRamdiskPatchers.erase(it);
     delete patcher;
 }
 
@@ -825,12 +996,22 @@ static boost::filesystem::path makeRelative(boost::filesystem::path from,
  */
 bool PatcherConfig::loadPatchInfos()
 {
+    const std::string dataDir = dataDirectory();
+
+    // Other threads looking up PatchInfos wait until all of them are loaded
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+    const std::string cachePath = m_impl->patchInfoCachePath;
+
     try {
-        const boost::filesystem::path dirPath(dataDirectory() + "/patchinfos");
+        const boost::filesystem::path dirPath(dataDir + "/patchinfos");
 
         boost::filesystem::recursive_directory_iterator it(dirPath);
         boost::filesystem::recursive_directory_iterator end;
 
+        std::vector<std::string> paths;
+        std::vector<PatchInfoFile> files;
+
         for (; it != end; ++it) {
             if (boost::filesystem::is_regular_file(it->status())
                     && it->path().extension() == ".xml") {
@@ -838,15 +1019,50 @@ bool PatcherConfig::loadPatchInfos()
                 std::string id = relPath.string();
                 boost::erase_tail(id, 4);
 
-                if (!m_impl->loadPatchInfoXml(it->path().string(), id)) {
-                    m_impl->error = PatcherError::createXmlError(
-                            ErrorCode::XmlParseFileError,
-                            it->path().string());
-                    return false;
+                PatchInfoFile file;
+                file.id = id;
+                file.size = 0;
+                file.mtime = 0;
+                if (!cachePath.empty()
+                        && !FileUtils::statFile(it->path().string(),
+                                                &file.size, &file.mtime)) {
+                    FLOGW("{}: Failed to stat file", it->path().string());
                 }
+
+                paths.push_back(it->path().string());
+                files.push_back(std::move(file));
+            }
+        }
+
+        uint64_t key = 0;
+
+        if (!cachePath.empty()) {
+            key = patchInfoCacheKey(files);
+
+            if (loadPatchInfoCache(cachePath, key, &m_impl->patchInfos)) {
+                FLOGD("Loaded {} patchinfos from cache",
+                      m_impl->patchInfos.size());
+                m_impl->compileMatchers();
+                return true;
             }
         }
 
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            if (!m_impl->loadPatchInfoXml(paths[i], files[i].id)) {
+                m_impl->error = PatcherError::createXmlError(
+                        ErrorCode::XmlParseFileError, paths[i]);
+                return false;
+            }
+        }
+
+        m_impl->compileMatchers();
+
+        // Failing to write the cache is not fatal. The XML files will just be
+        // parsed again next time.
+        if (!cachePath.empty()) {
+            savePatchInfoCache(cachePath, key, m_impl->patchInfos);
+        }
+
         return true;
     } catch (std::exception &e) {
         LOGW(e.what());
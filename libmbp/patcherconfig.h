@@ -57,6 +57,11 @@ public:
     void setDataDirectory(std::string path);
     void setTempDirectory(std::string path);
 
+#ifndef LIBMBP_MINI
+    std::string patchInfoCachePath() const;
+    void setPatchInfoCachePath(std::string path);
+#endif
+
     std::string version() const;
     std::vector<Device *> devices() const;
 #ifndef LIBMBP_MINI
@@ -44,6 +44,25 @@ public:
     typedef void (*FilesUpdatedCallback) (uint64_t, uint64_t, void *);
     typedef void (*DetailsUpdatedCallback) (const std::string &, void *);
 
+    /*!
+     * \brief Snapshot of the patching progress
+     */
+    struct ProgressEvent
+    {
+        uint64_t bytes;
+        uint64_t maxBytes;
+        uint64_t files;
+        uint64_t maxFiles;
+        // Entry that is currently being processed
+        std::string currentEntry;
+        // Average throughput since patching started
+        double bytesPerSecond;
+        // Estimated time remaining in seconds or -1 if unknown
+        double etaSeconds;
+    };
+
+    typedef void (*ProgressEventCallback) (const ProgressEvent &, void *);
+
     virtual ~Patcher() {}
 
     /*!
@@ -81,6 +100,8 @@ public:
      * This method starts the patching operations for the current file. The
      * callback parameters can be passed nullptr if they are not needed.
      *
+     * Any earlier call to cancelPatching() is discarded when patching starts.
+     *
      * \param progressCb Callback for receiving current progress values
      * \param filesCb Callback for receiving current files count
      * \param detailsCb Callback for receiving detailed progress text
@@ -95,9 +116,39 @@ public:
      * \brief Cancel the patching of a file
      *
      * This method allows the patching process to be cancelled. This is only
-     * useful if the patching operation is being done on a thread.
+     * useful if the patching operation is being done on a thread. Calls made
+     * before patchFile() starts have no effect.
      */
     virtual void cancelPatching() = 0;
+
+    /*!
+     * \brief Limit the number of threads used to patch a file
+     *
+     * Patchers that don't use multiple threads ignore this.
+     *
+     * \param threads Maximum number of threads (0 means the number of CPUs)
+     */
+    virtual void setMaxThreads(unsigned int threads)
+    {
+        (void) threads;
+    }
+
+    /*!
+     * \brief Set a callback for receiving structured progress events
+     *
+     * The callback is independent of the ones passed to patchFile() and is
+     * called, at the same (rate limited) times, with all of the progress
+     * values at once. Patchers that don't support it ignore this.
+     *
+     * \param cb Callback (or nullptr to remove it)
+     * \param userData Pointer to pass to the callback
+     */
+    virtual void setProgressEventCallback(ProgressEventCallback cb,
+                                          void *userData)
+    {
+        (void) cb;
+        (void) userData;
+    }
 };
 
 
@@ -149,6 +200,34 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patchFiles(const std::string &directory) = 0;
+
+    /*!
+     * \brief Whether the files can be patched in memory
+     *
+     * If this returns true, the files returned by existingFiles() can be
+     * patched one at a time with patchFileInMemory() instead of extracting
+     * them and calling patchFiles().
+     */
+    virtual bool canPatchInMemory() const
+    {
+        return false;
+    }
+
+    /*!
+     * \brief Patch a file in memory
+     *
+     * This must be implemented if canPatchInMemory() returns true.
+     *
+     * \param file Path of the file in the zip file (one of existingFiles())
+     * \param contents Contents of the file (modified in place)
+     */
+    virtual bool patchFileInMemory(const std::string &file,
+                                   std::vector<unsigned char> *contents)
+    {
+        (void) file;
+        (void) contents;
+        return false;
+    }
 };
 
 
@@ -139,15 +139,17 @@ bool MbtoolUpdater::patchFile(ProgressUpdatedCallback progressCb,
 
 bool MbtoolUpdater::Impl::patchImage()
 {
+    // The output is written to a different file, so the input can be mapped
     BootImage bi;
-    if (!bi.load(info->filename())) {
+    if (!bi.loadMapped(info->filename())) {
         error = bi.error();
         return false;
     }
 
     // Load the ramdisk cpio
     CpioFile cpio;
-    if (!cpio.load(bi.ramdiskImage())) {
+    BinaryView ramdisk = bi.ramdiskImageView();
+    if (!cpio.load(ramdisk.data(), ramdisk.size())) {
         error = cpio.error();
         return false;
     }
@@ -186,11 +188,12 @@ bool MbtoolUpdater::Impl::patchImage()
 
 void MbtoolUpdater::Impl::patchInitRc(CpioFile *cpio)
 {
-    std::vector<unsigned char> contents;
-    cpio->contents("init.rc", &contents);
+    BinaryView view;
+    cpio->contentsView("init.rc", &view);
 
     std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    boost::split(lines, view, boost::is_any_of("\n"));
+    bool changed = false;
 
     std::regex whitespace("^\\s*$");
     bool insideService = false;
@@ -205,14 +208,17 @@ void MbtoolUpdater::Impl::patchInitRc(CpioFile *cpio)
 
         if (insideService) {
             it = lines.erase(it);
+            changed = true;
         } else {
             ++it;
         }
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    cpio->setContents("init.rc", std::move(contents));
+    if (changed) {
+        std::string strContents = boost::join(lines, "\n");
+        cpio->contentsBuffer("init.rc")->assign(
+                strContents.begin(), strContents.end());
+    }
 
     CoreRamdiskPatcher crp(pc, info, cpio);
 
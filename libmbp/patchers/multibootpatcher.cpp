@@ -21,6 +21,16 @@
 
 #include <cassert>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <boost/algorithm/string/classification.hpp>
@@ -35,6 +45,8 @@
 #include "patcherconfig.h"
 #include "private/fileutils.h"
 #include "private/logging.h"
+#include "private/progressreporter.h"
+#include "private/zipindex.h"
 
 // minizip
 #include "external/minizip/unzip.h"
@@ -44,6 +56,55 @@
 namespace mbp
 {
 
+/*! \cond INTERNAL */
+/*
+ * An entry of the input zip that is passed from the pass 1 reader to the
+ * writer. Entries are committed to the output zip in the order they were read.
+ */
+struct Pass1Entry
+{
+    enum class Action {
+        // Extracted for the AutoPatchers by the reader, nothing to write
+        Extract,
+        // Boot image that needs to be patched by a worker
+        Patch,
+        // Data read (and possibly patched) by the reader
+        Add,
+        // Raw copy of the compressed data
+        Copy
+    };
+
+    Action action;
+    std::string name;
+    std::string outputName;
+    unz64_file_pos pos;
+    uint64_t uncompressedSize = 0;
+    std::vector<unsigned char> data;
+
+    // Set by whoever patches the boot image
+    bool started = false;
+    bool done = false;
+    bool ok = true;
+    PatcherError error;
+};
+
+struct Pass1Queue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    // All entries in zip order (consumed by the writer)
+    std::deque<std::shared_ptr<Pass1Entry>> entries;
+    // Boot images waiting for a worker
+    std::deque<std::shared_ptr<Pass1Entry>> jobs;
+    // Number of files held in memory that have not been written yet
+    std::size_t inMemory = 0;
+    std::size_t maxInMemory;
+    bool readerDone = false;
+    // Set when the writer stops early
+    bool stop = false;
+};
+/*! \endcond */
+
 /*! \cond INTERNAL */
 class MultiBootPatcher::Impl
 {
@@ -58,27 +119,43 @@ public:
     uint64_t files;
     uint64_t maxFiles;
 
-    volatile bool cancelled;
+    // Reset when patchFile() starts. Set from other threads.
+    std::atomic<bool> cancelled{false};
+
+    // Maximum number of pass 1 worker threads (0 means the number of CPUs)
+    unsigned int maxThreads = 0;
 
     PatcherError error;
 
-    // Callbacks
-    ProgressUpdatedCallback progressCb;
-    FilesUpdatedCallback filesCb;
-    DetailsUpdatedCallback detailsCb;
-    void *userData;
+    // Callbacks (rate limited)
+    std::unique_ptr<ProgressReporter> progress;
+    ProgressEventCallback eventCb = nullptr;
+    void *eventUserData = nullptr;
 
     // Patching
     unzFile zInput = nullptr;
     zipFile zOutput = nullptr;
+    // Entries of the input zip from a single read of its central directory
+    ZipIndex inputIndex;
     std::vector<AutoPatcher *> autoPatchers;
+    // AutoPatchers that need the files to be extracted (run in pass 2)
+    std::vector<AutoPatcher *> diskPatchers;
+    // Files patched in memory during pass 1 and the AutoPatchers to run
+    std::unordered_map<std::string, std::vector<AutoPatcher *>> memoryPatchers;
 
-    bool patchBootImage(std::vector<unsigned char> *data);
+    bool patchBootImage(std::vector<unsigned char> *data,
+                        PatcherError *errorOut);
     bool patchZip();
 
     bool pass1(zipFile const aOutput,
                const std::string &temporaryDir,
                const std::unordered_set<std::string> &exclude);
+    void pass1Reader(Pass1Queue *queue,
+                     const std::string &temporaryDir,
+                     const std::unordered_set<std::string> &exclude);
+    void pass1Worker(Pass1Queue *queue);
+    bool pass1Commit(zipFile const aOutput, unzFile const zRaw,
+                     Pass1Entry *entry);
     bool pass2(zipFile const aOutput,
                const std::string &temporaryDir,
                const std::unordered_set<std::string> &files);
@@ -154,7 +231,19 @@ std::string MultiBootPatcher::newFilePath()
 
 void MultiBootPatcher::cancelPatching()
 {
-    m_impl->cancelled = true;
+    m_impl->cancelled.store(true);
+}
+
+void MultiBootPatcher::setMaxThreads(unsigned int threads)
+{
+    m_impl->maxThreads = threads;
+}
+
+void MultiBootPatcher::setProgressEventCallback(ProgressEventCallback cb,
+                                                void *userData)
+{
+    m_impl->eventCb = cb;
+    m_impl->eventUserData = userData;
 }
 
 bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
@@ -162,8 +251,6 @@ bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
                                  DetailsUpdatedCallback detailsCb,
                                  void *userData)
 {
-    m_impl->cancelled = false;
-
     assert(m_impl->info != nullptr);
 
     if (!boost::iends_with(m_impl->info->filename(), ".zip")) {
@@ -172,10 +259,12 @@ bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
         return false;
     }
 
-    m_impl->progressCb = progressCb;
-    m_impl->filesCb = filesCb;
-    m_impl->detailsCb = detailsCb;
-    m_impl->userData = userData;
+    m_impl->cancelled.store(false);
+
+    m_impl->progress.reset(new ProgressReporter(
+            progressCb, filesCb, detailsCb, userData));
+    m_impl->progress->setEventCallback(
+            m_impl->eventCb, m_impl->eventUserData);
 
     m_impl->bytes = 0;
     m_impl->maxBytes = 0;
@@ -184,15 +273,19 @@ bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
 
     bool ret = m_impl->patchZip();
 
-    m_impl->progressCb = nullptr;
-    m_impl->filesCb = nullptr;
-    m_impl->detailsCb = nullptr;
-    m_impl->userData = nullptr;
+    m_impl->progress->flush();
+    if (ret) {
+        FLOGD("Patched {} bytes at {:.1f} MiB/s", m_impl->bytes,
+              m_impl->progress->bytesPerSecond() / 1024 / 1024);
+    }
+    m_impl->progress.reset();
 
     for (auto *p : m_impl->autoPatchers) {
         m_impl->pc->destroyAutoPatcher(p);
     }
     m_impl->autoPatchers.clear();
+    m_impl->diskPatchers.clear();
+    m_impl->memoryPatchers.clear();
 
     if (m_impl->zInput != nullptr) {
         m_impl->closeInputArchive();
@@ -201,7 +294,7 @@ bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
         m_impl->closeOutputArchive();
     }
 
-    if (m_impl->cancelled) {
+    if (m_impl->cancelled.load()) {
         m_impl->error = PatcherError::createCancelledError(
                 ErrorCode::PatchingCancelled);
         return false;
@@ -210,11 +303,18 @@ bool MultiBootPatcher::patchFile(ProgressUpdatedCallback progressCb,
     return ret;
 }
 
-bool MultiBootPatcher::Impl::patchBootImage(std::vector<unsigned char> *data)
+/*!
+ * \brief Patch a boot image
+ *
+ * This is called from the pass 1 worker threads, so errors are returned in
+ * \a errorOut instead of being stored in Impl::error.
+ */
+bool MultiBootPatcher::Impl::patchBootImage(std::vector<unsigned char> *data,
+                                            PatcherError *errorOut)
 {
     BootImage bi;
     if (!bi.load(*data)) {
-        error = bi.error();
+        *errorOut = bi.error();
         return false;
     }
 
@@ -224,31 +324,35 @@ bool MultiBootPatcher::Impl::patchBootImage(std::vector<unsigned char> *data)
 
     // Load the ramdisk cpio
     CpioFile cpio;
-    if (!cpio.load(bi.ramdiskImage())) {
-        error = cpio.error();
+    BinaryView ramdisk = bi.ramdiskImageView();
+    if (!cpio.load(ramdisk.data(), ramdisk.size())) {
+        *errorOut = cpio.error();
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
-    auto *rp = pc->createRamdiskPatcher(
+    RamdiskPatcher *rp = pc->createRamdiskPatcher(
             info->patchInfo()->ramdisk(), info, &cpio);
     if (!rp) {
-        error = PatcherError::createPatcherCreationError(
+        *errorOut = PatcherError::createPatcherCreationError(
                 ErrorCode::RamdiskPatcherCreateError,
                 info->patchInfo()->ramdisk());
         return false;
     }
 
-    if (!rp->patchRamdisk()) {
-        error = rp->error();
-        pc->destroyRamdiskPatcher(rp);
-        return false;
+    bool patched = rp->patchRamdisk();
+    if (!patched) {
+        *errorOut = rp->error();
     }
 
     pc->destroyRamdiskPatcher(rp);
 
-    if (cancelled) return false;
+    if (!patched) {
+        return false;
+    }
+
+    if (cancelled.load()) return false;
 
     // Add mbtool
     const std::string mbtool("mbtool");
@@ -259,15 +363,15 @@ bool MultiBootPatcher::Impl::patchBootImage(std::vector<unsigned char> *data)
 
     if (!cpio.addFile(pc->dataDirectory() + "/binaries/android/"
             + info->device()->architecture() + "/mbtool", mbtool, 0750)) {
-        error = cpio.error();
+        *errorOut = cpio.error();
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     std::vector<unsigned char> newRamdisk;
     if (!cpio.createData(&newRamdisk)) {
-        error = cpio.error();
+        *errorOut = cpio.error();
         return false;
     }
     bi.setRamdiskImage(std::move(newRamdisk));
@@ -277,7 +381,7 @@ bool MultiBootPatcher::Impl::patchBootImage(std::vector<unsigned char> *data)
 
     *data = bi.create();
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     return true;
 }
@@ -305,10 +409,49 @@ bool MultiBootPatcher::Impl::patchZip()
         }
 
         autoPatchers.push_back(ap);
+    }
+
+    // Files are patched in memory during the first pass if every AutoPatcher
+    // that touches them supports it. Otherwise, all of those AutoPatchers run
+    // on the extracted files in the second pass so they are still applied in
+    // order.
+    std::unordered_set<AutoPatcher *> onDisk;
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (auto *ap : autoPatchers) {
+            if (onDisk.find(ap) != onDisk.end()) {
+                continue;
+            }
 
-        // AutoPatcher files should be excluded from the first pass
-        for (auto const &file : existingFiles) {
-            excludeFromPass1.insert(file);
+            auto existingFiles = ap->existingFiles();
+            bool needsDisk = !ap->canPatchInMemory() || std::any_of(
+                    existingFiles.begin(), existingFiles.end(),
+                    [&](const std::string &file) {
+                        return excludeFromPass1.find(file)
+                                != excludeFromPass1.end();
+                    });
+
+            if (needsDisk) {
+                onDisk.insert(ap);
+                changed = true;
+
+                // AutoPatcher files should be excluded from the first pass
+                excludeFromPass1.insert(existingFiles.begin(),
+                                        existingFiles.end());
+            }
+        }
+    }
+
+    for (auto *ap : autoPatchers) {
+        if (onDisk.find(ap) != onDisk.end()) {
+            diskPatchers.push_back(ap);
+        } else {
+            for (auto const &file : ap->existingFiles()) {
+                memoryPatchers[file].push_back(ap);
+            }
         }
     }
 
@@ -317,50 +460,61 @@ bool MultiBootPatcher::Impl::patchZip()
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
+
+    if (!openInputArchive()) {
+        return false;
+    }
 
-    FileUtils::ArchiveStats stats;
-    auto result = FileUtils::mzArchiveStats(info->filename(), &stats,
-                                            std::vector<std::string>());
+    auto result = inputIndex.load(info->filename());
     if (!result) {
         error = result;
         return false;
     }
 
-    maxBytes = stats.totalSize;
+    maxBytes = inputIndex.totalUncompressedSize();
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     // +1 for mbtool_recovery (update-binary)
     // +1 for bb-wrapper.sh
     // +1 for info.prop
-    maxFiles = stats.files + 3;
+    maxFiles = inputIndex.count() + 3;
     updateFiles(files, maxFiles);
 
-    if (!openInputArchive()) {
-        return false;
+    // Files for AutoPatchers that cannot patch in memory are extracted to a
+    // temporary directory
+    std::string tempDir;
+    if (!diskPatchers.empty()) {
+        tempDir = FileUtils::createTemporaryDir(pc->tempDirectory());
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string tempDir = FileUtils::createTemporaryDir(pc->tempDirectory());
-
     if (!pass1(zOutput, tempDir, excludeFromPass1)) {
-        boost::filesystem::remove_all(tempDir);
+        if (!tempDir.empty()) {
+            boost::filesystem::remove_all(tempDir);
+        }
         return false;
     }
 
-    if (cancelled) return false;
+    progress->flush();
+
+    if (cancelled.load()) return false;
 
-    // On the second pass, run the autopatchers on the rest of the files
+    // On the second pass, run the remaining autopatchers on the extracted
+    // files
+
+    if (!diskPatchers.empty()) {
+        if (!pass2(zOutput, tempDir, excludeFromPass1)) {
+            boost::filesystem::remove_all(tempDir);
+            return false;
+        }
 
-    if (!pass2(zOutput, tempDir, excludeFromPass1)) {
         boost::filesystem::remove_all(tempDir);
-        return false;
-    }
 
-    boost::filesystem::remove_all(tempDir);
+        progress->flush();
+    }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     updateFiles(++files, maxFiles);
     updateDetails("META-INF/com/google/android/update-binary");
@@ -375,7 +529,7 @@ bool MultiBootPatcher::Impl::patchZip()
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     updateFiles(++files, maxFiles);
     updateDetails("multiboot/bb-wrapper.sh");
@@ -389,7 +543,7 @@ bool MultiBootPatcher::Impl::patchZip()
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     updateFiles(++files, maxFiles);
     updateDetails("multiboot/info.prop");
@@ -403,7 +557,7 @@ bool MultiBootPatcher::Impl::patchZip()
         return false;
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     return true;
 }
@@ -415,49 +569,224 @@ bool MultiBootPatcher::Impl::patchZip()
  *
  * - If the PatchInfo has the `hasBootImage` parameter set to true for the
  *   current file, then patch the boot images and copy them to the output file.
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
+ * - Files needed by AutoPatchers that can patch in memory are patched as they
+ *   are read and written to the output zip.
+ * - Files needed by other AutoPatchers are extracted to the temporary
+ *   directory.
  * - Otherwise, the file is copied directly to the output zip.
+ *
+ * The work is pipelined. A reader thread walks the input zip, extracts the
+ * AutoPatcher files and loads the boot images, which are patched by a pool of
+ * worker threads. The calling thread commits the entries to the output zip in
+ * the original order (copying raw data through a second handle to the input
+ * zip), so the output is the same as if everything was done sequentially. All
+ * callbacks are called from the calling thread.
  */
 bool MultiBootPatcher::Impl::pass1(zipFile const zOutput,
                                    const std::string &temporaryDir,
                                    const std::unordered_set<std::string> &exclude)
 {
-    // Boot image params
-    bool hasBootImage = info->patchInfo()->hasBootImage();
-    auto piBootImages = info->patchInfo()->bootImages();
-
-    int ret = unzGoToFirstFile(zInput);
-    if (ret != UNZ_OK) {
+    // Second handle for raw copies, since zInput belongs to the reader
+    unzFile zRaw = FileUtils::mzOpenInputFile(info->filename());
+    if (!zRaw) {
+        FLOGE("minizip: Failed to open for reading: {}", info->filename());
         error = PatcherError::createArchiveError(
-                ErrorCode::ArchiveReadHeaderError, std::string());
+                ErrorCode::ArchiveReadOpenError, info->filename());
         return false;
     }
 
-    do {
-        if (cancelled) return false;
+    unsigned int nWorkers = maxThreads;
+    if (nWorkers == 0) {
+        nWorkers = std::thread::hardware_concurrency();
+    }
+    if (nWorkers == 0) {
+        nWorkers = 1;
+    }
 
-        unz_file_info64 fi;
-        std::string curFile;
+    Pass1Queue queue;
+    // Limit the number of boot images (up to 30 MiB each) held in memory
+    queue.maxInMemory = nWorkers + 1;
 
-        if (!FileUtils::mzGetInfo(zInput, &fi, &curFile)) {
-            error = PatcherError::createArchiveError(
-                    ErrorCode::ArchiveReadHeaderError, curFile);
-            return false;
+    std::thread reader;
+    std::vector<std::thread> workers;
+
+    try {
+        reader = std::thread(&Impl::pass1Reader, this, &queue,
+                             std::cref(temporaryDir), std::cref(exclude));
+    } catch (const std::system_error &e) {
+        FLOGE("Failed to start pass 1 reader thread: {}", e.what());
+        FileUtils::mzCloseInputFile(zRaw);
+        error = PatcherError::createGenericError(ErrorCode::UnknownError);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < nWorkers; ++i) {
+        try {
+            workers.emplace_back(&Impl::pass1Worker, this, &queue);
+        } catch (const std::system_error &e) {
+            // The writer patches the boot images itself if there are no
+            // workers, so this is not fatal
+            FLOGW("Failed to start pass 1 worker thread: {}", e.what());
+            break;
+        }
+    }
+
+    bool ret = true;
+
+    while (true) {
+        std::shared_ptr<Pass1Entry> entry;
+        bool patchHere = false;
+
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+
+            while (true) {
+                if (!queue.entries.empty()) {
+                    auto &front = queue.entries.front();
+                    if (front->action != Pass1Entry::Action::Patch
+                            || front->done) {
+                        break;
+                    }
+                    if (!front->started) {
+                        // Nobody has picked up the boot image that is needed
+                        // next, so patch it here instead of waiting
+                        front->started = true;
+                        patchHere = true;
+                        break;
+                    }
+                } else if (queue.readerDone) {
+                    break;
+                }
+                queue.cv.wait(lock);
+            }
+
+            if (queue.entries.empty()) {
+                break;
+            }
+
+            entry = queue.entries.front();
+            queue.entries.pop_front();
+
+            if (patchHere) {
+                queue.jobs.erase(std::find(queue.jobs.begin(),
+                                           queue.jobs.end(), entry));
+            }
         }
 
-        updateFiles(++files, maxFiles);
-        updateDetails(curFile);
+        if (patchHere) {
+            entry->ok = patchBootImage(&entry->data, &entry->error);
+            entry->done = true;
+        }
+
+        if (cancelled.load() || !pass1Commit(zOutput, zRaw, entry.get())) {
+            ret = false;
+            break;
+        }
+
+        if (entry->action == Pass1Entry::Action::Patch
+                || entry->action == Pass1Entry::Action::Add) {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            --queue.inMemory;
+            queue.cv.notify_all();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.stop = true;
+        queue.cv.notify_all();
+    }
+
+    reader.join();
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    FileUtils::mzCloseInputFile(zRaw);
+
+    if (cancelled.load()) return false;
+
+    return ret;
+}
+
+/*!
+ * \brief Pass 1 reader thread
+ *
+ * Walks the input zip and queues every entry for the writer. Boot images are
+ * also queued for the workers.
+ */
+void MultiBootPatcher::Impl::pass1Reader(Pass1Queue *queue,
+                                         const std::string &temporaryDir,
+                                         const std::unordered_set<std::string> &exclude)
+{
+    // Boot image params
+    bool hasBootImage = info->patchInfo()->hasBootImage();
+    auto piBootImages = info->patchInfo()->bootImages();
+
+    auto push = [&](std::shared_ptr<Pass1Entry> entry) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (entry->action == Pass1Entry::Action::Patch) {
+            queue->jobs.push_back(entry);
+        }
+        queue->entries.push_back(std::move(entry));
+        queue->cv.notify_all();
+    };
+
+    auto fail = [&](PatcherError e) {
+        auto entry = std::make_shared<Pass1Entry>();
+        entry->action = Pass1Entry::Action::Extract;
+        entry->ok = false;
+        entry->done = true;
+        entry->error = std::move(e);
+        push(std::move(entry));
+    };
+
+    // Entries are visited in central directory order using the index, so
+    // zInput only needs to be positioned for the files that are read here
+    for (std::size_t i = 0; i < inputIndex.count(); ++i) {
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (queue->stop) {
+                break;
+            }
+        }
+
+        if (cancelled.load()) break;
+
+        const ZipIndex::Entry &ze = inputIndex.entry(i);
+        auto entry = std::make_shared<Pass1Entry>();
+
+        entry->name = inputIndex.name(i);
+        entry->outputName = entry->name;
+        entry->uncompressedSize = ze.uncompressedSize;
+        entry->pos.pos_in_zip_directory = ze.centralOffset;
+        entry->pos.num_of_file = i;
+        entry->done = true;
+
+        const std::string &curFile = entry->name;
+
+        // Rename the installer for mbtool
+        if (curFile == "META-INF/com/google/android/update-binary") {
+            entry->outputName =
+                    "META-INF/com/google/android/update-binary.orig";
+        }
 
         // Skip files that should be patched and added in pass 2
         if (exclude.find(curFile) != exclude.end()) {
-            if (!FileUtils::mzExtractFile(zInput, temporaryDir)) {
-                error = PatcherError::createArchiveError(
-                        ErrorCode::ArchiveReadDataError, curFile);
-                return false;
+            if (unzGoToFilePos64(zInput, &entry->pos) != UNZ_OK
+                    || !FileUtils::mzExtractFile(zInput, temporaryDir)) {
+                fail(PatcherError::createArchiveError(
+                        ErrorCode::ArchiveReadDataError, curFile));
+                break;
             }
+            entry->action = Pass1Entry::Action::Extract;
+            push(std::move(entry));
             continue;
         }
 
+        // Files that AutoPatchers patch in memory
+        auto memoryIt = memoryPatchers.find(curFile);
+
         // Try to patch the patchinfo-defined boot images as well as
         // files that end in a common boot image extension
 
@@ -465,73 +794,171 @@ bool MultiBootPatcher::Impl::pass1(zipFile const zOutput,
                                 curFile) != piBootImages.end();
         bool isExtImg = boost::ends_with(curFile, ".img");
         bool isExtLok = boost::ends_with(curFile, ".lok");
-        // Boot images should be over about 30 MiB. This check is here so the
-        // patcher won't try to read a multi-gigabyte system image into RAM
-        bool isSizeOK = fi.uncompressed_size <= 30 * 1024 * 1024;
+        // Boot images should be over about 30 MiB. This check is here so
+        // the patcher won't try to read a multi-gigabyte system image
+        // into RAM
+        bool isSizeOK = ze.uncompressedSize <= 30 * 1024 * 1024;
+
+        if (memoryIt != memoryPatchers.end()
+                || (hasBootImage && (inList || isExtImg || isExtLok)
+                        && isSizeOK)) {
+            {
+                std::unique_lock<std::mutex> lock(queue->mutex);
+                while (!queue->stop
+                        && queue->inMemory >= queue->maxInMemory) {
+                    queue->cv.wait(lock);
+                }
+                if (queue->stop) {
+                    break;
+                }
+                ++queue->inMemory;
+            }
 
-        if (hasBootImage && (inList || isExtImg || isExtLok) && isSizeOK) {
             // Load the file into memory
-            std::vector<unsigned char> data;
-
-            if (!FileUtils::mzReadToMemory(zInput, &data,
-                                           &laProgressCb, this)) {
-                error = PatcherError::createArchiveError(
-                        ErrorCode::ArchiveReadDataError, curFile);
-                return false;
+            if (unzGoToFilePos64(zInput, &entry->pos) != UNZ_OK
+                    || !FileUtils::mzReadToMemory(zInput, &entry->data,
+                                                  nullptr, nullptr)) {
+                fail(PatcherError::createArchiveError(
+                        ErrorCode::ArchiveReadDataError, curFile));
+                break;
             }
 
-            // If the file contains the boot image magic string, then
-            // assume it really is a boot image and patch it
-            if (data.size() >= 512) {
+            entry->action = Pass1Entry::Action::Add;
+
+            if (memoryIt != memoryPatchers.end()) {
+                bool patched = true;
+
+                for (auto *ap : memoryIt->second) {
+                    if (!ap->patchFileInMemory(curFile, &entry->data)) {
+                        fail(ap->error());
+                        patched = false;
+                        break;
+                    }
+                }
+
+                if (!patched) {
+                    break;
+                }
+            } else if (entry->data.size() >= 512) {
+                // If the file contains the boot image magic string, then
+                // assume it really is a boot image and patch it
                 const char *magic = BootImage::BootMagic;
                 unsigned int size = BootImage::BootMagicSize;
-                auto end = data.begin() + 512;
-                auto it = std::search(data.begin(), end,
+                auto end = entry->data.begin() + 512;
+                auto it = std::search(entry->data.begin(), end,
                                       magic, magic + size);
                 if (it != end) {
-                    if (!patchBootImage(&data)) {
-                        return false;
-                    }
-
-                    // Update total size
-                    maxBytes += (data.size() - fi.uncompressed_size);
+                    entry->action = Pass1Entry::Action::Patch;
+                    entry->done = false;
                 }
             }
+        } else {
+            // Directly copy other files to the output zip. The writer reads
+            // them through its own handle.
+            entry->action = Pass1Entry::Action::Copy;
+        }
 
-            auto ret2 = FileUtils::mzAddFile(zOutput, curFile, data);
-            if (!ret2) {
-                error = ret2;
-                return false;
-            }
+        push(std::move(entry));
+    }
 
-            bytes += data.size();
-        } else {
-            // Directly copy other files to the output zip
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->readerDone = true;
+    queue->cv.notify_all();
+}
 
-            // Rename the installer for mbtool
-            if (curFile == "META-INF/com/google/android/update-binary") {
-                curFile = "META-INF/com/google/android/update-binary.orig";
+/*!
+ * \brief Pass 1 worker thread
+ *
+ * Patches queued boot images until the reader is done and there is nothing
+ * left to patch.
+ */
+void MultiBootPatcher::Impl::pass1Worker(Pass1Queue *queue)
+{
+    while (true) {
+        std::shared_ptr<Pass1Entry> entry;
+
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            while (!queue->stop && queue->jobs.empty()
+                    && !queue->readerDone) {
+                queue->cv.wait(lock);
             }
-
-            if (!FileUtils::mzCopyFileRaw(zInput, zOutput, curFile,
-                                          &laProgressCb, this)) {
-                FLOGW("minizip: Failed to copy raw data: {}", curFile);
-                error = PatcherError::createArchiveError(
-                        ErrorCode::ArchiveWriteDataError, curFile);
-                return false;
+            if (queue->stop || queue->jobs.empty()) {
+                return;
             }
 
-            bytes += fi.uncompressed_size;
+            entry = queue->jobs.front();
+            queue->jobs.pop_front();
+            entry->started = true;
         }
-    } while ((ret = unzGoToNextFile(zInput)) == UNZ_OK);
 
-    if (ret != UNZ_END_OF_LIST_OF_FILE) {
-        error = PatcherError::createArchiveError(
-                ErrorCode::ArchiveReadHeaderError, std::string());
+        PatcherError patchError;
+        bool ok = patchBootImage(&entry->data, &patchError);
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        entry->ok = ok;
+        entry->error = std::move(patchError);
+        entry->done = true;
+        queue->cv.notify_all();
+    }
+}
+
+/*!
+ * \brief Write a pass 1 entry to the output zip
+ *
+ * This is only called from the thread that called pass1().
+ */
+bool MultiBootPatcher::Impl::pass1Commit(zipFile const zOutput,
+                                         unzFile const zRaw,
+                                         Pass1Entry *entry)
+{
+    if (!entry->ok) {
+        error = entry->error;
         return false;
     }
 
-    if (cancelled) return false;
+    updateFiles(++files, maxFiles);
+    updateDetails(entry->name);
+
+    switch (entry->action) {
+    case Pass1Entry::Action::Extract:
+        bytes += entry->uncompressedSize;
+        updateProgress(bytes, maxBytes);
+        break;
+
+    case Pass1Entry::Action::Patch:
+    case Pass1Entry::Action::Add: {
+        // Update total size
+        maxBytes += (entry->data.size() - entry->uncompressedSize);
+
+        auto ret = FileUtils::mzAddFile(zOutput, entry->outputName,
+                                        entry->data);
+        if (!ret) {
+            error = ret;
+            return false;
+        }
+
+        bytes += entry->data.size();
+        updateProgress(bytes, maxBytes);
+
+        std::vector<unsigned char>().swap(entry->data);
+        break;
+    }
+
+    case Pass1Entry::Action::Copy:
+        if (unzGoToFilePos64(zRaw, &entry->pos) != UNZ_OK
+                || !FileUtils::mzCopyFileRaw(zRaw, zOutput, entry->outputName,
+                                             &laProgressCb, this)) {
+            FLOGW("minizip: Failed to copy raw data: {}", entry->name);
+            error = PatcherError::createArchiveError(
+                    ErrorCode::ArchiveWriteDataError, entry->name);
+            return false;
+        }
+
+        bytes += entry->uncompressedSize;
+        updateProgress(bytes, maxBytes);
+        break;
+    }
 
     return true;
 }
@@ -541,15 +968,15 @@ bool MultiBootPatcher::Impl::pass1(zipFile const zOutput,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * - Patch files in the temporary directory using the AutoPatchers that cannot
+ *   patch in memory and add the resulting files to the output zip
  */
 bool MultiBootPatcher::Impl::pass2(zipFile const zOutput,
                                    const std::string &temporaryDir,
                                    const std::unordered_set<std::string> &files)
 {
-    for (auto *ap : autoPatchers) {
-        if (cancelled) return false;
+    for (auto *ap : diskPatchers) {
+        if (cancelled.load()) return false;
         if (!ap->patchFiles(temporaryDir)) {
             error = ap->error();
             return false;
@@ -559,7 +986,7 @@ bool MultiBootPatcher::Impl::pass2(zipFile const zOutput,
     // TODO Headers are being discarded
 
     for (auto const &file : files) {
-        if (cancelled) return false;
+        if (cancelled.load()) return false;
 
         PatcherError ret;
 
@@ -581,7 +1008,7 @@ bool MultiBootPatcher::Impl::pass2(zipFile const zOutput,
         }
     }
 
-    if (cancelled) return false;
+    if (cancelled.load()) return false;
 
     return true;
 }
@@ -646,23 +1073,17 @@ void MultiBootPatcher::Impl::closeOutputArchive()
 
 void MultiBootPatcher::Impl::updateProgress(uint64_t bytes, uint64_t maxBytes)
 {
-    if (progressCb) {
-        progressCb(bytes, maxBytes, userData);
-    }
+    progress->setBytes(bytes, maxBytes);
 }
 
 void MultiBootPatcher::Impl::updateFiles(uint64_t files, uint64_t maxFiles)
 {
-    if (filesCb) {
-        filesCb(files, maxFiles, userData);
-    }
+    progress->setFiles(files, maxFiles);
 }
 
 void MultiBootPatcher::Impl::updateDetails(const std::string &msg)
 {
-    if (detailsCb) {
-        detailsCb(msg, userData);
-    }
+    progress->setDetails(msg);
 }
 
 void MultiBootPatcher::Impl::laProgressCb(uint64_t bytes, void *userData)
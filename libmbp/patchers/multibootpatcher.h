@@ -54,6 +54,11 @@ public:
 
     virtual void cancelPatching() override;
 
+    virtual void setMaxThreads(unsigned int threads) override;
+
+    virtual void setProgressEventCallback(ProgressEventCallback cb,
+                                          void *userData) override;
+
 private:
     class Impl;
     std::unique_ptr<Impl> m_impl;
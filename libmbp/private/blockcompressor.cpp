@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/blockcompressor.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zlib.h>
+
+
+namespace mbp
+{
+
+// Amount of preceding data used to prime each deflate block
+static const std::size_t GzipWindowSize = 32 * 1024;
+
+// LZ4 legacy frame magic number (0x184C2102, little endian)
+static const unsigned char Lz4LegacyMagic[] = { 0x02, 0x21, 0x4c, 0x18 };
+
+// Same cutoff as libarchive's lz4 filter: lower levels use the fast compressor
+static const int Lz4MinHcLevel = 3;
+
+/*! \cond INTERNAL */
+struct CompressedBlock
+{
+    std::vector<unsigned char> data;
+    uLong crc = 0;
+    bool ok = false;
+};
+/*! \endcond */
+
+/*!
+ * \brief Number of threads to use when no explicit count is given
+ */
+unsigned int defaultThreadCount()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+/*!
+ * Call \a func for every index in [0, count) using up to \a threads threads.
+ * The calling thread also processes blocks, so a thread count of 1 does not
+ * spawn anything.
+ */
+template<typename Func>
+static void forEachBlock(std::size_t count, unsigned int threads, Func func)
+{
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&]() {
+        std::size_t i;
+        while ((i = next++) < count) {
+            func(i);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    std::size_t nThreads = std::min<std::size_t>(std::max(threads, 1u), count);
+
+    for (std::size_t i = 1; i < nThreads; ++i) {
+        try {
+            pool.emplace_back(worker);
+        } catch (const std::system_error &) {
+            // Out of threads. The remaining blocks are still processed by
+            // the threads that did start.
+            break;
+        }
+    }
+
+    worker();
+
+    for (std::thread &t : pool) {
+        t.join();
+    }
+}
+
+static std::size_t blockCount(std::size_t size, std::size_t blockSize)
+{
+    return std::max<std::size_t>(1, (size + blockSize - 1) / blockSize);
+}
+
+static void putLe32(std::vector<unsigned char> *out, uint32_t value)
+{
+    out->push_back(value & 0xff);
+    out->push_back((value >> 8) & 0xff);
+    out->push_back((value >> 16) & 0xff);
+    out->push_back((value >> 24) & 0xff);
+}
+
+/*!
+ * Deflate one block as a raw deflate fragment. The window is primed with the
+ * preceding data so the compression ratio is close to that of a single
+ * stream. Every block except the last ends with a sync flush so that the
+ * fragments can simply be concatenated.
+ */
+static void deflateBlock(const unsigned char *data, std::size_t offset,
+                         std::size_t length, int level, bool last,
+                         CompressedBlock *block)
+{
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    if (offset > 0) {
+        std::size_t dictSize = std::min(offset, GzipWindowSize);
+        if (deflateSetDictionary(&strm, data + offset - dictSize,
+                                 dictSize) != Z_OK) {
+            deflateEnd(&strm);
+            return;
+        }
+    }
+
+    // Room for the sync flush marker in addition to the compressed data
+    block->data.resize(deflateBound(&strm, length) + 16);
+
+    strm.next_in = const_cast<Bytef *>(data + offset);
+    strm.avail_in = length;
+
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    std::size_t used = 0;
+    int ret;
+
+    do {
+        if (used == block->data.size()) {
+            block->data.resize(block->data.size() * 2);
+        }
+        strm.next_out = block->data.data() + used;
+        strm.avail_out = block->data.size() - used;
+
+        ret = deflate(&strm, flush);
+        used = block->data.size() - strm.avail_out;
+    } while (ret == Z_OK && (last || strm.avail_out == 0));
+
+    deflateEnd(&strm);
+
+    if (last ? ret != Z_STREAM_END
+            : (ret != Z_OK && ret != Z_BUF_ERROR) || strm.avail_in != 0) {
+        return;
+    }
+
+    block->data.resize(used);
+    block->crc = crc32(0, data + offset, length);
+    block->ok = true;
+}
+
+/*!
+ * \brief Compress data as a single gzip member using multiple threads
+ *
+ * The input is split into blocks of GzipBlockSize bytes that are deflated
+ * independently (like pigz). Since the block size is fixed, the output does
+ * not depend on the number of threads.
+ *
+ * \param data Data to compress
+ * \param size Size of data
+ * \param level zlib compression level (-1 for the default)
+ * \param threads Number of threads to use
+ * \param out Output vector (compressed data is appended)
+ *
+ * \return Whether the data was successfully compressed
+ */
+bool gzipCompressBlocks(const unsigned char *data, std::size_t size,
+                        int level, unsigned int threads,
+                        std::vector<unsigned char> *out)
+{
+    if (level < 0 || level > 9) {
+        level = Z_DEFAULT_COMPRESSION;
+    }
+
+    std::size_t count = blockCount(size, GzipBlockSize);
+    std::vector<CompressedBlock> blocks(count);
+
+    forEachBlock(count, threads, [&](std::size_t i) {
+        std::size_t offset = i * GzipBlockSize;
+        std::size_t length = std::min(GzipBlockSize, size - offset);
+        deflateBlock(data, offset, length, level, i == count - 1, &blocks[i]);
+    });
+
+    // Magic, deflate, no flags, no mtime, no extra flags, Unix
+    static const unsigned char header[] = {
+        0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03
+    };
+    out->insert(out->end(), header, header + sizeof(header));
+
+    uLong crc = crc32(0, nullptr, 0);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        if (!blocks[i].ok) {
+            return false;
+        }
+
+        std::size_t length = std::min(GzipBlockSize, size - i * GzipBlockSize);
+        crc = crc32_combine(crc, blocks[i].crc, length);
+        out->insert(out->end(), blocks[i].data.begin(), blocks[i].data.end());
+        std::vector<unsigned char>().swap(blocks[i].data);
+    }
+
+    putLe32(out, crc);
+    putLe32(out, size & 0xffffffff);
+
+    return true;
+}
+
+/*!
+ * \brief Compress data in the LZ4 legacy format using multiple threads
+ *
+ * The legacy format (as produced by `lz4 -l`) is the one that the kernel can
+ * decompress. Every block is compressed independently, so the blocks can be
+ * compressed in parallel.
+ *
+ * \param data Data to compress
+ * \param size Size of data
+ * \param level Compression level. Levels below 3 (including -1 for the
+ *              default) use the fast compressor and higher levels use LZ4HC.
+ * \param threads Number of threads to use
+ * \param out Output vector (compressed data is appended)
+ *
+ * \return Whether the data was successfully compressed
+ */
+bool lz4CompressBlocks(const unsigned char *data, std::size_t size,
+                       int level, unsigned int threads,
+                       std::vector<unsigned char> *out)
+{
+    std::size_t count = size == 0 ? 0 : blockCount(size, Lz4BlockSize);
+    std::vector<CompressedBlock> blocks(count);
+
+    forEachBlock(count, threads, [&](std::size_t i) {
+        std::size_t offset = i * Lz4BlockSize;
+        int length = std::min(Lz4BlockSize, size - offset);
+        CompressedBlock &block = blocks[i];
+
+        block.data.resize(LZ4_compressBound(length));
+
+        auto src = reinterpret_cast<const char *>(data + offset);
+        auto dest = reinterpret_cast<char *>(block.data.data());
+        int n;
+
+        if (level >= Lz4MinHcLevel) {
+            n = LZ4_compressHC2(src, dest, length, level);
+        } else {
+            n = LZ4_compress(src, dest, length);
+        }
+
+        if (n > 0) {
+            block.data.resize(n);
+            block.ok = true;
+        }
+    });
+
+    out->insert(out->end(), Lz4LegacyMagic,
+                Lz4LegacyMagic + sizeof(Lz4LegacyMagic));
+
+    for (CompressedBlock &block : blocks) {
+        if (!block.ok) {
+            return false;
+        }
+
+        putLe32(out, block.data.size());
+        out->insert(out->end(), block.data.begin(), block.data.end());
+        std::vector<unsigned char>().swap(block.data);
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+
+namespace mbp
+{
+
+// Block size used for parallel gzip compression
+static const std::size_t GzipBlockSize = 128 * 1024;
+// Block size used for LZ4 legacy frames (must not exceed 8 MiB)
+static const std::size_t Lz4BlockSize = 1024 * 1024;
+
+unsigned int defaultThreadCount();
+
+bool gzipCompressBlocks(const unsigned char *data, std::size_t size,
+                        int level, unsigned int threads,
+                        std::vector<unsigned char> *out);
+
+bool lz4CompressBlocks(const unsigned char *data, std::size_t size,
+                       int level, unsigned int threads,
+                       std::vector<unsigned char> *out);
+
+}
@@ -21,15 +21,18 @@
 
 #include <algorithm>
 #include <fstream>
+#include <unordered_set>
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
 
 #include "private/logging.h"
+#include "private/zipindex.h"
 
 #ifdef _WIN32
 #define USEWIN32IOAPI
 #include "external/minizip/iowin32.h"
+#include <windows.h>
 #else
 #include <sys/stat.h>
 #endif
@@ -168,15 +171,66 @@ std::string FileUtils::createTemporaryDir(const std::string &directory)
 #endif
 }
 
-unzFile FileUtils::mzOpenInputFile(const std::string &path)
+/*!
+    \brief Get the size and modification time of a file
+
+    The modification time has sub-second precision so that callers caching
+    something derived from the file notice edits made within the same second.
+
+    \param path Path to file
+    \param size Output size in bytes
+    \param mtimeNs Output modification time in nanoseconds (100ns intervals
+                   on Windows)
+
+    \return Whether the file could be stat'ed
+ */
+bool FileUtils::statFile(const std::string &path,
+                         uint64_t *size, int64_t *mtimeNs)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(boost::filesystem::path(path).c_str(),
+                              GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    *size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32)
+            | data.nFileSizeLow;
+    *mtimeNs = static_cast<int64_t>(
+            (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32)
+            | data.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+#if defined(__APPLE__)
+    long nsec = sb.st_mtimespec.tv_nsec;
+#elif defined(__ANDROID__)
+    long nsec = sb.st_mtime_nsec;
+#else
+    long nsec = sb.st_mtim.tv_nsec;
+#endif
+
+    *size = sb.st_size;
+    *mtimeNs = static_cast<int64_t>(sb.st_mtime) * 1000000000 + nsec;
+#endif
+
+    return true;
+}
+
+unzFile FileUtils::mzOpenInputFile(const std::string &path,
+                                   ZipReadMode mode)
 {
 #ifdef USEWIN32IOAPI
+    (void) mode;
     zlib_filefunc64_def zFunc;
     memset(&zFunc, 0, sizeof(zFunc));
     fill_win32_filefunc64A(&zFunc);
     return unzOpen2_64(path.c_str(), &zFunc);
 #else
-    return unzOpen64(path.c_str());
+    return openZipInput(path.c_str(), mode);
 #endif
 }
 
@@ -188,18 +242,26 @@ zipFile FileUtils::mzOpenOutputFile(const std::string &path)
     fill_win32_filefunc64A(&zFunc);
     return zipOpen2_64(path.c_str(), 0, nullptr, &zFunc);
 #else
-    return zipOpen64(path.c_str(), 0);
+    return openZipOutput(path.c_str());
 #endif
 }
 
 int FileUtils::mzCloseInputFile(unzFile uf)
 {
+#ifdef USEWIN32IOAPI
     return unzClose(uf);
+#else
+    return closeZipInput(uf);
+#endif
 }
 
 int FileUtils::mzCloseOutputFile(zipFile zf)
 {
+#ifdef USEWIN32IOAPI
     return zipClose(zf, nullptr);
+#else
+    return closeZipOutput(zf);
+#endif
 }
 
 PatcherError FileUtils::mzArchiveStats(const std::string &path,
@@ -208,48 +270,27 @@ PatcherError FileUtils::mzArchiveStats(const std::string &path,
 {
     assert(stats != nullptr);
 
-    unzFile uf = mzOpenInputFile(path);
-
-    if (!uf) {
-        FLOGE("minizip: Failed to open for reading: {}", path);
-        return PatcherError::createArchiveError(
-                ErrorCode::ArchiveReadOpenError, path);
+    // Only the central directory needs to be read
+    ZipIndex index;
+    auto ret = index.load(path);
+    if (!ret) {
+        return ret;
     }
 
-    uint64_t count = 0;
-    uint64_t totalSize = 0;
-    std::string name;
-    unz_file_info64 fi;
-    memset(&fi, 0, sizeof(fi));
-
-    int ret = unzGoToFirstFile(uf);
-    if (ret != UNZ_OK) {
-        mzCloseInputFile(uf);
-        return PatcherError::createArchiveError(
-                ErrorCode::ArchiveReadHeaderError, std::string());
-    }
+    uint64_t count = index.count();
+    uint64_t totalSize = index.totalUncompressedSize();
 
-    do {
-        if (!mzGetInfo(uf, &fi, &name)) {
-            mzCloseInputFile(uf);
-            return PatcherError::createArchiveError(
-                    ErrorCode::ArchiveReadHeaderError, std::string());
-        }
+    if (!ignore.empty()) {
+        std::unordered_set<std::string> ignoreSet(ignore.begin(), ignore.end());
 
-        if (std::find(ignore.begin(), ignore.end(), name) == ignore.end()) {
-            ++count;
-            totalSize += fi.uncompressed_size;
+        for (std::size_t i = 0; i < index.count(); ++i) {
+            if (ignoreSet.find(index.name(i)) != ignoreSet.end()) {
+                --count;
+                totalSize -= index.entry(i).uncompressedSize;
+            }
         }
-    } while ((ret = unzGoToNextFile(uf)) == UNZ_OK);
-
-    if (ret != UNZ_END_OF_LIST_OF_FILE) {
-        mzCloseInputFile(uf);
-        return PatcherError::createArchiveError(
-                ErrorCode::ArchiveReadHeaderError, std::string());
     }
 
-    mzCloseInputFile(uf);
-
     stats->files = count;
     stats->totalSize = totalSize;
 
@@ -347,6 +388,12 @@ bool FileUtils::mzCopyFileRaw(unzFile uf,
         return false;
     }
 
+#ifndef USEWIN32IOAPI
+    // If possible, copy the compressed data directly from the input file to
+    // the output file without passing it through minizip
+    bool splice = !zip64 && beginRawSplice(uf, zf, ufi.compressed_size);
+#endif
+
     // Open raw file in output zip
     ret = zipOpenNewFileInZip2_64(
         zf,             // file
@@ -367,6 +414,31 @@ bool FileUtils::mzCopyFileRaw(unzFile uf,
         return false;
     }
 
+#ifndef USEWIN32IOAPI
+    if (splice) {
+        unzCloseCurrentFile(uf);
+
+        if (!reserveRawSplice(zf)) {
+            zipCloseFileInZip(zf);
+            return false;
+        }
+
+        ret = zipCloseFileInZipRaw64(zf, ufi.uncompressed_size, ufi.crc);
+        if (ret != ZIP_OK) {
+            return false;
+        }
+
+        return finishRawSplice(zf, [&](uint64_t bytes) {
+            if (cb) {
+                // Scale this to the uncompressed size for the purposes of a
+                // progress bar
+                double ratio = (double) bytes / ufi.compressed_size;
+                cb(ratio * ufi.uncompressed_size, userData);
+            }
+        });
+    }
+#endif
+
     uint64_t bytes = 0;
 
     // Exceeds Android's default stack size, unfortunately, so allocate
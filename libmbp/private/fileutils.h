@@ -22,10 +22,13 @@
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
 #include "external/minizip/unzip.h"
 #include "external/minizip/zip.h"
 
 #include "patchererror.h"
+#include "private/zipio.h"
 
 
 namespace mbp
@@ -46,12 +49,16 @@ public:
 
     static std::string createTemporaryDir(const std::string &directory);
 
+    static bool statFile(const std::string &path,
+                         uint64_t *size, int64_t *mtimeNs);
+
     struct ArchiveStats {
         uint64_t files;
         uint64_t totalSize;
     };
 
-    static unzFile mzOpenInputFile(const std::string &path);
+    static unzFile mzOpenInputFile(const std::string &path,
+                                   ZipReadMode mode = ZipReadMode::Mapped);
 
     static zipFile mzOpenOutputFile(const std::string &path);
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/mappedfile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "private/fileutils.h"
+#include "private/logging.h"
+
+
+namespace mbp
+{
+
+/*!
+ * \class MappedFile
+ * \brief Read-only memory mapping of a file
+ *
+ * On systems without mmap(), the file is read into memory instead so that
+ * callers do not need to care about the difference.
+ */
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0), m_mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/*!
+ * \brief Map a file into memory
+ *
+ * Any previously mapped file is unmapped first. Block devices are supported as
+ * well. Their size is determined by seeking to the end of the device.
+ *
+ * \param path Path to file
+ *
+ * \return Success or not
+ */
+PatcherError MappedFile::open(const std::string &path)
+{
+    close();
+
+#ifdef _WIN32
+    auto ret = FileUtils::readToMemory(path, &m_buffer);
+    if (!ret) {
+        return ret;
+    }
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+
+    return PatcherError();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        FLOGE("{}: Failed to open: {}", path, strerror(errno));
+        return PatcherError::createIOError(ErrorCode::FileOpenError, path);
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        FLOGE("{}: Failed to stat: {}", path, strerror(errno));
+        ::close(fd);
+        return PatcherError::createIOError(ErrorCode::FileReadError, path);
+    }
+
+    // st_size is zero for block devices
+    uint64_t size;
+    if (S_ISREG(sb.st_mode)) {
+        size = sb.st_size;
+    } else {
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end < 0) {
+            FLOGE("{}: Failed to seek: {}", path, strerror(errno));
+            ::close(fd);
+            return PatcherError::createIOError(ErrorCode::FileReadError, path);
+        }
+        size = end;
+    }
+
+    if (size > SIZE_MAX) {
+        FLOGE("{}: File is too large to map", path);
+        ::close(fd);
+        return PatcherError::createIOError(ErrorCode::FileReadError, path);
+    }
+
+    if (size == 0) {
+        // mmap() does not allow zero-length mappings
+        ::close(fd);
+        return PatcherError();
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file descriptor is closed
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        FLOGE("{}: Failed to mmap: {}", path, strerror(errno));
+        return PatcherError::createIOError(ErrorCode::FileReadError, path);
+    }
+
+    m_data = static_cast<const unsigned char *>(addr);
+    m_size = size;
+    m_mapped = true;
+
+    return PatcherError();
+#endif
+}
+
+/*!
+ * \brief Unmap the file
+ *
+ * All pointers previously returned by data() become invalid.
+ */
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if (m_mapped) {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+#endif
+
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+}
+
+const unsigned char * MappedFile::data() const
+{
+    return m_data;
+}
+
+std::size_t MappedFile::size() const
+{
+    return m_size;
+}
+
+}
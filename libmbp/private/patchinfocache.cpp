@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "private/patchinfocache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "patchinfo.h"
+#include "private/logging.h"
+#include "private/mappedfile.h"
+#include "private/patchinfocache_generated.h"
+
+
+namespace mbp
+{
+
+static const uint64_t FnvOffsetBasis = 0xcbf29ce484222325ULL;
+static const uint64_t FnvPrime = 0x100000001b3ULL;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, std::size_t size)
+{
+    auto ptr = reinterpret_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= ptr[i];
+        hash *= FnvPrime;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a(uint64_t hash, uint64_t value)
+{
+    unsigned char buf[8];
+    for (int i = 0; i < 8; ++i) {
+        buf[i] = static_cast<unsigned char>(value >> (i * 8));
+    }
+    return fnv1a(hash, buf, sizeof(buf));
+}
+
+/*!
+ * \brief Compute the cache key for a set of patchinfo files
+ *
+ * The key only covers the IDs, sizes, and modification times of the files, so
+ * computing it does not require reading any of them.
+ *
+ * \param files PatchInfo XML files
+ *
+ * \return Key to pass to loadPatchInfoCache() and savePatchInfoCache()
+ */
+uint64_t patchInfoCacheKey(std::vector<PatchInfoFile> files)
+{
+    std::sort(files.begin(), files.end(),
+              [](const PatchInfoFile &a, const PatchInfoFile &b) {
+        return a.id < b.id;
+    });
+
+    uint64_t hash = FnvOffsetBasis;
+    hash = fnv1a(hash, files.size());
+
+    for (const PatchInfoFile &file : files) {
+        // Include the terminating NULL so "a" + "bc" differs from "ab" + "c"
+        hash = fnv1a(hash, file.id.c_str(), file.id.size() + 1);
+        hash = fnv1a(hash, file.size);
+        hash = fnv1a(hash, static_cast<uint64_t>(file.mtime));
+    }
+
+    return hash;
+}
+
+static std::vector<std::string> toStringList(
+        const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *v)
+{
+    std::vector<std::string> result;
+    if (v) {
+        result.reserve(v->size());
+        for (auto const *str : *v) {
+            result.push_back(str->str());
+        }
+    }
+    return result;
+}
+
+static std::string toString(const flatbuffers::String *str)
+{
+    return str ? str->str() : std::string();
+}
+
+/*!
+ * \brief Load PatchInfos from the cache
+ *
+ * \param path Path to cache file
+ * \param key Expected key (from patchInfoCacheKey())
+ * \param infos Output list of PatchInfos. The caller takes ownership of the
+ *              PatchInfos that are appended to it.
+ *
+ * \return True if the cache exists, is valid, and matches \a key. Otherwise,
+ *         false is returned and \a infos is not modified.
+ */
+bool loadPatchInfoCache(const std::string &path, uint64_t key,
+                        std::vector<PatchInfo *> *infos)
+{
+    // Not an error: the cache is written after the XML files are parsed
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(path, ec)) {
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+
+    flatbuffers::Verifier verifier(file.data(), file.size());
+    if (!cache::VerifyPatchInfoCacheBuffer(verifier)) {
+        FLOGW("{}: Invalid patchinfo cache", path);
+        return false;
+    }
+
+    auto const *root = cache::GetPatchInfoCache(file.data());
+    if (root->key() != key) {
+        FLOGD("{}: Patchinfo cache is out of date", path);
+        return false;
+    }
+    if (toString(root->version()) != LIBMBP_VERSION) {
+        FLOGD("{}: Patchinfo cache was written by a different version", path);
+        return false;
+    }
+
+    std::vector<PatchInfo *> loaded;
+
+    if (root->patchinfos()) {
+        loaded.reserve(root->patchinfos()->size());
+
+        for (auto const *fbInfo : *root->patchinfos()) {
+            PatchInfo *info = new PatchInfo();
+            info->setId(toString(fbInfo->id()));
+            info->setName(toString(fbInfo->name()));
+            info->setRegexes(toStringList(fbInfo->regexes()));
+            info->setExcludeRegexes(toStringList(fbInfo->exclude_regexes()));
+            info->setHasBootImage(fbInfo->has_boot_image() != 0);
+            info->setRamdisk(toString(fbInfo->ramdisk()));
+            info->setDeviceCheck(fbInfo->device_check() != 0);
+
+            if (fbInfo->autopatchers()) {
+                for (auto const *fbAp : *fbInfo->autopatchers()) {
+                    PatchInfo::AutoPatcherArgs args;
+                    if (fbAp->args()) {
+                        for (auto const *fbArg : *fbAp->args()) {
+                            args[toString(fbArg->key())] =
+                                    toString(fbArg->value());
+                        }
+                    }
+                    info->addAutoPatcher(toString(fbAp->name()),
+                                         std::move(args));
+                }
+            }
+
+            loaded.push_back(info);
+        }
+    }
+
+    infos->insert(infos->end(), loaded.begin(), loaded.end());
+
+    return true;
+}
+
+// Create a uniquely named file next to path for writing
+static FILE * openTemporaryFile(const std::string &path,
+                                std::string *tempPath)
+{
+#ifdef _WIN32
+    for (int tries = 0; tries < 256; ++tries) {
+        boost::filesystem::path p = boost::filesystem::unique_path(
+                path + ".%%%%%%%%.tmp");
+        int fd = _wopen(p.c_str(),
+                        _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY,
+                        _S_IREAD | _S_IWRITE);
+        if (fd >= 0) {
+            *tempPath = p.string();
+            return _fdopen(fd, "wb");
+        } else if (errno != EEXIST) {
+            break;
+        }
+    }
+
+    return nullptr;
+#else
+    // mkstemp modifies buffer
+    std::string pathTemplate = path + ".XXXXXX";
+    std::vector<char> buf(pathTemplate.begin(), pathTemplate.end());
+    buf.push_back('\0');
+
+    int fd = mkstemp(buf.data());
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    // mkstemp() creates the file with 0600 permissions
+    fchmod(fd, 0644);
+
+    *tempPath = buf.data();
+
+    FILE *fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        std::remove(tempPath->c_str());
+    }
+    return fp;
+#endif
+}
+
+/*!
+ * \brief Write PatchInfos to the cache
+ *
+ * The cache is written to a uniquely named temporary file in the same
+ * directory and then renamed over \a path so that concurrent readers never see
+ * a partially written cache and concurrent writers don't clobber each other.
+ *
+ * \param path Path to cache file
+ * \param key Key (from patchInfoCacheKey())
+ * \param infos PatchInfos to write
+ *
+ * \return Whether the cache was successfully written
+ */
+bool savePatchInfoCache(const std::string &path, uint64_t key,
+                        const std::vector<PatchInfo *> &infos)
+{
+    flatbuffers::FlatBufferBuilder fbb;
+
+    std::vector<flatbuffers::Offset<cache::PatchInfo>> fbInfos;
+    fbInfos.reserve(infos.size());
+
+    for (const PatchInfo *info : infos) {
+        std::vector<flatbuffers::Offset<cache::AutoPatcher>> fbAps;
+
+        for (const std::string &apName : info->autoPatchers()) {
+            std::vector<flatbuffers::Offset<cache::AutoPatcherArg>> fbArgs;
+
+            for (auto const &arg : info->autoPatcherArgs(apName)) {
+                fbArgs.push_back(cache::CreateAutoPatcherArg(
+                        fbb, fbb.CreateString(arg.first),
+                        fbb.CreateString(arg.second)));
+            }
+
+            fbAps.push_back(cache::CreateAutoPatcher(
+                    fbb, fbb.CreateString(apName), fbb.CreateVector(fbArgs)));
+        }
+
+        fbInfos.push_back(cache::CreatePatchInfo(
+                fbb,
+                fbb.CreateString(info->id()),
+                fbb.CreateString(info->name()),
+                fbb.CreateVectorOfStrings(info->regexes()),
+                fbb.CreateVectorOfStrings(info->excludeRegexes()),
+                info->hasBootImage(),
+                fbb.CreateString(info->ramdisk()),
+                fbb.CreateVector(fbAps),
+                info->deviceCheck()));
+    }
+
+    auto root = cache::CreatePatchInfoCache(
+            fbb, key, fbb.CreateString(LIBMBP_VERSION),
+            fbb.CreateVector(fbInfos));
+    cache::FinishPatchInfoCacheBuffer(fbb, root);
+
+    std::string tempPath;
+
+    FILE *fp = openTemporaryFile(path, &tempPath);
+    if (!fp) {
+        FLOGW("{}: Failed to create temporary file", path);
+        return false;
+    }
+
+    bool ok = std::fwrite(fbb.GetBufferPointer(), 1, fbb.GetSize(), fp)
+            == fbb.GetSize();
+    ok = std::fclose(fp) == 0 && ok;
+
+    if (!ok) {
+        FLOGW("{}: Failed to write patchinfo cache", tempPath);
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    // rename() does not replace existing files on Windows
+    std::remove(path.c_str());
+#endif
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        FLOGW("{}: Failed to move patchinfo cache into place", path);
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}
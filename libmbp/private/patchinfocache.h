@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+
+namespace mbp
+{
+
+class PatchInfo;
+
+/*! \cond INTERNAL */
+struct PatchInfoFile
+{
+    // PatchInfo ID (path relative to the patchinfos directory without .xml)
+    std::string id;
+    uint64_t size;
+    // Modification time in nanoseconds (100ns intervals on Windows)
+    int64_t mtime;
+};
+/*! \endcond */
+
+uint64_t patchInfoCacheKey(std::vector<PatchInfoFile> files);
+
+bool loadPatchInfoCache(const std::string &path, uint64_t key,
+                        std::vector<PatchInfo *> *infos);
+bool savePatchInfoCache(const std::string &path, uint64_t key,
+                        const std::vector<PatchInfo *> &infos);
+
+}
@@ -0,0 +1,209 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_PATCHINFOCACHE_MBP_CACHE_H_
+#define FLATBUFFERS_GENERATED_PATCHINFOCACHE_MBP_CACHE_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbp {
+namespace cache {
+
+struct AutoPatcherArg;
+struct AutoPatcher;
+struct PatchInfo;
+struct PatchInfoCache;
+
+struct AutoPatcherArg : private flatbuffers::Table {
+  const flatbuffers::String *key() const { return GetPointer<const flatbuffers::String *>(4); }
+  const flatbuffers::String *value() const { return GetPointer<const flatbuffers::String *>(6); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 4 /* key */) &&
+           verifier.Verify(key()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 6 /* value */) &&
+           verifier.Verify(value()) &&
+           verifier.EndTable();
+  }
+};
+
+struct AutoPatcherArgBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_key(flatbuffers::Offset<flatbuffers::String> key) { fbb_.AddOffset(4, key); }
+  void add_value(flatbuffers::Offset<flatbuffers::String> value) { fbb_.AddOffset(6, value); }
+  AutoPatcherArgBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  AutoPatcherArgBuilder &operator=(const AutoPatcherArgBuilder &);
+  flatbuffers::Offset<AutoPatcherArg> Finish() {
+    auto o = flatbuffers::Offset<AutoPatcherArg>(fbb_.EndTable(start_, 2));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<AutoPatcherArg> CreateAutoPatcherArg(flatbuffers::FlatBufferBuilder &_fbb,
+   flatbuffers::Offset<flatbuffers::String> key = 0,
+   flatbuffers::Offset<flatbuffers::String> value = 0) {
+  AutoPatcherArgBuilder builder_(_fbb);
+  builder_.add_value(value);
+  builder_.add_key(key);
+  return builder_.Finish();
+}
+
+struct AutoPatcher : private flatbuffers::Table {
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(4); }
+  const flatbuffers::Vector<flatbuffers::Offset<AutoPatcherArg>> *args() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<AutoPatcherArg>> *>(6); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 4 /* name */) &&
+           verifier.Verify(name()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 6 /* args */) &&
+           verifier.Verify(args()) &&
+           verifier.VerifyVectorOfTables(args()) &&
+           verifier.EndTable();
+  }
+};
+
+struct AutoPatcherBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(4, name); }
+  void add_args(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<AutoPatcherArg>>> args) { fbb_.AddOffset(6, args); }
+  AutoPatcherBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  AutoPatcherBuilder &operator=(const AutoPatcherBuilder &);
+  flatbuffers::Offset<AutoPatcher> Finish() {
+    auto o = flatbuffers::Offset<AutoPatcher>(fbb_.EndTable(start_, 2));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<AutoPatcher> CreateAutoPatcher(flatbuffers::FlatBufferBuilder &_fbb,
+   flatbuffers::Offset<flatbuffers::String> name = 0,
+   flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<AutoPatcherArg>>> args = 0) {
+  AutoPatcherBuilder builder_(_fbb);
+  builder_.add_args(args);
+  builder_.add_name(name);
+  return builder_.Finish();
+}
+
+struct PatchInfo : private flatbuffers::Table {
+  const flatbuffers::String *id() const { return GetPointer<const flatbuffers::String *>(4); }
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(6); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *regexes() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(8); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *exclude_regexes() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(10); }
+  uint8_t has_boot_image() const { return GetField<uint8_t>(12, 0); }
+  const flatbuffers::String *ramdisk() const { return GetPointer<const flatbuffers::String *>(14); }
+  const flatbuffers::Vector<flatbuffers::Offset<AutoPatcher>> *autopatchers() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<AutoPatcher>> *>(16); }
+  uint8_t device_check() const { return GetField<uint8_t>(18, 0); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 4 /* id */) &&
+           verifier.Verify(id()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 6 /* name */) &&
+           verifier.Verify(name()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 8 /* regexes */) &&
+           verifier.Verify(regexes()) &&
+           verifier.VerifyVectorOfStrings(regexes()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 10 /* exclude_regexes */) &&
+           verifier.Verify(exclude_regexes()) &&
+           verifier.VerifyVectorOfStrings(exclude_regexes()) &&
+           VerifyField<uint8_t>(verifier, 12 /* has_boot_image */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 14 /* ramdisk */) &&
+           verifier.Verify(ramdisk()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 16 /* autopatchers */) &&
+           verifier.Verify(autopatchers()) &&
+           verifier.VerifyVectorOfTables(autopatchers()) &&
+           VerifyField<uint8_t>(verifier, 18 /* device_check */) &&
+           verifier.EndTable();
+  }
+};
+
+struct PatchInfoBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_id(flatbuffers::Offset<flatbuffers::String> id) { fbb_.AddOffset(4, id); }
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(6, name); }
+  void add_regexes(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> regexes) { fbb_.AddOffset(8, regexes); }
+  void add_exclude_regexes(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> exclude_regexes) { fbb_.AddOffset(10, exclude_regexes); }
+  void add_has_boot_image(uint8_t has_boot_image) { fbb_.AddElement<uint8_t>(12, has_boot_image, 0); }
+  void add_ramdisk(flatbuffers::Offset<flatbuffers::String> ramdisk) { fbb_.AddOffset(14, ramdisk); }
+  void add_autopatchers(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<AutoPatcher>>> autopatchers) { fbb_.AddOffset(16, autopatchers); }
+  void add_device_check(uint8_t device_check) { fbb_.AddElement<uint8_t>(18, device_check, 0); }
+  PatchInfoBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  PatchInfoBuilder &operator=(const PatchInfoBuilder &);
+  flatbuffers::Offset<PatchInfo> Finish() {
+    auto o = flatbuffers::Offset<PatchInfo>(fbb_.EndTable(start_, 8));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PatchInfo> CreatePatchInfo(flatbuffers::FlatBufferBuilder &_fbb,
+   flatbuffers::Offset<flatbuffers::String> id = 0,
+   flatbuffers::Offset<flatbuffers::String> name = 0,
+   flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> regexes = 0,
+   flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> exclude_regexes = 0,
+   uint8_t has_boot_image = 0,
+   flatbuffers::Offset<flatbuffers::String> ramdisk = 0,
+   flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<AutoPatcher>>> autopatchers = 0,
+   uint8_t device_check = 0) {
+  PatchInfoBuilder builder_(_fbb);
+  builder_.add_autopatchers(autopatchers);
+  builder_.add_ramdisk(ramdisk);
+  builder_.add_exclude_regexes(exclude_regexes);
+  builder_.add_regexes(regexes);
+  builder_.add_name(name);
+  builder_.add_id(id);
+  builder_.add_device_check(device_check);
+  builder_.add_has_boot_image(has_boot_image);
+  return builder_.Finish();
+}
+
+struct PatchInfoCache : private flatbuffers::Table {
+  uint64_t key() const { return GetField<uint64_t>(4, 0); }
+  const flatbuffers::String *version() const { return GetPointer<const flatbuffers::String *>(6); }
+  const flatbuffers::Vector<flatbuffers::Offset<PatchInfo>> *patchinfos() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<PatchInfo>> *>(8); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, 4 /* key */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 6 /* version */) &&
+           verifier.Verify(version()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 8 /* patchinfos */) &&
+           verifier.Verify(patchinfos()) &&
+           verifier.VerifyVectorOfTables(patchinfos()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PatchInfoCacheBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_key(uint64_t key) { fbb_.AddElement<uint64_t>(4, key, 0); }
+  void add_version(flatbuffers::Offset<flatbuffers::String> version) { fbb_.AddOffset(6, version); }
+  void add_patchinfos(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PatchInfo>>> patchinfos) { fbb_.AddOffset(8, patchinfos); }
+  PatchInfoCacheBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  PatchInfoCacheBuilder &operator=(const PatchInfoCacheBuilder &);
+  flatbuffers::Offset<PatchInfoCache> Finish() {
+    auto o = flatbuffers::Offset<PatchInfoCache>(fbb_.EndTable(start_, 3));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PatchInfoCache> CreatePatchInfoCache(flatbuffers::FlatBufferBuilder &_fbb,
+   uint64_t key = 0,
+   flatbuffers::Offset<flatbuffers::String> version = 0,
+   flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PatchInfo>>> patchinfos = 0) {
+  PatchInfoCacheBuilder builder_(_fbb);
+  builder_.add_key(key);
+  builder_.add_patchinfos(patchinfos);
+  builder_.add_version(version);
+  return builder_.Finish();
+}
+
+inline const PatchInfoCache *GetPatchInfoCache(const void *buf) { return flatbuffers::GetRoot<PatchInfoCache>(buf); }
+
+inline bool VerifyPatchInfoCacheBuffer(flatbuffers::Verifier &verifier) { return verifier.VerifyBuffer<PatchInfoCache>(); }
+
+inline void FinishPatchInfoCacheBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<PatchInfoCache> root) { fbb.Finish(root); }
+
+}  // namespace cache
+}  // namespace mbp
+
+#endif  // FLATBUFFERS_GENERATED_PATCHINFOCACHE_MBP_CACHE_H_
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/patternscanner.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace mbp
+{
+
+// Maximum number of distinct two byte prefixes to compare in the SIMD loop
+static const std::size_t MaxSimdPrefixes = 8;
+
+/*!
+ * \brief Add a pattern to search for
+ *
+ * \param pattern Pattern bytes
+ * \param size Size of pattern (must be at least 2 bytes)
+ *
+ * \return ID of the pattern that is passed to the match callback
+ */
+std::size_t PatternScanner::addPattern(const void *pattern, std::size_t size)
+{
+    assert(size >= 2);
+
+    auto ptr = reinterpret_cast<const unsigned char *>(pattern);
+    std::size_t id = m_patterns.size();
+    m_patterns.emplace_back(ptr, ptr + size);
+
+    for (Prefix &prefix : m_prefixes) {
+        if (prefix.first == ptr[0] && prefix.second == ptr[1]) {
+            prefix.patterns.push_back(id);
+            return id;
+        }
+    }
+
+    Prefix prefix;
+    prefix.first = ptr[0];
+    prefix.second = ptr[1];
+    prefix.patterns.push_back(id);
+    m_prefixes.push_back(std::move(prefix));
+
+    return id;
+}
+
+/*!
+ * \brief Find all occurrences of the patterns
+ *
+ * The callback is called for every match in order of increasing offset.
+ * Matches at the same offset are reported in an unspecified order.
+ *
+ * \param data Data to search
+ * \param size Size of data
+ * \param callback Function to call for each match. Scanning stops if it
+ *                 returns false.
+ */
+void PatternScanner::scan(const unsigned char *data, std::size_t size,
+                          const MatchCallback &callback) const
+{
+    if (m_prefixes.empty() || size < 2) {
+        return;
+    }
+
+    std::size_t offset = 0;
+
+    if (!scanSimd(data, size, &offset, callback)) {
+        return;
+    }
+
+    if (m_prefixes.size() == 1) {
+        // memchr() is vectorized by pretty much every libc
+        const Prefix &prefix = m_prefixes[0];
+
+        while (offset < size - 1) {
+            auto ptr = reinterpret_cast<const unsigned char *>(
+                    std::memchr(data + offset, prefix.first,
+                                size - 1 - offset));
+            if (!ptr) {
+                break;
+            }
+
+            offset = ptr - data;
+
+            if (!checkPrefix(prefix, data, size, offset, callback)) {
+                return;
+            }
+
+            ++offset;
+        }
+    } else {
+        bool firstBytes[256] = {};
+        for (const Prefix &prefix : m_prefixes) {
+            firstBytes[prefix.first] = true;
+        }
+
+        for (; offset < size - 1; ++offset) {
+            if (firstBytes[data[offset]]
+                    && !checkOffset(data, size, offset, callback)) {
+                return;
+            }
+        }
+    }
+}
+
+bool PatternScanner::checkPrefix(const Prefix &prefix,
+                                 const unsigned char *data, std::size_t size,
+                                 std::size_t offset,
+                                 const MatchCallback &callback) const
+{
+    if (data[offset] != prefix.first || data[offset + 1] != prefix.second) {
+        return true;
+    }
+
+    for (std::size_t id : prefix.patterns) {
+        const std::vector<unsigned char> &pattern = m_patterns[id];
+
+        if (pattern.size() <= size - offset
+                && std::memcmp(data + offset + 2, pattern.data() + 2,
+                               pattern.size() - 2) == 0
+                && !callback(id, offset)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PatternScanner::checkOffset(const unsigned char *data, std::size_t size,
+                                 std::size_t offset,
+                                 const MatchCallback &callback) const
+{
+    for (const Prefix &prefix : m_prefixes) {
+        if (!checkPrefix(prefix, data, size, offset, callback)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * Compare 16 positions at a time against the first two bytes of each pattern.
+ * \a offset is advanced to the first position that has not been checked.
+ * Returns false if the callback stopped the scan.
+ */
+bool PatternScanner::scanSimd(const unsigned char *data, std::size_t size,
+                              std::size_t *offset,
+                              const MatchCallback &callback) const
+{
+#if defined(__SSE2__)
+    if (m_prefixes.size() > MaxSimdPrefixes) {
+        return true;
+    }
+
+    __m128i first[MaxSimdPrefixes];
+    __m128i second[MaxSimdPrefixes];
+    std::size_t count = m_prefixes.size();
+
+    for (std::size_t i = 0; i < count; ++i) {
+        first[i] = _mm_set1_epi8(static_cast<char>(m_prefixes[i].first));
+        second[i] = _mm_set1_epi8(static_cast<char>(m_prefixes[i].second));
+    }
+
+    std::size_t pos = *offset;
+
+    // The second load reads one byte past the 16 positions being checked
+    for (; size - pos >= 17; pos += 16) {
+        __m128i chunk0 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(data + pos));
+        __m128i chunk1 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(data + pos + 1));
+        __m128i eq = _mm_setzero_si128();
+
+        for (std::size_t i = 0; i < count; ++i) {
+            eq = _mm_or_si128(eq, _mm_and_si128(
+                    _mm_cmpeq_epi8(chunk0, first[i]),
+                    _mm_cmpeq_epi8(chunk1, second[i])));
+        }
+
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(eq));
+
+        while (mask != 0) {
+            unsigned int bit = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            if (!checkOffset(data, size, pos + bit, callback)) {
+                return false;
+            }
+        }
+    }
+
+    *offset = pos;
+#else
+    (void) data;
+    (void) size;
+    (void) offset;
+    (void) callback;
+#endif
+
+    return true;
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+
+namespace mbp
+{
+
+/*!
+ * Finds all occurrences of a set of byte patterns in a single pass over the
+ * data. Candidate positions are found by looking for the first two bytes of
+ * every pattern (using SIMD where available) and only those positions are
+ * compared against the full patterns.
+ */
+class PatternScanner
+{
+public:
+    // Return false to stop scanning
+    typedef std::function<bool(std::size_t patternId, std::size_t offset)>
+            MatchCallback;
+
+    std::size_t addPattern(const void *pattern, std::size_t size);
+
+    void scan(const unsigned char *data, std::size_t size,
+              const MatchCallback &callback) const;
+
+private:
+    struct Prefix {
+        unsigned char first;
+        unsigned char second;
+        std::vector<std::size_t> patterns;
+    };
+
+    std::vector<std::vector<unsigned char>> m_patterns;
+    std::vector<Prefix> m_prefixes;
+
+    bool checkPrefix(const Prefix &prefix, const unsigned char *data,
+                     std::size_t size, std::size_t offset,
+                     const MatchCallback &callback) const;
+    bool checkOffset(const unsigned char *data, std::size_t size,
+                     std::size_t offset, const MatchCallback &callback) const;
+    bool scanSimd(const unsigned char *data, std::size_t size,
+                  std::size_t *offset, const MatchCallback &callback) const;
+};
+
+}
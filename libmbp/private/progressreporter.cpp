@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "private/progressreporter.h"
+
+
+namespace mbp
+{
+
+const ProgressReporter::Clock::duration ProgressReporter::MinInterval =
+        std::chrono::milliseconds(50);
+
+// Don't bother checking the time unless at least this fraction of the total
+// size has been processed since the last check
+static const uint64_t ByteStepDivisor = 1000;
+
+ProgressReporter::ProgressReporter(Patcher::ProgressUpdatedCallback progressCb,
+                                   Patcher::FilesUpdatedCallback filesCb,
+                                   Patcher::DetailsUpdatedCallback detailsCb,
+                                   void *userData)
+    : m_progressCb(progressCb), m_filesCb(filesCb), m_detailsCb(detailsCb),
+    m_userData(userData), m_startTime(Clock::now())
+{
+}
+
+/*!
+ * \brief Set the callback for structured progress events
+ */
+void ProgressReporter::setEventCallback(Patcher::ProgressEventCallback eventCb,
+                                        void *eventUserData)
+{
+    m_eventCb = eventCb;
+    m_eventUserData = eventUserData;
+}
+
+/*!
+ * \brief Update the number of bytes processed
+ *
+ * A change in \a maxBytes is delivered immediately.
+ */
+void ProgressReporter::setBytes(uint64_t bytes, uint64_t maxBytes)
+{
+    if (bytes == m_bytes && maxBytes == m_maxBytes) {
+        return;
+    }
+
+    bool force = maxBytes != m_maxBytes;
+
+    m_bytes = bytes;
+    m_maxBytes = maxBytes;
+    m_progressDirty = true;
+
+    if (!force && bytes >= m_checkedBytes
+            && bytes - m_checkedBytes < maxBytes / ByteStepDivisor) {
+        return;
+    }
+
+    m_checkedBytes = bytes;
+    maybeFlush(force);
+}
+
+/*!
+ * \brief Update the number of files processed
+ *
+ * A change in \a maxFiles is delivered immediately.
+ */
+void ProgressReporter::setFiles(uint64_t files, uint64_t maxFiles)
+{
+    if (files == m_files && maxFiles == m_maxFiles) {
+        return;
+    }
+
+    bool force = maxFiles != m_maxFiles;
+
+    m_files = files;
+    m_maxFiles = maxFiles;
+    m_filesDirty = true;
+
+    maybeFlush(force);
+}
+
+/*!
+ * \brief Update the details text (usually the current file)
+ */
+void ProgressReporter::setDetails(const std::string &details)
+{
+    m_details = details;
+    m_detailsDirty = true;
+
+    maybeFlush(false);
+}
+
+/*!
+ * \brief Deliver all pending updates now
+ */
+void ProgressReporter::flush()
+{
+    maybeFlush(true);
+}
+
+/*!
+ * \brief Average throughput since the reporter was created
+ */
+double ProgressReporter::bytesPerSecond() const
+{
+    std::chrono::duration<double> elapsed = Clock::now() - m_startTime;
+    if (elapsed.count() <= 0) {
+        return 0;
+    }
+    return m_bytes / elapsed.count();
+}
+
+/*!
+ * \brief Estimated time remaining in seconds or -1 if unknown
+ */
+double ProgressReporter::etaSeconds() const
+{
+    double rate = bytesPerSecond();
+    if (rate <= 0 || m_bytes > m_maxBytes) {
+        return -1;
+    }
+    return (m_maxBytes - m_bytes) / rate;
+}
+
+void ProgressReporter::maybeFlush(bool force)
+{
+    Clock::time_point now = Clock::now();
+
+    if (!force && m_flushed && now - m_lastFlush < MinInterval) {
+        return;
+    }
+
+    m_flushed = true;
+    m_lastFlush = now;
+
+    if (m_eventCb && (m_progressDirty || m_filesDirty || m_detailsDirty)) {
+        Patcher::ProgressEvent event;
+        event.bytes = m_bytes;
+        event.maxBytes = m_maxBytes;
+        event.files = m_files;
+        event.maxFiles = m_maxFiles;
+        event.currentEntry = m_details;
+        event.bytesPerSecond = bytesPerSecond();
+        event.etaSeconds = etaSeconds();
+        m_eventCb(event, m_eventUserData);
+    }
+
+    if (m_filesDirty) {
+        m_filesDirty = false;
+        if (m_filesCb) {
+            m_filesCb(m_files, m_maxFiles, m_userData);
+        }
+    }
+
+    if (m_detailsDirty) {
+        m_detailsDirty = false;
+        if (m_detailsCb) {
+            m_detailsCb(m_details, m_userData);
+        }
+    }
+
+    if (m_progressDirty) {
+        m_progressDirty = false;
+        if (m_progressCb) {
+            m_progressCb(m_bytes, m_maxBytes, m_userData);
+        }
+    }
+}
+
+}
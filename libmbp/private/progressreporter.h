@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "patcherinterface.h"
+
+
+namespace mbp
+{
+
+/*!
+ * \brief Rate-limited delivery of a Patcher's progress callbacks
+ *
+ * Progress, file count and details updates are coalesced and delivered at
+ * most once per MinInterval, so patching a zip with tens of thousands of
+ * small entries doesn't spend its time in the callbacks (which usually end up
+ * as cross-thread signals in a UI). Only the latest values are delivered. If
+ * an event callback is set, it receives all of the values (plus throughput and
+ * ETA) whenever any of them is delivered.
+ *
+ * This class is not thread safe. All methods must be called from the thread
+ * that the callbacks should be called from.
+ */
+class ProgressReporter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const Clock::duration MinInterval;
+
+    ProgressReporter(Patcher::ProgressUpdatedCallback progressCb,
+                     Patcher::FilesUpdatedCallback filesCb,
+                     Patcher::DetailsUpdatedCallback detailsCb,
+                     void *userData);
+
+    void setEventCallback(Patcher::ProgressEventCallback eventCb,
+                          void *eventUserData);
+
+    void setBytes(uint64_t bytes, uint64_t maxBytes);
+    void setFiles(uint64_t files, uint64_t maxFiles);
+    void setDetails(const std::string &details);
+
+    void flush();
+
+    double bytesPerSecond() const;
+    double etaSeconds() const;
+
+private:
+    void maybeFlush(bool force);
+
+    Patcher::ProgressUpdatedCallback m_progressCb;
+    Patcher::FilesUpdatedCallback m_filesCb;
+    Patcher::DetailsUpdatedCallback m_detailsCb;
+    void *m_userData;
+    Patcher::ProgressEventCallback m_eventCb = nullptr;
+    void *m_eventUserData = nullptr;
+
+    uint64_t m_bytes = 0;
+    uint64_t m_maxBytes = 0;
+    uint64_t m_files = 0;
+    uint64_t m_maxFiles = 0;
+    std::string m_details;
+
+    bool m_progressDirty = false;
+    bool m_filesDirty = false;
+    bool m_detailsDirty = false;
+
+    // Byte count when the clock was last checked
+    uint64_t m_checkedBytes = 0;
+
+    Clock::time_point m_startTime;
+    Clock::time_point m_lastFlush;
+    bool m_flushed = false;
+};
+
+}
@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "private/unifieddiff.h"
+
+#include <algorithm>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "private/logging.h"
+
+
+namespace mbp
+{
+
+/*! \cond INTERNAL */
+struct Slice
+{
+    const char *data;
+    std::size_t size;
+    bool newline;
+};
+/*! \endcond */
+
+static bool startsWith(const std::string &str, const char *prefix)
+{
+    return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static void splitLines(const std::string &str, std::vector<Slice> *lines)
+{
+    const char *data = str.data();
+    std::size_t size = str.size();
+    std::size_t pos = 0;
+
+    while (pos < size) {
+        auto nl = reinterpret_cast<const char *>(
+                memchr(data + pos, '\n', size - pos));
+        if (nl) {
+            lines->push_back({ data + pos, (std::size_t) (nl - data) - pos,
+                               true });
+            pos = nl - data + 1;
+        } else {
+            lines->push_back({ data + pos, size - pos, false });
+            pos = size;
+        }
+    }
+}
+
+/*!
+ * Get the path from a "--- " or "+++ " line. Anything after a tab (usually a
+ * timestamp) is ignored.
+ */
+static std::string parsePath(const std::string &line)
+{
+    std::size_t begin = line.find_first_not_of(" \t", 4);
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+
+    std::size_t end = line.find('\t', begin);
+    if (end == std::string::npos) {
+        end = line.size();
+    }
+
+    std::string path = line.substr(begin, end - begin);
+
+    if (path.size() >= 2 && path.front() == '"' && path.back() == '"') {
+        path.erase(path.begin());
+        path.pop_back();
+    }
+
+    return path;
+}
+
+static void stripPath(std::string *path, unsigned int strip)
+{
+    for (unsigned int i = 0; i < strip; ++i) {
+        auto pos = path->find('/');
+        if (pos == std::string::npos) {
+            break;
+        }
+        path->erase(0, pos + 1);
+    }
+}
+
+static bool parseRange(const char **ptr, std::size_t *start, std::size_t *count)
+{
+    char *end;
+
+    *start = strtoul(*ptr, &end, 10);
+    if (end == *ptr) {
+        return false;
+    }
+
+    if (*end == ',') {
+        const char *countPtr = end + 1;
+        *count = strtoul(countPtr, &end, 10);
+        if (end == countPtr) {
+            return false;
+        }
+    } else {
+        *count = 1;
+    }
+
+    *ptr = end;
+    return true;
+}
+
+// Parse "@@ -<start>[,<count>] +<start>[,<count>] @@"
+static bool parseHunkHeader(const std::string &line, UnifiedDiff::Hunk *hunk)
+{
+    const char *ptr = line.c_str() + 3;
+
+    if (*ptr++ != '-' || !parseRange(&ptr, &hunk->oldStart, &hunk->oldCount)
+            || *ptr++ != ' ' || *ptr++ != '+'
+            || !parseRange(&ptr, &hunk->newStart, &hunk->newCount)) {
+        return false;
+    }
+
+    return strncmp(ptr, " @@", 3) == 0;
+}
+
+/*!
+ * \brief Parse a unified diff
+ *
+ * \param contents Contents of the diff
+ * \param strip Number of leading path components to strip from the filenames
+ *              (like `patch -p<strip>`)
+ *
+ * \return Whether the diff was successfully parsed
+ */
+bool UnifiedDiff::parse(const std::string &contents, unsigned int strip)
+{
+    m_files.clear();
+
+    std::vector<std::string> lines;
+    std::size_t pos = 0;
+    while (pos <= contents.size()) {
+        std::size_t nl = contents.find('\n', pos);
+        if (nl == std::string::npos) {
+            lines.push_back(contents.substr(pos));
+            break;
+        }
+        lines.push_back(contents.substr(pos, nl - pos));
+        pos = nl + 1;
+    }
+
+    std::size_t i = 0;
+
+    while (i < lines.size()) {
+        // Skip everything (eg. "diff --git" and "index" lines) until the next
+        // file header
+        if (!startsWith(lines[i], "--- ") || i + 1 == lines.size()
+                || !startsWith(lines[i + 1], "+++ ")) {
+            ++i;
+            continue;
+        }
+
+        FilePatch fp;
+        std::string oldPath = parsePath(lines[i]);
+        std::string newPath = parsePath(lines[i + 1]);
+        fp.isNew = oldPath == "/dev/null";
+        fp.path = fp.isNew ? newPath : oldPath;
+        i += 2;
+
+        // Skip files containing escaped characters
+        bool skip = fp.path.find('\\') != std::string::npos;
+        if (skip) {
+            FLOGW("Skipping file with escaped characters in filename: {}",
+                  fp.path);
+        }
+
+        stripPath(&fp.path, strip);
+
+        while (i < lines.size() && startsWith(lines[i], "@@ ")) {
+            Hunk hunk;
+            hunk.oldNoNewline = false;
+            hunk.newNoNewline = false;
+
+            if (!parseHunkHeader(lines[i], &hunk)) {
+                FLOGE("Invalid hunk header: {}", lines[i]);
+                return false;
+            }
+            ++i;
+
+            std::size_t oldLeft = hunk.oldCount;
+            std::size_t newLeft = hunk.newCount;
+
+            while (i < lines.size()) {
+                const std::string &line = lines[i];
+
+                // "\ No newline at end of file" applies to the previous line
+                if (startsWith(line, "\\")) {
+                    if (hunk.lines.empty()) {
+                        break;
+                    }
+                    char prev = hunk.lines.back().type;
+                    hunk.oldNoNewline = hunk.oldNoNewline || prev != '+';
+                    hunk.newNoNewline = hunk.newNoNewline || prev != '-';
+                    ++i;
+                    continue;
+                }
+
+                if (oldLeft == 0 && newLeft == 0) {
+                    break;
+                }
+
+                // Some editors strip the space from empty context lines
+                char type = line.empty() ? ' ' : line[0];
+
+                if ((type == ' ' && (oldLeft == 0 || newLeft == 0))
+                        || (type == '-' && oldLeft == 0)
+                        || (type == '+' && newLeft == 0)
+                        || (type != ' ' && type != '-' && type != '+')) {
+                    FLOGE("{}: Malformed hunk at line {}", fp.path, i + 1);
+                    return false;
+                }
+
+                if (type != '+') {
+                    --oldLeft;
+                }
+                if (type != '-') {
+                    --newLeft;
+                }
+
+                hunk.lines.push_back({ type, line.empty()
+                        ? std::string() : line.substr(1) });
+                ++i;
+            }
+
+            if (oldLeft != 0 || newLeft != 0) {
+                FLOGE("{}: Truncated hunk at end of patch", fp.path);
+                return false;
+            }
+
+            fp.hunks.push_back(std::move(hunk));
+        }
+
+        if (!skip) {
+            m_files.push_back(std::move(fp));
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Files patched by the diff in the order they appear
+ */
+const std::vector<UnifiedDiff::FilePatch> & UnifiedDiff::files() const
+{
+    return m_files;
+}
+
+/*!
+ * \brief Find the patch for a file
+ *
+ * \param path Path of the file (with the leading components stripped)
+ *
+ * \return Patch for the file or nullptr if the diff does not touch it
+ */
+const UnifiedDiff::FilePatch * UnifiedDiff::file(const std::string &path) const
+{
+    for (const FilePatch &fp : m_files) {
+        if (fp.path == path) {
+            return &fp;
+        }
+    }
+
+    return nullptr;
+}
+
+/*!
+ * Check if old lines [begin, end) of a hunk match the file when the first old
+ * line is at \a where. As in GNU patch, a line only matches if it also has the
+ * same newline state.
+ */
+static bool matchesAt(const std::vector<Slice> &src, long where,
+                      const std::vector<const UnifiedDiff::HunkLine *> &pattern,
+                      bool noNewline, std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; ++i) {
+        const Slice &line = src[where + i];
+        const std::string &text = pattern[i]->text;
+        bool newline = !(noNewline && i == pattern.size() - 1);
+
+        if (line.newline != newline || line.size != text.size()
+                || memcmp(line.data, text.data(), line.size) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * Copy lines [begin, end) of the original file to the output. Like GNU patch,
+ * if the output does not end with a newline, one is added before the first
+ * copied line.
+ */
+static void copyLines(const std::vector<Slice> &src, std::size_t begin,
+                      std::size_t end, std::string *out, bool *afterNewline)
+{
+    end = std::min(end, src.size());
+
+    for (std::size_t i = begin; i < end; ++i) {
+        if (!*afterNewline) {
+            out->push_back('\n');
+        }
+        out->append(src[i].data, src[i].size);
+        if (src[i].newline) {
+            out->push_back('\n');
+        }
+        *afterNewline = src[i].newline;
+    }
+}
+
+/*!
+ * Find the line where the first old line of a hunk is, like GNU patch's
+ * locate_hunk(). Up to \a prefixFuzz leading and \a suffixFuzz trailing old
+ * lines are not compared. If either is negative, that end of the hunk has less
+ * context than the other, so the hunk must be at that end of the file (the
+ * start only if the header also says so).
+ *
+ * \return Index of the line or -1 if the hunk was not found
+ */
+static long findHunk(const std::vector<Slice> &src,
+                     const std::vector<const UnifiedDiff::HunkLine *> &oldLines,
+                     bool noNewline, long firstGuess, bool atStart,
+                     long minWhere, std::size_t leading,
+                     long prefixFuzz, long suffixFuzz)
+{
+    long patternSize = static_cast<long>(oldLines.size());
+    long maxWhere = static_cast<long>(src.size()) - patternSize + suffixFuzz;
+
+    // A hunk that removes nothing and has no context matches anywhere
+    if (patternSize == 0) {
+        return firstGuess >= minWhere ? firstGuess : -1;
+    }
+
+    if (prefixFuzz < 0 && atStart) {
+        // Can only match the start of the file
+        if (minWhere <= static_cast<long>(leading) && maxWhere >= 0
+                && matchesAt(src, 0, oldLines, noNewline,
+                             0, patternSize - suffixFuzz)) {
+            return 0;
+        }
+        return -1;
+    } else if (prefixFuzz < 0) {
+        prefixFuzz = 0;
+    }
+
+    if (suffixFuzz < 0) {
+        // Can only match the end of the file
+        long where = static_cast<long>(src.size()) - patternSize;
+        if (where >= minWhere
+                && matchesAt(src, where, oldLines, noNewline,
+                             prefixFuzz, patternSize)) {
+            return where;
+        }
+        return -1;
+    }
+
+    long begin = prefixFuzz;
+    long end = patternSize - suffixFuzz;
+    long maxPosOffset = maxWhere - firstGuess;
+    long maxNegOffset = firstGuess - minWhere;
+    long maxOffset = std::max(maxPosOffset, maxNegOffset);
+
+    // Search outwards from the expected position
+    for (long offset = 0; offset <= maxOffset; ++offset) {
+        long after = firstGuess + offset;
+        long before = firstGuess - offset;
+
+        if (offset <= maxPosOffset && after >= minWhere
+                && matchesAt(src, after, oldLines, noNewline, begin, end)) {
+            return after;
+        }
+        if (offset > 0 && offset <= maxNegOffset && before <= maxWhere
+                && matchesAt(src, before, oldLines, noNewline, begin, end)) {
+            return before;
+        }
+    }
+
+    return -1;
+}
+
+/*!
+ * \brief Apply the hunks for one file
+ *
+ * Like GNU patch, each hunk is first looked for at the line given in its
+ * header (adjusted by how far the previous hunk was moved) and then at
+ * increasing distances from there. If it cannot be found, up to \a maxFuzz
+ * lines of context are ignored, starting with the end of the hunk that has
+ * more context. Until then, a hunk with less context at one end than at the
+ * other is only applied at that end of the file.
+ *
+ * \param patch Patch for the file
+ * \param in Original contents of the file
+ * \param out Output string for the patched contents. This is only valid if all
+ *            hunks were applied.
+ * \param results If not null, the result of every hunk is appended to this
+ * \param maxFuzz Maximum number of context lines to ignore
+ *
+ * \return Whether all hunks were applied
+ */
+bool UnifiedDiff::apply(const FilePatch &patch, const std::string &in,
+                        std::string *out, std::vector<HunkResult> *results,
+                        unsigned int maxFuzz)
+{
+    std::vector<Slice> src;
+    splitLines(in, &src);
+
+    std::string dst;
+    dst.reserve(in.size());
+    // Whether dst is empty or ends with a newline
+    bool afterNewline = true;
+
+    std::vector<const HunkLine *> oldLines;
+
+    // Next line of the original file that has not been copied to dst. The
+    // trailing context of a hunk is not consumed, so the next hunk's leading
+    // context may overlap it.
+    std::size_t cursor = 0;
+    // How far the previous hunk was from the position in its header
+    long lastOffset = 0;
+    bool ok = true;
+
+    for (std::size_t h = 0; h < patch.hunks.size(); ++h) {
+        const Hunk &hunk = patch.hunks[h];
+
+        oldLines.clear();
+        std::size_t newCount = 0;
+        // Index after the last line that is not an added line
+        std::size_t oldEnd = 0;
+
+        for (std::size_t i = 0; i < hunk.lines.size(); ++i) {
+            if (hunk.lines[i].type != '+') {
+                oldLines.push_back(&hunk.lines[i]);
+                oldEnd = i + 1;
+            }
+            if (hunk.lines[i].type != '-') {
+                ++newCount;
+            }
+        }
+
+        std::size_t leading = 0;
+        while (leading < hunk.lines.size()
+                && hunk.lines[leading].type == ' ') {
+            ++leading;
+        }
+        std::size_t trailing = 0;
+        while (trailing < hunk.lines.size() - leading
+                && hunk.lines[hunk.lines.size() - 1 - trailing].type == ' ') {
+            ++trailing;
+        }
+        std::size_t context = std::max(leading, trailing);
+
+        HunkResult result;
+        result.hunk = h;
+        result.applied = false;
+        result.offset = 0;
+        result.fuzz = 0;
+        result.line = 0;
+
+        // A hunk that removes nothing is inserted after line oldStart
+        long first = static_cast<long>(hunk.oldStart)
+                - (hunk.oldCount == 0 ? 0 : 1);
+        long where = -1;
+
+        for (unsigned int fuzz = 0; fuzz <= std::min<std::size_t>(
+                maxFuzz, context); ++fuzz) {
+            long prefixFuzz = static_cast<long>(fuzz + leading)
+                    - static_cast<long>(context);
+            long suffixFuzz = static_cast<long>(fuzz + trailing)
+                    - static_cast<long>(context);
+
+            where = findHunk(src, oldLines, hunk.oldNoNewline,
+                             first + lastOffset, first <= 0,
+                             static_cast<long>(cursor), leading,
+                             prefixFuzz, suffixFuzz);
+            if (where >= 0) {
+                result.applied = true;
+                result.fuzz = fuzz;
+                break;
+            }
+        }
+
+        if (!result.applied) {
+            ok = false;
+            if (results) {
+                results->push_back(result);
+            }
+            continue;
+        }
+
+        lastOffset = where - first;
+        result.offset = lastOffset;
+        result.line = where + 1;
+
+        std::size_t oldIndex = 0;
+        std::size_t newIndex = 0;
+
+        // Context lines are left in the original file so that they keep its
+        // newline state
+        for (std::size_t i = 0; i < hunk.lines.size(); ++i) {
+            const HunkLine &line = hunk.lines[i];
+
+            if (line.type == ' ') {
+                ++oldIndex;
+                ++newIndex;
+                continue;
+            }
+
+            copyLines(src, cursor, where + oldIndex, &dst, &afterNewline);
+            cursor = where + oldIndex;
+
+            if (line.type == '-') {
+                ++cursor;
+                ++oldIndex;
+                continue;
+            }
+
+            // GNU patch only completes a line from the end of the original
+            // file before lines added after the hunk's last old line
+            if (i >= oldEnd && !afterNewline) {
+                dst.push_back('\n');
+            }
+
+            ++newIndex;
+            afterNewline = !(newIndex == newCount && hunk.newNoNewline);
+            dst.append(line.text);
+            if (afterNewline) {
+                dst.push_back('\n');
+            }
+        }
+
+        if (results) {
+            results->push_back(result);
+        }
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    copyLines(src, cursor, src.size(), &dst, &afterNewline);
+
+    out->swap(dst);
+
+    return true;
+}
+
+}
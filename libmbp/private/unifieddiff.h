@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace mbp
+{
+
+/*!
+ * Parser and applier for unified diffs (the subset of `patch -p<N>` that the
+ * patches shipped with the patcher use). Parsed diffs are immutable, so one
+ * instance can be shared by any number of threads applying it.
+ */
+class UnifiedDiff
+{
+public:
+    struct HunkLine
+    {
+        // ' ' for context, '-' for removed lines, '+' for added lines
+        char type;
+        std::string text;
+    };
+
+    struct Hunk
+    {
+        // 1-based line numbers and line counts from the @@ header
+        std::size_t oldStart;
+        std::size_t oldCount;
+        std::size_t newStart;
+        std::size_t newCount;
+        std::vector<HunkLine> lines;
+        // Whether the last old/new line has no trailing newline
+        bool oldNoNewline;
+        bool newNoNewline;
+    };
+
+    struct FilePatch
+    {
+        // Path of the file to patch with the leading components stripped
+        std::string path;
+        // Whether the file is created by the patch (--- /dev/null)
+        bool isNew;
+        std::vector<Hunk> hunks;
+    };
+
+    struct HunkResult
+    {
+        // Index of the hunk in FilePatch::hunks
+        std::size_t hunk;
+        bool applied;
+        // Number of lines the hunk was moved from its expected position
+        long offset;
+        // Number of context lines at each end that were ignored
+        unsigned int fuzz;
+        // 1-based line in the original file where the hunk was applied
+        std::size_t line;
+    };
+
+    bool parse(const std::string &contents, unsigned int strip);
+
+    const std::vector<FilePatch> & files() const;
+    const FilePatch * file(const std::string &path) const;
+
+    static bool apply(const FilePatch &patch, const std::string &in,
+                      std::string *out, std::vector<HunkResult> *results,
+                      unsigned int maxFuzz = 2);
+
+private:
+    std::vector<FilePatch> m_files;
+};
+
+}
@@ -0,0 +1,614 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "private/updaterscriptrewriter.h"
+
+#include <cctype>
+#include <cstring>
+
+#include <boost/algorithm/string/replace.hpp>
+
+#include <cppformat/format.h>
+
+#include "device.h"
+
+
+namespace mbp
+{
+
+static const char *Mount
+        = "run_program(\"/update-binary-tool\", \"mount\", \"{}\");";
+static const char *Unmount
+        = "run_program(\"/update-binary-tool\", \"unmount\", \"{}\");";
+static const char *Format
+        = "run_program(\"/update-binary-tool\", \"format\", \"{}\");";
+
+static const char *PartitionPaths[] = { "/system", "/cache", "/data" };
+
+static const char *SystemImage = "/mb/system.img";
+
+// Quick hack for CM12
+static const char *Cm12UnmountLine
+        = "ifelse(is_mounted(\"/system\"), unmount(\"/system\"));";
+
+static const char *DeviceCheckBypass = "\"true\" == \"true\" || ";
+
+// Every line that a rule can change contains at least one of its keywords
+const UpdaterScriptRewriter::RuleEntry UpdaterScriptRewriter::Rules[] = {
+    { MountRule,        { "mount", nullptr },
+      &UpdaterScriptRewriter::applyMount },
+    { UnmountRule,      { "mount", nullptr },
+      &UpdaterScriptRewriter::applyUnmount },
+    { FormatRule,       { "format", "delete_recursive" },
+      &UpdaterScriptRewriter::applyFormat },
+    { BlockUpdateRule,  { "block_image_update", nullptr },
+      &UpdaterScriptRewriter::applySystemImage },
+    { ImageExtractRule, { "package_extract_file", nullptr },
+      &UpdaterScriptRewriter::applySystemImage },
+    { DeviceCheckRule,  { "assert", nullptr },
+      &UpdaterScriptRewriter::applyDeviceCheck },
+};
+
+UpdaterScriptRewriter::UpdaterScriptRewriter(const Device *device,
+                                             unsigned int rules)
+    : m_rules(rules)
+{
+    if (device) {
+        m_devs[System] = device->systemBlockDevs();
+        m_devs[Cache] = device->cacheBlockDevs();
+        m_devs[Data] = device->dataBlockDevs();
+    } else {
+        m_rules &= ~PartitionRules;
+    }
+
+    for (int i = 0; i < PartitionCount; ++i) {
+        m_mountLines[i] = fmt::format(Mount, PartitionPaths[i]);
+        m_unmountLines[i] = fmt::format(Unmount, PartitionPaths[i]);
+        m_formatLines[i] = fmt::format(Format, PartitionPaths[i]);
+    }
+
+    std::vector<const char *> keywords;
+
+    for (const RuleEntry &entry : Rules) {
+        if (!(m_rules & entry.rule)) {
+            continue;
+        }
+
+        for (const char *keyword : entry.keywords) {
+            if (!keyword) {
+                continue;
+            }
+
+            std::size_t id = 0;
+            for (; id < keywords.size(); ++id) {
+                if (strcmp(keywords[id], keyword) == 0) {
+                    break;
+                }
+            }
+
+            if (id == keywords.size()) {
+                keywords.push_back(keyword);
+                m_patternRules.push_back(0);
+                m_scanner.addPattern(keyword, strlen(keyword));
+            }
+
+            m_patternRules[id] |= entry.rule;
+        }
+    }
+}
+
+/*!
+ * \brief Rewrite an updater-script
+ *
+ * \param data Contents of the updater-script
+ * \param size Size of \a data
+ * \param out Output string for the rewritten updater-script
+ */
+void UpdaterScriptRewriter::rewrite(const char *data, std::size_t size,
+                                    std::string *out) const
+{
+    out->clear();
+    out->reserve(size + size / 8);
+
+    // Keyword matches in order of increasing offset
+    std::vector<std::pair<std::size_t, unsigned int>> hits;
+    m_scanner.scan(reinterpret_cast<const unsigned char *>(data), size,
+                   [&](std::size_t patternId, std::size_t offset) {
+        hits.emplace_back(offset, m_patternRules[patternId]);
+        return true;
+    });
+
+    Line line;
+    std::size_t pos = 0;
+    std::size_t hit = 0;
+
+    while (hit < hits.size()) {
+        // Copy all lines up to the one containing the next match as is
+        std::size_t start = hits[hit].first;
+        while (start > pos && data[start - 1] != '\n') {
+            --start;
+        }
+        out->append(data + pos, start - pos);
+
+        auto nl = reinterpret_cast<const char *>(
+                memchr(data + start, '\n', size - start));
+        std::size_t end = nl ? nl - data : size;
+
+        unsigned int candidates = 0;
+        for (; hit < hits.size() && hits[hit].first < end; ++hit) {
+            candidates |= hits[hit].second;
+        }
+
+        line.text.assign(data + start, end - start);
+        line.tokenized = false;
+
+        if (rewriteLine(&line, candidates)) {
+            out->append(line.text);
+            pos = end;
+        } else if (nl) {
+            // Drop the line along with its newline
+            pos = end + 1;
+        } else {
+            // Last line: drop the newline separating it from the previous one
+            if (!out->empty()) {
+                out->pop_back();
+            }
+            pos = size;
+        }
+    }
+
+    out->append(data + pos, size - pos);
+}
+
+/*!
+ * \brief Rewrite an updater-script in place
+ *
+ * \param contents Contents of the updater-script
+ */
+void UpdaterScriptRewriter::rewrite(std::string *contents) const
+{
+    std::string out;
+    rewrite(contents->data(), contents->size(), &out);
+    contents->swap(out);
+}
+
+/*!
+ * \brief Rewrite the lines of an updater-script in place
+ *
+ * \param lines Lines of the updater-script (without newlines)
+ */
+void UpdaterScriptRewriter::rewrite(std::vector<std::string> *lines) const
+{
+    Line line;
+    std::size_t kept = 0;
+
+    for (std::size_t i = 0; i < lines->size(); ++i) {
+        std::string &text = (*lines)[i];
+        unsigned int candidates = candidateRules(text.data(), text.size());
+
+        if (candidates != 0) {
+            line.text.swap(text);
+            line.tokenized = false;
+
+            bool keep = rewriteLine(&line, candidates);
+            text.swap(line.text);
+
+            if (!keep) {
+                continue;
+            }
+        }
+
+        if (kept != i) {
+            (*lines)[kept].swap(text);
+        }
+        ++kept;
+    }
+
+    lines->resize(kept);
+}
+
+unsigned int UpdaterScriptRewriter::candidateRules(const char *data,
+                                                   std::size_t size) const
+{
+    unsigned int candidates = 0;
+    m_scanner.scan(reinterpret_cast<const unsigned char *>(data), size,
+                   [&](std::size_t patternId, std::size_t offset) {
+        (void) offset;
+        candidates |= m_patternRules[patternId];
+        return true;
+    });
+    return candidates;
+}
+
+/*!
+ * Run the rules in \a candidates over the line in table order. Returns false
+ * if the line should be removed.
+ */
+bool UpdaterScriptRewriter::rewriteLine(Line *line,
+                                        unsigned int candidates) const
+{
+    for (const RuleEntry &entry : Rules) {
+        if (!(candidates & entry.rule)) {
+            continue;
+        }
+
+        switch ((this->*entry.apply)(line)) {
+        case LineAction::Unchanged:
+            break;
+        case LineAction::Changed:
+            // The remaining rules see the rewritten line
+            line->tokenized = false;
+            candidates = candidateRules(line->text.data(), line->text.size());
+            break;
+        case LineAction::Removed:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline bool isIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (c >= '0' && c <= '9') || c == '_';
+}
+
+void UpdaterScriptRewriter::tokenize(Line *line)
+{
+    const std::string &text = line->text;
+    const std::size_t size = text.size();
+
+    line->tokens.clear();
+    line->lastCloseParen = -1;
+
+    std::size_t pos = 0;
+
+    while (pos < size) {
+        char c = text[pos];
+
+        if (isspace(static_cast<unsigned char>(c))) {
+            ++pos;
+        } else if (c == '"') {
+            std::size_t begin = ++pos;
+            while (pos < size && text[pos] != '"') {
+                if (text[pos] == '\\' && pos + 1 < size) {
+                    ++pos;
+                }
+                ++pos;
+            }
+            line->tokens.push_back({ Token::String, begin, pos });
+            if (pos < size) {
+                // Skip closing quote
+                ++pos;
+            }
+        } else if (isIdentifierChar(c)) {
+            std::size_t begin = pos;
+            while (pos < size && isIdentifierChar(text[pos])) {
+                ++pos;
+            }
+            line->tokens.push_back({ Token::Identifier, begin, pos });
+        } else {
+            if (c == ')') {
+                line->lastCloseParen = line->tokens.size();
+            }
+            line->tokens.push_back({ Token::Punctuation, pos, pos + 1 });
+            ++pos;
+        }
+    }
+
+    line->tokenized = true;
+}
+
+static inline bool tokenEquals(const std::string &text, std::size_t begin,
+                               std::size_t end, const char *str)
+{
+    std::size_t len = strlen(str);
+    return end - begin == len && text.compare(begin, len, str) == 0;
+}
+
+/*!
+ * Whether token \a i starts a call to \a name that is closed later on the line
+ *
+ * Like the old `(^|[^a-z])name\s*\(` regexes, the identifier only has to end
+ * with \a name as long as it isn't preceded by a lowercase letter. For example,
+ * `foo_mount(` and `Xmount(` are mount calls, but `unmount(` is not.
+ */
+bool UpdaterScriptRewriter::isCall(const Line &line, std::size_t i,
+                                   const char *name)
+{
+    if (i + 1 >= line.tokens.size()
+            || line.lastCloseParen <= static_cast<long>(i + 1)) {
+        return false;
+    }
+
+    const Token &ident = line.tokens[i];
+    const Token &paren = line.tokens[i + 1];
+
+    if (ident.type != Token::Identifier
+            || paren.type != Token::Punctuation
+            || line.text[paren.begin] != '(') {
+        return false;
+    }
+
+    std::size_t len = strlen(name);
+    if (ident.end - ident.begin < len) {
+        return false;
+    }
+
+    std::size_t begin = ident.end - len;
+    if (begin > ident.begin) {
+        char c = line.text[begin - 1];
+        if (c >= 'a' && c <= 'z') {
+            return false;
+        }
+    }
+
+    return tokenEquals(line.text, begin, ident.end, name);
+}
+
+bool UpdaterScriptRewriter::isString(const Line &line, std::size_t i,
+                                     const char *str)
+{
+    if (i >= line.tokens.size()) {
+        return false;
+    }
+
+    const Token &token = line.tokens[i];
+    return token.type == Token::String
+            && tokenEquals(line.text, token.begin, token.end, str);
+}
+
+bool UpdaterScriptRewriter::isStringWithSuffix(const Line &line, std::size_t i,
+                                               const char *suffix)
+{
+    if (i >= line.tokens.size()) {
+        return false;
+    }
+
+    const Token &token = line.tokens[i];
+    std::size_t len = strlen(suffix);
+    return token.type == Token::String
+            && token.end - token.begin >= len
+            && line.text.compare(token.end - len, len, suffix) == 0;
+}
+
+static bool findItemsInString(const std::string &haystack,
+                              const std::vector<std::string> &needles)
+{
+    for (auto const &needle : needles) {
+        if (haystack.find(needle) != std::string::npos) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * Find which partition a mount, unmount, or format line refers to. Returns -1
+ * if the line does not refer to any of them.
+ */
+int UpdaterScriptRewriter::partitionOf(const std::string &text) const
+{
+    if (text.find("/system") != std::string::npos
+            || findItemsInString(text, m_devs[System])) {
+        return System;
+    } else if (text.find("/cache") != std::string::npos
+            || findItemsInString(text, m_devs[Cache])) {
+        return Cache;
+    } else if (text.find("/data") != std::string::npos
+            || text.find("/userdata") != std::string::npos
+            || findItemsInString(text, m_devs[Data])) {
+        return Data;
+    }
+
+    return -1;
+}
+
+/*!
+ * Matches:
+ * - mount(...)
+ * - run_program("...busybox", "mount", ...)
+ * - run_program(".../mount", ...)
+ */
+UpdaterScriptRewriter::LineAction
+UpdaterScriptRewriter::applyMount(Line *line) const
+{
+    if (!line->tokenized) {
+        tokenize(line);
+    }
+
+    bool isMountLine = false;
+
+    for (std::size_t i = 0; i < line->tokens.size() && !isMountLine; ++i) {
+        if (isCall(*line, i, "mount")) {
+            isMountLine = true;
+        } else if (isCall(*line, i, "run_program")) {
+            isMountLine = (isStringWithSuffix(*line, i + 2, "busybox")
+                    && isString(*line, i + 4, "mount"))
+                    || isStringWithSuffix(*line, i + 2, "/mount");
+        }
+    }
+
+    if (isMountLine) {
+        int partition = partitionOf(line->text);
+        if (partition >= 0) {
+            line->text = m_mountLines[partition];
+            return LineAction::Changed;
+        }
+    }
+
+    return LineAction::Unchanged;
+}
+
+/*!
+ * Matches:
+ * - unmount(...)
+ * - run_program("...busybox", "umount", ...)
+ */
+UpdaterScriptRewriter::LineAction
+UpdaterScriptRewriter::applyUnmount(Line *line) const
+{
+    if (line->text.find(Cm12UnmountLine) != std::string::npos) {
+        return LineAction::Removed;
+    }
+
+    if (!line->tokenized) {
+        tokenize(line);
+    }
+
+    bool isUnmountLine = false;
+
+    for (std::size_t i = 0; i < line->tokens.size() && !isUnmountLine; ++i) {
+        if (isCall(*line, i, "unmount")) {
+            isUnmountLine = true;
+        } else if (isCall(*line, i, "run_program")) {
+            isUnmountLine = isStringWithSuffix(*line, i + 2, "busybox")
+                    && isString(*line, i + 4, "umount");
+        }
+    }
+
+    if (isUnmountLine) {
+        int partition = partitionOf(line->text);
+        if (partition >= 0) {
+            line->text = m_unmountLines[partition];
+            return LineAction::Changed;
+        }
+    }
+
+    return LineAction::Unchanged;
+}
+
+/*!
+ * Matches:
+ * - format(...)
+ * - delete_recursive("/system", ...) and delete_recursive("/cache", ...)
+ * - run_program(".../format.sh", ...), which formats /data
+ */
+UpdaterScriptRewriter::LineAction
+UpdaterScriptRewriter::applyFormat(Line *line) const
+{
+    if (!line->tokenized) {
+        tokenize(line);
+    }
+
+    bool isFormatLine = false;
+    bool deletesSystem = false;
+    bool deletesCache = false;
+    bool runsFormatSh = false;
+
+    for (std::size_t i = 0; i < line->tokens.size(); ++i) {
+        if (isCall(*line, i, "format")) {
+            isFormatLine = true;
+            break;
+        } else if (isCall(*line, i, "delete_recursive")) {
+            deletesSystem = deletesSystem || isString(*line, i + 2, "/system");
+            deletesCache = deletesCache || isString(*line, i + 2, "/cache");
+        } else if (isCall(*line, i, "run_program")) {
+            runsFormatSh = runsFormatSh
+                    || isStringWithSuffix(*line, i + 2, "/format.sh");
+        }
+    }
+
+    int partition = -1;
+
+    if (isFormatLine) {
+        partition = partitionOf(line->text);
+    } else if (deletesSystem) {
+        partition = System;
+    } else if (deletesCache) {
+        partition = Cache;
+    } else if (runsFormatSh) {
+        partition = Data;
+    }
+
+    if (partition >= 0) {
+        line->text = m_formatLines[partition];
+        return LineAction::Changed;
+    }
+
+    return LineAction::Unchanged;
+}
+
+/*!
+ * References to the system partition in block_image_update and
+ * package_extract_file lines should become /mb/system.img
+ */
+UpdaterScriptRewriter::LineAction
+UpdaterScriptRewriter::applySystemImage(Line *line) const
+{
+    bool changed = false;
+
+    for (auto const &dev : m_devs[System]) {
+        if (line->text.find(dev) != std::string::npos) {
+            boost::replace_all(line->text, dev, SystemImage);
+            changed = true;
+        }
+    }
+
+    return changed ? LineAction::Changed : LineAction::Unchanged;
+}
+
+/*!
+ * Matches assert(...getprop(...ro.product.device...) at the start of the line
+ * (or ro.build.product) and makes the assertion always succeed.
+ */
+UpdaterScriptRewriter::LineAction
+UpdaterScriptRewriter::applyDeviceCheck(Line *line) const
+{
+    if (!line->tokenized) {
+        tokenize(line);
+    }
+
+    const std::vector<Token> &tokens = line->tokens;
+
+    if (tokens.size() < 2
+            || tokens[0].type != Token::Identifier
+            || !tokenEquals(line->text, tokens[0].begin, tokens[0].end, "assert")
+            || tokens[1].type != Token::Punctuation
+            || line->text[tokens[1].begin] != '(') {
+        return LineAction::Unchanged;
+    }
+
+    for (std::size_t i = 2; i + 1 < tokens.size(); ++i) {
+        // The old regex had no boundary for getprop, so this also catches
+        // file_getprop()
+        if (tokens[i].type == Token::Identifier
+                && tokens[i].end - tokens[i].begin >= 7
+                && tokenEquals(line->text, tokens[i].end - 7, tokens[i].end,
+                               "getprop")
+                && tokens[i + 1].type == Token::Punctuation
+                && line->text[tokens[i + 1].begin] == '(') {
+            std::size_t from = tokens[i + 1].end;
+
+            if (line->text.find("ro.product.device", from) != std::string::npos
+                    || line->text.find("ro.build.product", from)
+                            != std::string::npos) {
+                line->text.insert(tokens[1].end, DeviceCheckBypass);
+                return LineAction::Changed;
+            }
+
+            break;
+        }
+    }
+
+    return LineAction::Unchanged;
+}
+
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "private/patternscanner.h"
+
+
+namespace mbp
+{
+
+class Device;
+
+/*!
+ * Rewrites updater-script files in a single pass. A PatternScanner finds the
+ * lines containing the keywords of the enabled rules and only those lines are
+ * tokenized and run through the rule table. All other lines are copied as is.
+ */
+class UpdaterScriptRewriter
+{
+public:
+    enum Rule : unsigned int
+    {
+        // Replace mount commands with update-binary-tool calls
+        MountRule = 1 << 0,
+        // Replace unmount commands with update-binary-tool calls
+        UnmountRule = 1 << 1,
+        // Replace format commands with update-binary-tool calls
+        FormatRule = 1 << 2,
+        // Point block_image_update at /mb/system.img
+        BlockUpdateRule = 1 << 3,
+        // Point package_extract_file at /mb/system.img
+        ImageExtractRule = 1 << 4,
+        // Disable device model asserts
+        DeviceCheckRule = 1 << 5,
+
+        PartitionRules = MountRule | UnmountRule | FormatRule
+                | BlockUpdateRule | ImageExtractRule,
+        AllRules = PartitionRules | DeviceCheckRule
+    };
+
+    // device may be null if only DeviceCheckRule is enabled
+    UpdaterScriptRewriter(const Device *device, unsigned int rules);
+
+    void rewrite(const char *data, std::size_t size, std::string *out) const;
+    void rewrite(std::string *contents) const;
+    void rewrite(std::vector<std::string> *lines) const;
+
+private:
+    enum Partition
+    {
+        System,
+        Cache,
+        Data,
+        PartitionCount
+    };
+
+    enum class LineAction
+    {
+        Unchanged,
+        Changed,
+        Removed
+    };
+
+    struct Token
+    {
+        enum Type { Identifier, String, Punctuation } type;
+        // For strings, this excludes the quotes
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    struct Line
+    {
+        std::string text;
+        bool tokenized;
+        std::vector<Token> tokens;
+        // Index of the last ')' token or -1 if there is none
+        long lastCloseParen;
+    };
+
+    struct RuleEntry
+    {
+        Rule rule;
+        const char *keywords[2];
+        LineAction (UpdaterScriptRewriter::*apply)(Line *line) const;
+    };
+
+    static const RuleEntry Rules[];
+
+    unsigned int m_rules;
+    std::vector<std::string> m_devs[PartitionCount];
+    std::string m_mountLines[PartitionCount];
+    std::string m_unmountLines[PartitionCount];
+    std::string m_formatLines[PartitionCount];
+
+    PatternScanner m_scanner;
+    // Rules that should be tried for each scanner pattern
+    std::vector<unsigned int> m_patternRules;
+
+    unsigned int candidateRules(const char *data, std::size_t size) const;
+    bool rewriteLine(Line *line, unsigned int candidates) const;
+
+    static void tokenize(Line *line);
+    static bool isCall(const Line &line, std::size_t i, const char *name);
+    static bool isString(const Line &line, std::size_t i, const char *str);
+    static bool isStringWithSuffix(const Line &line, std::size_t i,
+                                   const char *suffix);
+    int partitionOf(const std::string &text) const;
+
+    LineAction applyMount(Line *line) const;
+    LineAction applyUnmount(Line *line) const;
+    LineAction applyFormat(Line *line) const;
+    LineAction applySystemImage(Line *line) const;
+    LineAction applyDeviceCheck(Line *line) const;
+};
+
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/zipindex.h"
+
+#include <cassert>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+
+#include "private/logging.h"
+
+
+namespace mbp
+{
+
+static const uint32_t EocdSignature = 0x06054b50;
+static const uint32_t Zip64LocatorSignature = 0x07064b50;
+static const uint32_t Zip64EocdSignature = 0x06064b50;
+static const uint32_t CentralHeaderSignature = 0x02014b50;
+
+static const std::size_t EocdSize = 22;
+static const std::size_t MaxCommentSize = 0xffff;
+static const std::size_t Zip64LocatorSize = 20;
+static const std::size_t Zip64EocdSize = 56;
+static const std::size_t CentralHeaderSize = 46;
+
+static const uint16_t Zip64ExtraId = 0x0001;
+
+const std::size_t ZipIndex::NotFound;
+
+static inline uint16_t readLe16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t readLe32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint64_t readLe64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(readLe32(p))
+            | (static_cast<uint64_t>(readLe32(p + 4)) << 32);
+}
+
+static bool readAt(std::ifstream *file, uint64_t offset, std::size_t size,
+                   std::vector<unsigned char> *out)
+{
+    out->resize(size);
+    file->seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    return file->read(reinterpret_cast<char *>(out->data()), size)
+            && static_cast<std::size_t>(file->gcount()) == size;
+}
+
+/*!
+ * Apply the zip64 extended information extra field to an entry. Only the
+ * fields that are saturated in the central directory record are present.
+ */
+static bool applyZip64Extra(const unsigned char *extra, std::size_t size,
+                            ZipIndex::Entry *entry)
+{
+    while (size >= 4) {
+        uint16_t id = readLe16(extra);
+        uint16_t fieldSize = readLe16(extra + 2);
+        extra += 4;
+        size -= 4;
+
+        if (fieldSize > size) {
+            return false;
+        }
+
+        if (id == Zip64ExtraId) {
+            const unsigned char *p = extra;
+            const unsigned char *end = extra + fieldSize;
+
+            if (entry->uncompressedSize == 0xffffffff) {
+                if (end - p < 8) return false;
+                entry->uncompressedSize = readLe64(p);
+                p += 8;
+            }
+            if (entry->compressedSize == 0xffffffff) {
+                if (end - p < 8) return false;
+                entry->compressedSize = readLe64(p);
+                p += 8;
+            }
+            if (entry->localOffset == 0xffffffff) {
+                if (end - p < 8) return false;
+                entry->localOffset = readLe64(p);
+            }
+            return true;
+        }
+
+        extra += fieldSize;
+        size -= fieldSize;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Build the index from a zip file
+ *
+ * Only the end of central directory record (and its zip64 counterpart) and
+ * the central directory itself are read.
+ *
+ * \param path Path to zip file
+ *
+ * \return Success or not
+ */
+PatcherError ZipIndex::load(const std::string &path)
+{
+    m_entries.clear();
+    m_names.clear();
+    m_lookup.clear();
+    m_totalSize = 0;
+    m_bytesBefore = 0;
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (file.fail()) {
+        return PatcherError::createIOError(ErrorCode::FileOpenError, path);
+    }
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = file.tellg();
+
+    if (fileSize < EocdSize) {
+        FLOGE("{}: Too small to be a zip file", path);
+        return PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadHeaderError, path);
+    }
+
+    // The end of central directory record is followed by a comment of up to
+    // 64 KiB and may be preceded by the zip64 locator
+    std::size_t tailSize = std::min<uint64_t>(
+            fileSize, EocdSize + MaxCommentSize + Zip64LocatorSize);
+    uint64_t tailOffset = fileSize - tailSize;
+    std::vector<unsigned char> tail;
+
+    if (!readAt(&file, tailOffset, tailSize, &tail)) {
+        return PatcherError::createIOError(ErrorCode::FileReadError, path);
+    }
+
+    std::size_t eocd = tailSize - EocdSize + 1;
+    do {
+        --eocd;
+        if (readLe32(tail.data() + eocd) == EocdSignature) {
+            break;
+        }
+    } while (eocd > 0);
+
+    if (readLe32(tail.data() + eocd) != EocdSignature) {
+        FLOGE("{}: End of central directory not found", path);
+        return PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadHeaderError, path);
+    }
+
+    const unsigned char *p = tail.data() + eocd;
+    uint64_t entries = readLe16(p + 10);
+    uint64_t centralSize = readLe32(p + 12);
+    uint64_t centralOffset = readLe32(p + 16);
+    uint64_t centralEnd = tailOffset + eocd;
+
+    if (eocd >= Zip64LocatorSize && readLe32(p - Zip64LocatorSize)
+            == Zip64LocatorSignature) {
+        uint64_t zip64Offset = readLe64(p - Zip64LocatorSize + 8);
+        std::vector<unsigned char> record;
+
+        if (!readAt(&file, zip64Offset, Zip64EocdSize, &record)
+                || readLe32(record.data()) != Zip64EocdSignature) {
+            FLOGE("{}: Invalid zip64 end of central directory", path);
+            return PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, path);
+        }
+
+        entries = readLe64(record.data() + 32);
+        centralSize = readLe64(record.data() + 40);
+        centralOffset = readLe64(record.data() + 48);
+        centralEnd = zip64Offset;
+    }
+
+    // Same as minizip's byte_before_the_zipfile (eg. for self-extracting
+    // archives)
+    if (centralSize > centralEnd || centralEnd - centralSize < centralOffset) {
+        FLOGE("{}: Invalid central directory location", path);
+        return PatcherError::createArchiveError(
+                ErrorCode::ArchiveReadHeaderError, path);
+    }
+    m_bytesBefore = centralEnd - centralOffset - centralSize;
+
+    std::vector<unsigned char> central;
+    if (!readAt(&file, centralOffset + m_bytesBefore, centralSize, &central)) {
+        return PatcherError::createIOError(ErrorCode::FileReadError, path);
+    }
+
+    // The entry count is untrusted, so don't reserve more than the central
+    // directory can actually hold
+    m_entries.reserve(std::min<uint64_t>(
+            entries, central.size() / CentralHeaderSize));
+    m_lookup.reserve(m_entries.capacity());
+
+    std::size_t pos = 0;
+
+    for (uint64_t i = 0; i < entries; ++i) {
+        if (central.size() - pos < CentralHeaderSize
+                || readLe32(central.data() + pos) != CentralHeaderSignature) {
+            FLOGE("{}: Invalid central directory record {}", path, i);
+            return PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, path);
+        }
+
+        const unsigned char *h = central.data() + pos;
+        std::size_t nameSize = readLe16(h + 28);
+        std::size_t extraSize = readLe16(h + 30);
+        std::size_t commentSize = readLe16(h + 32);
+        std::size_t recordSize =
+                CentralHeaderSize + nameSize + extraSize + commentSize;
+
+        if (central.size() - pos < recordSize) {
+            FLOGE("{}: Truncated central directory record {}", path, i);
+            return PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, path);
+        }
+
+        Entry entry;
+        entry.centralOffset = centralOffset + pos;
+        entry.flags = readLe16(h + 8);
+        entry.method = readLe16(h + 10);
+        entry.dosDate = (static_cast<uint32_t>(readLe16(h + 14)) << 16)
+                | readLe16(h + 12);
+        entry.crc32 = readLe32(h + 16);
+        entry.compressedSize = readLe32(h + 20);
+        entry.uncompressedSize = readLe32(h + 24);
+        entry.externalAttr = readLe32(h + 38);
+        entry.localOffset = readLe32(h + 42);
+        entry.nameOffset = m_names.size();
+        entry.nameSize = nameSize;
+
+        if (!applyZip64Extra(h + CentralHeaderSize + nameSize, extraSize,
+                             &entry)) {
+            FLOGE("{}: Invalid zip64 extra field in record {}", path, i);
+            return PatcherError::createArchiveError(
+                    ErrorCode::ArchiveReadHeaderError, path);
+        }
+
+        m_names.insert(m_names.end(), h + CentralHeaderSize,
+                       h + CentralHeaderSize + nameSize);
+        m_totalSize += entry.uncompressedSize;
+        // Keeps the first entry if a name is duplicated
+        m_lookup.emplace(std::string(reinterpret_cast<const char *>(
+                h + CentralHeaderSize), nameSize), m_entries.size());
+        m_entries.push_back(entry);
+
+        pos += recordSize;
+    }
+
+    return PatcherError();
+}
+
+/*!
+ * \brief Number of entries in the zip file
+ */
+std::size_t ZipIndex::count() const
+{
+    return m_entries.size();
+}
+
+/*!
+ * \brief Get an entry by its position in the central directory
+ */
+const ZipIndex::Entry & ZipIndex::entry(std::size_t index) const
+{
+    assert(index < m_entries.size());
+    return m_entries[index];
+}
+
+/*!
+ * \brief Get the name of an entry
+ */
+std::string ZipIndex::name(std::size_t index) const
+{
+    const Entry &e = entry(index);
+    return std::string(m_names.data() + e.nameOffset, e.nameSize);
+}
+
+/*!
+ * \brief Find an entry by name
+ *
+ * \return Index of the (first) entry with the name or ZipIndex::NotFound
+ */
+std::size_t ZipIndex::find(const std::string &name) const
+{
+    auto it = m_lookup.find(name);
+    return it == m_lookup.end() ? NotFound : it->second;
+}
+
+/*!
+ * \brief Sum of the uncompressed sizes of all entries
+ */
+uint64_t ZipIndex::totalUncompressedSize() const
+{
+    return m_totalSize;
+}
+
+/*!
+ * \brief Number of bytes preceding the zip data in the file
+ *
+ * This is non-zero for archives with data prepended to them (eg.
+ * self-extracting archives). The offsets in the entries do not include it.
+ */
+uint64_t ZipIndex::bytesBeforeArchive() const
+{
+    return m_bytesBefore;
+}
+
+}
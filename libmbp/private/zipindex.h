@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "patchererror.h"
+
+
+namespace mbp
+{
+
+/*!
+ * Index of the entries in a zip file, built from a single read of the central
+ * directory. File names are stored back to back in one string table.
+ */
+class ZipIndex
+{
+public:
+    struct Entry
+    {
+        // Offset of the central directory record (as used by minizip's
+        // unz64_file_pos::pos_in_zip_directory)
+        uint64_t centralOffset;
+        // Offset of the local file header
+        uint64_t localOffset;
+        uint64_t compressedSize;
+        uint64_t uncompressedSize;
+        uint32_t crc32;
+        uint32_t dosDate;
+        uint32_t externalAttr;
+        uint16_t method;
+        uint16_t flags;
+        std::size_t nameOffset;
+        std::size_t nameSize;
+    };
+
+    static const std::size_t NotFound = static_cast<std::size_t>(-1);
+
+    PatcherError load(const std::string &path);
+
+    std::size_t count() const;
+    const Entry & entry(std::size_t index) const;
+    std::string name(std::size_t index) const;
+    std::size_t find(const std::string &name) const;
+
+    uint64_t totalUncompressedSize() const;
+    uint64_t bytesBeforeArchive() const;
+
+private:
+    std::vector<Entry> m_entries;
+    std::vector<char> m_names;
+    uint64_t m_totalSize = 0;
+    uint64_t m_bytesBefore = 0;
+
+    // Maps names to indexes. Built by load() so that find() is safe to call
+    // from multiple threads.
+    std::unordered_map<std::string, std::size_t> m_lookup;
+};
+
+}
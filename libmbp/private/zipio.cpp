@@ -0,0 +1,908 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "private/zipio.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+// sendfile64() is only declared by bionic since API 21
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+#define ZIPIO_HAVE_SENDFILE64
+#endif
+
+#include "private/logging.h"
+
+
+// 32-bit Android does not have a 64-bit off_t, so use the explicit 64-bit
+// variants to support zips larger than 2 GiB
+#ifdef __linux__
+#define ZIPIO_OFF_T off64_t
+#define ZIPIO_PREAD pread64
+#define ZIPIO_PWRITE pwrite64
+#else
+#define ZIPIO_OFF_T off_t
+#define ZIPIO_PREAD pread
+#define ZIPIO_PWRITE pwrite
+#endif
+
+
+namespace mbp
+{
+
+// Leave enough address space for everything else on 32-bit hosts
+static const uint64_t MaxMappedSize =
+        sizeof(void *) >= 8 ? UINT64_MAX : 1024 * 1024 * 1024;
+
+// Small writes (eg. the individual header fields written by minizip) are
+// gathered into a buffer of this size
+static const std::size_t WriteBufferSize = 64 * 1024;
+
+// Amount of data to transfer between progress updates when splicing
+static const uint64_t SpliceChunkSize = 8 * 1024 * 1024;
+
+static const uint32_t CentralHeaderSignature = 0x02014b50;
+static const uint32_t EocdSignature = 0x06054b50;
+static const uint32_t Zip64EocdSignature = 0x06064b50;
+static const uint32_t Zip64LocatorSignature = 0x07064b50;
+static const std::size_t CentralHeaderSize = 46;
+static const std::size_t EocdSize = 22;
+static const std::size_t Zip64EocdSize = 56;
+static const std::size_t Zip64LocatorSize = 20;
+
+/*! \cond INTERNAL */
+struct ZipStream
+{
+    int fd = -1;
+    // Non-null if the file is memory mapped
+    const unsigned char *data = nullptr;
+    uint64_t size = 0;
+    uint64_t pos = 0;
+    int error = 0;
+
+    // Pending writes at [bufferOffset, bufferOffset + buffer.size())
+    std::vector<unsigned char> buffer;
+    uint64_t bufferOffset = 0;
+
+    // Region of the output file whose contents are copied from another file.
+    // minizip never sees the data, so it thinks the entry is empty.
+    struct {
+        bool active = false;
+        int srcFd = -1;
+        const unsigned char *srcData = nullptr;
+        uint64_t srcOffset = 0;
+        uint64_t headerOffset = 0;
+        uint64_t dstOffset = 0;
+        uint64_t size = 0;
+        bool reserved = false;
+    } splice;
+
+    // Compressed sizes of the spliced entries by local header offset. minizip
+    // writes 0 to their central directory records, which are fixed when the
+    // file is closed.
+    std::unordered_map<uint64_t, uint32_t> splicedEntries;
+};
+
+struct ZipIoContext
+{
+    ZipReadMode mode;
+    ZipStream *stream = nullptr;
+};
+/*! \endcond */
+
+// Streams behind the handles returned by openZipInput() and openZipOutput()
+static std::mutex handlesMutex;
+static std::unordered_map<void *, ZipIoContext *> handles;
+
+static ZipStream * streamForHandle(void *handle)
+{
+    std::lock_guard<std::mutex> lock(handlesMutex);
+    auto it = handles.find(handle);
+    return it == handles.end() ? nullptr : it->second->stream;
+}
+
+static bool writeFully(int fd, const unsigned char *data, uint64_t size,
+                       uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = ZIPIO_PWRITE(fd, data, size,
+                                 static_cast<ZIPIO_OFF_T>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static bool readFully(int fd, unsigned char *data, uint64_t size,
+                      uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = ZIPIO_PREAD(fd, data, size,
+                                static_cast<ZIPIO_OFF_T>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+
+        data += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static uint16_t readLe16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLe32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(readLe16(p))
+            | (static_cast<uint32_t>(readLe16(p + 2)) << 16);
+}
+
+static uint64_t readLe64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(readLe32(p))
+            | (static_cast<uint64_t>(readLe32(p + 4)) << 32);
+}
+
+static void writeLe32(unsigned char *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static bool flushBuffer(ZipStream *stream)
+{
+    if (stream->buffer.empty()) {
+        return true;
+    }
+
+    if (!writeFully(stream->fd, stream->buffer.data(), stream->buffer.size(),
+                    stream->bufferOffset)) {
+        stream->error = errno;
+        return false;
+    }
+
+    stream->buffer.clear();
+    return true;
+}
+
+static voidpf ZCALLBACK ioOpenRead(voidpf opaque, const void *filename,
+                                    int mode)
+{
+    // Only reading is supported
+    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ
+            || !filename) {
+        return nullptr;
+    }
+
+    auto ctx = static_cast<ZipIoContext *>(opaque);
+    auto path = static_cast<const char *>(filename);
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    ZipStream *stream = new ZipStream();
+    stream->fd = fd;
+    stream->size = sb.st_size;
+
+    if (ctx->mode == ZipReadMode::Mapped && stream->size > 0
+            && stream->size <= MaxMappedSize) {
+        void *addr = mmap(nullptr, stream->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            FLOGW("{}: Failed to mmap, using pread instead: {}",
+                  path, strerror(errno));
+        } else {
+            stream->data = static_cast<const unsigned char *>(addr);
+        }
+    }
+
+    ctx->stream = stream;
+    return stream;
+}
+
+static voidpf ZCALLBACK ioOpenWrite(voidpf opaque, const void *filename,
+                                     int mode)
+{
+    // Only creating new files is supported
+    if (!(mode & ZLIB_FILEFUNC_MODE_CREATE) || !filename) {
+        return nullptr;
+    }
+
+    auto ctx = static_cast<ZipIoContext *>(opaque);
+    auto path = static_cast<const char *>(filename);
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    ZipStream *stream = new ZipStream();
+    stream->fd = fd;
+    stream->buffer.reserve(WriteBufferSize);
+
+    ctx->stream = stream;
+    return stream;
+}
+
+static uLong ZCALLBACK ioRead(voidpf opaque, voidpf s, void *buf, uLong size)
+{
+    (void) opaque;
+    auto stream = static_cast<ZipStream *>(s);
+
+    if (!stream->buffer.empty() && !flushBuffer(stream)) {
+        return 0;
+    }
+
+    if (stream->pos >= stream->size) {
+        return 0;
+    }
+
+    uint64_t remaining = stream->size - stream->pos;
+    if (size > remaining) {
+        size = remaining;
+    }
+
+    if (stream->data) {
+        memcpy(buf, stream->data + stream->pos, size);
+        stream->pos += size;
+        return size;
+    }
+
+    auto out = static_cast<unsigned char *>(buf);
+    uLong total = 0;
+
+    while (total < size) {
+        ssize_t n = ZIPIO_PREAD(stream->fd, out + total, size - total,
+                                static_cast<ZIPIO_OFF_T>(stream->pos));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            stream->error = errno;
+            break;
+        } else if (n == 0) {
+            break;
+        }
+
+        total += n;
+        stream->pos += n;
+    }
+
+    return total;
+}
+
+static uLong ZCALLBACK ioWriteReadOnly(voidpf opaque, voidpf s,
+                                        const void *buf, uLong size)
+{
+    (void) opaque;
+    (void) buf;
+    (void) size;
+    static_cast<ZipStream *>(s)->error = EBADF;
+    return 0;
+}
+
+static uLong ZCALLBACK ioWrite(voidpf opaque, voidpf s, const void *buf,
+                                uLong size)
+{
+    (void) opaque;
+    auto stream = static_cast<ZipStream *>(s);
+    auto in = static_cast<const unsigned char *>(buf);
+    uLong remaining = size;
+
+    while (remaining > 0) {
+        uint64_t n = remaining;
+
+        // Only contiguous writes are buffered
+        if (stream->bufferOffset + stream->buffer.size() != stream->pos
+                || stream->buffer.size() + n > WriteBufferSize) {
+            if (!flushBuffer(stream)) {
+                return 0;
+            }
+            stream->bufferOffset = stream->pos;
+        }
+
+        if (n >= WriteBufferSize) {
+            if (!writeFully(stream->fd, in, n, stream->pos)) {
+                stream->error = errno;
+                return 0;
+            }
+            stream->bufferOffset = stream->pos + n;
+        } else {
+            stream->buffer.insert(stream->buffer.end(), in, in + n);
+        }
+
+        stream->pos += n;
+        stream->size = std::max(stream->size, stream->pos);
+        in += n;
+        remaining -= n;
+    }
+
+    return size;
+}
+
+static ZPOS64_T ZCALLBACK ioTell(voidpf opaque, voidpf s)
+{
+    (void) opaque;
+    return static_cast<ZipStream *>(s)->pos;
+}
+
+static long ZCALLBACK ioSeek(voidpf opaque, voidpf s, ZPOS64_T offset,
+                              int origin)
+{
+    (void) opaque;
+    auto stream = static_cast<ZipStream *>(s);
+    uint64_t base;
+
+    switch (origin) {
+    case ZLIB_FILEFUNC_SEEK_SET:
+        base = 0;
+        break;
+    case ZLIB_FILEFUNC_SEEK_CUR:
+        base = stream->pos;
+        break;
+    case ZLIB_FILEFUNC_SEEK_END:
+        base = stream->size;
+        break;
+    default:
+        return -1;
+    }
+
+    stream->pos = base + offset;
+    return 0;
+}
+
+// Returns the local header offset stored in a central directory record
+static bool centralHeaderOffset(const unsigned char *h, std::size_t size,
+                                uint64_t *offset)
+{
+    *offset = readLe32(h + 42);
+    if (*offset != 0xffffffffu) {
+        return true;
+    }
+
+    // The zip64 extra field only contains the values that didn't fit in the
+    // record, in this order
+    std::size_t skip = 0;
+    if (readLe32(h + 24) == 0xffffffffu) {
+        skip += 8;
+    }
+    if (readLe32(h + 20) == 0xffffffffu) {
+        skip += 8;
+    }
+
+    const unsigned char *extra = h + CentralHeaderSize + readLe16(h + 28);
+    const unsigned char *extraEnd = extra + readLe16(h + 30);
+    if (extraEnd > h + size) {
+        return false;
+    }
+
+    while (extraEnd - extra >= 4) {
+        uint16_t id = readLe16(extra);
+        uint16_t length = readLe16(extra + 2);
+        extra += 4;
+
+        if (length > extraEnd - extra) {
+            return false;
+        } else if (id == 0x0001 && skip + 8 <= length) {
+            *offset = readLe64(extra + skip);
+            return true;
+        }
+
+        extra += length;
+    }
+
+    return false;
+}
+
+// Write the compressed sizes of the spliced entries to the central directory
+// that minizip wrote when the zip was closed
+static bool fixSplicedEntries(ZipStream *stream)
+{
+    if (stream->splicedEntries.empty()) {
+        return true;
+    }
+
+    // minizip never writes a zip comment here
+    unsigned char eocd[EocdSize];
+    if (stream->size < EocdSize || !readFully(
+            stream->fd, eocd, EocdSize, stream->size - EocdSize)
+            || readLe32(eocd) != EocdSignature) {
+        LOGE("Failed to find the end of central directory record");
+        return false;
+    }
+
+    uint64_t centralSize = readLe32(eocd + 12);
+    uint64_t centralOffset = readLe32(eocd + 16);
+
+    if (centralOffset == 0xffffffffu
+            && stream->size >= EocdSize + Zip64LocatorSize) {
+        unsigned char locator[Zip64LocatorSize];
+        unsigned char record[Zip64EocdSize];
+
+        if (!readFully(stream->fd, locator, Zip64LocatorSize,
+                       stream->size - EocdSize - Zip64LocatorSize)
+                || readLe32(locator) != Zip64LocatorSignature
+                || !readFully(stream->fd, record, Zip64EocdSize,
+                              readLe64(locator + 8))
+                || readLe32(record) != Zip64EocdSignature) {
+            LOGE("Failed to read the zip64 end of central directory record");
+            return false;
+        }
+
+        centralSize = readLe64(record + 40);
+        centralOffset = readLe64(record + 48);
+    }
+
+    if (centralOffset > stream->size
+            || centralSize > stream->size - centralOffset) {
+        LOGE("Invalid central directory location");
+        return false;
+    }
+
+    std::vector<unsigned char> central(centralSize);
+    if (!readFully(stream->fd, central.data(), centralSize, centralOffset)) {
+        FLOGE("Failed to read central directory: {}", strerror(errno));
+        return false;
+    }
+
+    std::size_t pos = 0;
+    std::size_t fixed = 0;
+
+    while (central.size() - pos >= CentralHeaderSize
+            && readLe32(central.data() + pos) == CentralHeaderSignature) {
+        unsigned char *h = central.data() + pos;
+        std::size_t recordSize = CentralHeaderSize + readLe16(h + 28)
+                + readLe16(h + 30) + readLe16(h + 32);
+        uint64_t offset;
+
+        if (central.size() - pos < recordSize
+                || !centralHeaderOffset(h, recordSize, &offset)) {
+            LOGE("Invalid central directory record");
+            return false;
+        }
+
+        auto it = stream->splicedEntries.find(offset);
+        if (it != stream->splicedEntries.end()) {
+            writeLe32(h + 20, it->second);
+            ++fixed;
+        }
+
+        pos += recordSize;
+    }
+
+    if (fixed != stream->splicedEntries.size()) {
+        LOGE("Not all spliced zip entries are in the central directory");
+        return false;
+    }
+
+    if (!writeFully(stream->fd, central.data(), central.size(),
+                    centralOffset)) {
+        FLOGE("Failed to write central directory: {}", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static int ZCALLBACK ioClose(voidpf opaque, voidpf s)
+{
+    auto ctx = static_cast<ZipIoContext *>(opaque);
+    auto stream = static_cast<ZipStream *>(s);
+    int ret = 0;
+
+    if (!flushBuffer(stream) || !fixSplicedEntries(stream)) {
+        ret = -1;
+    }
+
+    if (stream->data) {
+        munmap(const_cast<unsigned char *>(stream->data), stream->size);
+    }
+    if (::close(stream->fd) < 0) {
+        ret = -1;
+    }
+
+    if (ctx->stream == stream) {
+        ctx->stream = nullptr;
+    }
+
+    delete stream;
+    return ret;
+}
+
+static int ZCALLBACK ioError(voidpf opaque, voidpf s)
+{
+    (void) opaque;
+    return static_cast<ZipStream *>(s)->error;
+}
+
+/*!
+ * \brief Open a zip file for reading
+ *
+ * Instead of minizip's buffered stdio functions, reads are either served
+ * directly from a memory mapping of the file or done with pread() at explicit
+ * offsets, so seeking is free and there is no per-chunk lseek()/read() pair.
+ * Files larger than the address space can handle always use pread().
+ *
+ * The handle must be closed with closeZipInput().
+ *
+ * \param path Path to zip file
+ * \param mode Read mode
+ *
+ * \return minizip handle or nullptr if the file could not be opened
+ */
+unzFile openZipInput(const char *path, ZipReadMode mode)
+{
+    ZipIoContext *ctx = new ZipIoContext();
+    ctx->mode = mode;
+
+    zlib_filefunc64_def def;
+    def.zopen64_file = &ioOpenRead;
+    def.zread_file = &ioRead;
+    def.zwrite_file = &ioWriteReadOnly;
+    def.ztell64_file = &ioTell;
+    def.zseek64_file = &ioSeek;
+    def.zclose_file = &ioClose;
+    def.zerror_file = &ioError;
+    def.opaque = ctx;
+
+    unzFile uf = unzOpen2_64(path, &def);
+    if (!uf) {
+        delete ctx;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(handlesMutex);
+    handles[uf] = ctx;
+    return uf;
+}
+
+/*!
+ * \brief Create a new zip file
+ *
+ * All writes are done with pwrite() at explicit offsets. Entries copied with
+ * beginRawSplice(), reserveRawSplice() and finishRawSplice() never pass
+ * through minizip or, where the kernel supports it, userspace.
+ *
+ * The handle must be closed with closeZipOutput().
+ *
+ * \param path Path to zip file
+ *
+ * \return minizip handle or nullptr if the file could not be created
+ */
+zipFile openZipOutput(const char *path)
+{
+    ZipIoContext *ctx = new ZipIoContext();
+    ctx->mode = ZipReadMode::Pread;
+
+    zlib_filefunc64_def def;
+    def.zopen64_file = &ioOpenWrite;
+    def.zread_file = &ioRead;
+    def.zwrite_file = &ioWrite;
+    def.ztell64_file = &ioTell;
+    def.zseek64_file = &ioSeek;
+    def.zclose_file = &ioClose;
+    def.zerror_file = &ioError;
+    def.opaque = ctx;
+
+    zipFile zf = zipOpen2_64(path, APPEND_STATUS_CREATE, nullptr, &def);
+    if (!zf) {
+        delete ctx;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(handlesMutex);
+    handles[zf] = ctx;
+    return zf;
+}
+
+static void releaseHandle(void *handle)
+{
+    std::lock_guard<std::mutex> lock(handlesMutex);
+    auto it = handles.find(handle);
+    if (it != handles.end()) {
+        delete it->second;
+        handles.erase(it);
+    }
+}
+
+int closeZipInput(unzFile uf)
+{
+    int ret = unzClose(uf);
+    releaseHandle(uf);
+    return ret;
+}
+
+int closeZipOutput(zipFile zf)
+{
+    int ret = zipClose(zf, nullptr);
+    releaseHandle(zf);
+    return ret;
+}
+
+/*!
+ * \brief Start copying the raw data of the current input entry
+ *
+ * This must be called after the raw entry has been opened in \a uf (with
+ * unzOpenCurrentFile2()), but before the entry is opened in \a zf (with
+ * zipOpenNewFileInZip*()). Once the entry has been opened in \a zf,
+ * reserveRawSplice() must be called instead of writing any data. After the
+ * entry has been closed with zipCloseFileInZipRaw64(), finishRawSplice()
+ * copies the data directly between the files.
+ *
+ * minizip only counts the data passed to zipWriteInFileInZip(), so it records
+ * a compressed size of 0 for the entry. finishRawSplice() fixes the local
+ * header and the central directory record is fixed when the zip is closed.
+ * Because of that, only entries that don't need zip64 fields can be spliced.
+ *
+ * \param uf Input zip opened with openZipInput()
+ * \param zf Output zip opened with openZipOutput()
+ * \param size Compressed size of the current entry
+ *
+ * \return Whether the data can be spliced. If false, the data must be copied
+ *         normally.
+ */
+bool beginRawSplice(unzFile uf, zipFile zf, uint64_t size)
+{
+    ZipStream *src = streamForHandle(uf);
+    ZipStream *dst = streamForHandle(zf);
+    if (!src || !dst || size >= 0xffffffffu) {
+        return false;
+    }
+
+    // Position of the entry's compressed data in the input file
+    uint64_t srcOffset = unzGetCurrentFileZStreamPos64(uf);
+    if (srcOffset > src->size || size > src->size - srcOffset) {
+        return false;
+    }
+
+    // Any earlier splice that was never reserved (eg. because opening the
+    // output entry failed) is discarded
+    auto &splice = dst->splice;
+    splice.active = true;
+    splice.srcFd = src->fd;
+    splice.srcData = src->data;
+    splice.srcOffset = srcOffset;
+    // minizip writes the local header at the current position
+    splice.headerOffset = dst->pos;
+    splice.dstOffset = 0;
+    splice.size = size;
+    splice.reserved = false;
+
+    return true;
+}
+
+/*!
+ * \brief Reserve space for the data of an entry started with beginRawSplice()
+ *
+ * This must be called right after the entry has been opened in the output zip.
+ *
+ * \param zf Output zip opened with openZipOutput()
+ *
+ * \return Whether space was reserved
+ */
+bool reserveRawSplice(zipFile zf)
+{
+    ZipStream *dst = streamForHandle(zf);
+    if (!dst || !dst->splice.active || dst->splice.reserved) {
+        return false;
+    }
+
+    auto &splice = dst->splice;
+    splice.reserved = true;
+    // minizip has already written the local header
+    splice.dstOffset = dst->pos;
+
+    // The range is filled in by finishRawSplice()
+    dst->pos += splice.size;
+    dst->size = std::max(dst->size, dst->pos);
+
+    return true;
+}
+
+#ifdef __linux__
+static ssize_t copyFileRange(int fdIn, loff_t *offIn, int fdOut,
+                             loff_t *offOut, size_t len)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fdIn, offIn, fdOut, offOut, len, 0u);
+#else
+    (void) fdIn;
+    (void) offIn;
+    (void) fdOut;
+    (void) offOut;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static bool isUnsupportedError(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == EBADF;
+}
+#endif
+
+/*!
+ * \brief Copy the data of an entry started with beginRawSplice()
+ *
+ * This must be called after the entry has been closed in the output zip. The
+ * data is copied with copy_file_range() where supported, falling back to
+ * sendfile() (where sendfile64() is available) and then to regular writes. The compressed size is then written
+ * to the entry's local header.
+ *
+ * \param zf Output zip opened with openZipOutput()
+ * \param progress Called with the number of bytes copied so far
+ *
+ * \return Whether the data was successfully copied
+ */
+bool finishRawSplice(zipFile zf,
+                     const std::function<void(uint64_t bytes)> &progress)
+{
+    ZipStream *dst = streamForHandle(zf);
+    if (!dst || !dst->splice.active || !dst->splice.reserved) {
+        return false;
+    }
+
+    auto &splice = dst->splice;
+    splice.active = false;
+
+    // minizip's update of the local header may still be buffered and must not
+    // overwrite the size written below
+    if (!flushBuffer(dst)) {
+        return false;
+    }
+
+    uint64_t done = 0;
+#ifdef __linux__
+    bool useCopyFileRange = true;
+#endif
+#ifdef ZIPIO_HAVE_SENDFILE64
+    bool useSendfile = true;
+#endif
+    std::vector<unsigned char> buf;
+
+    while (done < splice.size) {
+        uint64_t chunk = std::min(splice.size - done, SpliceChunkSize);
+        uint64_t srcOffset = splice.srcOffset + done;
+        uint64_t dstOffset = splice.dstOffset + done;
+        ssize_t n;
+
+#ifdef __linux__
+        if (useCopyFileRange) {
+            loff_t offIn = srcOffset;
+            loff_t offOut = dstOffset;
+            n = copyFileRange(splice.srcFd, &offIn, dst->fd, &offOut, chunk);
+            if ((n < 0 && isUnsupportedError(errno))
+                    || (n == 0 && done == 0)) {
+                // Some kernels and filesystems (eg. cross-filesystem copies
+                // before Linux 5.3 and some FUSE and overlay mounts) return 0
+                // instead of an error when they can't copy the range
+                useCopyFileRange = false;
+                continue;
+            }
+        } else
+#endif
+#ifdef ZIPIO_HAVE_SENDFILE64
+        if (useSendfile) {
+            // sendfile() writes at the output file's current offset
+            off64_t offIn = srcOffset;
+            if (lseek64(dst->fd, dstOffset, SEEK_SET) < 0) {
+                n = -1;
+            } else {
+                n = sendfile64(dst->fd, splice.srcFd, &offIn, chunk);
+                if (n < 0 && isUnsupportedError(errno)) {
+                    useSendfile = false;
+                    continue;
+                }
+            }
+        } else
+#endif
+        if (splice.srcData) {
+            n = writeFully(dst->fd, splice.srcData + srcOffset, chunk,
+                           dstOffset) ? chunk : -1;
+        } else {
+            buf.resize(chunk);
+            n = ZIPIO_PREAD(splice.srcFd, buf.data(), chunk,
+                            static_cast<ZIPIO_OFF_T>(srcOffset));
+            if (n > 0 && !writeFully(dst->fd, buf.data(), n, dstOffset)) {
+                n = -1;
+            }
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            FLOGE("Failed to copy zip entry data: {}", strerror(errno));
+            dst->error = errno;
+            return false;
+        } else if (n == 0) {
+            LOGE("Unexpected EOF when copying zip entry data");
+            return false;
+        }
+
+        done += n;
+
+        if (progress) {
+            progress(done);
+        }
+    }
+
+    // Compressed size field of the local header
+    unsigned char size[4];
+    writeLe32(size, splice.size);
+    if (!writeFully(dst->fd, size, sizeof(size), splice.headerOffset + 18)) {
+        FLOGE("Failed to write zip entry header: {}", strerror(errno));
+        dst->error = errno;
+        return false;
+    }
+
+    dst->splicedEntries[splice.headerOffset] = splice.size;
+
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "external/minizip/unzip.h"
+#include "external/minizip/zip.h"
+
+
+namespace mbp
+{
+
+enum class ZipReadMode
+{
+    // Serve reads from a memory mapping of the whole file. Falls back to
+    // Pread if the file cannot be mapped (eg. larger than the address space).
+    Mapped,
+    // Use pread() with an explicit offset for every read
+    Pread
+};
+
+#ifndef _WIN32
+unzFile openZipInput(const char *path, ZipReadMode mode);
+zipFile openZipOutput(const char *path);
+int closeZipInput(unzFile uf);
+int closeZipOutput(zipFile zf);
+
+bool beginRawSplice(unzFile uf, zipFile zf, uint64_t size);
+bool reserveRawSplice(zipFile zf);
+bool finishRawSplice(zipFile zf,
+                     const std::function<void(uint64_t bytes)> &progress);
+#endif
+
+}
@@ -19,6 +19,10 @@
 
 #include "ramdiskpatchers/coreramdiskpatcher.h"
 
+#include <cctype>
+#include <cstring>
+
+#include <algorithm>
 #include <regex>
 #include <unordered_map>
 
@@ -80,6 +84,44 @@ static const std::string InitRc = "init.rc";
 static const std::string InitMultiBootRc = "init.multiboot.rc";
 static const std::string FileContexts = "file_contexts";
 
+
+/*!
+ * Calls \a func with the start and end offsets of every line in \a data. The
+ * line endings are not included. Like boost::split(), the (possibly empty)
+ * text after the last newline is treated as a line. Iteration stops if \a func
+ * returns false.
+ */
+template<typename Func>
+static void forEachLine(const unsigned char *data, std::size_t size, Func func)
+{
+    std::size_t start = 0;
+
+    while (true) {
+        auto nl = start < size ? static_cast<const unsigned char *>(
+                std::memchr(data + start, '\n', size - start)) : nullptr;
+        std::size_t end = nl ? static_cast<std::size_t>(nl - data) : size;
+
+        if (!func(start, end) || !nl) {
+            break;
+        }
+
+        start = end + 1;
+    }
+}
+
+static bool containsString(const BinaryView &view, const std::string &str)
+{
+    return std::search(view.begin(), view.end(), str.begin(), str.end())
+            != view.end();
+}
+
+static bool lineStartsWith(const unsigned char *data, std::size_t start,
+                           std::size_t end, const std::string &prefix)
+{
+    return end - start >= prefix.size()
+            && std::memcmp(data + start, prefix.data(), prefix.size()) == 0;
+}
+
 CoreRamdiskPatcher::CoreRamdiskPatcher(const PatcherConfig * const pc,
                                        const FileInfo * const info,
                                        CpioFile * const cpio) :
@@ -135,53 +177,51 @@ bool CoreRamdiskPatcher::addMultiBootRc()
         return false;
     }
 
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(InitRc, &contents)) {
+    std::vector<unsigned char> *contents =
+            m_impl->cpio->contentsBuffer(InitRc);
+    if (!contents) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
 
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
-
-    bool added = false;
+    // Add the import before the first line that isn't a comment
+    std::size_t insertPos = std::string::npos;
 
-    for (auto it = lines.begin(); it != lines.end(); ++it) {
-        if (!it->empty() && it->at(0) == '#') {
-            continue;
+    forEachLine(contents->data(), contents->size(),
+                [&](std::size_t start, std::size_t end) {
+        if (end > start && (*contents)[start] == '#') {
+            return true;
         }
-        lines.insert(it, ImportMultiBootRc);
-        added = true;
-        break;
-    }
-
-    if (!added) {
-        lines.push_back(ImportMultiBootRc);
+        insertPos = start;
+        return false;
+    });
+
+    if (insertPos != std::string::npos) {
+        std::string line = ImportMultiBootRc + "\n";
+        contents->insert(contents->begin() + insertPos,
+                         line.begin(), line.end());
+    } else {
+        std::string line = "\n" + ImportMultiBootRc;
+        contents->insert(contents->end(), line.begin(), line.end());
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(InitRc, std::move(contents));
-
     return true;
 }
 
 bool CoreRamdiskPatcher::addDaemonService()
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(InitMultiBootRc, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(InitMultiBootRc, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
 
-    const std::string serviceName("mbtooldaemon");
-    if (std::search(contents.begin(), contents.end(),
-                    serviceName.begin(), serviceName.end()) == contents.end()) {
-        contents.insert(contents.end(),
-                        MbtoolDaemonService.begin(),
-                        MbtoolDaemonService.end());
-
-        m_impl->cpio->setContents(InitMultiBootRc, std::move(contents));
+    if (!containsString(view, "mbtooldaemon")) {
+        std::vector<unsigned char> *contents =
+                m_impl->cpio->contentsBuffer(InitMultiBootRc);
+        contents->insert(contents->end(),
+                         MbtoolDaemonService.begin(),
+                         MbtoolDaemonService.end());
     }
 
     return true;
@@ -189,20 +229,18 @@ bool CoreRamdiskPatcher::addDaemonService()
 
 bool CoreRamdiskPatcher::addAppsyncService()
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(InitMultiBootRc, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(InitMultiBootRc, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
 
-    const std::string serviceName("appsync");
-    if (std::search(contents.begin(), contents.end(),
-                    serviceName.begin(), serviceName.end()) == contents.end()) {
-        contents.insert(contents.end(),
-                        MbtoolAppsyncService.begin(),
-                        MbtoolAppsyncService.end());
-
-        m_impl->cpio->setContents(InitMultiBootRc, std::move(contents));
+    if (!containsString(view, "appsync")) {
+        std::vector<unsigned char> *contents =
+                m_impl->cpio->contentsBuffer(InitMultiBootRc);
+        contents->insert(contents->end(),
+                         MbtoolAppsyncService.begin(),
+                         MbtoolAppsyncService.end());
     }
 
     return true;
@@ -210,44 +248,51 @@ bool CoreRamdiskPatcher::addAppsyncService()
 
 bool CoreRamdiskPatcher::disableInstalldService()
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(InitRc, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(InitRc, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
 
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
-
-    std::regex whitespace("^\\s*$");
+    const unsigned char *data = view.data();
     bool insideService = false;
     bool isDisabled = false;
-    std::vector<std::string>::iterator installdIter = lines.end();
+    std::size_t installdEnd = std::string::npos;
 
-    // Remove old mbtooldaemon service definition
-    for (auto it = lines.begin(); it != lines.end(); ++it) {
-        if (boost::starts_with(*it, "service")) {
-            insideService = it->find("installd") != std::string::npos;
+    forEachLine(data, view.size(), [&](std::size_t start, std::size_t end) {
+        const unsigned char *begin = data + start;
+        const unsigned char *finish = data + end;
+
+        if (lineStartsWith(data, start, end, "service")) {
+            static const std::string installd("installd");
+            insideService = std::search(begin, finish, installd.begin(),
+                                        installd.end()) != finish;
             if (insideService) {
-                installdIter = it;
+                installdEnd = end;
             }
-        } else if (insideService && std::regex_search(*it, whitespace)) {
+        } else if (insideService && std::all_of(begin, finish, [](unsigned char c) {
+            return std::isspace(c);
+        })) {
             insideService = false;
         }
 
-        if (insideService && it->find("disabled") != std::string::npos) {
+        static const std::string disabled("disabled");
+        if (insideService && std::search(begin, finish, disabled.begin(),
+                                         disabled.end()) != finish) {
             isDisabled = true;
         }
-    }
 
-    if (!isDisabled && installdIter != lines.end()) {
-        lines.insert(++installdIter, "    disabled");
+        return true;
+    });
+
+    if (!isDisabled && installdEnd != std::string::npos) {
+        static const std::string line("\n    disabled");
+        std::vector<unsigned char> *contents =
+                m_impl->cpio->contentsBuffer(InitRc);
+        contents->insert(contents->begin() + installdEnd,
+                         line.begin(), line.end());
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(InitRc, std::move(contents));
-
     return true;
 }
 
@@ -266,26 +311,25 @@ bool CoreRamdiskPatcher::fixDataMediaContext()
 
     bool hasDataMediaContext = false;
 
-    std::vector<unsigned char> contents;
-    m_impl->cpio->contents(FileContexts, &contents);
-
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    BinaryView view;
+    m_impl->cpio->contentsView(FileContexts, &view);
 
-    for (auto it = lines.begin(); it != lines.end(); ++it) {
-        if (boost::starts_with(*it, "/data/media")) {
+    forEachLine(view.data(), view.size(),
+                [&](std::size_t start, std::size_t end) {
+        if (lineStartsWith(view.data(), start, end, "/data/media")) {
             hasDataMediaContext = true;
+            return false;
         }
-    }
+        return true;
+    });
 
     if (!hasDataMediaContext) {
-        lines.push_back(DataMediaContext);
+        std::string line = "\n" + DataMediaContext;
+        std::vector<unsigned char> *contents =
+                m_impl->cpio->contentsBuffer(FileContexts);
+        contents->insert(contents->end(), line.begin(), line.end());
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(FileContexts, std::move(contents));
-
     return true;
 }
 
@@ -301,24 +345,38 @@ bool CoreRamdiskPatcher::removeRestorecon()
         return true;
     }
 
-    std::vector<unsigned char> contents;
-    m_impl->cpio->contents(InitRc, &contents);
-
-    std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    BinaryView view;
+    m_impl->cpio->contentsView(InitRc, &view);
 
     const std::regex re1("^\\s*restorecon_recursive\\s+/data\\s*$");
     const std::regex re2("^\\s*restorecon_recursive\\s+/cache\\s*$");
+    static const std::string command("restorecon_recursive");
 
-    for (auto it = lines.begin(); it != lines.end(); ++it) {
-        if (std::regex_search(*it, re1) || std::regex_search(*it, re2)) {
-            it->insert(it->begin(), '#');
+    std::vector<std::size_t> commentOut;
+
+    forEachLine(view.data(), view.size(),
+                [&](std::size_t start, std::size_t end) {
+        const char *begin = reinterpret_cast<const char *>(view.data()) + start;
+        const char *finish = reinterpret_cast<const char *>(view.data()) + end;
+
+        // Avoid running the regexes on lines that can't possibly match
+        if (std::search(begin, finish, command.begin(), command.end()) != finish
+                && (std::regex_search(begin, finish, re1)
+                || std::regex_search(begin, finish, re2))) {
+            commentOut.push_back(start);
         }
-    }
+        return true;
+    });
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(InitRc, std::move(contents));
+    if (!commentOut.empty()) {
+        std::vector<unsigned char> *contents =
+                m_impl->cpio->contentsBuffer(InitRc);
+
+        // Insert from the end so the earlier offsets remain valid
+        for (auto it = commentOut.rbegin(); it != commentOut.rend(); ++it) {
+            contents->insert(contents->begin() + *it, '#');
+        }
+    }
 
     return true;
 }
@@ -333,8 +391,8 @@ static std::string whitespace(const std::string &str) {
 
 bool CoreRamdiskPatcher::useGeneratedFstab(const std::string &filename)
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(filename, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(filename, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
@@ -343,9 +401,10 @@ bool CoreRamdiskPatcher::useGeneratedFstab(const std::string &filename)
             std::regex("^\\s+mount_all\\s+([^\\s]+)\\s*(#.*)?$");
 
     std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    boost::split(lines, view, boost::is_any_of("\n"));
 
     std::vector<std::string> newFstabs;
+    bool changed = false;
 
     for (auto it = lines.begin(); it != lines.end(); ++it) {
         std::smatch what;
@@ -391,18 +450,21 @@ bool CoreRamdiskPatcher::useGeneratedFstab(const std::string &filename)
             // Mount generated fstab
             ++it;
             *it = spaces + "mount_all " + generated;
+            changed = true;
         }
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(filename, std::move(contents));
+    if (changed) {
+        std::string strContents = boost::join(lines, "\n");
+        m_impl->cpio->contentsBuffer(filename)->assign(
+                strContents.begin(), strContents.end());
+    }
 
     // Add mount services for the new fstab files to init.multiboot.rc
     if (!newFstabs.empty()) {
-        std::vector<unsigned char> multiBootRc;
-
-        if (!m_impl->cpio->contents("init.multiboot.rc", &multiBootRc)) {
+        std::vector<unsigned char> *multiBootRc =
+                m_impl->cpio->contentsBuffer("init.multiboot.rc");
+        if (!multiBootRc) {
             m_impl->error = m_impl->cpio->error();
             return false;
         }
@@ -412,11 +474,10 @@ bool CoreRamdiskPatcher::useGeneratedFstab(const std::string &filename)
                     fmt::format("mbtool-mount-{:03d}", m_impl->fstabs.size());
             std::string service = fmt::format(
                     MbtoolMountServiceFmt, serviceName, fstab);
-            multiBootRc.insert(multiBootRc.end(), service.begin(), service.end());
+            multiBootRc->insert(multiBootRc->end(),
+                                service.begin(), service.end());
             m_impl->fstabs.push_back(std::move(fstab));
         }
-
-        m_impl->cpio->setContents("init.multiboot.rc", std::move(multiBootRc));
     }
 
     return true;
@@ -439,8 +500,8 @@ bool CoreRamdiskPatcher::useGeneratedFstabAuto()
 
 bool CoreRamdiskPatcher::fixChargerMount(const std::string &filename)
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(filename, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(filename, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
@@ -459,7 +520,8 @@ bool CoreRamdiskPatcher::fixChargerMount(const std::string &filename)
     std::string previousLine;
 
     std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    boost::split(lines, view, boost::is_any_of("\n"));
+    bool changed = false;
 
     static auto const reMountSystem = std::regex("mount.*/system");
     static auto const reOnCharger = std::regex("on\\s+charger");
@@ -471,14 +533,17 @@ bool CoreRamdiskPatcher::fixChargerMount(const std::string &filename)
             std::string spaces = whitespace(*it);
             *it = spaces + "start mbtool-mount-000";
             it = lines.insert(++it, spaces + "wait " + completed + " 15");
+            changed = true;
         }
 
         previousLine = *it;
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(filename, std::move(contents));
+    if (changed) {
+        std::string strContents = boost::join(lines, "\n");
+        m_impl->cpio->contentsBuffer(filename)->assign(
+                strContents.begin(), strContents.end());
+    }
 
     return true;
 }
@@ -113,23 +113,27 @@ bool GalaxyRamdiskPatcher::getwModifyMsm8960LpmRc()
         return true;
     }
 
-    std::vector<unsigned char> contents;
-    m_impl->cpio->contents(Msm8960LpmRc, &contents);
+    BinaryView view;
+    m_impl->cpio->contentsView(Msm8960LpmRc, &view);
 
     std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    boost::split(lines, view, boost::is_any_of("\n"));
+    bool changed = false;
 
     static auto const re = std::regex("^\\s+mount.*/cache.*$");
 
     for (auto it = lines.begin(); it != lines.end(); ++it) {
         if (std::regex_search(*it, re)) {
             it->insert(it->begin(), '#');
+            changed = true;
         }
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(Msm8960LpmRc, std::move(contents));
+    if (changed) {
+        std::string strContents = boost::join(lines, "\n");
+        m_impl->cpio->contentsBuffer(Msm8960LpmRc)->assign(
+                strContents.begin(), strContents.end());
+    }
 
     return true;
 }
@@ -101,14 +101,14 @@ bool QcomRamdiskPatcher::addMissingCacheInFstab(const std::vector<std::string> &
                   additionalFstabs.begin(), additionalFstabs.end());
 
     for (auto const &fstab : fstabs) {
-        std::vector<unsigned char> contents;
-        if (!m_impl->cpio->contents(fstab, &contents)) {
+        BinaryView view;
+        if (!m_impl->cpio->contentsView(fstab, &view)) {
             m_impl->error = m_impl->cpio->error();
             return false;
         }
 
         std::vector<std::string> lines;
-        boost::split(lines, contents, boost::is_any_of("\n"));
+        boost::split(lines, view, boost::is_any_of("\n"));
 
         // Some Android 4.2 ROMs mount the cache partition in the init
         // scripts, so the fstab has no cache line
@@ -131,13 +131,13 @@ bool QcomRamdiskPatcher::addMissingCacheInFstab(const std::vector<std::string> &
             std::string mountArgs = "nosuid,nodev,barrier=1";
             std::string voldArgs = "wait,check";
 
-            lines.push_back(fmt::format(
-                    cacheLine, CachePartition, mountArgs, voldArgs));
-        }
+            std::string line = "\n" + fmt::format(
+                    cacheLine, CachePartition, mountArgs, voldArgs);
 
-        std::string strContents = boost::join(lines, "\n");
-        contents.assign(strContents.begin(), strContents.end());
-        m_impl->cpio->setContents(fstab, std::move(contents));
+            std::vector<unsigned char> *contents =
+                    m_impl->cpio->contentsBuffer(fstab);
+            contents->insert(contents->end(), line.begin(), line.end());
+        }
     }
 
     return true;
@@ -145,14 +145,15 @@ bool QcomRamdiskPatcher::addMissingCacheInFstab(const std::vector<std::string> &
 
 bool QcomRamdiskPatcher::stripManualMounts(const std::string &filename)
 {
-    std::vector<unsigned char> contents;
-    if (!m_impl->cpio->contents(filename, &contents)) {
+    BinaryView view;
+    if (!m_impl->cpio->contentsView(filename, &view)) {
         m_impl->error = m_impl->cpio->error();
         return false;
     }
 
     std::vector<std::string> lines;
-    boost::split(lines, contents, boost::is_any_of("\n"));
+    boost::split(lines, view, boost::is_any_of("\n"));
+    bool changed = false;
 
     const std::regex reWaitCache("^\\s+wait\\s+/dev/.*/cache");
     const std::regex reCheckFsCache("^\\s+check_fs\\s+/dev/.*/cache");
@@ -169,12 +170,15 @@ bool QcomRamdiskPatcher::stripManualMounts(const std::string &filename)
                 || std::regex_search(*it, reCheckFsData)
                 || std::regex_search(*it, reMountData)) {
             it->insert(it->begin(), '#');
+            changed = true;
         }
     }
 
-    std::string strContents = boost::join(lines, "\n");
-    contents.assign(strContents.begin(), strContents.end());
-    m_impl->cpio->setContents(filename, std::move(contents));
+    if (changed) {
+        std::string strContents = boost::join(lines, "\n");
+        m_impl->cpio->contentsBuffer(filename)->assign(
+                strContents.begin(), strContents.end());
+    }
 
     return true;
 }
@@ -66,7 +66,8 @@ static std::string find_block_dev(const std::vector<std::string> &search_dirs,
 }
 
 static bool flash_extra_images(const std::string &multiboot_dir,
-                               const std::vector<std::string> &block_dev_dirs)
+                               const std::vector<std::string> &block_dev_dirs,
+                               util::ProgressReporter *progress)
 {
     DIR *dir;
     dirent *ent;
@@ -112,7 +113,7 @@ static bool flash_extra_images(const std::string &multiboot_dir,
         LOGD("- Source: {}", path);
         LOGD("- Target: {}", block_dev);
 
-        if (!util::copy_contents(path, block_dev)) {
+        if (!util::copy_contents(path, block_dev, progress)) {
             LOGE("Failed to write {}", block_dev);
             return false;
         }
@@ -124,7 +125,8 @@ static bool flash_extra_images(const std::string &multiboot_dir,
 static bool choose_or_set_rom(const std::string &id,
                               const std::string &boot_blockdev,
                               const std::vector<std::string> &blockdev_base_dirs,
-                              bool choose)
+                              bool choose,
+                              util::ProgressReporter *progress)
 {
     // Path for all of the images
     std::string multiboot_path(MULTIBOOT_DIR);
@@ -151,7 +153,8 @@ static bool choose_or_set_rom(const std::string &id,
 
     // Flash or set kernel
     if (!util::copy_contents(choose ? bootimg_path : boot_blockdev,
-                             choose ? boot_blockdev : bootimg_path)) {
+                             choose ? boot_blockdev : bootimg_path,
+                             progress)) {
         LOGE("Failed to write {}", choose ? boot_blockdev : bootimg_path);
         return false;
     }
@@ -170,7 +173,8 @@ static bool choose_or_set_rom(const std::string &id,
 
     // If there are additional image files, flash those too
     if (choose) {
-        if (!flash_extra_images(multiboot_path, blockdev_base_dirs)) {
+        if (!flash_extra_images(multiboot_path, blockdev_base_dirs,
+                                progress)) {
             LOGE("Failed to flash extra images");
             return false;
         }
@@ -180,14 +184,17 @@ static bool choose_or_set_rom(const std::string &id,
 }
 
 bool action_choose_rom(const std::string &id, const std::string &boot_blockdev,
-                       const std::vector<std::string> &blockdev_base_dirs)
+                       const std::vector<std::string> &blockdev_base_dirs,
+                       util::ProgressReporter *progress)
 {
-    return choose_or_set_rom(id, boot_blockdev, blockdev_base_dirs, true);
+    return choose_or_set_rom(id, boot_blockdev, blockdev_base_dirs, true,
+                             progress);
 }
 
-bool action_set_kernel(const std::string &id, const std::string &boot_blockdev)
+bool action_set_kernel(const std::string &id, const std::string &boot_blockdev,
+                       util::ProgressReporter *progress)
 {
-    return choose_or_set_rom(id, boot_blockdev, {}, false);
+    return choose_or_set_rom(id, boot_blockdev, {}, false, progress);
 }
 
 }
@@ -22,12 +22,16 @@
 #include <string>
 #include <vector>
 
+#include "util/progress.h"
+
 namespace mb
 {
 
 bool action_choose_rom(const std::string &id, const std::string &boot_blockdev,
-                       const std::vector<std::string> &blockdev_base_dirs);
-bool action_set_kernel(const std::string &id, const std::string &boot_blockdev);
+                       const std::vector<std::string> &blockdev_base_dirs,
+                       util::ProgressReporter *progress = nullptr);
+bool action_set_kernel(const std::string &id, const std::string &boot_blockdev,
+                       util::ProgressReporter *progress = nullptr);
 bool action_reboot(const std::string &reboot_arg);
 
 }
\ No newline at end of file
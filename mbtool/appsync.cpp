@@ -39,6 +39,7 @@
 #include "apk.h"
 #include "appsyncmanager.h"
 #include "packages.h"
+#include "packagescache.h"
 #include "romconfig.h"
 #include "roms.h"
 #include "util/chown.h"
@@ -188,8 +189,8 @@ static bool prepare_appsync()
     // Detect directory locations
     AppSyncManager::detect_directories();
 
-    Packages pkgs;
-    if (!pkgs.load_xml(PACKAGES_XML)) {
+    std::shared_ptr<Packages> pkgs = system_packages().get();
+    if (!pkgs) {
         LOGE("Failed to load {}", PACKAGES_XML);
         return false;
     }
@@ -203,7 +204,7 @@ static bool prepare_appsync()
         SharedPackage &shared_pkg = *it;
 
         // Ensure package is installed, so we can get its UID
-        auto pkg = pkgs.find_by_pkg(shared_pkg.pkg_id);
+        auto pkg = pkgs->find_by_pkg(shared_pkg.pkg_id);
         if (!pkg) {
             LOGW("Package {} won't be shared because it is not installed",
                  shared_pkg.pkg_id);
@@ -265,7 +266,7 @@ static bool prepare_appsync()
 
     // Actually share the apk and data
     for (SharedPackage &shared_pkg : config.shared_pkgs) {
-        auto pkg = pkgs.find_by_pkg(shared_pkg.pkg_id);
+        auto pkg = pkgs->find_by_pkg(shared_pkg.pkg_id);
 
         if (disable_apk_sharing) {
             shared_pkg.share_apk = false;
@@ -25,29 +25,44 @@
 #include <cstring>
 #include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mount.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include <proc/readproc.h>
 
 #include "actions.h"
 #include "multiboot.h"
 #include "packages.h"
+#include "packagescache.h"
 #include "reboot.h"
 #include "roms.h"
 #include "sepolpatch.h"
-#include "validcerts.h"
 #include "util/copy.h"
 #include "util/delete.h"
 #include "util/finally.h"
 #include "util/logging.h"
+#include "util/progress.h"
 #include "util/properties.h"
 #include "util/selinux.h"
 #include "util/socket.h"
+#include "util/string.h"
+#include "util/threadpool.h"
 
 // flatbuffers
 #include "protocol/get_version_generated.h"
@@ -61,6 +76,8 @@
 #include "protocol/copy_generated.h"
 #include "protocol/chmod_generated.h"
 #include "protocol/wipe_rom_generated.h"
+#include "protocol/cancel_generated.h"
+#include "protocol/progress_generated.h"
 #include "protocol/request_generated.h"
 #include "protocol/response_generated.h"
 
@@ -76,26 +93,162 @@ namespace mb
 namespace v2 = mbtool::daemon::v2;
 namespace fb = flatbuffers;
 
-static bool v2_send_response(int fd, const fb::FlatBufferBuilder &builder)
+// Message queued for sending to a client. If fd is not -1, the file descriptor
+// is passed with SCM_RIGHTS instead of sending data.
+struct OutMessage
+{
+    OutMessage() = default;
+
+    OutMessage(OutMessage &&other) noexcept
+        : data(std::move(other.data)), fd(other.fd)
+    {
+        other.fd = -1;
+    }
+
+    OutMessage(const OutMessage &) = delete;
+    OutMessage & operator=(const OutMessage &) = delete;
+
+    ~OutMessage()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    std::vector<uint8_t> data;
+    int fd = -1;
+};
+
+// Cancellation state of a request running on a worker thread
+enum CancelState : int
 {
-    return util::socket_write_bytes(
-            fd, builder.GetBufferPointer(), builder.GetSize());
+    CANCEL_NONE,
+    // The client cancelled the request
+    CANCEL_REQUESTED,
+    // The request is writing something that must not be left half-written
+    CANCEL_DISABLED,
+};
+
+// Responses produced by a request handler. Handlers queue their responses
+// here instead of writing to the socket so that they can run on a worker
+// thread while the event loop keeps serving other clients.
+struct Reply
+{
+    std::vector<OutMessage> messages;
+    // ID of the request being handled, which is echoed in the response
+    uint32_t request_id = 0;
+    // Close the connection after the messages have been sent
+    bool close = false;
+    // Send PROGRESS responses while the request is running
+    bool report_progress = false;
+    // Cancellation state shared with the event loop
+    std::shared_ptr<std::atomic<int>> cancel_state;
+    // Sends messages before the request has completed. Only set for requests
+    // running on a worker thread.
+    std::function<void(Reply *)> send_partial;
+};
+
+// Queue a length-prefixed buffer (same format as util::socket_write_bytes())
+static void queue_bytes(Reply *reply, const uint8_t *data, size_t len)
+{
+    int32_t len32 = len;
+
+    OutMessage msg;
+    msg.data.resize(sizeof(len32) + len);
+    memcpy(msg.data.data(), &len32, sizeof(len32));
+    memcpy(msg.data.data() + sizeof(len32), data, len);
+
+    reply->messages.push_back(std::move(msg));
+}
+
+static void queue_string(Reply *reply, const std::string &str)
+{
+    queue_bytes(reply, reinterpret_cast<const uint8_t *>(str.data()),
+                str.size());
+}
+
+// Takes ownership of fd
+static void queue_fd(Reply *reply, int fd)
+{
+    OutMessage msg;
+    msg.fd = fd;
+    reply->messages.push_back(std::move(msg));
 }
 
-static bool v2_send_generic_response(int fd, v2::ResponseType type)
+static bool v2_send_response(Reply *reply, const fb::FlatBufferBuilder &builder)
+{
+    queue_bytes(reply, builder.GetBufferPointer(), builder.GetSize());
+    return true;
+}
+
+static bool v2_send_generic_response(Reply *reply, v2::ResponseType type)
 {
     fb::FlatBufferBuilder builder;
     v2::ResponseBuilder rb(builder);
     rb.add_type(type);
+    rb.add_id(reply->request_id);
     builder.Finish(rb.Finish());
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
+}
+
+static bool v2_cancelled(Reply *reply)
+{
+    return reply->cancel_state && *reply->cancel_state == CANCEL_REQUESTED;
+}
+
+// Stop accepting cancellation before starting a write that must complete, such
+// as flashing a partition. Returns false if the request was already cancelled,
+// in which case nothing should be written.
+static bool v2_disable_cancel(Reply *reply)
+{
+    if (!reply->cancel_state) {
+        return true;
+    }
+
+    int expected = CANCEL_NONE;
+    return reply->cancel_state->compare_exchange_strong(
+            expected, CANCEL_DISABLED) || expected == CANCEL_DISABLED;
+}
+
+// Create a progress reporter for a long-running request. The reporter stops
+// the operation once the request is cancelled.
+static util::ProgressReporter v2_progress_reporter(Reply *reply)
+{
+    return util::ProgressReporter([reply](uint64_t bytes, uint64_t files,
+                                          const std::string &path) {
+        if (v2_cancelled(reply)) {
+            return false;
+        }
+
+        if (reply->report_progress && reply->send_partial) {
+            fb::FlatBufferBuilder builder;
+
+            // Create response
+            auto fb_path = builder.CreateString(path);
+            auto response = v2::CreateProgressResponse(
+                    builder, bytes, files, fb_path);
+
+            // Wrap response
+            v2::ResponseBuilder rb(builder);
+            rb.add_type(v2::ResponseType_PROGRESS);
+            rb.add_id(reply->request_id);
+            rb.add_progress_response(response);
+            builder.Finish(rb.Finish());
+
+            Reply partial;
+            v2_send_response(&partial, builder);
+            reply->send_partial(&partial);
+        }
+
+        return true;
+    });
 }
 
-static bool v2_get_version(int fd, const v2::Request *msg)
+static bool v2_get_version(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->get_version_request();
     if (!request) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -107,17 +260,18 @@ static bool v2_get_version(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_GET_VERSION);
+    rb.add_id(reply->request_id);
     rb.add_get_version_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_get_roms_list(int fd, const v2::Request *msg)
+static bool v2_get_roms_list(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->get_roms_list_request();
     if (!request) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -167,17 +321,18 @@ static bool v2_get_roms_list(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_GET_ROMS_LIST);
+    rb.add_id(reply->request_id);
     rb.add_get_roms_list_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_get_builtin_rom_ids(int fd, const v2::Request *msg)
+static bool v2_get_builtin_rom_ids(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->get_builtin_rom_ids_request();
     if (!request) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -198,17 +353,18 @@ static bool v2_get_builtin_rom_ids(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_GET_BUILTIN_ROM_IDS);
+    rb.add_id(reply->request_id);
     rb.add_get_builtin_rom_ids_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_get_current_rom(int fd, const v2::Request *msg)
+static bool v2_get_current_rom(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->get_current_rom_request();
     if (!request) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -225,17 +381,18 @@ static bool v2_get_current_rom(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_GET_CURRENT_ROM);
+    rb.add_id(reply->request_id);
     rb.add_get_current_rom_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_switch_rom(int fd, const v2::Request *msg)
+static bool v2_switch_rom(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->switch_rom_request();
     if (!request || !request->rom_id() || !request->boot_blockdev()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     std::vector<std::string> block_dev_dirs;
@@ -248,9 +405,14 @@ static bool v2_switch_rom(int fd, const v2::Request *msg)
 
     fb::FlatBufferBuilder builder;
 
-    bool success = action_choose_rom(request->rom_id()->c_str(),
-                                     request->boot_blockdev()->c_str(),
-                                     block_dev_dirs);
+    util::ProgressReporter progress = v2_progress_reporter(reply);
+
+    // A cancelled write would leave the boot or modem partition half-written,
+    // so the request can only be cancelled before it starts
+    bool success = v2_disable_cancel(reply)
+            && action_choose_rom(request->rom_id()->c_str(),
+                                 request->boot_blockdev()->c_str(),
+                                 block_dev_dirs, &progress);
 
     // Create response
     auto response = v2::CreateSwitchRomResponse(builder, success);
@@ -258,23 +420,29 @@ static bool v2_switch_rom(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_SWITCH_ROM);
+    rb.add_id(reply->request_id);
     rb.add_switch_rom_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_set_kernel(int fd, const v2::Request *msg)
+static bool v2_set_kernel(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->set_kernel_request();
     if (!request || !request->rom_id() || !request->boot_blockdev()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
 
-    bool success = action_set_kernel(request->rom_id()->c_str(),
-                                     request->boot_blockdev()->c_str());
+    util::ProgressReporter progress = v2_progress_reporter(reply);
+
+    // Don't leave a truncated boot image behind
+    bool success = v2_disable_cancel(reply)
+            && action_set_kernel(request->rom_id()->c_str(),
+                                 request->boot_blockdev()->c_str(),
+                                 &progress);
 
     // Create response
     auto response = v2::CreateSetKernelResponse(builder, success);
@@ -282,17 +450,18 @@ static bool v2_set_kernel(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_SET_KERNEL);
+    rb.add_id(reply->request_id);
     rb.add_set_kernel_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_reboot(int fd, const v2::Request *msg)
+static bool v2_reboot(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->reboot_request();
     if (!request) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -312,20 +481,23 @@ static bool v2_reboot(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_REBOOT);
+    rb.add_id(reply->request_id);
     rb.add_reboot_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_open(int fd, const v2::Request *msg)
+static bool v2_open(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->open_request();
     if (!request || !request->path()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
-    int flags = 0;
+    // Other worker threads may spawn processes while the fd is waiting to be
+    // sent. The flag is not passed along with the fd.
+    int flags = O_CLOEXEC;
 
     if (request->flags()) {
         for (short openflag : *request->flags()) {
@@ -350,78 +522,102 @@ static bool v2_open(int fd, const v2::Request *msg)
     int ffd = open(request->path()->c_str(), flags, 0666);
     if (ffd < 0) {
         // Create response
-        auto error = builder.CreateString(strerror(errno));
+        auto error = builder.CreateString(util::error_string(errno));
         auto response = v2::CreateOpenResponse(builder, false, error);
 
         // Wrap response
         v2::ResponseBuilder rb(builder);
         rb.add_type(v2::ResponseType_OPEN);
+        rb.add_id(reply->request_id);
         rb.add_open_response(response);
         builder.Finish(rb.Finish());
 
-        return v2_send_response(fd, builder);
+        return v2_send_response(reply, builder);
     }
 
-    auto close_ffd = util::finally([&]{
-        close(ffd);
-    });
-
     // Send SUCCESS, so the client knows to receive an fd
     auto response = v2::CreateOpenResponse(builder, true);
 
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_OPEN);
+    rb.add_id(reply->request_id);
     rb.add_open_response(response);
     builder.Finish(rb.Finish());
 
-    if (!v2_send_response(fd, builder)) {
-        return false;
-    }
+    v2_send_response(reply, builder);
+
+    // The fd is closed once it has been sent
+    queue_fd(reply, ffd);
 
-    return util::socket_send_fds(fd, { ffd });
+    return true;
 }
 
-static bool v2_copy(int fd, const v2::Request *msg)
+static bool v2_copy(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->copy_request();
     if (!request || !request->source() || !request->target()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
 
     fb::Offset<v2::CopyResponse> response;
 
-    if (util::copy_contents(request->source()->c_str(),
-                            request->target()->c_str())) {
+    util::ProgressReporter progress = v2_progress_reporter(reply);
+
+    const char *target = request->target()->c_str();
+
+    // A cancelled copy must not leave a partial file behind. New and regular
+    // files are removed when the copy is cancelled. Anything else (eg. a block
+    // device) can only be cancelled before writing starts.
+    struct stat sb;
+    bool removable = lstat(target, &sb) < 0
+            ? errno == ENOENT : S_ISREG(sb.st_mode);
+
+    bool ret;
+    if (!removable && !v2_disable_cancel(reply)) {
+        errno = ECANCELED;
+        ret = false;
+    } else {
+        // errno is ECANCELED if the request was cancelled
+        ret = util::copy_contents(request->source()->c_str(), target,
+                                  &progress);
+        if (!ret && errno == ECANCELED && removable) {
+            unlink(target);
+            errno = ECANCELED;
+        }
+    }
+
+    if (ret) {
         response = v2::CreateCopyResponse(builder, true);
     } else {
-        auto error = builder.CreateString(strerror(errno));
+        auto error = builder.CreateString(util::error_string(errno));
         response = v2::CreateCopyResponse(builder, false, error);
     }
 
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_COPY);
+    rb.add_id(reply->request_id);
     rb.add_copy_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_chmod(int fd, const v2::Request *msg)
+static bool v2_chmod(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->chmod_request();
     if (!request || !request->path()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     // Don't allow setting setuid or setgid permissions
     uint32_t mode = request->mode();
     uint32_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     fb::FlatBufferBuilder builder;
@@ -429,7 +625,7 @@ static bool v2_chmod(int fd, const v2::Request *msg)
     fb::Offset<v2::ChmodResponse> response;
 
     if (chmod(request->path()->c_str(), mode) < 0) {
-        auto error = builder.CreateString(strerror(errno));
+        auto error = builder.CreateString(util::error_string(errno));
         response = v2::CreateChmodResponse(builder, false, error);
     } else {
         response = v2::CreateChmodResponse(builder, true);
@@ -438,17 +634,18 @@ static bool v2_chmod(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_CHMOD);
+    rb.add_id(reply->request_id);
     rb.add_chmod_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
 }
 
-static bool v2_wipe_rom(int fd, const v2::Request *msg)
+static bool v2_wipe_rom(Reply *reply, const v2::Request *msg)
 {
     auto request = msg->wipe_rom_request();
     if (!request || !request->rom_id()) {
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     // Find and verify ROM is installed
@@ -459,40 +656,48 @@ static bool v2_wipe_rom(int fd, const v2::Request *msg)
     if (!rom) {
         LOGE("Tried to wipe non-installed or invalid ROM ID: {}",
              request->rom_id()->c_str());
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     // The GUI should check this, but we'll enforce it here
     auto current_rom = Roms::get_current_rom();
     if (current_rom && current_rom->id == rom->id) {
         LOGE("Cannot wipe currently booted ROM: {}", rom->id);
-        return v2_send_generic_response(fd, v2::ResponseType_INVALID);
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
     }
 
     // Wipe the selected targets
     std::vector<int16_t> succeeded;
     std::vector<int16_t> failed;
 
+    util::ProgressReporter progress = v2_progress_reporter(reply);
+
     if (request->targets()) {
         std::string raw_system = get_raw_path("/system");
         if (mount("", raw_system.c_str(), "", MS_REMOUNT, "") < 0) {
             LOGW("Failed to mount {} as writable: {}",
-                 raw_system, strerror(errno));
+                 raw_system, util::error_string(errno));
         }
 
         for (short target : *request->targets()) {
             bool success = false;
 
+            if (progress.cancelled() || v2_cancelled(reply)) {
+                // Report the remaining targets as failed
+                failed.push_back(target);
+                continue;
+            }
+
             if (target == v2::WipeTarget_SYSTEM) {
-                success = wipe_directory(rom->system_path, true);
+                success = wipe_directory(rom->system_path, true, &progress);
                 // Try removing ROM's /system if it's empty
                 remove(rom->system_path.c_str());
             } else if (target == v2::WipeTarget_CACHE) {
-                success = wipe_directory(rom->cache_path, true);
+                success = wipe_directory(rom->cache_path, true, &progress);
                 // Try removing ROM's /cache if it's empty
                 remove(rom->cache_path.c_str());
             } else if (target == v2::WipeTarget_DATA) {
-                success = wipe_directory(rom->data_path, false);
+                success = wipe_directory(rom->data_path, false, &progress);
                 // Try removing ROM's /data/media and /data if they're empty
                 remove((rom->data_path + "/media").c_str());
                 remove(rom->data_path.c_str());
@@ -506,13 +711,13 @@ static bool v2_wipe_rom(int fd, const v2::Request *msg)
                 // util::delete_recursive() returns true if the path does not
                 // exist (ie. returns false only on errors), which is exactly
                 // what we want
-                success = util::delete_recursive(data_path) &&
-                        util::delete_recursive(cache_path);
+                success = util::delete_recursive(data_path, &progress) &&
+                        util::delete_recursive(cache_path, &progress);
             } else if (target == v2::WipeTarget_MULTIBOOT) {
                 // Delete /data/media/0/MultiBoot/[ROM ID]
                 std::string multiboot_path("/data/media/0/MultiBoot/");
                 multiboot_path += rom->id;
-                success = util::delete_recursive(multiboot_path);
+                success = util::delete_recursive(multiboot_path, &progress);
             } else {
                 LOGE("Unknown wipe target {:d}", target);
             }
@@ -535,177 +740,938 @@ static bool v2_wipe_rom(int fd, const v2::Request *msg)
     // Wrap response
     v2::ResponseBuilder rb(builder);
     rb.add_type(v2::ResponseType_WIPE_ROM);
+    rb.add_id(reply->request_id);
     rb.add_wipe_rom_response(response);
     builder.Finish(rb.Finish());
 
-    return v2_send_response(fd, builder);
+    return v2_send_response(reply, builder);
+}
+
+typedef bool (*V2Handler)(Reply *reply, const v2::Request *msg);
+
+// Where a request handler runs
+enum class V2Run
+{
+    // On the event loop thread. Must not block.
+    INLINE,
+    // On the worker pool for requests that may block briefly (eg. on disk I/O)
+    SHORT,
+    // On a separate worker pool for requests that can take minutes, so they
+    // can't occupy every thread needed by credential checks and short requests
+    LONG,
+};
+
+struct V2Command
+{
+    v2::RequestType type;
+    V2Handler handler;
+    V2Run run;
+};
+
+static const V2Command v2_commands[] = {
+    { v2::RequestType_GET_VERSION,         v2_get_version,         V2Run::INLINE },
+    { v2::RequestType_GET_ROMS_LIST,       v2_get_roms_list,       V2Run::SHORT  },
+    { v2::RequestType_GET_BUILTIN_ROM_IDS, v2_get_builtin_rom_ids, V2Run::INLINE },
+    { v2::RequestType_GET_CURRENT_ROM,     v2_get_current_rom,     V2Run::INLINE },
+    { v2::RequestType_SWITCH_ROM,          v2_switch_rom,          V2Run::LONG   },
+    { v2::RequestType_SET_KERNEL,          v2_set_kernel,          V2Run::LONG   },
+    { v2::RequestType_REBOOT,              v2_reboot,              V2Run::LONG   },
+    { v2::RequestType_OPEN,                v2_open,                V2Run::SHORT  },
+    { v2::RequestType_COPY,                v2_copy,                V2Run::LONG   },
+    { v2::RequestType_CHMOD,               v2_chmod,               V2Run::SHORT  },
+    { v2::RequestType_WIPE_ROM,            v2_wipe_rom,            V2Run::LONG   },
+};
+
+static const V2Command * v2_find_command(v2::RequestType type)
+{
+    for (const V2Command &command : v2_commands) {
+        if (command.type == type) {
+            return &command;
+        }
+    }
+    return nullptr;
+}
+
+static bool verify_credentials(uid_t uid)
+{
+    // Rely on the OS for signature checking and simply compare strings in
+    // packages.xml. The only way that file changes is if the package is
+    // removed and reinstalled, in which case, Android will kill the client and
+    // the connection will terminate. Or, the client already has root access, in
+    // which case, there's not much we can do to prevent damage.
+
+    // The parsed packages.xml and the signature check results are cached
+    // until the file changes
+    bool trusted = false;
+    std::shared_ptr<Package> pkg =
+            system_packages().find_by_uid(uid, &trusted);
+    if (!pkg) {
+        LOGE("Failed to find package for UID {:d}", uid);
+        return false;
+    }
+
+    LOGD("{} has {:d} signatures", pkg->name, pkg->sig_indexes.size());
+
+    if (trusted) {
+        LOGV("{} matches whitelisted signatures", pkg->name);
+        return true;
+    }
+
+    LOGE("{} does not match whitelisted signatures", pkg->name);
+    return false;
+}
+
+enum class ClientState
+{
+    // Waiting for the interface version
+    VERSION,
+    // Handling version 2 requests
+    V2,
+    // Sending the remaining messages before closing the connection
+    CLOSING
+};
+
+struct Client
+{
+    uint64_t id;
+    int fd;
+    struct ucred cred;
+    ClientState state;
+
+    // Received data that has not been processed yet (starting at in_offset)
+    std::vector<uint8_t> in;
+    size_t in_offset = 0;
+
+    // Messages waiting to be sent and the number of bytes of the first one
+    // that have already been sent
+    std::deque<OutMessage> out;
+    size_t out_offset = 0;
+
+    // Number of requests running on worker threads
+    unsigned int pending = 0;
+    // Whether the running request must complete before anything else from
+    // the client is handled
+    bool ordered = false;
+    // Cancellation flags of the requests running on worker threads, by
+    // request ID
+    std::unordered_map<uint32_t, std::shared_ptr<std::atomic<int>>> running;
+
+    // Events currently registered with epoll
+    uint32_t events = 0;
+};
+
+// Serves all clients from a single process. Sockets are non-blocking and are
+// only touched by the event loop thread. Requests that may block run on one of
+// two small thread pools (short and long running requests) and hand their
+// responses back to the event loop.
+//
+// Unlike the old fork-per-client model, handlers are not isolated from each
+// other. Anything that runs on a worker thread must be thread-safe (eg. use
+// util::error_string() instead of strerror()) and a crash in one handler
+// drops every client. run_daemon() restarts the server if that happens.
+class DaemonServer
+{
+public:
+    DaemonServer();
+    ~DaemonServer();
+
+    bool run(int listen_fd);
+
+private:
+    // epoll data for the listening socket and the eventfd. Clients use their
+    // ID, which is never reused, so stale events can't reach a new client
+    // that got the same fd.
+    static const uint64_t LISTEN_ID = 0;
+    static const uint64_t EVENT_ID = 1;
+
+    struct Completion
+    {
+        uint64_t client_id;
+        std::shared_ptr<Reply> reply;
+        // Whether the request has completed or if this is a progress update
+        bool final;
+    };
+
+    int _epoll_fd = -1;
+    int _event_fd = -1;
+    int _listen_fd = -1;
+    // Reserved fd that is closed to accept and drop a connection when the
+    // process runs out of fds
+    int _spare_fd = -1;
+    // Whether the listening socket is registered for EPOLLIN
+    bool _listening = true;
+    uint64_t _next_id = 2;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Client>> _clients;
+
+    std::mutex _completions_mutex;
+    std::vector<Completion> _completions;
+
+    // Must be destroyed first so that no worker posts to a destroyed server
+    std::unique_ptr<util::ThreadPool> _pool;
+    std::unique_ptr<util::ThreadPool> _long_pool;
+
+    bool accept_clients();
+    void set_listening(bool listening);
+    void handle_client_events(Client *client, uint32_t events);
+    void handle_completions();
+
+    bool read_client(Client *client);
+    bool process_input(Client *client);
+    bool process_queued_cancels(Client *client);
+    bool process_v2_request(Client *client, const v2::Request *request,
+                            const uint8_t *data, size_t size);
+    bool cancel_request(Client *client, Reply *reply,
+                        const v2::Request *msg);
+    bool flush_client(Client *client);
+    void update_events(Client *client);
+    void close_client(Client *client);
+
+    void queue_reply(Client *client, Reply *reply);
+    void run_blocking(Client *client, bool ordered, bool long_running,
+                      std::function<void(Reply *)> task);
+    void post_completion(uint64_t client_id, std::shared_ptr<Reply> reply,
+                         bool final);
+};
+
+// Maximum size of a request. Requests are tiny, so this only prevents clients
+// from making the daemon allocate huge buffers.
+#define MAX_REQUEST_SIZE (1024 * 1024)
+#define WORKER_THREADS 4
+#define LONG_WORKER_THREADS 2
+// Maximum number of requests with IDs that a client can have running at once
+#define MAX_PENDING_REQUESTS 8
+#define MAX_EVENTS 16
+
+DaemonServer::DaemonServer()
+{
+}
+
+DaemonServer::~DaemonServer()
+{
+    _pool.reset();
+    _long_pool.reset();
+    _clients.clear();
+
+    if (_event_fd >= 0) {
+        close(_event_fd);
+    }
+    if (_spare_fd >= 0) {
+        close(_spare_fd);
+    }
+    if (_epoll_fd >= 0) {
+        close(_epoll_fd);
+    }
 }
 
-static bool connection_version_2(int fd)
+bool DaemonServer::run(int listen_fd)
 {
-    std::string command;
+    _listen_fd = listen_fd;
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
+        LOGE("Failed to create epoll instance: {}", util::error_string(errno));
+        return false;
+    }
 
-    while (1) {
-        std::vector<uint8_t> data;
-        if (!util::socket_read_bytes(fd, &data)) {
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event_fd < 0) {
+        LOGE("Failed to create eventfd: {}", util::error_string(errno));
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev) < 0) {
+        LOGE("Failed to add socket to epoll: {}", util::error_string(errno));
+        return false;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_ID;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &ev) < 0) {
+        LOGE("Failed to add eventfd to epoll: {}", util::error_string(errno));
+        return false;
+    }
+
+    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (_spare_fd < 0) {
+        LOGW("Failed to open spare fd: {}", util::error_string(errno));
+    }
+
+    _pool.reset(new util::ThreadPool(WORKER_THREADS));
+    _long_pool.reset(new util::ThreadPool(LONG_WORKER_THREADS));
+
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(_epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for events: {}", util::error_string(errno));
             return false;
         }
 
-        auto verifier = fb::Verifier(data.data(), data.size());
-        if (!v2::VerifyRequestBuffer(verifier)) {
-            LOGE("Received invalid buffer");
+        for (int i = 0; i < n; ++i) {
+            uint64_t id = events[i].data.u64;
+
+            if (id == LISTEN_ID) {
+                if (!accept_clients()) {
+                    return false;
+                }
+            } else if (id == EVENT_ID) {
+                handle_completions();
+            } else {
+                // The client may have been closed by an earlier event
+                auto it = _clients.find(id);
+                if (it != _clients.end()) {
+                    handle_client_events(it->second.get(), events[i].events);
+                }
+            }
+        }
+    }
+}
+
+bool DaemonServer::accept_clients()
+{
+    while (true) {
+        int fd = accept4(_listen_fd, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            } else if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno == EMFILE || errno == ENFILE) {
+                LOGW("Failed to accept connection: {}", util::error_string(errno));
+
+                // The listening socket stays readable while the connection
+                // is in the backlog. Use the spare fd to accept and drop it so
+                // the event loop doesn't spin.
+                if (_spare_fd >= 0) {
+                    close(_spare_fd);
+                    _spare_fd = accept4(_listen_fd, nullptr, nullptr,
+                                        SOCK_CLOEXEC);
+                    if (_spare_fd >= 0) {
+                        close(_spare_fd);
+                    }
+                    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (_spare_fd >= 0) {
+                        continue;
+                    }
+                }
+
+                // Otherwise, stop listening until a client is closed and
+                // keep serving the existing clients
+                set_listening(false);
+                return true;
+            }
+            LOGE("Failed to accept connection on socket: {}", util::error_string(errno));
             return false;
         }
 
-        const v2::Request *request = v2::GetRequest(data.data());
+        LOGD("Accepted connection from {:d}", fd);
 
-        // NOTE: A false return value indicates a connection error, not a
-        //       command failure!
-        bool ret = true;
-
-        if (request->type() == v2::RequestType_GET_VERSION) {
-            ret = v2_get_version(fd, request);
-        } else if (request->type() == v2::RequestType_GET_ROMS_LIST) {
-            ret = v2_get_roms_list(fd, request);
-        } else if (request->type() == v2::RequestType_GET_BUILTIN_ROM_IDS) {
-            ret = v2_get_builtin_rom_ids(fd, request);
-        } else if (request->type() == v2::RequestType_GET_CURRENT_ROM) {
-            ret = v2_get_current_rom(fd, request);
-        } else if (request->type() == v2::RequestType_SWITCH_ROM) {
-            ret = v2_switch_rom(fd, request);
-        } else if (request->type() == v2::RequestType_SET_KERNEL) {
-            ret = v2_set_kernel(fd, request);
-        } else if (request->type() == v2::RequestType_REBOOT) {
-            ret = v2_reboot(fd, request);
-        } else if (request->type() == v2::RequestType_OPEN) {
-            ret = v2_open(fd, request);
-        } else if (request->type() == v2::RequestType_COPY) {
-            ret = v2_copy(fd, request);
-        } else if (request->type() == v2::RequestType_CHMOD) {
-            ret = v2_chmod(fd, request);
-        } else if (request->type() == v2::RequestType_WIPE_ROM) {
-            ret = v2_wipe_rom(fd, request);
-        } else {
-            // Invalid command; allow further commands
-            ret = v2_send_generic_response(fd, v2::ResponseType_UNSUPPORTED);
+        std::unique_ptr<Client> client(new Client());
+        client->id = _next_id++;
+        client->fd = fd;
+        client->state = ClientState::VERSION;
+
+        socklen_t cred_len = sizeof(struct ucred);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED,
+                       &client->cred, &cred_len) < 0) {
+            LOGE("Failed to get socket credentials: {}", util::error_string(errno));
+            LOGE("Killing connection");
+            close(fd);
+            continue;
         }
 
-        if (!ret) {
-            return false;
+        LOGD("Client PID: {:d}", client->cred.pid);
+        LOGD("Client UID: {:d}", client->cred.uid);
+        LOGD("Client GID: {:d}", client->cred.gid);
+
+        struct epoll_event ev;
+        ev.events = 0;
+        ev.data.u64 = client->id;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add client to epoll: {}", util::error_string(errno));
+            close(fd);
+            continue;
         }
-    }
 
-    return true;
+        Client *c = client.get();
+        _clients[c->id] = std::move(client);
+
+        // Parsing packages.xml is slow, so don't block other clients
+        uid_t uid = c->cred.uid;
+        run_blocking(c, true, false, [uid](Reply *reply) {
+            if (verify_credentials(uid)) {
+                queue_string(reply, RESPONSE_ALLOW);
+            } else {
+                queue_string(reply, RESPONSE_DENY);
+                reply->close = true;
+            }
+        });
+    }
 }
 
-static bool verify_credentials(uid_t uid)
+void DaemonServer::handle_client_events(Client *client, uint32_t events)
 {
-    // Rely on the OS for signature checking and simply compare strings in
-    // packages.xml. The only way that file changes is if the package is
-    // removed and reinstalled, in which case, Android will kill the client and
-    // the connection will terminate. Or, the client already has root access, in
-    // which case, there's not much we can do to prevent damage.
+    if (events & EPOLLIN) {
+        if (!read_client(client)) {
+            close_client(client);
+            return;
+        }
+    }
 
-    Packages pkgs;
-    if (!pkgs.load_xml("/data/system/packages.xml")) {
-        LOGE("Failed to load /data/system/packages.xml");
-        return false;
+    if (events & (EPOLLHUP | EPOLLERR) && !(events & EPOLLIN)) {
+        close_client(client);
+        return;
     }
 
-    std::shared_ptr<Package> pkg = pkgs.find_by_uid(uid);
-    if (!pkg) {
-        LOGE("Failed to find package for UID {:d}", uid);
-        return false;
+    if (!process_input(client) || !flush_client(client)) {
+        close_client(client);
+        return;
     }
 
-    pkg->dump();
-    LOGD("{} has {:d} signatures", pkg->name, pkg->sig_indexes.size());
+    if (client->state == ClientState::CLOSING && client->out.empty()
+            && client->pending == 0) {
+        close_client(client);
+        return;
+    }
+
+    update_events(client);
+}
 
-    for (const std::string &index : pkg->sig_indexes) {
-        if (pkgs.sigs.find(index) == pkgs.sigs.end()) {
-            LOGW("Signature index {} has no key", index);
+// Run completion callbacks posted by the worker threads
+void DaemonServer::handle_completions()
+{
+    uint64_t count;
+    while (read(_event_fd, &count, sizeof(count)) > 0) {
+        // Reset the counter
+    }
+
+    std::vector<Completion> completions;
+    {
+        std::lock_guard<std::mutex> lock(_completions_mutex);
+        completions.swap(_completions);
+    }
+
+    for (Completion &completion : completions) {
+        auto it = _clients.find(completion.client_id);
+        if (it == _clients.end()) {
+            // The client disconnected while the request was running. Any fds
+            // in the reply are closed when it is destroyed.
             continue;
         }
 
-        const std::string &key = pkgs.sigs[index];
-        if (std::find(valid_certs.begin(), valid_certs.end(), key)
-                != valid_certs.end()) {
-            LOGV("{} matches whitelisted signatures", pkg->name);
-            return true;
+        Client *client = it->second.get();
+        Reply *reply = completion.reply.get();
+
+        if (!completion.final) {
+            // Progress update for a request that is still running
+            queue_reply(client, reply);
+            if (!flush_client(client)) {
+                close_client(client);
+            } else {
+                update_events(client);
+            }
+            continue;
         }
-    }
 
-    LOGE("{} does not match whitelisted signatures", pkg->name);
-    return false;
+        if (--client->pending == 0) {
+            client->ordered = false;
+        }
+
+        auto running = client->running.find(reply->request_id);
+        if (running != client->running.end()
+                && running->second == reply->cancel_state) {
+            client->running.erase(running);
+        }
+
+        queue_reply(client, reply);
+
+        // Handle requests that arrived while the worker was running
+        handle_client_events(client, 0);
+    }
 }
 
-static bool client_connection(int fd)
+bool DaemonServer::read_client(Client *client)
 {
-    bool ret = true;
-    auto fail = util::finally([&] {
-        if (!ret) {
-            LOGE("Killing connection");
+    while (true) {
+        // Reuse the buffer instead of allocating one per message
+        if (client->in_offset == client->in.size()) {
+            client->in.clear();
+            client->in_offset = 0;
         }
-    });
 
-    LOGD("Accepted connection from {:d}", fd);
+        size_t old_size = client->in.size();
+        client->in.resize(old_size + 16384);
 
-    struct ucred cred;
-    socklen_t cred_len = sizeof(struct ucred);
+        ssize_t n = read(client->fd, client->in.data() + old_size, 16384);
+        client->in.resize(old_size + (n > 0 ? n : 0));
+
+        if (n == 0) {
+            // Client closed the connection
+            return false;
+        } else if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            LOGE("Failed to read from client: {}", util::error_string(errno));
+            return false;
+        }
 
-    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) {
-        LOGE("Failed to get socket credentials: {}", strerror(errno));
-        return ret = false;
+        if (client->in.size() - client->in_offset
+                > MAX_REQUEST_SIZE + sizeof(int32_t)) {
+            // Stop reading until the buffered requests are processed
+            return true;
+        }
     }
+}
 
-    LOGD("Client PID: {:d}", cred.pid);
-    LOGD("Client UID: {:d}", cred.uid);
-    LOGD("Client GID: {:d}", cred.gid);
+// Handle complete messages in the input buffer. Returns false if the
+// connection should be killed.
+bool DaemonServer::process_input(Client *client)
+{
+    while (true) {
+        size_t available = client->in.size() - client->in_offset;
+        const uint8_t *data = client->in.data() + client->in_offset;
 
-    if (verify_credentials(cred.uid)) {
-        if (!util::socket_write_string(fd, RESPONSE_ALLOW)) {
-            LOGE("Failed to send credentials allowed message");
-            return ret = false;
+        if (client->state == ClientState::CLOSING) {
+            // Ignore anything sent after an error
+            client->in_offset = client->in.size();
+            return true;
         }
-    } else {
-        if (!util::socket_write_string(fd, RESPONSE_DENY)) {
-            LOGE("Failed to send credentials denied message");
+
+        if (available < sizeof(int32_t)) {
+            break;
+        }
+
+        int32_t value;
+        memcpy(&value, data, sizeof(value));
+
+        if (client->state == ClientState::VERSION) {
+            if (client->ordered) {
+                // Credentials are still being checked
+                break;
+            }
+
+            client->in_offset += sizeof(value);
+
+            Reply reply;
+
+            if (value == 2) {
+                queue_string(&reply, RESPONSE_OK);
+                client->state = ClientState::V2;
+            } else {
+                LOGE("Unsupported interface version: {:d}", value);
+                queue_string(&reply, RESPONSE_UNSUPPORTED);
+                reply.close = true;
+            }
+
+            queue_reply(client, &reply);
+        } else if (client->state == ClientState::V2) {
+            if (value < 0 || value > MAX_REQUEST_SIZE) {
+                LOGE("[Version 2] Invalid request size: {:d}", value);
+                return false;
+            }
+
+            if (available - sizeof(value) < (size_t) value) {
+                break;
+            }
+
+            const uint8_t *buf = data + sizeof(value);
+
+            auto verifier = fb::Verifier(buf, value);
+            if (!v2::VerifyRequestBuffer(verifier)) {
+                LOGE("[Version 2] Received invalid buffer");
+                return false;
+            }
+
+            const v2::Request *request = v2::GetRequest(buf);
+
+            // Requests without an ID are handled only after all earlier
+            // requests have completed, so their responses stay in order.
+            // Requests with an ID may run concurrently, up to a limit.
+            // Cancel requests are always handled right away since they need
+            // to reach the running requests, even if they are queued behind
+            // a request that has to wait.
+            if (request->type() != v2::RequestType_CANCEL
+                    && (client->ordered || (request->id() == 0
+                            ? client->pending > 0
+                            : client->pending >= MAX_PENDING_REQUESTS))) {
+                if (!process_queued_cancels(client)) {
+                    return false;
+                }
+                break;
+            }
+
+            client->in_offset += sizeof(value) + value;
+
+            if (!process_v2_request(client, request, buf, value)) {
+                LOGE("[Version 2] Communication error");
+                return false;
+            }
+        } else {
+            break;
         }
-        return ret = false;
     }
 
-    int32_t version;
-    if (!util::socket_read_int32(fd, &version)) {
-        LOGE("Failed to get interface version");
-        return ret = false;
+    // Don't keep large buffers around for idle clients
+    if (client->in_offset == client->in.size()
+            && client->in.capacity() > 65536) {
+        std::vector<uint8_t>().swap(client->in);
+        client->in_offset = 0;
     }
 
-    if (version == 2) {
-        if (!util::socket_write_string(fd, RESPONSE_OK)) {
-            return false;
+    return true;
+}
+
+// Handle the cancel requests among the complete requests in the input buffer
+// and remove them from it. Anything else is left for process_input(), which
+// also reports invalid requests.
+bool DaemonServer::process_queued_cancels(Client *client)
+{
+    size_t offset = client->in_offset;
+
+    while (true) {
+        size_t available = client->in.size() - offset;
+        if (available < sizeof(int32_t)) {
+            break;
+        }
+
+        int32_t value;
+        memcpy(&value, client->in.data() + offset, sizeof(value));
+
+        if (value < 0 || value > MAX_REQUEST_SIZE
+                || available - sizeof(value) < (size_t) value) {
+            break;
         }
 
-        if (!connection_version_2(fd)) {
+        const uint8_t *buf = client->in.data() + offset + sizeof(value);
+        size_t frame_size = sizeof(value) + value;
+
+        auto verifier = fb::Verifier(buf, value);
+        if (!v2::VerifyRequestBuffer(verifier)) {
+            break;
+        }
+
+        const v2::Request *request = v2::GetRequest(buf);
+        if (request->type() != v2::RequestType_CANCEL) {
+            offset += frame_size;
+            continue;
+        }
+
+        if (!process_v2_request(client, request, buf, value)) {
             LOGE("[Version 2] Communication error");
+            return false;
         }
+
+        client->in.erase(client->in.begin() + offset,
+                         client->in.begin() + offset + frame_size);
+    }
+
+    return true;
+}
+
+bool DaemonServer::process_v2_request(Client *client,
+                                      const v2::Request *request,
+                                      const uint8_t *data, size_t size)
+{
+    uint32_t request_id = request->id();
+
+    if (request->type() == v2::RequestType_CANCEL) {
+        Reply reply;
+        reply.request_id = request_id;
+        bool ret = cancel_request(client, &reply, request);
+        queue_reply(client, &reply);
+        return ret;
+    }
+
+    const V2Command *command = v2_find_command(request->type());
+
+    if (!command) {
+        // Invalid command; allow further commands
+        Reply reply;
+        reply.request_id = request_id;
+        v2_send_generic_response(&reply, v2::ResponseType_UNSUPPORTED);
+        queue_reply(client, &reply);
         return true;
-    } else {
-        LOGE("Unsupported interface version: {:d}", version);
-        util::socket_write_string(fd, RESPONSE_UNSUPPORTED);
-        return ret = false;
+    }
+
+    if (command->run == V2Run::INLINE) {
+        // NOTE: A false return value indicates a connection error, not a
+        //       command failure!
+        Reply reply;
+        reply.request_id = request_id;
+        bool ret = command->handler(&reply, request);
+        queue_reply(client, &reply);
+        return ret;
+    }
+
+    // The receive buffer is reused before the worker runs
+    std::shared_ptr<std::vector<uint8_t>> buf(
+            new std::vector<uint8_t>(data, data + size));
+    V2Handler handler = command->handler;
+    bool report_progress = request->report_progress();
+
+    // Requests without an ID can be cancelled with ID 0
+    std::shared_ptr<std::atomic<int>> cancel_state(
+            new std::atomic<int>(CANCEL_NONE));
+    client->running[request_id] = cancel_state;
+
+    auto task = [buf, handler, request_id, report_progress, cancel_state]
+            (Reply *reply) {
+        reply->request_id = request_id;
+        reply->report_progress = report_progress;
+        reply->cancel_state = cancel_state;
+        if (!handler(reply, v2::GetRequest(buf->data()))) {
+            reply->close = true;
+        }
+    };
+
+    // Requests with an ID run in the background while the client keeps
+    // sending other requests
+    run_blocking(client, request_id == 0, command->run == V2Run::LONG,
+                 std::move(task));
+
+    return true;
+}
+
+// Cancel a running request. The response only says whether the request was
+// found and could still be cancelled. The cancelled request still sends its own
+// response once it stops.
+bool DaemonServer::cancel_request(Client *client, Reply *reply,
+                                  const v2::Request *msg)
+{
+    auto request = msg->cancel_request();
+    if (!request) {
+        return v2_send_generic_response(reply, v2::ResponseType_INVALID);
+    }
+
+    bool success = false;
+
+    auto it = client->running.find(request->id());
+    if (it != client->running.end()) {
+        // Fails if the request has started a write that can't be interrupted
+        int expected = CANCEL_NONE;
+        success = it->second->compare_exchange_strong(
+                expected, CANCEL_REQUESTED) || expected == CANCEL_REQUESTED;
+    }
+
+    fb::FlatBufferBuilder builder;
+
+    // Create response
+    auto response = v2::CreateCancelResponse(builder, success);
+
+    // Wrap response
+    v2::ResponseBuilder rb(builder);
+    rb.add_type(v2::ResponseType_CANCEL);
+    rb.add_id(reply->request_id);
+    rb.add_cancel_response(response);
+    builder.Finish(rb.Finish());
+
+    return v2_send_response(reply, builder);
+}
+
+static bool send_fd_nonblock(int fd, int send_fd)
+{
+    char dummy = '!';
+
+    struct iovec iov;
+    iov.iov_base = &dummy;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(cmsg), &send_fd, sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1;
+}
+
+// Send as much of the queued output as possible without blocking. Returns
+// false if the connection should be killed.
+bool DaemonServer::flush_client(Client *client)
+{
+    while (!client->out.empty()) {
+        OutMessage &msg = client->out.front();
+
+        if (msg.fd >= 0) {
+            if (!send_fd_nonblock(client->fd, msg.fd)) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                LOGE("Failed to send fd to client: {}", util::error_string(errno));
+                return false;
+            }
+        } else {
+            ssize_t n = send(client->fd, msg.data.data() + client->out_offset,
+                             msg.data.size() - client->out_offset,
+                             MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                LOGE("Failed to write to client: {}", util::error_string(errno));
+                return false;
+            }
+
+            client->out_offset += n;
+            if (client->out_offset < msg.data.size()) {
+                continue;
+            }
+        }
+
+        client->out.pop_front();
+        client->out_offset = 0;
     }
 
     return true;
 }
 
+void DaemonServer::update_events(Client *client)
+{
+    uint32_t events = 0;
+
+    // Don't read more while the buffered requests can't be processed
+    if (client->state != ClientState::CLOSING
+            && client->in.size() - client->in_offset
+                    <= MAX_REQUEST_SIZE + sizeof(int32_t)) {
+        events |= EPOLLIN;
+    }
+    if (!client->out.empty()) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != client->events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = client->id;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) < 0) {
+            LOGE("Failed to update epoll events: {}", util::error_string(errno));
+        }
+        client->events = events;
+    }
+}
+
+void DaemonServer::close_client(Client *client)
+{
+    if (client->state != ClientState::CLOSING || !client->out.empty()) {
+        LOGE("Killing connection");
+    }
+
+    // Closing the fd also removes it from the epoll set. If a worker is still
+    // running for this client, its reply is dropped.
+    close(client->fd);
+    _clients.erase(client->id);
+
+    if (!_listening) {
+        if (_spare_fd < 0) {
+            _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        set_listening(true);
+    }
+}
+
+void DaemonServer::set_listening(bool listening)
+{
+    struct epoll_event ev;
+    ev.events = listening ? static_cast<uint32_t>(EPOLLIN) : 0;
+    ev.data.u64 = LISTEN_ID;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, _listen_fd, &ev) < 0) {
+        LOGW("Failed to update socket events: {}", util::error_string(errno));
+        return;
+    }
+
+    _listening = listening;
+}
+
+void DaemonServer::queue_reply(Client *client, Reply *reply)
+{
+    for (OutMessage &msg : reply->messages) {
+        client->out.push_back(std::move(msg));
+    }
+    reply->messages.clear();
+
+    if (reply->close) {
+        client->state = ClientState::CLOSING;
+    }
+}
+
+// Run task on a worker thread. If ordered is true, the client does not process
+// further requests until the reply has been queued. If long_running is true,
+// the task runs on the pool for long running requests.
+void DaemonServer::run_blocking(Client *client, bool ordered,
+                                bool long_running,
+                                std::function<void(Reply *)> task)
+{
+    ++client->pending;
+    client->ordered |= ordered;
+
+    uint64_t id = client->id;
+
+    util::ThreadPool *pool = long_running ? _long_pool.get() : _pool.get();
+
+    pool->submit([this, id, task] {
+        std::shared_ptr<Reply> reply(new Reply());
+        reply->send_partial = [this, id](Reply *partial) {
+            std::shared_ptr<Reply> copy(new Reply());
+            copy->messages = std::move(partial->messages);
+            post_completion(id, std::move(copy), false);
+        };
+
+        task(reply.get());
+
+        post_completion(id, std::move(reply), true);
+    });
+}
+
+// Hand a reply from a worker thread to the event loop
+void DaemonServer::post_completion(uint64_t client_id,
+                                   std::shared_ptr<Reply> reply, bool final)
+{
+    {
+        std::lock_guard<std::mutex> lock(_completions_mutex);
+        _completions.push_back({ client_id, std::move(reply), final });
+    }
+
+    uint64_t value = 1;
+    if (write(_event_fd, &value, sizeof(value)) < 0) {
+        LOGE("Failed to wake up event loop: {}", util::error_string(errno));
+    }
+}
+
 static bool run_daemon(void)
 {
     int fd;
     struct sockaddr_un addr;
 
-    fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) {
-        LOGE("Failed to create socket: {}", strerror(errno));
+        LOGE("Failed to create socket: {}", util::error_string(errno));
         return false;
     }
 
@@ -725,48 +1691,80 @@ static bool run_daemon(void)
     socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + abs_name_len;
 
     if (bind(fd, (struct sockaddr *) &addr, addr_len) < 0) {
-        LOGE("Failed to bind socket: {}", strerror(errno));
+        LOGE("Failed to bind socket: {}", util::error_string(errno));
         LOGE("Is another instance running?");
         return false;
     }
 
-    if (listen(fd, 3) < 0) {
-        LOGE("Failed to listen on socket: {}", strerror(errno));
+    if (listen(fd, SOMAXCONN) < 0) {
+        LOGE("Failed to listen on socket: {}", util::error_string(errno));
         return false;
     }
 
-    // Eat zombies!
-    // SIG_IGN reaps zombie processes (it's not just a dummy function)
+    // A client disconnecting must not kill the whole daemon. Writes to the
+    // sockets use MSG_NOSIGNAL, but ignore SIGPIPE to be safe.
     struct sigaction sa;
     sa.sa_handler = SIG_IGN;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    if (sigaction(SIGCHLD, &sa, 0) < 0) {
-        LOGE("Failed to set SIGCHLD handler: {}", strerror(errno));
+    if (sigaction(SIGPIPE, &sa, 0) < 0) {
+        LOGE("Failed to set SIGPIPE handler: {}", util::error_string(errno));
         return false;
     }
 
     LOGD("Socket ready, waiting for connections");
 
-    int client_fd;
-    while ((client_fd = accept(fd, nullptr, nullptr)) >= 0) {
-        pid_t child_pid = fork();
-        if (child_pid < 0) {
-            LOGE("Failed to fork: {}", strerror(errno));
-        } else if (child_pid == 0) {
-            bool ret = client_connection(client_fd);
-            close(client_fd);
-            _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+    // All clients share one process, so run the server in a child and start a
+    // new one if it crashes. The listening socket is inherited, so
+    // connections made in the meantime wait in the backlog.
+    pid_t supervisor = getpid();
+
+    while (true) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            LOGE("Failed to fork: {}", util::error_string(errno));
+            return false;
+        } else if (pid == 0) {
+            // The server holds the socket, so it must not outlive the
+            // supervisor or the next daemon would fail to bind
+            if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) {
+                LOGE("Failed to set parent death signal: {}",
+                     util::error_string(errno));
+                _exit(EXIT_FAILURE);
+            }
+            if (getppid() != supervisor) {
+                _exit(EXIT_FAILURE);
+            }
+
+            DaemonServer server;
+            _exit(server.run(fd) ? EXIT_SUCCESS : EXIT_FAILURE);
         }
-        close(client_fd);
-    }
 
-    if (client_fd < 0) {
-        LOGE("Failed to accept connection on socket: {}", strerror(errno));
-        return false;
-    }
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                LOGE("Failed to wait for server: {}",
+                     util::error_string(errno));
+                return false;
+            }
+        }
 
-    return true;
+        if (!WIFSIGNALED(status)) {
+            return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+
+        int sig = WTERMSIG(status);
+        if (sig != SIGSEGV && sig != SIGBUS && sig != SIGABRT
+                && sig != SIGFPE && sig != SIGILL) {
+            LOGE("Server was killed by signal {:d}", sig);
+            return false;
+        }
+
+        LOGE("Server crashed with signal {:d}; restarting", sig);
+
+        // Don't spin if the server crashes right away
+        sleep(1);
+    }
 }
 
 __attribute__((noreturn))
@@ -774,14 +1772,14 @@ static void run_daemon_fork(void)
 {
     pid_t pid = fork();
     if (pid < 0) {
-        LOGE("Failed to fork: {}", strerror(errno));
+        LOGE("Failed to fork: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     } else if (pid > 0) {
         _exit(EXIT_SUCCESS);
     }
 
     if (setsid() < 0) {
-        LOGE("Failed to become session leader: {}", strerror(errno));
+        LOGE("Failed to become session leader: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     }
 
@@ -789,14 +1787,14 @@ static void run_daemon_fork(void)
 
     pid = fork();
     if (pid < 0) {
-        LOGE("Failed to fork: {}", strerror(errno));
+        LOGE("Failed to fork: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     } else if (pid > 0) {
         _exit(EXIT_SUCCESS);
     }
 
     if (chdir("/") < 0) {
-        LOGE("Failed to change cwd to /: {}", strerror(errno));
+        LOGE("Failed to change cwd to /: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     }
 
@@ -808,15 +1806,15 @@ static void run_daemon_fork(void)
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
     if (open("/dev/null", O_RDONLY) < 0) {
-        LOGE("Failed to reopen stdin: {}", strerror(errno));
+        LOGE("Failed to reopen stdin: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     }
     if (open("/dev/null",O_WRONLY) == -1) {
-        LOGE("Failed to reopen stdout: {}", strerror(errno));
+        LOGE("Failed to reopen stdout: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     }
     if (open("/dev/null",O_RDWR) == -1) {
-        LOGE("Failed to reopen stderr: {}", strerror(errno));
+        LOGE("Failed to reopen stderr: {}", util::error_string(errno));
         _exit(EXIT_FAILURE);
     }
 
@@ -1274,7 +1274,8 @@ Installer::ProceedState Installer::install_stage_finish()
         }
 
         mbp::CpioFile cpio;
-        if (!cpio.load(bi.ramdiskImage())) {
+        mbp::BinaryView ramdisk = bi.ramdiskImageView();
+        if (!cpio.load(ramdisk.data(), ramdisk.size())) {
             LOGE("Failed to read ramdisk image for adding /romid");
             display_msg("Failed to read ramdisk image");
             return ProceedState::Fail;
@@ -1308,21 +1309,9 @@ Installer::ProceedState Installer::install_stage_finish()
             bi.setApplyLoki(true);
         }
 
-        auto bootimg = bi.create();
-        std::string temp_boot_img(_temp);
-        temp_boot_img += "/boot.img";
-
-        // Backup kernel
-
-        if (!util::file_write_data(temp_boot_img,
-                                   reinterpret_cast<char *>(bootimg.data()),
-                                   bootimg.size())) {
-            LOGE("Failed to write {}: {}", temp_boot_img, strerror(errno));
-            display_msg(fmt::format("Failed to write {}", temp_boot_img));
-            return ProceedState::Fail;
-        }
-
-        // Write to multiboot directory and boot partition
+        // Write to multiboot directory and boot partition. The boot image is
+        // written directly from the BootImage, so no temporary file or
+        // serialized copy is needed.
 
         std::string path(MULTIBOOT_DIR);
         path += "/";
@@ -1333,14 +1322,6 @@ Installer::ProceedState Installer::install_stage_finish()
             return ProceedState::Fail;
         }
 
-        int fd_source = open(temp_boot_img.c_str(), O_RDONLY);
-        if (fd_source < 0) {
-            LOGE("Failed to open {}: {}", temp_boot_img, strerror(errno));
-            return ProceedState::Fail;
-        }
-
-        auto close_fd_source = util::finally([&] { close(fd_source); });
-
         int fd_boot = open(_boot_block_dev.c_str(), O_WRONLY);
         if (fd_boot < 0) {
             LOGE("Failed to open {}: {}", _boot_block_dev, strerror(errno));
@@ -1357,15 +1338,15 @@ Installer::ProceedState Installer::install_stage_finish()
 
         auto close_fd_backup = util::finally([&] { close(fd_backup); });
 
-        if (!util::copy_data_fd(fd_source, fd_boot)) {
+        if (!bi.writeTo(fd_boot)) {
             LOGE("Failed to write {}: {}", _boot_block_dev, strerror(errno));
             return ProceedState::Fail;
         }
 
-        lseek(fd_source, 0, SEEK_SET);
-
-        if (!util::copy_data_fd(fd_source, fd_backup)) {
+        // Backup kernel
+        if (!bi.writeTo(fd_backup)) {
             LOGE("Failed to write {}: {}", path, strerror(errno));
+            display_msg(fmt::format("Failed to write {}", path));
             return ProceedState::Fail;
         }
 
@@ -27,6 +27,7 @@
 #include "util/copy.h"
 #include "util/fts.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 
 namespace mb
@@ -34,9 +35,11 @@ namespace mb
 
 class WipeDirectory : public util::FTSWrapper {
 public:
-    WipeDirectory(std::string path, bool wipe_media)
+    WipeDirectory(std::string path, bool wipe_media,
+                  util::ProgressReporter *progress)
         : FTSWrapper(path, FTS_GroupSpecialFiles),
-        _wipe_media(wipe_media)
+        _wipe_media(wipe_media),
+        _progress(progress)
     {
     }
 
@@ -62,40 +65,51 @@ public:
 
     virtual int on_reached_directory_post() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_file() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_symlink() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_special_file() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
 private:
     bool _wipe_media;
+    util::ProgressReporter *_progress;
 
-    bool delete_path()
+    int delete_path()
     {
         if (_curr->fts_level >= 1 && remove(_curr->fts_accpath) < 0) {
             _error_msg = fmt::format("{}: Failed to remove: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, util::error_string(errno));
             LOGW("{}", _error_msg);
-            return false;
+            return Action::FTS_Fail;
         }
-        return true;
+
+        if (_progress && _curr->fts_info != FTS_DP) {
+            _progress->set_path(_curr->fts_path);
+            if (!_progress->add(_curr->fts_statp->st_size, 1)) {
+                _error_msg = fmt::format("{}: Cancelled", _path);
+                return Action::FTS_Fail | Action::FTS_Stop;
+            }
+        }
+
+        return Action::FTS_OK;
     }
 };
 
-bool wipe_directory(const std::string &mountpoint, bool wipe_media)
+bool wipe_directory(const std::string &mountpoint, bool wipe_media,
+                    util::ProgressReporter *progress)
 {
     struct stat sb;
     if (stat(mountpoint.c_str(), &sb) < 0 && errno == ENOENT) {
@@ -103,7 +117,7 @@ bool wipe_directory(const std::string &mountpoint, bool wipe_media)
         return true;
     }
 
-    WipeDirectory wd(mountpoint, wipe_media);
+    WipeDirectory wd(mountpoint, wipe_media, progress);
     return wd.run();
 }
 
@@ -143,7 +157,7 @@ public:
         if (!util::copy_dir(_curr->fts_accpath, _target,
                             util::COPY_ATTRIBUTES | util::COPY_XATTRS)) {
             _error_msg = fmt::format("{}: Failed to copy directory: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, util::error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Skip | Action::FTS_Fail;
         }
@@ -174,7 +188,7 @@ private:
         if (!util::copy_file(_curr->fts_accpath, _curtgtpath,
                              util::COPY_ATTRIBUTES | util::COPY_XATTRS)) {
             _error_msg = fmt::format("{}: Failed to copy file: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, util::error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
@@ -21,10 +21,13 @@
 
 #include <string>
 
+#include "util/progress.h"
+
 namespace mb
 {
 
-bool wipe_directory(const std::string &mountpoint, bool wipe_media);
+bool wipe_directory(const std::string &mountpoint, bool wipe_media,
+                    util::ProgressReporter *progress = nullptr);
 bool copy_system(const std::string &source, const std::string &target);
 
 }
\ No newline at end of file
@@ -19,14 +19,16 @@
 
 #include "packages.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 
-#include <pugixml.hpp>
-
+#include "util/file.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 
 namespace mb
@@ -81,13 +83,6 @@ static const char *ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_DIR
 static const char *ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA
                                              = "nativeLibraryRootRequiresIsa";
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs);
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs);
-
 
 Package::Package() :
         name(),
@@ -244,113 +239,456 @@ void Package::dump()
         LOGD(fmt_string, "Installer:", installer);
 }
 
-bool Packages::load_xml(const std::string &path)
+// Minimal streaming XML reader for packages.xml. The document is tokenized in
+// place: element names and attribute values are NUL-terminated and unescaped
+// within the buffer, so nothing is allocated per element or attribute and
+// subtrees that aren't needed are skipped without building any nodes.
+// Comments, processing instructions, DTDs and CDATA sections are skipped.
+class XmlReader
 {
-    pkgs.clear();
-    sigs.clear();
+public:
+    enum class Event
+    {
+        START,
+        END,
+        END_DOCUMENT,
+        ERROR
+    };
+
+    struct Attribute
+    {
+        const char *name;
+        const char *value;
+    };
+
+    XmlReader(char *data, size_t size);
+
+    Event next();
+    bool skip();
+
+    const char * name() const;
+    const std::vector<Attribute> & attributes() const;
+    const char * error() const;
+
+private:
+    char *_cur;
+    char *_end;
+    const char *_name;
+    std::vector<Attribute> _attrs;
+    std::vector<const char *> _stack;
+    bool _pending_end;
+    const char *_error;
+
+    Event fail(const char *error);
+    bool parse_start_tag();
+    bool parse_end_tag();
+    bool skip_past(const char *terminator);
+    void skip_spaces();
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
 
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
-    if (!result) {
-        LOGE("Failed to parse XML file: {}: {}", path, result.description());
-        return false;
+static char * encode_utf8(char *out, unsigned long cp)
+{
+    if (cp < 0x80) {
+        *out++ = static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        *out++ = static_cast<char>(0xc0 | (cp >> 6));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        *out++ = static_cast<char>(0xe0 | (cp >> 12));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        *out++ = static_cast<char>(0xf0 | (cp >> 18));
+        *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3f));
+    }
+    return out;
+}
+
+// Unescape the entities in [begin, end) in place and NUL-terminate the result.
+// An entity is never shorter than the UTF-8 sequence it encodes, so the result
+// always fits.
+static bool unescape(char *begin, char *end)
+{
+    char *in = static_cast<char *>(memchr(begin, '&', end - begin));
+    if (!in) {
+        *end = '\0';
+        return true;
     }
 
-    pugi::xml_node root = doc.root();
+    char *out = in;
 
-    for (pugi::xml_node cur_node : root.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
+    while (in < end) {
+        if (*in != '&') {
+            *out++ = *in++;
             continue;
         }
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            if (!parse_tag_packages(cur_node, this)) {
+        char *semicolon = static_cast<char *>(memchr(in, ';', end - in));
+        if (!semicolon) {
+            return false;
+        }
+
+        ++in;
+        size_t len = semicolon - in;
+
+        if (len == 3 && memcmp(in, "amp", 3) == 0) {
+            *out++ = '&';
+        } else if (len == 2 && memcmp(in, "lt", 2) == 0) {
+            *out++ = '<';
+        } else if (len == 2 && memcmp(in, "gt", 2) == 0) {
+            *out++ = '>';
+        } else if (len == 4 && memcmp(in, "quot", 4) == 0) {
+            *out++ = '"';
+        } else if (len == 4 && memcmp(in, "apos", 4) == 0) {
+            *out++ = '\'';
+        } else if (len >= 2 && in[0] == '#') {
+            char *num_end;
+            unsigned long cp;
+            if (in[1] == 'x') {
+                cp = strtoul(in + 2, &num_end, 16);
+            } else {
+                cp = strtoul(in + 1, &num_end, 10);
+            }
+            if (num_end != semicolon || cp == 0 || cp > 0x10ffff) {
                 return false;
             }
+            out = encode_utf8(out, cp);
         } else {
-            LOGW("Unrecognized root tag: {}", cur_node.name());
+            return false;
         }
+
+        in = semicolon + 1;
     }
 
+    *out = '\0';
     return true;
 }
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+XmlReader::XmlReader(char *data, size_t size)
+    : _cur(data), _end(data + size), _name(nullptr), _pending_end(false),
+    _error(nullptr)
+{
+}
+
+const char * XmlReader::name() const
+{
+    return _name;
+}
+
+const std::vector<XmlReader::Attribute> & XmlReader::attributes() const
+{
+    return _attrs;
+}
+
+const char * XmlReader::error() const
 {
-    assert(strcmp(node->name, TAG_CERT) == 0);
+    return _error;
+}
+
+XmlReader::Event XmlReader::fail(const char *error)
+{
+    _error = error;
+    return Event::ERROR;
+}
+
+// Get the next start or end tag. For START, name() and attributes() are valid
+// until the next call. Empty elements produce both a START and an END.
+XmlReader::Event XmlReader::next()
+{
+    if (_error) {
+        return Event::ERROR;
+    }
 
-    std::string index;
-    std::string key;
+    if (_pending_end) {
+        _pending_end = false;
+        _name = _stack.back();
+        _stack.pop_back();
+        return Event::END;
+    }
+
+    while (true) {
+        // Character data is not needed for anything in packages.xml
+        char *lt = static_cast<char *>(memchr(_cur, '<', _end - _cur));
+        if (!lt) {
+            _cur = _end;
+            if (!_stack.empty()) {
+                return fail("Unexpected end of document");
+            }
+            return Event::END_DOCUMENT;
+        }
 
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
+        _cur = lt + 1;
+        if (_cur == _end) {
+            return fail("Unexpected end of document");
+        }
 
-        if (strcmp(name, ATTR_INDEX) == 0) {
-            index = value;
-        } else if (strcmp(name, ATTR_KEY) == 0) {
-            key = value;
+        bool ok;
+
+        if (*_cur == '?') {
+            ok = skip_past("?>");
+        } else if (*_cur == '!') {
+            if (_end - _cur >= 3 && memcmp(_cur, "!--", 3) == 0) {
+                ok = skip_past("-->");
+            } else if (_end - _cur >= 8 && memcmp(_cur, "![CDATA[", 8) == 0) {
+                ok = skip_past("]]>");
+            } else {
+                ok = skip_past(">");
+            }
+        } else if (*_cur == '/') {
+            ++_cur;
+            return parse_end_tag() ? Event::END : Event::ERROR;
         } else {
-            LOGW("Unrecognized attribute '{}' in <{}>", name, TAG_CERT);
+            return parse_start_tag() ? Event::START : Event::ERROR;
+        }
+
+        if (!ok) {
+            return Event::ERROR;
         }
     }
+}
 
-    if (index.empty()) {
-        LOGW("Missing or empty index in <{}>", TAG_CERT);
-    } else {
-        pkg->sig_indexes.push_back(index);
+// Skip the rest of the element that was just started, including its END
+bool XmlReader::skip()
+{
+    size_t depth = _stack.size();
+
+    while (true) {
+        Event event = next();
+        if (event == Event::ERROR) {
+            return false;
+        } else if (event == Event::END && _stack.size() < depth) {
+            return true;
+        }
+    }
+}
+
+void XmlReader::skip_spaces()
+{
+    while (_cur < _end && is_space(*_cur)) {
+        ++_cur;
+    }
+}
+
+bool XmlReader::skip_past(const char *terminator)
+{
+    size_t len = strlen(terminator);
+
+    while (true) {
+        char *found = static_cast<char *>(
+                memchr(_cur, terminator[0], _end - _cur));
+        if (!found || static_cast<size_t>(_end - found) < len) {
+            _error = "Unterminated markup";
+            return false;
+        }
+        if (memcmp(found, terminator, len) == 0) {
+            _cur = found + len;
+            return true;
+        }
+        _cur = found + 1;
+    }
+}
+
+bool XmlReader::parse_start_tag()
+{
+    char *name = _cur;
+    while (_cur < _end && !is_space(*_cur) && *_cur != '/' && *_cur != '>') {
+        ++_cur;
     }
-    if (!index.empty() && !key.empty()) {
-        auto it = pkgs->sigs.find(index);
-        if (it != pkgs->sigs.end()) {
-            // Make sure key matches if it's already in the map
-            if (it->second != key) {
-                LOGE("Error: Index \"{}\" assigned to multiple keys", index);
+    if (_cur == _end || _cur == name) {
+        _error = "Invalid start tag";
+        return false;
+    }
+
+    // The character after the name is overwritten by the terminator
+    char c = *_cur;
+    *_cur = '\0';
+
+    _attrs.clear();
+
+    while (true) {
+        if (is_space(c)) {
+            ++_cur;
+            skip_spaces();
+            if (_cur == _end) {
+                _error = "Unexpected end of document";
                 return false;
             }
+            c = *_cur;
+        } else if (c == '>') {
+            ++_cur;
+            break;
+        } else if (c == '/') {
+            ++_cur;
+            if (_cur == _end || *_cur != '>') {
+                _error = "Invalid empty element tag";
+                return false;
+            }
+            ++_cur;
+            _pending_end = true;
+            break;
         } else {
-            // Otherwise, add it to the map
-            pkgs->sigs.insert(std::make_pair(std::move(index), std::move(key)));
+            char *attr_name = _cur;
+            while (_cur < _end && *_cur != '=' && !is_space(*_cur)
+                    && *_cur != '/' && *_cur != '>') {
+                ++_cur;
+            }
+            char *attr_name_end = _cur;
+
+            skip_spaces();
+            if (_cur == _end || *_cur != '=' || attr_name_end == attr_name) {
+                _error = "Invalid attribute";
+                return false;
+            }
+            ++_cur;
+            skip_spaces();
+            if (_cur == _end || (*_cur != '"' && *_cur != '\'')) {
+                _error = "Invalid attribute value";
+                return false;
+            }
+
+            char quote = *_cur++;
+            char *value = _cur;
+            char *value_end = static_cast<char *>(
+                    memchr(_cur, quote, _end - _cur));
+            if (!value_end || value_end + 1 == _end) {
+                _error = "Unterminated attribute value";
+                return false;
+            }
+
+            *attr_name_end = '\0';
+            if (!unescape(value, value_end)) {
+                _error = "Invalid entity reference";
+                return false;
+            }
+
+            _attrs.push_back({ attr_name, value });
+
+            _cur = value_end + 1;
+            c = *_cur;
         }
     }
 
+    _name = name;
+    _stack.push_back(name);
+
     return true;
 }
 
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+bool XmlReader::parse_end_tag()
 {
-    assert(strcmp(node.name(), TAG_SIGS) == 0);
+    char *name = _cur;
+    while (_cur < _end && !is_space(*_cur) && *_cur != '>') {
+        ++_cur;
+    }
+    size_t len = _cur - name;
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
+    skip_spaces();
+    if (_cur == _end || *_cur != '>') {
+        _error = "Invalid end tag";
+        return false;
+    }
+    ++_cur;
+
+    if (_stack.empty() || strlen(_stack.back()) != len
+            || memcmp(_stack.back(), name, len) != 0) {
+        _error = "Mismatched end tag";
+        return false;
+    }
+
+    _name = _stack.back();
+    _stack.pop_back();
+
+    return true;
+}
+
+// Iterate over the child elements of the current element. Evaluates to false
+// when the END of the current element is reached or an error occurs.
+static bool next_child(XmlReader &reader)
+{
+    return reader.next() == XmlReader::Event::START;
+}
+
+static bool parse_tag_cert(XmlReader &reader, Packages *pkgs, Package *pkg)
+{
+    assert(strcmp(reader.name(), TAG_CERT) == 0);
+
+    const char *index = nullptr;
+    const char *key = nullptr;
+
+    for (const XmlReader::Attribute &attr : reader.attributes()) {
+        if (strcmp(attr.name, ATTR_INDEX) == 0) {
+            index = attr.value;
+        } else if (strcmp(attr.name, ATTR_KEY) == 0) {
+            key = attr.value;
+        } else {
+            LOGW("Unrecognized attribute '{}' in <{}>", attr.name, TAG_CERT);
         }
+    }
+
+    if (!index || !*index) {
+        LOGW("Missing or empty index in <{}>", TAG_CERT);
+    } else {
+        std::string index_str(index);
+
+        // Keys are only listed the first time an index is used
+        if (key && *key) {
+            auto it = pkgs->sigs.find(index_str);
+            if (it != pkgs->sigs.end()) {
+                // Make sure key matches if it's already in the map
+                if (it->second != key) {
+                    LOGE("Error: Index \"{}\" assigned to multiple keys",
+                         index_str);
+                    return false;
+                }
+            } else {
+                // Otherwise, add it to the map
+                pkgs->sigs.insert(std::make_pair(index_str, key));
+            }
+        }
+
+        pkg->sig_indexes.push_back(std::move(index_str));
+    }
 
-        if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
+    return reader.skip();
+}
+
+static bool parse_tag_sigs(XmlReader &reader, Packages *pkgs, Package *pkg)
+{
+    assert(strcmp(reader.name(), TAG_SIGS) == 0);
+
+    while (next_child(reader)) {
+        if (strcmp(reader.name(), TAG_SIGS) == 0) {
             LOGW("Nested <{}> is not allowed", TAG_SIGS);
-        } else if (strcmp(cur_node.name(), TAG_CERT) == 0) {
-            if (!parse_tag_cert(cur_node, pkgs, pkg)) {
+            if (!reader.skip()) {
+                return false;
+            }
+        } else if (strcmp(reader.name(), TAG_CERT) == 0) {
+            if (!parse_tag_cert(reader, pkgs, pkg)) {
                 return false;
             }
         } else {
-            LOGW("Unrecognized <{}> within <{}>", cur_node.name(), TAG_SIGS);
+            LOGW("Unrecognized <{}> within <{}>", reader.name(), TAG_SIGS);
+            if (!reader.skip()) {
+                return false;
+            }
         }
     }
 
-    return true;
+    return !reader.error();
 }
 
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+static void parse_package_attrs(XmlReader &reader, Package *pkg)
 {
-    assert(strcmp(node.name(), TAG_PACKAGE) == 0);
-
-    std::shared_ptr<Package> pkg(new Package());
-
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
+    for (const XmlReader::Attribute &attr : reader.attributes()) {
+        const char *name = attr.name;
+        const char *value = attr.value;
 
         if (strcmp(name, ATTR_CODE_PATH) == 0) {
             pkg->code_path = value;
@@ -401,82 +739,159 @@ static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
             LOGW("Unrecognized attribute '{}' in <{}>", name, TAG_PACKAGE);
         }
     }
+}
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+static bool parse_tag_package(XmlReader &reader, Packages *pkgs)
+{
+    assert(strcmp(reader.name(), TAG_PACKAGE) == 0);
 
-        if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
+    std::shared_ptr<Package> pkg(new Package());
+    parse_package_attrs(reader, pkg.get());
+
+    while (next_child(reader)) {
+        if (strcmp(reader.name(), TAG_PACKAGE) == 0) {
             LOGW("Nested <{}> is not allowed", TAG_PACKAGE);
-        } else if (strcmp(cur_node.name(), TAG_DEFINED_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_PERMS) == 0
-                || strcmp(cur_node.name(), TAG_PROPER_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_UPGRADE_KEYSET) == 0) {
-            // Ignore
-        } else if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
-            if (!parse_tag_sigs(cur_node, pkgs, pkg)) {
+            if (!reader.skip()) {
+                return false;
+            }
+        } else if (strcmp(reader.name(), TAG_SIGS) == 0) {
+            if (!parse_tag_sigs(reader, pkgs, pkg.get())) {
                 return false;
             }
         } else {
-            LOGW("Unrecognized <{}> within <{}>", cur_node.name(), TAG_PACKAGE);
+            if (strcmp(reader.name(), TAG_DEFINED_KEYSET) != 0
+                    && strcmp(reader.name(), TAG_PERMS) != 0
+                    && strcmp(reader.name(), TAG_PROPER_SIGNING_KEYSET) != 0
+                    && strcmp(reader.name(), TAG_SIGNING_KEYSET) != 0
+                    && strcmp(reader.name(), TAG_UPGRADE_KEYSET) != 0) {
+                LOGW("Unrecognized <{}> within <{}>",
+                     reader.name(), TAG_PACKAGE);
+            }
+            if (!reader.skip()) {
+                return false;
+            }
         }
     }
 
-    pkgs->pkgs.push_back(std::move(pkg));
+    if (reader.error()) {
+        return false;
+    }
+
+    pkgs->add_package(std::move(pkg));
 
     return true;
 }
 
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_packages(XmlReader &reader, Packages *pkgs)
 {
-    assert(strcmp(node.name(), TAG_PACKAGES) == 0);
+    assert(strcmp(reader.name(), TAG_PACKAGES) == 0);
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
+    while (next_child(reader)) {
+        if (strcmp(reader.name(), TAG_PACKAGE) == 0) {
+            if (!parse_tag_package(reader, pkgs)) {
+                return false;
+            }
             continue;
         }
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
+        if (strcmp(reader.name(), TAG_PACKAGES) == 0) {
             LOGW("Nested <{}> is not allowed", TAG_PACKAGES);
-        } else if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
-            if (!parse_tag_package(cur_node, pkgs)) {
-                return false;
+        } else if (strcmp(reader.name(), TAG_DATABASE_VERSION) != 0
+                && strcmp(reader.name(), TAG_KEYSET_SETTINGS) != 0
+                && strcmp(reader.name(), TAG_LAST_PLATFORM_VERSION) != 0
+                && strcmp(reader.name(), TAG_PERMISSION_TREES) != 0
+                && strcmp(reader.name(), TAG_PERMISSIONS) != 0
+                && strcmp(reader.name(), TAG_RENAMED_PACKAGE) != 0
+                && strcmp(reader.name(), TAG_SHARED_USER) != 0
+                && strcmp(reader.name(), TAG_UPDATED_PACKAGE) != 0) {
+            LOGW("Unrecognized <{}> within <{}>", reader.name(), TAG_PACKAGES);
+        }
+
+        // Skipped without building anything, which avoids most of the work
+        // since the permission lists make up most of the file
+        if (!reader.skip()) {
+            return false;
+        }
+    }
+
+    return !reader.error();
+}
+
+static bool parse_xml(const std::string &path, Packages *pkgs)
+{
+    std::vector<unsigned char> data;
+    if (!util::file_read_all(path, &data)) {
+        LOGE("Failed to read XML file: {}: {}", path, util::error_string(errno));
+        return false;
+    }
+
+    XmlReader reader(reinterpret_cast<char *>(data.data()), data.size());
+    XmlReader::Event event;
+
+    while ((event = reader.next()) == XmlReader::Event::START) {
+        if (strcmp(reader.name(), TAG_PACKAGES) == 0) {
+            if (!parse_tag_packages(reader, pkgs)) {
+                break;
             }
-        } else if (strcmp(cur_node.name(), TAG_DATABASE_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_KEYSET_SETTINGS) == 0
-                || strcmp(cur_node.name(), TAG_LAST_PLATFORM_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSION_TREES) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSIONS) == 0
-                || strcmp(cur_node.name(), TAG_RENAMED_PACKAGE) == 0
-                || strcmp(cur_node.name(), TAG_SHARED_USER) == 0
-                || strcmp(cur_node.name(), TAG_UPDATED_PACKAGE) == 0) {
-            // Ignore
         } else {
-            LOGW("Unrecognized <{}> within <{}>", cur_node.name(), TAG_PACKAGES);
+            LOGW("Unrecognized root tag: {}", reader.name());
+            if (!reader.skip()) {
+                break;
+            }
         }
     }
 
-    return true;
+    if (reader.error()) {
+        LOGE("Failed to parse XML file: {}: {}", path, reader.error());
+        return false;
+    }
+
+    return event == XmlReader::Event::END_DOCUMENT;
+}
+
+bool Packages::load_xml(const std::string &path)
+{
+    clear();
+
+    return parse_xml(path, this);
+}
+
+void Packages::clear()
+{
+    _pkgs.clear();
+    sigs.clear();
+    _uid_index.clear();
+}
+
+void Packages::add_package(std::shared_ptr<Package> pkg)
+{
+    if (!pkg->is_shared_user) {
+        // Keep the first package if there are duplicates
+        _uid_index.insert(std::make_pair(
+                static_cast<uid_t>(pkg->user_id), _pkgs.size()));
+    }
+    _pkgs.push_back(std::move(pkg));
+}
+
+const std::vector<std::shared_ptr<Package>> & Packages::packages() const
+{
+    return _pkgs;
 }
 
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid)
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _uid_index.find(uid);
+    return it == _uid_index.end() ? std::shared_ptr<Package>()
+            : _pkgs[it->second];
 }
 
 std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id)
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
+    auto it = std::find_if(_pkgs.begin(), _pkgs.end(),
                            [&](const std::shared_ptr<Package> &pkg) {
         return pkg->name == pkg_id;
     });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    return it == _pkgs.end() ? std::shared_ptr<Package>() : *it;
 }
 
 }
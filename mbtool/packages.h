@@ -102,13 +102,23 @@ public:
 class Packages
 {
 public:
-    std::vector<std::shared_ptr<Package>> pkgs;
     std::unordered_map<std::string, std::string> sigs;
 
     bool load_xml(const std::string &path);
 
+    void clear();
+    void add_package(std::shared_ptr<Package> pkg);
+
     std::shared_ptr<Package> find_by_uid(uid_t uid);
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id);
+
+    const std::vector<std::shared_ptr<Package>> & packages() const;
+
+private:
+    // Only modified through add_package() so that _uid_index stays in sync
+    std::vector<std::shared_ptr<Package>> _pkgs;
+    // UID -> index in _pkgs for non-shared packages
+    std::unordered_map<uid_t, std::size_t> _uid_index;
 };
 
 }
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "packagescache.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+
+#include "validcerts.h"
+#include "util/logging.h"
+#include "util/string.h"
+
+#define PACKAGES_XML                    "/data/system/packages.xml"
+
+
+namespace mb
+{
+
+PackagesCache::PackagesCache(std::string path) : _path(std::move(path))
+{
+    memset(&_sb, 0, sizeof(_sb));
+}
+
+// Get the parsed packages.xml, reloading it if it has changed. The returned
+// object is never modified by the cache, so it can be used after the file is
+// reloaded. Returns nullptr if the file cannot be loaded.
+std::shared_ptr<Packages> PackagesCache::get()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!reload()) {
+        return std::shared_ptr<Packages>();
+    }
+
+    return _pkgs;
+}
+
+// Find the (non-shared) package with the specified UID. If trusted is not null,
+// it is set to whether the package is signed with one of the certificates in
+// valid_certs.
+std::shared_ptr<Package> PackagesCache::find_by_uid(uid_t uid, bool *trusted)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!reload()) {
+        return std::shared_ptr<Package>();
+    }
+
+    auto it = _uids.find(uid);
+    if (it == _uids.end()) {
+        return std::shared_ptr<Package>();
+    }
+
+    if (trusted) {
+        *trusted = it->second.trusted;
+    }
+    return it->second.pkg;
+}
+
+bool PackagesCache::is_current(const struct stat &sb) const
+{
+    return _pkgs
+            && sb.st_dev == _sb.st_dev
+            && sb.st_ino == _sb.st_ino
+            && sb.st_size == _sb.st_size
+            && sb.st_mtime == _sb.st_mtime
+            && sb.st_ctime == _sb.st_ctime;
+}
+
+// Must be called with _mutex held
+bool PackagesCache::reload()
+{
+    struct stat sb;
+    if (stat(_path.c_str(), &sb) < 0) {
+        LOGE("{}: Failed to stat: {}", _path, util::error_string(errno));
+        return false;
+    }
+
+    if (is_current(sb)) {
+        return true;
+    }
+
+    std::shared_ptr<Packages> pkgs(new Packages());
+    if (!pkgs->load_xml(_path)) {
+        LOGE("Failed to load {}", _path);
+        _pkgs.reset();
+        _uids.clear();
+        return false;
+    }
+
+    LOGV("Loaded {:d} packages from {}", pkgs->packages().size(), _path);
+
+    static const std::unordered_set<std::string> certs(
+            valid_certs.begin(), valid_certs.end());
+
+    std::unordered_map<uid_t, UidEntry> uids;
+
+    for (const std::shared_ptr<Package> &pkg : pkgs->packages()) {
+        if (pkg->is_shared_user) {
+            continue;
+        }
+
+        bool trusted = false;
+
+        for (const std::string &index : pkg->sig_indexes) {
+            auto it = pkgs->sigs.find(index);
+            if (it == pkgs->sigs.end()) {
+                LOGW("{}: Signature index {} has no key", pkg->name, index);
+            } else if (certs.find(it->second) != certs.end()) {
+                trusted = true;
+                break;
+            }
+        }
+
+        // Keep the first package if there are duplicates
+        uids.insert(std::make_pair(static_cast<uid_t>(pkg->user_id),
+                                   UidEntry{pkg, trusted}));
+    }
+
+    _sb = sb;
+    _pkgs = std::move(pkgs);
+    _uids.swap(uids);
+
+    return true;
+}
+
+// Shared cache for /data/system/packages.xml
+PackagesCache & system_packages()
+{
+    static PackagesCache cache(PACKAGES_XML);
+    return cache;
+}
+
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "packages.h"
+
+
+namespace mb
+{
+
+// Keeps a parsed copy of packages.xml around for as long as the file does not
+// change. Every lookup does a stat() of the file and only reparses it if the
+// file was replaced or modified. Android always writes packages.xml to a new
+// file, so this is cheap and reliable.
+class PackagesCache
+{
+public:
+    explicit PackagesCache(std::string path);
+
+    PackagesCache(const PackagesCache &) = delete;
+    PackagesCache & operator=(const PackagesCache &) = delete;
+
+    std::shared_ptr<Packages> get();
+
+    std::shared_ptr<Package> find_by_uid(uid_t uid, bool *trusted);
+
+private:
+    struct UidEntry
+    {
+        std::shared_ptr<Package> pkg;
+        // Whether the package is signed with a whitelisted certificate
+        bool trusted;
+    };
+
+    bool is_current(const struct stat &sb) const;
+    bool reload();
+
+    std::mutex _mutex;
+    std::string _path;
+    struct stat _sb;
+    std::shared_ptr<Packages> _pkgs;
+    std::unordered_map<uid_t, UidEntry> _uids;
+};
+
+PackagesCache & system_packages();
+
+}
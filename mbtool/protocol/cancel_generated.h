@@ -0,0 +1,174 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_CANCEL_MBTOOL_DAEMON_V2_H_
+#define FLATBUFFERS_GENERATED_CANCEL_MBTOOL_DAEMON_V2_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetVersionRequest;
+struct GetVersionResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct Rom;
+struct GetRomsListRequest;
+struct GetRomsListResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetBuiltinRomIdsRequest;
+struct GetBuiltinRomIdsResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetCurrentRomRequest;
+struct GetCurrentRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct SwitchRomRequest;
+struct SwitchRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct SetKernelRequest;
+struct SetKernelResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct RebootRequest;
+struct RebootResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct OpenRequest;
+struct OpenResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct CopyRequest;
+struct CopyResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct ChmodRequest;
+struct ChmodResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct LokiPatchRequest;
+struct LokiPatchResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct WipeRomRequest;
+struct WipeRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+
+struct CancelRequest;
+struct CancelResponse;
+
+struct CancelRequest : private flatbuffers::Table {
+  uint32_t id() const { return GetField<uint32_t>(4, 0); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, 4 /* id */) &&
+           verifier.EndTable();
+  }
+};
+
+struct CancelRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_id(uint32_t id) { fbb_.AddElement<uint32_t>(4, id, 0); }
+  CancelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  CancelRequestBuilder &operator=(const CancelRequestBuilder &);
+  flatbuffers::Offset<CancelRequest> Finish() {
+    auto o = flatbuffers::Offset<CancelRequest>(fbb_.EndTable(start_, 1));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<CancelRequest> CreateCancelRequest(flatbuffers::FlatBufferBuilder &_fbb,
+   uint32_t id = 0) {
+  CancelRequestBuilder builder_(_fbb);
+  builder_.add_id(id);
+  return builder_.Finish();
+}
+
+struct CancelResponse : private flatbuffers::Table {
+  uint8_t success() const { return GetField<uint8_t>(4, 0); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, 4 /* success */) &&
+           verifier.EndTable();
+  }
+};
+
+struct CancelResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_success(uint8_t success) { fbb_.AddElement<uint8_t>(4, success, 0); }
+  CancelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  CancelResponseBuilder &operator=(const CancelResponseBuilder &);
+  flatbuffers::Offset<CancelResponse> Finish() {
+    auto o = flatbuffers::Offset<CancelResponse>(fbb_.EndTable(start_, 1));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<CancelResponse> CreateCancelResponse(flatbuffers::FlatBufferBuilder &_fbb,
+   uint8_t success = 0) {
+  CancelResponseBuilder builder_(_fbb);
+  builder_.add_success(success);
+  return builder_.Finish();
+}
+
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_CANCEL_MBTOOL_DAEMON_V2_H_
@@ -0,0 +1,164 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_PROGRESS_MBTOOL_DAEMON_V2_H_
+#define FLATBUFFERS_GENERATED_PROGRESS_MBTOOL_DAEMON_V2_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetVersionRequest;
+struct GetVersionResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct Rom;
+struct GetRomsListRequest;
+struct GetRomsListResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetBuiltinRomIdsRequest;
+struct GetBuiltinRomIdsResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct GetCurrentRomRequest;
+struct GetCurrentRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct SwitchRomRequest;
+struct SwitchRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct SetKernelRequest;
+struct SetKernelResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct RebootRequest;
+struct RebootResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct OpenRequest;
+struct OpenResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct CopyRequest;
+struct CopyResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct ChmodRequest;
+struct ChmodResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct LokiPatchRequest;
+struct LokiPatchResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct WipeRomRequest;
+struct WipeRomResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct CancelRequest;
+struct CancelResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+
+struct ProgressResponse;
+
+struct ProgressResponse : private flatbuffers::Table {
+  uint64_t bytes() const { return GetField<uint64_t>(4, 0); }
+  uint64_t files() const { return GetField<uint64_t>(6, 0); }
+  const flatbuffers::String *current_path() const { return GetPointer<const flatbuffers::String *>(8); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, 4 /* bytes */) &&
+           VerifyField<uint64_t>(verifier, 6 /* files */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 8 /* current_path */) &&
+           verifier.Verify(current_path()) &&
+           verifier.EndTable();
+  }
+};
+
+struct ProgressResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_bytes(uint64_t bytes) { fbb_.AddElement<uint64_t>(4, bytes, 0); }
+  void add_files(uint64_t files) { fbb_.AddElement<uint64_t>(6, files, 0); }
+  void add_current_path(flatbuffers::Offset<flatbuffers::String> current_path) { fbb_.AddOffset(8, current_path); }
+  ProgressResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  ProgressResponseBuilder &operator=(const ProgressResponseBuilder &);
+  flatbuffers::Offset<ProgressResponse> Finish() {
+    auto o = flatbuffers::Offset<ProgressResponse>(fbb_.EndTable(start_, 3));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<ProgressResponse> CreateProgressResponse(flatbuffers::FlatBufferBuilder &_fbb,
+   uint64_t bytes = 0,
+   uint64_t files = 0,
+   flatbuffers::Offset<flatbuffers::String> current_path = 0) {
+  ProgressResponseBuilder builder_(_fbb);
+  builder_.add_files(files);
+  builder_.add_bytes(bytes);
+  builder_.add_current_path(current_path);
+  return builder_.Finish();
+}
+
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_PROGRESS_MBTOOL_DAEMON_V2_H_
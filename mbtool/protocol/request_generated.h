@@ -102,6 +102,21 @@ struct WipeRomResponse;
 }  // namespace v2
 }  // namespace daemon
 }  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct CancelRequest;
+struct CancelResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct ProgressResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
 
 namespace mbtool {
 namespace daemon {
@@ -121,11 +136,12 @@ enum RequestType {
   RequestType_COPY = 8,
   RequestType_CHMOD = 9,
   RequestType_LOKI_PATCH = 10,
-  RequestType_WIPE_ROM = 11
+  RequestType_WIPE_ROM = 11,
+  RequestType_CANCEL = 12
 };
 
 inline const char **EnumNamesRequestType() {
-  static const char *names[] = { "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", nullptr };
+  static const char *names[] = { "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", "CANCEL", nullptr };
   return names;
 }
 
@@ -144,6 +160,9 @@ struct Request : private flatbuffers::Table {
   const mbtool::daemon::v2::CopyRequest *copy_request() const { return GetPointer<const mbtool::daemon::v2::CopyRequest *>(22); }
   const mbtool::daemon::v2::ChmodRequest *chmod_request() const { return GetPointer<const mbtool::daemon::v2::ChmodRequest *>(24); }
   const mbtool::daemon::v2::WipeRomRequest *wipe_rom_request() const { return GetPointer<const mbtool::daemon::v2::WipeRomRequest *>(28); }
+  uint32_t id() const { return GetField<uint32_t>(30, 0); }
+  const mbtool::daemon::v2::CancelRequest *cancel_request() const { return GetPointer<const mbtool::daemon::v2::CancelRequest *>(32); }
+  uint8_t report_progress() const { return GetField<uint8_t>(34, 0); }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int16_t>(verifier, 4 /* type */) &&
@@ -169,6 +188,10 @@ struct Request : private flatbuffers::Table {
            verifier.VerifyTable(chmod_request()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, 28 /* wipe_rom_request */) &&
            verifier.VerifyTable(wipe_rom_request()) &&
+           VerifyField<uint32_t>(verifier, 30 /* id */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 32 /* cancel_request */) &&
+           verifier.VerifyTable(cancel_request()) &&
+           VerifyField<uint8_t>(verifier, 34 /* report_progress */) &&
            verifier.EndTable();
   }
 };
@@ -188,10 +211,13 @@ struct RequestBuilder {
   void add_copy_request(flatbuffers::Offset<mbtool::daemon::v2::CopyRequest> copy_request) { fbb_.AddOffset(22, copy_request); }
   void add_chmod_request(flatbuffers::Offset<mbtool::daemon::v2::ChmodRequest> chmod_request) { fbb_.AddOffset(24, chmod_request); }
   void add_wipe_rom_request(flatbuffers::Offset<mbtool::daemon::v2::WipeRomRequest> wipe_rom_request) { fbb_.AddOffset(28, wipe_rom_request); }
+  void add_id(uint32_t id) { fbb_.AddElement<uint32_t>(30, id, 0); }
+  void add_cancel_request(flatbuffers::Offset<mbtool::daemon::v2::CancelRequest> cancel_request) { fbb_.AddOffset(32, cancel_request); }
+  void add_report_progress(uint8_t report_progress) { fbb_.AddElement<uint8_t>(34, report_progress, 0); }
   RequestBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
   RequestBuilder &operator=(const RequestBuilder &);
   flatbuffers::Offset<Request> Finish() {
-    auto o = flatbuffers::Offset<Request>(fbb_.EndTable(start_, 13));
+    auto o = flatbuffers::Offset<Request>(fbb_.EndTable(start_, 16));
     return o;
   }
 };
@@ -208,8 +234,13 @@ inline flatbuffers::Offset<Request> CreateRequest(flatbuffers::FlatBufferBuilder
    flatbuffers::Offset<mbtool::daemon::v2::OpenRequest> open_request = 0,
    flatbuffers::Offset<mbtool::daemon::v2::CopyRequest> copy_request = 0,
    flatbuffers::Offset<mbtool::daemon::v2::ChmodRequest> chmod_request = 0,
-   flatbuffers::Offset<mbtool::daemon::v2::WipeRomRequest> wipe_rom_request = 0) {
+   flatbuffers::Offset<mbtool::daemon::v2::WipeRomRequest> wipe_rom_request = 0,
+   uint32_t id = 0,
+   flatbuffers::Offset<mbtool::daemon::v2::CancelRequest> cancel_request = 0,
+   uint8_t report_progress = 0) {
   RequestBuilder builder_(_fbb);
+  builder_.add_cancel_request(cancel_request);
+  builder_.add_id(id);
   builder_.add_wipe_rom_request(wipe_rom_request);
   builder_.add_chmod_request(chmod_request);
   builder_.add_copy_request(copy_request);
@@ -222,6 +253,7 @@ inline flatbuffers::Offset<Request> CreateRequest(flatbuffers::FlatBufferBuilder
   builder_.add_get_roms_list_request(get_roms_list_request);
   builder_.add_get_version_request(get_version_request);
   builder_.add_type(type);
+  builder_.add_report_progress(report_progress);
   return builder_.Finish();
 }
 
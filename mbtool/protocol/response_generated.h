@@ -105,6 +105,21 @@ struct WipeRomResponse;
 namespace mbtool {
 namespace daemon {
 namespace v2 {
+struct CancelRequest;
+struct CancelResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
+struct ProgressResponse;
+}  // namespace v2
+}  // namespace daemon
+}  // namespace mbtool
+namespace mbtool {
+namespace daemon {
+namespace v2 {
 struct Request;
 }  // namespace v2
 }  // namespace daemon
@@ -130,11 +145,13 @@ enum ResponseType {
   ResponseType_COPY = 10,
   ResponseType_CHMOD = 11,
   ResponseType_LOKI_PATCH = 12,
-  ResponseType_WIPE_ROM = 13
+  ResponseType_WIPE_ROM = 13,
+  ResponseType_CANCEL = 14,
+  ResponseType_PROGRESS = 15
 };
 
 inline const char **EnumNamesResponseType() {
-  static const char *names[] = { "UNSUPPORTED", "INVALID", "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", nullptr };
+  static const char *names[] = { "UNSUPPORTED", "INVALID", "GET_VERSION", "GET_ROMS_LIST", "GET_BUILTIN_ROM_IDS", "GET_CURRENT_ROM", "SWITCH_ROM", "SET_KERNEL", "REBOOT", "OPEN", "COPY", "CHMOD", "LOKI_PATCH", "WIPE_ROM", "CANCEL", "PROGRESS", nullptr };
   return names;
 }
 
@@ -153,6 +170,9 @@ struct Response : private flatbuffers::Table {
   const mbtool::daemon::v2::CopyResponse *copy_response() const { return GetPointer<const mbtool::daemon::v2::CopyResponse *>(22); }
   const mbtool::daemon::v2::ChmodResponse *chmod_response() const { return GetPointer<const mbtool::daemon::v2::ChmodResponse *>(24); }
   const mbtool::daemon::v2::WipeRomResponse *wipe_rom_response() const { return GetPointer<const mbtool::daemon::v2::WipeRomResponse *>(28); }
+  uint32_t id() const { return GetField<uint32_t>(30, 0); }
+  const mbtool::daemon::v2::CancelResponse *cancel_response() const { return GetPointer<const mbtool::daemon::v2::CancelResponse *>(32); }
+  const mbtool::daemon::v2::ProgressResponse *progress_response() const { return GetPointer<const mbtool::daemon::v2::ProgressResponse *>(34); }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int16_t>(verifier, 4 /* type */) &&
@@ -178,6 +198,11 @@ struct Response : private flatbuffers::Table {
            verifier.VerifyTable(chmod_response()) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, 28 /* wipe_rom_response */) &&
            verifier.VerifyTable(wipe_rom_response()) &&
+           VerifyField<uint32_t>(verifier, 30 /* id */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 32 /* cancel_response */) &&
+           verifier.VerifyTable(cancel_response()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 34 /* progress_response */) &&
+           verifier.VerifyTable(progress_response()) &&
            verifier.EndTable();
   }
 };
@@ -197,10 +222,13 @@ struct ResponseBuilder {
   void add_copy_response(flatbuffers::Offset<mbtool::daemon::v2::CopyResponse> copy_response) { fbb_.AddOffset(22, copy_response); }
   void add_chmod_response(flatbuffers::Offset<mbtool::daemon::v2::ChmodResponse> chmod_response) { fbb_.AddOffset(24, chmod_response); }
   void add_wipe_rom_response(flatbuffers::Offset<mbtool::daemon::v2::WipeRomResponse> wipe_rom_response) { fbb_.AddOffset(28, wipe_rom_response); }
+  void add_id(uint32_t id) { fbb_.AddElement<uint32_t>(30, id, 0); }
+  void add_cancel_response(flatbuffers::Offset<mbtool::daemon::v2::CancelResponse> cancel_response) { fbb_.AddOffset(32, cancel_response); }
+  void add_progress_response(flatbuffers::Offset<mbtool::daemon::v2::ProgressResponse> progress_response) { fbb_.AddOffset(34, progress_response); }
   ResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
   ResponseBuilder &operator=(const ResponseBuilder &);
   flatbuffers::Offset<Response> Finish() {
-    auto o = flatbuffers::Offset<Response>(fbb_.EndTable(start_, 13));
+    auto o = flatbuffers::Offset<Response>(fbb_.EndTable(start_, 16));
     return o;
   }
 };
@@ -217,8 +245,14 @@ inline flatbuffers::Offset<Response> CreateResponse(flatbuffers::FlatBufferBuild
    flatbuffers::Offset<mbtool::daemon::v2::OpenResponse> open_response = 0,
    flatbuffers::Offset<mbtool::daemon::v2::CopyResponse> copy_response = 0,
    flatbuffers::Offset<mbtool::daemon::v2::ChmodResponse> chmod_response = 0,
-   flatbuffers::Offset<mbtool::daemon::v2::WipeRomResponse> wipe_rom_response = 0) {
+   flatbuffers::Offset<mbtool::daemon::v2::WipeRomResponse> wipe_rom_response = 0,
+   uint32_t id = 0,
+   flatbuffers::Offset<mbtool::daemon::v2::CancelResponse> cancel_response = 0,
+   flatbuffers::Offset<mbtool::daemon::v2::ProgressResponse> progress_response = 0) {
   ResponseBuilder builder_(_fbb);
+  builder_.add_progress_response(progress_response);
+  builder_.add_cancel_response(cancel_response);
+  builder_.add_id(id);
   builder_.add_wipe_rom_response(wipe_rom_response);
   builder_.add_chmod_response(chmod_response);
   builder_.add_copy_response(copy_response);
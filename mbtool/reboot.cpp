@@ -24,6 +24,7 @@
 #include "external/android_reboot.h"
 #include "util/logging.h"
 #include "util/properties.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -55,7 +56,7 @@ bool reboot_via_init(const std::string &reboot_arg)
 bool reboot_directly(const std::string &reboot_arg)
 {
     if (android_reboot(ANDROID_RB_RESTART2, reboot_arg.c_str()) < 0) {
-        LOGE("Failed to reboot: {}", strerror(errno));
+        LOGE("Failed to reboot: {}", util::error_string(errno));
         return false;
     }
 
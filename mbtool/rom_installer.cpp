@@ -115,13 +115,14 @@ Installer::ProceedState RomInstaller::on_checked_device()
 
     typedef std::unique_ptr<archive, int (*)(archive *)> archive_ptr;
 
+    // The recovery partition is only read from, so avoid copying it
     mbp::BootImage bi;
-    if (!bi.load(_recovery_block_dev)) {
+    if (!bi.loadMapped(_recovery_block_dev)) {
         display_msg("Failed to load recovery partition image");
         return ProceedState::Fail;
     }
 
-    std::vector<unsigned char> ramdisk = bi.ramdiskImage();
+    mbp::BinaryView ramdisk = bi.ramdiskImageView();
 
     archive_ptr in(archive_read_new(), archive_read_free);
     archive_ptr out(archive_write_disk_new(), archive_write_free);
@@ -97,7 +97,7 @@ void Roms::add_data_roms()
 
     DIR *dp = opendir(system.c_str());
     if (!dp ) {
-        LOGE("{}: Failed to open directory: {}", system, strerror(errno));
+        LOGE("{}: Failed to open directory: {}", system, util::error_string(errno));
         return;
     }
 
@@ -28,6 +28,7 @@
 #include "util/finally.h"
 #include "util/logging.h"
 #include "util/path.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -134,13 +135,13 @@ bool extract_archive(const std::string &filename, const std::string &target)
 
     if (!mkdir_recursive(target, S_IRWXU | S_IRWXG | S_IRWXO)) {
         LOGE("{}: Failed to create directory: {}",
-             target, strerror(errno));
+             target, error_string(errno));
         return false;
     }
 
     if (chdir(target.c_str()) < 0) {
         LOGE("{}: Failed to change to target directory: {}",
-             target, strerror(errno));
+             target, error_string(errno));
         return false;
     }
 
@@ -195,13 +196,13 @@ bool extract_files(const std::string &filename, const std::string &target,
 
     if (!mkdir_recursive(target, S_IRWXU | S_IRWXG | S_IRWXO)) {
         LOGE("{}: Failed to create directory: {}",
-             target, strerror(errno));
+             target, error_string(errno));
         return false;
     }
 
     if (chdir(target.c_str()) < 0) {
         LOGE("{}: Failed to change to target directory: {}",
-             target, strerror(errno));
+             target, error_string(errno));
         return false;
     }
 
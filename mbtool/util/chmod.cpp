@@ -27,6 +27,7 @@
 
 #include "util/fts.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -78,7 +79,7 @@ private:
     {
         if (chmod(_curr->fts_accpath, _perms) < 0) {
             _error_msg = fmt::format("{}: Failed to chmod: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
@@ -29,6 +29,7 @@
 
 #include "util/fts.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -87,7 +88,7 @@ private:
     {
         if (!chown_internal(_curr->fts_accpath, _uid, _gid, _follow_symlinks)) {
             _error_msg = fmt::format("{}: Failed to chown: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
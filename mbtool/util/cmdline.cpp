@@ -36,7 +36,7 @@ bool kernel_cmdline_get_option(const std::string &option,
 {
     std::string line;
     if (!file_first_line("/proc/cmdline", &line)) {
-        LOGE("Failed to read first line in /proc/cmdline: {}", strerror(errno));
+        LOGE("Failed to read first line in /proc/cmdline: {}", error_string(errno));
         return false;
     }
 
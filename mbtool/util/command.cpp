@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include "util/logging.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -129,11 +130,11 @@ int run_command2(const std::vector<std::string> &argv,
 
             if (!chroot_dir.empty()) {
                 if (chdir(chroot_dir.c_str()) < 0) {
-                    LOGE("{}; Failed to chdir: {}", chroot_dir, strerror(errno));
+                    LOGE("{}; Failed to chdir: {}", chroot_dir, error_string(errno));
                     _exit(EXIT_FAILURE);
                 }
                 if (chroot(chroot_dir.c_str()) < 0) {
-                    LOGE("{}: Failed to chroot: {}", chroot_dir, strerror(errno));
+                    LOGE("{}: Failed to chroot: {}", chroot_dir, error_string(errno));
                     _exit(EXIT_FAILURE);
                 }
             }
@@ -169,7 +170,7 @@ int run_command2(const std::vector<std::string> &argv,
                 } else {
                     do {
                         if (waitpid(reader_pid, &reader_status, 0) < 0) {
-                            LOGE("Failed to waitpid(): {}", strerror(errno));
+                            LOGE("Failed to waitpid(): {}", error_string(errno));
                             break;
                         }
                     } while (!WIFEXITED(reader_status)
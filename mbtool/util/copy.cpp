@@ -34,6 +34,7 @@
 #include "util/fts.h"
 #include "util/logging.h"
 #include "util/path.h"
+#include "util/string.h"
 
 // WARNING: Everything operates on paths, so it's subject to race conditions
 // Directory copy operations will not cross mountpoint boundaries
@@ -43,7 +44,9 @@ namespace mb
 namespace util
 {
 
-bool copy_data_fd(int fd_source, int fd_target)
+// If progress is not null, the number of bytes copied is reported to it. If the
+// operation is cancelled, false is returned and errno is set to ECANCELED.
+bool copy_data_fd(int fd_source, int fd_target, ProgressReporter *progress)
 {
     char buf[10240];
     ssize_t nread;
@@ -51,6 +54,7 @@ bool copy_data_fd(int fd_source, int fd_target)
     while ((nread = read(fd_source, buf, sizeof buf)) > 0) {
         char *out_ptr = buf;
         ssize_t nwritten;
+        ssize_t total = nread;
 
         do {
             if ((nwritten = write(fd_target, out_ptr, nread)) < 0) {
@@ -60,6 +64,11 @@ bool copy_data_fd(int fd_source, int fd_target)
             nread -= nwritten;
             out_ptr += nwritten;
         } while (nread > 0);
+
+        if (progress && !progress->add(total, 0)) {
+            errno = ECANCELED;
+            return false;
+        }
     }
 
     return nread == 0;
@@ -111,7 +120,7 @@ static bool copy_xattrs(const std::string &source, const std::string &target)
             return true;
         } else {
             LOGE("{}: Failed to list xattrs: {}",
-                 source, strerror(errno));
+                 source, error_string(errno));
             return false;
         }
     }
@@ -121,7 +130,7 @@ static bool copy_xattrs(const std::string &source, const std::string &target)
     size = llistxattr(source.c_str(), names.data(), size);
     if (size < 0) {
         LOGE("{}: Failed to list xattrs on second try: {}",
-             source, strerror(errno));
+             source, error_string(errno));
         return false;
     } else {
         names[size] = '\0';
@@ -136,7 +145,7 @@ static bool copy_xattrs(const std::string &source, const std::string &target)
         size = lgetxattr(source.c_str(), name, nullptr, 0);
         if (size < 0) {
             LOGW("{}: Failed to get attribute '{}': {}",
-                 source, name, strerror(errno));
+                 source, name, error_string(errno));
             continue;
         }
 
@@ -145,7 +154,7 @@ static bool copy_xattrs(const std::string &source, const std::string &target)
         size = lgetxattr(source.c_str(), name, value.data(), size);
         if (size < 0) {
             LOGW("{}: Failed to get attribute '{}' on second try: {}",
-                 source, name, strerror(errno));
+                 source, name, error_string(errno));
             continue;
         }
 
@@ -155,7 +164,7 @@ static bool copy_xattrs(const std::string &source, const std::string &target)
                 break;
             } else {
                 LOGE("{}: Failed to set xattrs: {}",
-                     target, strerror(errno));
+                     target, error_string(errno));
                 return false;
             }
         }
@@ -169,19 +178,19 @@ static bool copy_stat(const std::string &source, const std::string &target)
     struct stat sb;
 
     if (lstat(source.c_str(), &sb) < 0) {
-        LOGE("{}: Failed to stat: {}", source, strerror(errno));
+        LOGE("{}: Failed to stat: {}", source, error_string(errno));
         return false;
     }
 
     if (lchown(target.c_str(), sb.st_uid, sb.st_gid) < 0) {
-        LOGE("{}: Failed to chown: {}", target, strerror(errno));
+        LOGE("{}: Failed to chown: {}", target, error_string(errno));
         return false;
     }
 
     if (!S_ISLNK(sb.st_mode)) {
         if (chmod(target.c_str(), sb.st_mode & (S_ISUID | S_ISGID | S_ISVTX
                                               | S_IRWXU | S_IRWXG | S_IRWXO)) < 0) {
-            LOGE("{}: Failed to chmod: {}", target, strerror(errno));
+            LOGE("{}: Failed to chmod: {}", target, error_string(errno));
             return false;
         }
     }
@@ -189,7 +198,8 @@ static bool copy_stat(const std::string &source, const std::string &target)
     return true;
 }
 
-bool copy_contents(const std::string &source, const std::string &target)
+bool copy_contents(const std::string &source, const std::string &target,
+                   ProgressReporter *progress)
 {
     int fd_source = -1;
     int fd_target = -1;
@@ -210,7 +220,16 @@ bool copy_contents(const std::string &source, const std::string &target)
         close(fd_target);
     });
 
-    if (!copy_data_fd(fd_source, fd_target)) {
+    if (progress) {
+        progress->set_path(source.c_str());
+    }
+
+    if (!copy_data_fd(fd_source, fd_target, progress)) {
+        return false;
+    }
+
+    if (progress && !progress->add(0, 1)) {
+        errno = ECANCELED;
         return false;
     }
 
@@ -227,7 +246,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
 
     if (unlink(target.c_str()) < 0 && errno != ENOENT) {
         LOGE("{}: Failed to remove old file: {}",
-             target, strerror(errno));
+             target, error_string(errno));
         return false;
     }
 
@@ -235,7 +254,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
     if (((flags & COPY_FOLLOW_SYMLINKS)
             ? stat : lstat)(source.c_str(), &sb) < 0) {
         LOGE("{}: Failed to stat: {}",
-             source, strerror(errno));
+             source, error_string(errno));
         return false;
     }
 
@@ -243,7 +262,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
     case S_IFBLK:
         if (mknod(target.c_str(), S_IFBLK | S_IRWXU, sb.st_rdev) < 0) {
             LOGW("{}: Failed to create block device: {}",
-                 target, strerror(errno));
+                 target, error_string(errno));
             return false;
         }
         break;
@@ -251,7 +270,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
     case S_IFCHR:
         if (mknod(target.c_str(), S_IFCHR | S_IRWXU, sb.st_rdev) < 0) {
             LOGW("{}: Failed to create character device: {}",
-                 target, strerror(errno));
+                 target, error_string(errno));
             return false;
         }
         break;
@@ -259,7 +278,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
     case S_IFIFO:
         if (mkfifo(target.c_str(), S_IRWXU) < 0) {
             LOGW("{}: Failed to create FIFO pipe: {}",
-                 target, strerror(errno));
+                 target, error_string(errno));
             return false;
         }
         break;
@@ -269,13 +288,13 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
             std::string symlink_path;
             if (!read_link(source, &symlink_path)) {
                 LOGW("{}: Failed to read symlink path: {}",
-                     source, strerror(errno));
+                     source, error_string(errno));
                 return false;
             }
 
             if (symlink(symlink_path.c_str(), target.c_str()) < 0) {
                 LOGW("{}: Failed to create symlink: {}",
-                     target, strerror(errno));
+                     target, error_string(errno));
                 return false;
             }
 
@@ -286,7 +305,7 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
 
     case S_IFREG:
         if (!copy_data(source, target)) {
-            LOGE("{}: Failed to copy data: {}", target, strerror(errno));
+            LOGE("{}: Failed to copy data: {}", target, error_string(errno));
             return false;
         }
         break;
@@ -304,12 +323,12 @@ bool copy_file(const std::string &source, const std::string &target, int flags)
 
     if ((flags & COPY_ATTRIBUTES)
             && !copy_stat(source, target)) {
-        LOGE("{}: Failed to copy attributes: {}", target, strerror(errno));
+        LOGE("{}: Failed to copy attributes: {}", target, error_string(errno));
         return false;
     }
     if ((flags & COPY_XATTRS)
             && !copy_xattrs(source, target)) {
-        LOGE("{}: Failed to copy xattrs: {}", target, strerror(errno));
+        LOGE("{}: Failed to copy xattrs: {}", target, error_string(errno));
         return false;
     }
 
@@ -336,7 +355,7 @@ public:
         if (mkdir(_target.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) < 0
                 && errno != EEXIST) {
             _error_msg = fmt::format("{}: Failed to create directory: {}",
-                                     _target, strerror(errno));
+                                     _target, error_string(errno));
             LOGE("{}", _error_msg);
             return false;
         }
@@ -345,7 +364,7 @@ public:
 
         if (stat(_target.c_str(), &sb_target) < 0) {
             _error_msg = fmt::format("{}: Failed to stat: {}",
-                                     _target, strerror(errno));
+                                     _target, error_string(errno));
             LOGE("{}", _error_msg);
             return false;
         }
@@ -406,7 +425,7 @@ public:
         if (mkdir(_curtgtpath.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) < 0
                 && errno != EEXIST) {
             _error_msg = fmt::format("{}: Failed to create directory: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             success = false;
             skip = true;
@@ -460,7 +479,7 @@ public:
         // Copy file contents
         if (!copy_data(_curr->fts_accpath, _curtgtpath)) {
             _error_msg = fmt::format("{}: Failed to copy data: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -486,7 +505,7 @@ public:
         std::string symlink_path;
         if (!read_link(_curr->fts_accpath, &symlink_path)) {
             _error_msg = fmt::format("{}: Failed to read symlink path: {}",
-                                     _curr->fts_accpath, strerror(errno));
+                                     _curr->fts_accpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -494,7 +513,7 @@ public:
         // Create new symlink
         if (symlink(symlink_path.c_str(), _curtgtpath.c_str()) < 0) {
             _error_msg = fmt::format("{}: Failed to create symlink: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -519,7 +538,7 @@ public:
         if (mknod(_curtgtpath.c_str(), S_IFBLK | S_IRWXU,
                 _curr->fts_statp->st_rdev) < 0) {
             _error_msg = fmt::format("{}: Failed to create block device: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -544,7 +563,7 @@ public:
         if (mknod(_curtgtpath.c_str(), S_IFCHR | S_IRWXU,
                 _curr->fts_statp->st_rdev) < 0) {
             _error_msg = fmt::format("{}: Failed to create character device: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -568,7 +587,7 @@ public:
 
         if (mkfifo(_curtgtpath.c_str(), S_IRWXU) < 0) {
             _error_msg = fmt::format("{}: Failed to create FIFO pipe: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return Action::FTS_Fail;
         }
@@ -601,7 +620,7 @@ private:
         // Remove existing file
         if (unlink(_curtgtpath.c_str()) < 0 && errno != ENOENT) {
             _error_msg = fmt::format("{}: Failed to remove old path: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
@@ -613,7 +632,7 @@ private:
         if ((_copyflags & COPY_ATTRIBUTES)
                 && !copy_stat(_curr->fts_accpath, _curtgtpath)) {
             _error_msg = fmt::format("{}: Failed to copy attributes: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
@@ -625,7 +644,7 @@ private:
         if ((_copyflags & COPY_XATTRS)
                 && !copy_xattrs(_curr->fts_accpath, _curtgtpath)) {
             _error_msg = fmt::format("{}: Failed to copy xattrs: {}",
-                                     _curtgtpath, strerror(errno));
+                                     _curtgtpath, error_string(errno));
             LOGW("{}", _error_msg);
             return false;
         }
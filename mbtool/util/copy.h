@@ -21,6 +21,8 @@
 
 #include <string>
 
+#include "util/progress.h"
+
 namespace mb
 {
 namespace util
@@ -34,8 +36,10 @@ enum CopyFlags : int
     COPY_FOLLOW_SYMLINKS     = 0x8
 };
 
-bool copy_data_fd(int fd_source, int fd_target);
-bool copy_contents(const std::string &source, const std::string &target);
+bool copy_data_fd(int fd_source, int fd_target,
+                  ProgressReporter *progress = nullptr);
+bool copy_contents(const std::string &source, const std::string &target,
+                   ProgressReporter *progress = nullptr);
 bool copy_file(const std::string &source, const std::string &target, int flags);
 bool copy_dir(const std::string &source, const std::string &target, int flags);
 
@@ -27,6 +27,7 @@
 
 #include "util/fts.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -35,8 +36,9 @@ namespace util
 
 class RecursiveDeleter : public FTSWrapper {
 public:
-    RecursiveDeleter(std::string path)
-        : FTSWrapper(path, FTS_GroupSpecialFiles)
+    RecursiveDeleter(std::string path, ProgressReporter *progress)
+        : FTSWrapper(path, FTS_GroupSpecialFiles),
+        _progress(progress)
     {
     }
 
@@ -49,38 +51,49 @@ public:
 
     virtual int on_reached_directory_post() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_file() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_symlink() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
     virtual int on_reached_special_file() override
     {
-        return delete_path() ? Action::FTS_OK : Action::FTS_Fail;
+        return delete_path();
     }
 
 private:
-    bool delete_path()
+    ProgressReporter *_progress;
+
+    int delete_path()
     {
         if (remove(_curr->fts_accpath) < 0) {
             _error_msg = fmt::format("{}: Failed to remove: {}",
-                                     _curr->fts_path, strerror(errno));
+                                     _curr->fts_path, error_string(errno));
             LOGE("{}", _error_msg);
-            return false;
+            return Action::FTS_Fail;
         }
-        return true;
+
+        if (_progress && _curr->fts_info != FTS_DP) {
+            _progress->set_path(_curr->fts_path);
+            if (!_progress->add(_curr->fts_statp->st_size, 1)) {
+                _error_msg = fmt::format("{}: Cancelled", _path);
+                return Action::FTS_Fail | Action::FTS_Stop;
+            }
+        }
+
+        return Action::FTS_OK;
     }
 };
 
-bool delete_recursive(const std::string &path)
+bool delete_recursive(const std::string &path, ProgressReporter *progress)
 {
     struct stat sb;
     if (stat(path.c_str(), &sb) < 0 && errno == ENOENT) {
@@ -88,7 +101,7 @@ bool delete_recursive(const std::string &path)
         return true;
     }
 
-    RecursiveDeleter deleter(path);
+    RecursiveDeleter deleter(path, progress);
     return deleter.run();
 }
 
@@ -21,12 +21,15 @@
 
 #include <string>
 
+#include "util/progress.h"
+
 namespace mb
 {
 namespace util
 {
 
-bool delete_recursive(const std::string &path);
+bool delete_recursive(const std::string &path,
+                      ProgressReporter *progress = nullptr);
 
 }
 }
\ No newline at end of file
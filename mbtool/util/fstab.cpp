@@ -28,6 +28,7 @@
 
 #include "util/finally.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 
 namespace mb
@@ -83,7 +84,7 @@ std::vector<fstab_rec> read_fstab(const std::string &path)
 {
     file_ptr fp(std::fopen(path.c_str(), "rb"), std::fclose);
     if (!fp) {
-        LOGE("Failed to open file {}: {}", path, strerror(errno));
+        LOGE("Failed to open file {}: {}", path, error_string(errno));
         return std::vector<fstab_rec>();
     }
 
@@ -24,6 +24,8 @@
 
 #include <cppformat/format.h>
 
+#include "util/string.h"
+
 
 namespace mb
 {
@@ -82,7 +84,7 @@ bool FTSWrapper::run()
 
     _ftsp = fts_open(files, fts_flags, nullptr);
     if (!_ftsp) {
-        _error_msg = fmt::format("fts_open failed: {}", strerror(errno));
+        _error_msg = fmt::format("fts_open failed: {}", error_string(errno));
         ret = false;
     }
 
@@ -92,7 +94,7 @@ bool FTSWrapper::run()
         case FTS_DNR: // directory not read
         case FTS_ERR: // other error
             _error_msg = fmt::format("fts_read error: {}",
-                                     strerror(_curr->fts_errno));
+                                     error_string(_curr->fts_errno));
             ret = false;
             break;
 
@@ -23,6 +23,7 @@
 #include <cstdio>
 
 #include <util/logging.h>
+#include <util/string.h>
 
 namespace mb
 {
@@ -44,7 +45,7 @@ bool sha1_hash(const std::string &path, unsigned char digest[SHA_DIGEST_SIZE])
 {
     file_ptr fp(std::fopen(path.c_str(), "rb"), std::fclose);
     if (!fp) {
-        LOGE("{}: Failed to open: {}", path, strerror(errno));
+        LOGE("{}: Failed to open: {}", path, error_string(errno));
         return false;
     }
 
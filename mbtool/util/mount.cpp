@@ -48,7 +48,7 @@ bool is_mounted(const std::string &mountpoint)
 {
     file_ptr fp(setmntent("/proc/mounts", "r"), endmntent);
     if (!fp) {
-        LOGE("Failed to read /proc/mounts: {}", strerror(errno));
+        LOGE("Failed to read /proc/mounts: {}", error_string(errno));
         return false;
     }
 
@@ -77,7 +77,7 @@ bool unmount_all(const std::string &dir)
 
         file_ptr fp(setmntent("/proc/mounts", "r"), endmntent);
         if (!fp) {
-            LOGE("Failed to read /proc/mounts: {}", strerror(errno));
+            LOGE("Failed to read /proc/mounts: {}", error_string(errno));
             return false;
         }
 
@@ -87,7 +87,7 @@ bool unmount_all(const std::string &dir)
 
                 if (umount(ent.mnt_dir) < 0) {
                     LOGE("Failed to unmount {}: {}",
-                         ent.mnt_dir, strerror(errno));
+                         ent.mnt_dir, error_string(errno));
                     ++failed;
                 }
             }
@@ -111,13 +111,13 @@ bool bind_mount(const std::string &source, mode_t source_perms,
 
     if (stat(source.c_str(), &sb) < 0
             && !mkdir_recursive(source, source_perms)) {
-        LOGE("Failed to create {}: {}", source, strerror(errno));
+        LOGE("Failed to create {}: {}", source, error_string(errno));
         return false;
     }
 
     if (stat(target.c_str(), &sb) < 0
             && !mkdir_recursive(target, target_perms)) {
-        LOGE("Failed to create {}: {}", target, strerror(errno));
+        LOGE("Failed to create {}: {}", target, error_string(errno));
         return false;
     }
 
@@ -133,7 +133,7 @@ bool bind_mount(const std::string &source, mode_t source_perms,
 
     if (mount(source.c_str(), target.c_str(), "", MS_BIND, "") < 0) {
         LOGE("Failed to bind mount {} to {}: {}",
-             source, target, strerror(errno));
+             source, target, error_string(errno));
         return false;
     }
 
@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "util/logging.h"
+#include "util/string.h"
 
 namespace mb
 {
@@ -38,7 +39,7 @@ std::string get_cwd()
     char *cwd = nullptr;
 
     if (!(cwd = getcwd(nullptr, 0))) {
-        LOGE("Failed to get cwd: {}", strerror(errno));
+        LOGE("Failed to get cwd: {}", error_string(errno));
         return std::string();
     }
 
@@ -103,12 +104,12 @@ bool inodes_equal(const std::string &path1, const std::string &path2)
     struct stat sb2;
 
     if (lstat(path1.c_str(), &sb1) < 0) {
-        LOGE("{}: Failed to stat: {}", path1, strerror(errno));
+        LOGE("{}: Failed to stat: {}", path1, error_string(errno));
         return false;
     }
 
     if (lstat(path2.c_str(), &sb2) < 0) {
-        LOGE("{}: Failed to stat: {}", path2, strerror(errno));
+        LOGE("{}: Failed to stat: {}", path2, error_string(errno));
         return false;
     }
 
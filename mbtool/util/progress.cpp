@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/progress.h"
+
+#include <ctime>
+
+// Minimum time between reports
+#define REPORT_INTERVAL_MS 250
+
+namespace mb
+{
+namespace util
+{
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+ProgressReporter::ProgressReporter(Callback callback)
+    : _callback(std::move(callback))
+{
+}
+
+// Set the path that is currently being processed
+void ProgressReporter::set_path(const char *path)
+{
+    // Reuses the string's buffer for most paths
+    _path.assign(path);
+}
+
+// Add to the number of bytes and files that have been processed. Returns false
+// if the operation was cancelled.
+bool ProgressReporter::add(uint64_t bytes, uint64_t files)
+{
+    if (_cancelled) {
+        return false;
+    }
+
+    _bytes += bytes;
+    _files += files;
+
+    uint64_t now = monotonic_ms();
+    if (now - _last_report >= REPORT_INTERVAL_MS) {
+        _last_report = now;
+        if (_callback && !_callback(_bytes, _files, _path)) {
+            _cancelled = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ProgressReporter::cancelled() const
+{
+    return _cancelled;
+}
+
+}
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace mb
+{
+namespace util
+{
+
+// Accumulates the progress of a long-running operation and passes it to a
+// callback at a limited rate. The callback returns false to cancel the
+// operation, after which add() always returns false.
+class ProgressReporter {
+public:
+    typedef std::function<bool(uint64_t bytes, uint64_t files,
+                               const std::string &path)> Callback;
+
+    explicit ProgressReporter(Callback callback);
+
+    void set_path(const char *path);
+    bool add(uint64_t bytes, uint64_t files);
+    bool cancelled() const;
+
+private:
+    Callback _callback;
+    uint64_t _bytes = 0;
+    uint64_t _files = 0;
+    std::string _path;
+    // Monotonic time of the last report in milliseconds
+    uint64_t _last_report = 0;
+    bool _cancelled = false;
+};
+
+}
+}
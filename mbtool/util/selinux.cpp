@@ -32,6 +32,7 @@
 #include "util/finally.h"
 #include "util/fts.h"
 #include "util/logging.h"
+#include "util/string.h"
 
 
 namespace mb
@@ -92,7 +93,7 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 
     fd = open(path.c_str(), O_RDONLY);
     if (fd < 0) {
-        LOGE("Failed to open {}: {}", path, strerror(errno));
+        LOGE("Failed to open {}: {}", path, error_string(errno));
         return false;
     }
 
@@ -101,13 +102,13 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
     });
 
     if (fstat(fd, &sb) < 0) {
-        LOGE("Failed to stat {}: {}", path, strerror(errno));
+        LOGE("Failed to stat {}: {}", path, error_string(errno));
         return false;
     }
 
     map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     if (map == MAP_FAILED) {
-        LOGE("Failed to mmap {}: {}", path, strerror(errno));
+        LOGE("Failed to mmap {}: {}", path, error_string(errno));
         return false;
     }
 
@@ -156,7 +157,7 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
 
     fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
     if (fd < 0) {
-        LOGE("Failed to open {}: {}", path, strerror(errno));
+        LOGE("Failed to open {}: {}", path, error_string(errno));
         return false;
     }
 
@@ -165,7 +166,7 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
     });
 
     if (write(fd, data, len) < 0) {
-        LOGE("Failed to write to {}: {}", path, strerror(errno));
+        LOGE("Failed to write to {}: {}", path, error_string(errno));
         return false;
     }
 
@@ -97,5 +97,29 @@ std::string hex_string(unsigned char *data, size_t size)
     return result;
 }
 
+/*!
+ * \brief Thread-safe replacement for strerror()
+ *
+ * strerror() may return a static buffer that another thread overwrites, so
+ * this must be used by anything that can run on the daemon's worker threads.
+ *
+ * \param errnum Error number
+ *
+ * \return Description of \a errnum
+ */
+std::string error_string(int errnum)
+{
+    char buf[256];
+    buf[0] = '\0';
+
+    // strerror_r() returns a char * with GNU extensions (glibc and bionic
+    // since API 23) and an int otherwise
+#if defined(__USE_GNU) && (!defined(__ANDROID__) || __ANDROID_API__ >= 23)
+    return strerror_r(errnum, buf, sizeof(buf));
+#else
+    return strerror_r(errnum, buf, sizeof(buf)) == 0 ? buf : "Unknown error";
+#endif
+}
+
 }
 }
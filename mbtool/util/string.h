@@ -34,6 +34,8 @@ bool ends_with(const char *string, const char *suffix);
 
 std::string hex_string(unsigned char *data, size_t size);
 
+std::string error_string(int errnum);
+
 template <typename T>
 std::string to_string(const T& t)
 {
@@ -15,6 +15,8 @@ files=(
     v2/chmod.fbs
     v2/loki_patch.fbs
     v2/wipe_rom.fbs
+    v2/cancel.fbs
+    v2/progress.fbs
     request.fbs
     response.fbs
 )